@@ -0,0 +1,736 @@
+#include "util/resource-manager.h"
+#include "util/mesh-cache.h"
+#include "util/mesh-optimizer.h"
+#include "util/mip-generator.h"
+#include "util/gpu-mip-generator.h"
+#include "util/gpu-memory.h"
+#include "util/texture-container.h"
+#include "util/staging-uploader.h"
+#include "util/uniform-arena.h"
+#include "util/draw-list.h"
+#include "util/obj-parser.h"
+#include "util/shader-preprocessor.h"
+#include "util/thread-pool.h"
+#include "util/stb_image.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// CPU-side benchmarks of the resource loading paths, runnable without a window or GPU
+// (the sections comparing CPU and GPU work are skipped when no adapter is available).
+// Usage: webgpu-basics-bench [mesh.obj] [image]
+
+using VertexAttributes = ResourceManager::VertexAttributes;
+
+// Run fn the given number of times and return the best wall-clock time, in milliseconds
+template <typename Fn>
+static double measure_ms(int iterations, Fn&& fn)
+{
+    double best = 1e30;
+    for (int i = 0; i < iterations; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static void report(const char* name, double ms, double baseline_ms = 0.0)
+{
+    if (baseline_ms > 0.0)
+        printf("  %-32s %10.3f ms  (%.1fx)\n", name, ms, baseline_ms / ms);
+    else
+        printf("  %-32s %10.3f ms\n", name, ms);
+}
+
+template <typename T>
+static bool same_bytes(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+static void bench_obj_parse(const std::filesystem::path& obj_path)
+{
+    printf("obj parse: %s\n", obj_path.string().c_str());
+
+    tinyobj::attrib_t reference;
+    std::vector<tinyobj::shape_t> reference_shapes;
+    std::vector<tinyobj::material_t> reference_materials;
+    std::string mtl_basedir = obj_path.parent_path().string();
+    double serial_ms = measure_ms(1, [&] {
+        std::string warn, err;
+        tinyobj::LoadObj(&reference, &reference_shapes, &reference_materials, &warn, &err, obj_path.string().c_str(), mtl_basedir.c_str());
+    });
+    report("tinyobj", serial_ms);
+
+    for (unsigned threads = 1; threads <= ThreadPool::default_thread_count() + 1; threads *= 2)
+    {
+        ThreadPool pool(threads - 1);
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        bool ok = true;
+        double ms = measure_ms(3, [&] { ok = ParallelObjParser::parse(obj_path, pool, attrib, shapes, materials); });
+        if (!ok)
+        {
+            printf("  parallel parser falls back to tinyobj for this file\n");
+            return;
+        }
+
+        bool identical = same_bytes(attrib.vertices, reference.vertices) && same_bytes(attrib.normals, reference.normals) &&
+                         same_bytes(attrib.texcoords, reference.texcoords) && same_bytes(attrib.colors, reference.colors);
+        identical = identical && same_bytes(attrib.vertex_weights, reference.vertex_weights) && materials.size() == reference_materials.size();
+        identical = identical && shapes.size() == reference_shapes.size();
+        for (size_t s = 0; identical && s < shapes.size(); ++s)
+        {
+            const tinyobj::mesh_t& mesh = shapes[s].mesh;
+            const tinyobj::mesh_t& reference_mesh = reference_shapes[s].mesh;
+            identical = shapes[s].name == reference_shapes[s].name && mesh.indices.size() == reference_mesh.indices.size() &&
+                        mesh.num_face_vertices == reference_mesh.num_face_vertices && mesh.material_ids == reference_mesh.material_ids &&
+                        mesh.smoothing_group_ids == reference_mesh.smoothing_group_ids;
+            for (size_t i = 0; identical && i < mesh.indices.size(); ++i)
+            {
+                const tinyobj::index_t& a = mesh.indices[i];
+                const tinyobj::index_t& b = reference_mesh.indices[i];
+                identical = a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+            }
+        }
+
+        std::string name = "parallel, " + std::to_string(threads) + " thread(s)";
+        report(name.c_str(), ms, serial_ms);
+        if (!identical)
+            printf("  MISMATCH: parallel output differs from tinyobj\n");
+    }
+}
+
+static void bench_geometry(const std::filesystem::path& obj_path)
+{
+    ThreadPool pool;
+
+    printf("geometry: %s\n", obj_path.string().c_str());
+
+    std::vector<VertexAttributes> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<ResourceManager::Submesh> submeshes;
+    std::vector<ResourceManager::Material> materials;
+    bool ok = true;
+    double obj_ms = measure_ms(3, [&] { ok = ResourceManager::load_geometry_from_obj(obj_path, vertices, indices, submeshes, materials, &pool); });
+    if (!ok)
+    {
+        printf("  could not load %s\n", obj_path.string().c_str());
+        return;
+    }
+    report("obj parse + dedup", obj_ms);
+
+    // Bake as loaded, the optimizer is measured separately below
+    ResourceManager::GeometryOptions options;
+    options.optimize = false;
+    MeshCache cache;
+    double bake_ms = measure_ms(1, [&] { cache.bake(obj_path, vertices, indices, submeshes, materials, options, static_cast<float>(obj_ms)); });
+    report("cache bake", bake_ms);
+
+    // Opening the cache and copying its blobs out is what init_geometry does with a mapped GPU buffer
+    std::vector<uint8_t> upload;
+    double cache_ms = measure_ms(10, [&] {
+        MeshCache mapped;
+        ok = mapped.open(obj_path, options);
+        if (!ok)
+            return;
+        upload.resize(mapped.vertex_data_size() + mapped.index_data_size());
+        memcpy(upload.data(), mapped.vertex_data(), mapped.vertex_data_size());
+        memcpy(upload.data() + mapped.vertex_data_size(), mapped.index_data(), mapped.index_data_size());
+    });
+    if (!ok)
+    {
+        printf("  could not open the baked cache\n");
+        return;
+    }
+    report("cache map + copy", cache_ms, obj_ms);
+    printf("  %zu vertices, %zu indices\n", vertices.size(), indices.size());
+
+    std::vector<ResourceManager::PackedVertexAttributes> packed;
+    ResourceManager::VertexQuantization q;
+    double quantize_ms = measure_ms(3, [&] { q = ResourceManager::quantize_vertices(vertices, packed); });
+    report("vertex quantization", quantize_ms);
+    printf("  vertex data %zu -> %zu bytes, max position error %g, max normal error %g deg, max uv error %g\n",
+           vertices.size() * sizeof(VertexAttributes), packed.size() * sizeof(ResourceManager::PackedVertexAttributes), q.max_position_error,
+           q.max_normal_error, q.max_uv_error);
+
+    MeshOptimizer::CacheStats before = MeshOptimizer::analyze_vertex_cache(indices, vertices.size());
+    std::vector<uint32_t> cache_indices = indices;
+    double cache_opt_ms = measure_ms(1, [&] { MeshOptimizer::optimize_vertex_cache(cache_indices, vertices.size()); });
+    MeshOptimizer::CacheStats cache_stats = MeshOptimizer::analyze_vertex_cache(cache_indices, vertices.size());
+    report("vertex cache optimization", cache_opt_ms);
+
+    std::vector<uint32_t> overdraw_indices = indices;
+    double overdraw_ms = measure_ms(1, [&] { MeshOptimizer::optimize_overdraw(overdraw_indices, vertices); });
+    MeshOptimizer::CacheStats overdraw_stats = MeshOptimizer::analyze_vertex_cache(overdraw_indices, vertices.size());
+    report("overdraw optimization", overdraw_ms);
+    printf("  ACMR %.3f -> %.3f (cache) / %.3f (overdraw), ATVR %.3f -> %.3f / %.3f\n", before.acmr, cache_stats.acmr, overdraw_stats.acmr, before.atvr,
+           cache_stats.atvr, overdraw_stats.atvr);
+}
+
+// The mip chain as load_texture used to build it: scalar loops, a copy of level 0 and a new buffer per level
+static void legacy_mip_chain(const uint8_t* pixel_data, uint32_t width, uint32_t height, uint32_t level_count, uint64_t& checksum)
+{
+    std::vector<uint8_t> previous_level_pixels;
+    uint32_t previous_width = 0;
+    for (uint32_t level = 0; level < level_count; ++level)
+    {
+        std::vector<uint8_t> pixels(4 * size_t(width) * height);
+        if (level == 0)
+        {
+            memcpy(pixels.data(), pixel_data, pixels.size());
+        }
+        else
+        {
+            for (uint32_t i = 0; i < width; ++i)
+            {
+                for (uint32_t j = 0; j < height; ++j)
+                {
+                    uint8_t* p = &pixels[4 * (j * width + i)];
+                    uint8_t* p00 = &previous_level_pixels[4 * ((2 * j + 0) * previous_width + (2 * i + 0))];
+                    uint8_t* p01 = &previous_level_pixels[4 * ((2 * j + 0) * previous_width + (2 * i + 1))];
+                    uint8_t* p10 = &previous_level_pixels[4 * ((2 * j + 1) * previous_width + (2 * i + 0))];
+                    uint8_t* p11 = &previous_level_pixels[4 * ((2 * j + 1) * previous_width + (2 * i + 1))];
+                    for (int c = 0; c < 4; ++c)
+                        p[c] = (p00[c] + p01[c] + p10[c] + p11[c]) / 4;
+                }
+            }
+        }
+        checksum += pixels[0];
+        previous_level_pixels = std::move(pixels);
+        previous_width = width;
+        width /= 2;
+        height /= 2;
+    }
+}
+
+// Concatenate every level, to compare chains
+static std::vector<uint8_t> mip_chain(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t level_count, bool srgb, MipGenerator::Isa isa)
+{
+    std::vector<uint8_t> chain;
+    MipGenerator::generate(pixels, width, height, level_count, srgb, [&](uint32_t, const uint8_t* level, uint32_t w, uint32_t h) {
+        chain.insert(chain.end(), level, level + 4 * size_t(w) * h);
+    }, isa);
+    return chain;
+}
+
+static void bench_mip_maps(const std::filesystem::path& image_path)
+{
+    printf("mip maps: %s\n", image_path.string().c_str());
+
+    int w, h, channels;
+    uint8_t* pixels = stbi_load(image_path.string().c_str(), &w, &h, &channels, 4);
+    if (!pixels)
+    {
+        printf("  could not load %s\n", image_path.string().c_str());
+        return;
+    }
+    const uint32_t width = static_cast<uint32_t>(w), height = static_cast<uint32_t>(h);
+    // Same level count as load_texture
+    uint32_t level_count = 0;
+    for (uint32_t m = std::max(width, height); m >>= 1;)
+        ++level_count;
+
+    uint64_t checksum = 0;
+    double legacy_ms = measure_ms(5, [&] { legacy_mip_chain(pixels, width, height, level_count, checksum); });
+    report("legacy scalar", legacy_ms);
+
+    const std::vector<uint8_t> reference = mip_chain(pixels, width, height, level_count, false, MipGenerator::Isa::Scalar);
+    for (MipGenerator::Isa isa : {MipGenerator::Isa::Scalar, MipGenerator::Isa::SSE2, MipGenerator::Isa::AVX2, MipGenerator::Isa::NEON})
+    {
+        if (!MipGenerator::is_supported(isa))
+            continue;
+        auto visit = [&](uint32_t, const uint8_t* level, uint32_t, uint32_t) { checksum += level[0]; };
+        double ms = measure_ms(5, [&] { MipGenerator::generate(pixels, width, height, level_count, false, visit, isa); });
+        std::string name = std::string("generator, ") + MipGenerator::isa_name(isa);
+        report(name.c_str(), ms, legacy_ms);
+        if (mip_chain(pixels, width, height, level_count, false, isa) != reference)
+            printf("  MISMATCH: %s output differs from scalar\n", MipGenerator::isa_name(isa));
+    }
+
+    // sRGB, averaged in linear space as for albedo maps: every kernel must agree with scalar, and level 1 stay within
+    // one step of an exact float average
+    const std::vector<uint8_t> srgb_reference = mip_chain(pixels, width, height, level_count, true, MipGenerator::Isa::Scalar);
+    for (MipGenerator::Isa isa : {MipGenerator::Isa::Scalar, MipGenerator::Isa::SSE2, MipGenerator::Isa::AVX2, MipGenerator::Isa::NEON})
+    {
+        if (!MipGenerator::is_supported(isa))
+            continue;
+        auto visit = [&](uint32_t, const uint8_t* level, uint32_t, uint32_t) { checksum += level[0]; };
+        double ms = measure_ms(5, [&] { MipGenerator::generate(pixels, width, height, level_count, true, visit, isa); });
+        std::string name = std::string("generator, sRGB, ") + MipGenerator::isa_name(isa);
+        report(name.c_str(), ms, legacy_ms);
+        if (mip_chain(pixels, width, height, level_count, true, isa) != srgb_reference)
+            printf("  MISMATCH: sRGB %s output differs from scalar\n", MipGenerator::isa_name(isa));
+    }
+    if (width % 2 == 0 && height % 2 == 0 && level_count > 1)
+    {
+        auto to_linear = [](uint8_t v) {
+            double c = v / 255.0;
+            return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+        };
+        auto to_srgb = [](double l) { return l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055; };
+        const uint8_t* level1 = srgb_reference.data() + 4 * size_t(width) * height;
+        int max_error = 0;
+        for (uint32_t y = 0; y < height / 2; ++y)
+        {
+            for (uint32_t x = 0; x < width / 2; ++x)
+            {
+                const uint8_t* p = pixels + 4 * (size_t(2 * y) * width + 2 * x);
+                for (uint32_t c = 0; c < 3; ++c)
+                {
+                    double l = (to_linear(p[c]) + to_linear(p[4 + c]) + to_linear(p[4 * width + c]) + to_linear(p[4 * width + 4 + c])) / 4;
+                    int exact = static_cast<int>(to_srgb(l) * 255.0 + 0.5);
+                    max_error = std::max(max_error, std::abs(exact - level1[4 * (size_t(y) * (width / 2) + x) + c]));
+                }
+            }
+        }
+        printf("  sRGB level 1: max error %d against a float average%s\n", max_error, max_error > 1 ? " (MISMATCH)" : "");
+    }
+
+    // Odd and non-power-of-two sizes, cropped from the image: every kernel must agree with scalar
+    const uint32_t crop_width = std::min(width, 999u), crop_height = std::min(height, 601u);
+    std::vector<uint8_t> crop(4 * size_t(crop_width) * crop_height);
+    for (uint32_t y = 0; y < crop_height; ++y)
+        memcpy(&crop[4 * size_t(y) * crop_width], pixels + 4 * size_t(y) * width, 4 * size_t(crop_width));
+    const uint32_t crop_levels = level_count;
+    const std::vector<uint8_t> crop_reference = mip_chain(crop.data(), crop_width, crop_height, crop_levels, false, MipGenerator::Isa::Scalar);
+    bool identical = true;
+    for (MipGenerator::Isa isa : {MipGenerator::Isa::SSE2, MipGenerator::Isa::AVX2, MipGenerator::Isa::NEON})
+    {
+        if (MipGenerator::is_supported(isa))
+            identical = identical && mip_chain(crop.data(), crop_width, crop_height, crop_levels, false, isa) == crop_reference;
+    }
+    printf("  %ux%u crop: %s (checksum %llu)\n", crop_width, crop_height, identical ? "all kernels agree" : "MISMATCH between kernels",
+           static_cast<unsigned long long>(checksum));
+
+    stbi_image_free(pixels);
+}
+
+static void bench_texture_container(const std::filesystem::path& image_path)
+{
+    printf("texture container: %s\n", image_path.string().c_str());
+
+    // Bake next to a copy of the image rather than into the resources
+    std::error_code ec;
+    std::filesystem::path source = std::filesystem::temp_directory_path(ec) / image_path.filename();
+    if (ec || !std::filesystem::copy_file(image_path, source, std::filesystem::copy_options::overwrite_existing, ec))
+    {
+        printf("  could not copy %s\n", image_path.string().c_str());
+        return;
+    }
+
+    ThreadPool pool;
+    double decode_ms = measure_ms(3, [&] { ResourceManager::load_image(source, true, true); });
+    report("decode + CPU mips", decode_ms);
+
+    // Mapping is close to free, so include the copy that writeTexture makes of every level
+    std::vector<uint8_t> upload;
+    auto map_and_copy = [&](bool texture_compression_bc) {
+        ResourceManager::Image image = ResourceManager::load_image_container(source, texture_compression_bc);
+        upload.clear();
+        for (uint32_t level = 0; image.container && level < image.level_count; ++level)
+        {
+            const uint8_t* data = image.container->level_data(level);
+            upload.insert(upload.end(), data, data + image.container->level_size(level));
+        }
+        return image.is_valid();
+    };
+
+    const TextureCompressor::Format formats[] = {TextureCompressor::Format::RGBA8, TextureCompressor::Format::BC7};
+    for (TextureCompressor::Format format : formats)
+    {
+        if (!TextureContainer::encode(source, format, true, &pool))
+        {
+            printf("  could not bake a %s container\n", TextureCompressor::format_name(format));
+            continue;
+        }
+        std::string name = std::string(TextureCompressor::format_name(format)) + " container map + copy";
+        double map_ms = measure_ms(10, [&] { map_and_copy(true); });
+        report(name.c_str(), map_ms, decode_ms);
+        printf("  %zu bytes uploaded\n", upload.size());
+        if (TextureCompressor::is_compressed(format))
+        {
+            double transcode_ms = measure_ms(3, [&] { map_and_copy(false); });
+            report("BC7 transcode to RGBA8", transcode_ms, decode_ms);
+        }
+    }
+
+    std::filesystem::remove(TextureContainer::container_path_for(source), ec);
+    std::filesystem::remove(source, ec);
+}
+
+static void check_shader_preprocessor()
+{
+    printf("shader preprocessor\n");
+
+    std::error_code ec;
+    const std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / "shader-preprocessor-check";
+    std::filesystem::create_directories(dir, ec);
+    auto write = [&](const char* name, const char* text) { std::ofstream(dir / name, std::ios::binary) << text; };
+
+    // Preprocess a main file, comparing the output byte for byte. Removed lines are left empty.
+    auto check = [&](const char* name, const char* text, const ShaderPreprocessor::Defines& defines, const char* expected,
+                     size_t file_count = 1) {
+        write("main.wgsl", text);
+        std::string source;
+        std::vector<std::filesystem::path> files;
+        bool ok = ShaderPreprocessor::process(dir / "main.wgsl", defines, source, &files) && source == expected && files.size() == file_count;
+        printf("  %-32s %s\n", name, ok ? "ok" : "MISMATCH");
+        if (!ok)
+            printf("%s(%zu files)\n", source.c_str(), files.size());
+    };
+
+    // Directives in inactive branches are not evaluated, not even invalid expressions, nor are the #elif of a taken block
+    check("#if nesting",
+          "#if 0\n#if undefined(\n#elif 1\na\n#else\nb\n#endif\n#elif 1\nc\n#elif )\nd\n#else\ne\n#endif\n"
+          "#ifndef X\n#if 1\nf\n#else\ng\n#endif\n#endif\n",
+          {}, "\n\n\n\n\n\n\n\nc\n\n\n\n\n\n\n\nf\n\n\n\n\n");
+
+    write("common.wgsl", "#include \"main.wgsl\"\nconst common = 1;\n");
+    check("#include once", "#include \"common.wgsl\"\n#include \"./common.wgsl\"\nlet a = common;\n", {},
+          "\nconst common = 1;\n\n\nlet a = common;\n", 2);
+
+    check("defined()",
+          "#if defined(A) && !defined B && defined( C ) == 0\na\n#endif\n#define B\n#if defined B\nb\n#endif\n#undef A\n#ifdef A\nc\n#endif\n",
+          {{"A", "0"}}, "\na\n\n\n\nb\n\n\n\n\n\n");
+
+    // Expanded until a value is not a define, cycles left as is. #if evaluates names to their value.
+    check("recursive defines", "#define A B\n#define B C\n#define C 7\n#define SELF SELF\nlet a = A + SELF;\n#if A == 7\nx\n#endif\n", {},
+          "\n\n\n\nlet a = 7 + SELF;\n\nx\n\n");
+
+    // Members are left alone, as are comments, and numbers with a dot
+    check("member access", "let v = in.N + N.x + N1.N; // N\nlet f = 2.N;\n", {{"N", "3"}, {"N1", "s"}},
+          "let v = in.N + 3.x + s.N; // N\nlet f = 2.N;\n");
+
+    // Reported with the file and the last line
+    {
+        write("main.wgsl", "#if 1\nx\n");
+        std::ostringstream errors;
+        std::streambuf* cerr_buffer = std::cerr.rdbuf(errors.rdbuf());
+        std::string source;
+        bool processed = ShaderPreprocessor::process(dir / "main.wgsl", {}, source);
+        std::cerr.rdbuf(cerr_buffer);
+        bool ok = !processed && errors.str().find("main.wgsl:2: missing #endif") != std::string::npos;
+        printf("  %-32s %s\n", "unterminated #if", ok ? "ok" : "MISMATCH");
+    }
+
+    std::filesystem::remove_all(dir, ec);
+}
+
+// Block until the GPU has run everything submitted so far
+static void wait_for_queue(wgpu::Device device)
+{
+    wgpu::Queue queue = device.getQueue();
+    bool done = false;
+    auto callback = queue.onSubmittedWorkDone([&done](wgpu::QueueWorkDoneStatus) { done = true; });
+    while (!done)
+    {
+        ResourceManager::poll_device(device);
+    }
+    queue.release();
+}
+
+static void bench_texture_upload(const std::filesystem::path& image_path)
+{
+    printf("texture upload: %s\n", image_path.string().c_str());
+
+    wgpu::Instance instance = wgpu::createInstance(wgpu::InstanceDescriptor{});
+    wgpu::Adapter adapter = instance ? instance.requestAdapter(wgpu::RequestAdapterOptions{}) : nullptr;
+    if (!adapter)
+    {
+        printf("  no GPU adapter, skipped\n");
+        if (instance)
+            instance.release();
+        return;
+    }
+    wgpu::Device device = adapter.requestDevice(wgpu::DeviceDescriptor{});
+    adapter.release();
+
+    {
+        GpuMipGenerator gpu_mip_generator(device);
+        if (!gpu_mip_generator.is_valid())
+            printf("  could not create the GPU mip generator, both runs use the CPU\n");
+
+        // Both include decoding the image, which does not depend on where mips are built
+        double cpu_return_ms = 0.0, gpu_return_ms = 0.0;
+        auto load = [&](GpuMipGenerator* generator, double& return_ms) {
+            auto start = std::chrono::steady_clock::now();
+            wgpu::Texture texture = ResourceManager::load_texture(image_path, device, nullptr, true, generator);
+            return_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            wait_for_queue(device);
+            GpuMemory::destroy(texture);
+        };
+        double cpu_ms = measure_ms(3, [&] { load(nullptr, cpu_return_ms); });
+        double gpu_ms = measure_ms(3, [&] { load(&gpu_mip_generator, gpu_return_ms); });
+        report("CPU mips, until idle", cpu_ms);
+        report("GPU mips, until idle", gpu_ms, cpu_ms);
+        printf("  load_texture returns after %.3f ms (CPU mips) / %.3f ms (GPU mips)\n", cpu_return_ms, gpu_return_ms);
+    }
+
+    {
+        // Small uploads as a frame makes them (uniforms, indirect arguments), which writeBuffer stages one by one
+        constexpr uint32_t upload_count = 1000;
+        constexpr uint64_t upload_size = 256;
+        wgpu::BufferDescriptor buffer_desc;
+        buffer_desc.size = upload_count * upload_size;
+        buffer_desc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
+        buffer_desc.mappedAtCreation = false;
+        wgpu::Buffer target = GpuMemory::create_buffer(device, buffer_desc);
+        std::vector<uint8_t> payload(upload_size, 0x5A);
+
+        wgpu::Queue queue = device.getQueue();
+        StagingUploader uploader(device);
+        double write_ms = measure_ms(5, [&] {
+            for (uint32_t i = 0; i < upload_count; ++i)
+                queue.writeBuffer(target, i * upload_size, payload.data(), upload_size);
+            wait_for_queue(device);
+        });
+        double staged_ms = measure_ms(5, [&] {
+            for (uint32_t i = 0; i < upload_count; ++i)
+                uploader.upload_buffer(target, i * upload_size, payload.data(), upload_size);
+            uploader.submit();
+            wait_for_queue(device);
+        });
+        report("1000 x 256 B writeBuffer", write_ms);
+        report("1000 x 256 B staging uploader", staged_ms, write_ms);
+        const StagingUploader::Stats& stats = uploader.stats();
+        printf("  %.1f MB in %llu uploads through %u staging chunks, %llu stalls\n", stats.bytes_uploaded / 1e6,
+               (unsigned long long)stats.upload_count, stats.chunk_count, (unsigned long long)stats.stall_count);
+
+        queue.release();
+        GpuMemory::destroy(target);
+    }
+
+    device.release();
+    instance.release();
+}
+
+// The frame of Application::draw_materials with many objects: one draw per object in each of the depth prepass, main
+// and feedback passes, every object selecting its transform in a uniform arena by dynamic offset
+static void bench_object_encoding(uint32_t object_count)
+{
+    printf("object draw encoding: %u objects\n", object_count);
+
+    wgpu::Instance instance = wgpu::createInstance(wgpu::InstanceDescriptor{});
+    wgpu::Adapter adapter = instance ? instance.requestAdapter(wgpu::RequestAdapterOptions{}) : nullptr;
+    if (!adapter)
+    {
+        printf("  no GPU adapter, skipped\n");
+        if (instance)
+            instance.release();
+        return;
+    }
+    wgpu::Device device = adapter.requestDevice(wgpu::DeviceDescriptor{});
+    adapter.release();
+
+    {
+        const std::string source = "@group(0) @binding(0) var<uniform> uModel: mat4x4f;\n"
+                                   "@vertex fn vs_main(@builtin(vertex_index) i: u32) -> @builtin(position) vec4f {\n"
+                                   "    return uModel * vec4f(f32(i % 2u), f32(i / 2u), 0.0, 1.0);\n"
+                                   "}\n"
+                                   "@fragment fn fs_main() -> @location(0) vec4f { return vec4f(1.0); }\n";
+        wgpu::ShaderModule module = ResourceManager::create_shader_module(source, device);
+
+        wgpu::BindGroupLayoutEntry binding_layout = wgpu::Default;
+        binding_layout.binding = 0;
+        binding_layout.visibility = wgpu::ShaderStage::Vertex;
+        binding_layout.buffer.type = wgpu::BufferBindingType::Uniform;
+        binding_layout.buffer.hasDynamicOffset = true;
+        binding_layout.buffer.minBindingSize = sizeof(glm::mat4);
+        wgpu::BindGroupLayoutDescriptor bind_group_layout_desc{};
+        bind_group_layout_desc.entryCount = 1;
+        bind_group_layout_desc.entries = &binding_layout;
+        wgpu::BindGroupLayout bind_group_layout = device.createBindGroupLayout(bind_group_layout_desc);
+        wgpu::PipelineLayoutDescriptor layout_desc{};
+        layout_desc.bindGroupLayoutCount = 1;
+        layout_desc.bindGroupLayouts = (WGPUBindGroupLayout*)&bind_group_layout;
+        wgpu::PipelineLayout layout = device.createPipelineLayout(layout_desc);
+
+        wgpu::RenderPipelineDescriptor pipeline_desc;
+        pipeline_desc.layout = layout;
+        pipeline_desc.vertex.module = module;
+        pipeline_desc.vertex.entryPoint = "vs_main";
+        pipeline_desc.vertex.bufferCount = 0;
+        pipeline_desc.vertex.buffers = nullptr;
+        pipeline_desc.vertex.constantCount = 0;
+        pipeline_desc.vertex.constants = nullptr;
+        pipeline_desc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+        pipeline_desc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+        pipeline_desc.primitive.frontFace = wgpu::FrontFace::CCW;
+        pipeline_desc.primitive.cullMode = wgpu::CullMode::None;
+        wgpu::ColorTargetState color_target;
+        color_target.format = wgpu::TextureFormat::RGBA8Unorm;
+        color_target.blend = nullptr;
+        color_target.writeMask = wgpu::ColorWriteMask::All;
+        wgpu::FragmentState fragment_state;
+        fragment_state.module = module;
+        fragment_state.entryPoint = "fs_main";
+        fragment_state.constantCount = 0;
+        fragment_state.constants = nullptr;
+        fragment_state.targetCount = 1;
+        fragment_state.targets = &color_target;
+        pipeline_desc.fragment = &fragment_state;
+        pipeline_desc.depthStencil = nullptr;
+        pipeline_desc.multisample.count = 1;
+        pipeline_desc.multisample.mask = ~0u;
+        pipeline_desc.multisample.alphaToCoverageEnabled = false;
+        wgpu::RenderPipeline pipeline = device.createRenderPipeline(pipeline_desc);
+
+        wgpu::TextureDescriptor texture_desc;
+        texture_desc.dimension = wgpu::TextureDimension::_2D;
+        texture_desc.format = wgpu::TextureFormat::RGBA8Unorm;
+        texture_desc.size = {64, 64, 1};
+        texture_desc.mipLevelCount = 1;
+        texture_desc.sampleCount = 1;
+        texture_desc.usage = wgpu::TextureUsage::RenderAttachment;
+        texture_desc.viewFormatCount = 0;
+        texture_desc.viewFormats = nullptr;
+        wgpu::Texture target = GpuMemory::create_texture(device, texture_desc);
+        wgpu::TextureView target_view = target.createView();
+
+        std::vector<glm::mat4> transforms(object_count);
+        for (uint32_t i = 0; i < object_count; ++i)
+            transforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3(float(i % 100), float(i / 100), 0.0f));
+
+        wgpu::Queue queue = device.getQueue();
+        StagingUploader uploader(device);
+        UniformArena arena(device, sizeof(glm::mat4), object_count);
+        wgpu::BindGroup bind_group = nullptr;
+        uint32_t bind_group_generation = 0;
+        std::vector<uint32_t> offsets;
+
+        // Application::update_object_uniforms, then the three passes, until the command buffer is finished
+        double uniforms_ms = 1e30, encode_ms = 1e30;
+        for (int iteration = 0; iteration < 10; ++iteration)
+        {
+            auto start = std::chrono::steady_clock::now();
+            arena.reset();
+            offsets.clear();
+            for (const glm::mat4& transform : transforms)
+                offsets.push_back(arena.push(transform));
+            arena.upload(uploader);
+            if (!bind_group || arena.generation() != bind_group_generation)
+            {
+                if (bind_group)
+                    bind_group.release();
+                wgpu::BindGroupEntry binding;
+                binding.binding = 0;
+                binding.buffer = arena.buffer();
+                binding.offset = 0;
+                binding.size = sizeof(glm::mat4);
+                wgpu::BindGroupDescriptor bind_group_desc;
+                bind_group_desc.layout = bind_group_layout;
+                bind_group_desc.entryCount = 1;
+                bind_group_desc.entries = &binding;
+                bind_group = device.createBindGroup(bind_group_desc);
+                bind_group_generation = arena.generation();
+            }
+            auto uniforms_end = std::chrono::steady_clock::now();
+
+            wgpu::CommandEncoder encoder = device.createCommandEncoder(wgpu::CommandEncoderDescriptor{});
+            for (const char* label : {"Depth prepass", "Main pass", "Feedback pass"})
+            {
+                wgpu::RenderPassColorAttachment color_attachment = {};
+                color_attachment.view = target_view;
+                color_attachment.resolveTarget = nullptr;
+                color_attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+                color_attachment.loadOp = wgpu::LoadOp::Clear;
+                color_attachment.storeOp = wgpu::StoreOp::Store;
+                color_attachment.clearValue = wgpu::Color{0.0, 0.0, 0.0, 1.0};
+                wgpu::RenderPassDescriptor pass_desc = {};
+                pass_desc.label = label;
+                pass_desc.colorAttachmentCount = 1;
+                pass_desc.colorAttachments = &color_attachment;
+                pass_desc.depthStencilAttachment = nullptr;
+                pass_desc.timestampWrites = nullptr;
+                wgpu::RenderPassEncoder pass = encoder.beginRenderPass(pass_desc);
+                pass.setPipeline(pipeline);
+                for (uint32_t offset : offsets)
+                {
+                    pass.setBindGroup(0, bind_group, 1, &offset);
+                    pass.draw(6, 1, 0, 0);
+                }
+                pass.end();
+                pass.release();
+            }
+            wgpu::CommandBuffer command = encoder.finish(wgpu::CommandBufferDescriptor{});
+            encoder.release();
+            auto encode_end = std::chrono::steady_clock::now();
+
+            uniforms_ms = std::min(uniforms_ms, std::chrono::duration<double, std::milli>(uniforms_end - start).count());
+            encode_ms = std::min(encode_ms, std::chrono::duration<double, std::milli>(encode_end - uniforms_end).count());
+            uploader.submit();
+            queue.submit(command);
+            command.release();
+            wait_for_queue(device);
+        }
+        report("object uniforms push + upload", uniforms_ms);
+        report("3 passes encode", encode_ms);
+        printf("  %.3f us per draw, %.3f ms of CPU per frame in total\n", 1000.0 * encode_ms / (3.0 * object_count), uniforms_ms + encode_ms);
+
+        bind_group.release();
+        queue.release();
+        target_view.release();
+        GpuMemory::destroy(target);
+        pipeline.release();
+        layout.release();
+        bind_group_layout.release();
+        module.release();
+    }
+
+    device.release();
+    instance.release();
+}
+
+// Commands of the main pass for a mesh with material_count materials of two submeshes each, split over two shadings,
+// drawn for object_count objects, or as many instances
+static void bench_draw_list(uint32_t material_count, uint32_t object_count)
+{
+    printf("draw list: %u materials, %u submeshes, %u objects\n", material_count, 2 * material_count, object_count);
+
+    std::vector<DrawList::Draw> draws;
+    for (uint32_t i = 0; i < 2 * material_count; ++i)
+        draws.push_back({i, i / 2, i / 2 < material_count / 2 ? 0u : 1u});
+
+    std::vector<uint32_t> object_offsets(object_count);
+    for (uint32_t i = 0; i < object_count; ++i)
+        object_offsets[i] = 256 * i;
+    const std::vector<uint32_t> instanced_offsets = {0};
+
+    DrawList list;
+    for (bool instancing : {false, true})
+    {
+        const std::vector<uint32_t>& offsets = instancing ? instanced_offsets : object_offsets;
+        double ms = measure_ms(10, [&] { list.build(draws, offsets); });
+        const DrawList::Stats& stats = list.stats();
+        report(instancing ? "instanced, build" : "per object, build", ms);
+        // Setting the object bind group before each draw, as when the objects were the inner loop of every submesh
+        const uint32_t per_draw_binds = stats.material_bind_count + stats.draw_count;
+        printf("    per pass: %u pipelines, %u binds (%u material, %u object; %u binding per draw), %u draws\n", stats.pipeline_count,
+               stats.material_bind_count + stats.object_bind_count, stats.material_bind_count, stats.object_bind_count, per_draw_binds,
+               stats.draw_count);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::filesystem::path obj_path = argc > 1 ? argv[1] : RESOURCE_DIR "/fourareen.obj";
+    std::filesystem::path image_path = argc > 2 ? argv[2] : RESOURCE_DIR "/fourareen2K_albedo.jpg";
+    check_shader_preprocessor();
+    bench_obj_parse(obj_path);
+    bench_geometry(obj_path);
+    bench_mip_maps(image_path);
+    bench_texture_container(image_path);
+    bench_texture_upload(image_path);
+    bench_draw_list(8, 10000);
+    bench_object_encoding(10000);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Meshlet culling, one workgroup per meshlet: the meshlets that may be visible
+ * append their indices to the range of their submesh in culledIndices, and count
+ * them in the indirect draw of the submesh.
+ */
+
+// The same structure as MeshOptimizer::Meshlet
+struct Meshlet
+{
+    center: vec3f,
+    radius: f32,
+    coneAxis: vec3f,
+    coneCutoff: f32,
+    firstIndex: u32,
+    indexCount: u32,
+    vertexCount: u32,
+    submesh: u32,
+};
+
+// The same structure as CullUniforms in C++
+struct CullUniforms
+{
+    // Frustum planes in model space, the inside being positive
+    planes: array<vec4f, 6>,
+    // Camera position in model space
+    cameraPosition: vec3f,
+    meshletCount: u32,
+    // Whether the source index buffer is Uint16
+    shortIndices: u32,
+    // Whether meshlets facing away from the camera are culled
+    coneCulling: u32,
+};
+
+// Layout of the arguments of drawIndexedIndirect
+struct DrawIndexedIndirectArgs
+{
+    indexCount: atomic<u32>,
+    instanceCount: u32,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+};
+
+@group(0) @binding(0) var<uniform> uCull: CullUniforms;
+@group(0) @binding(1) var<storage, read> meshlets: array<Meshlet>;
+@group(0) @binding(2) var<storage, read> indices: array<u32>;
+@group(0) @binding(3) var<storage, read_write> culledIndices: array<u32>;
+@group(0) @binding(4) var<storage, read_write> drawArgs: array<DrawIndexedIndirectArgs>;
+
+const invalidOffset = 0xFFFFFFFFu;
+var<workgroup> outputOffset: u32;
+
+fn isVisible(meshlet: Meshlet) -> bool
+{
+    for (var i = 0u; i < 6u; i++)
+    {
+        if (dot(uCull.planes[i].xyz, meshlet.center) + uCull.planes[i].w < -meshlet.radius)
+        {
+            return false;
+        }
+    }
+
+    if (uCull.coneCulling != 0u)
+    {
+        let toCenter = meshlet.center - uCull.cameraPosition;
+        if (dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * length(toCenter) + meshlet.radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+fn loadIndex(i: u32) -> u32
+{
+    if (uCull.shortIndices != 0u)
+    {
+        return (indices[i / 2u] >> ((i & 1u) * 16u)) & 0xFFFFu;
+    }
+    return indices[i];
+}
+
+@compute @workgroup_size(64)
+fn cs_main(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groupCount: vec3u, @builtin(local_invocation_index) lane: u32)
+{
+    // Meshlets are spread over two dimensions to stay within maxComputeWorkgroupsPerDimension
+    let meshletIndex = group.x + group.y * groupCount.x;
+    if (meshletIndex >= uCull.meshletCount)
+    {
+        return;
+    }
+    let meshlet = meshlets[meshletIndex];
+
+    if (lane == 0u)
+    {
+        var offset = invalidOffset;
+        if (isVisible(meshlet))
+        {
+            let args = &drawArgs[meshlet.submesh];
+            offset = (*args).firstIndex + atomicAdd(&(*args).indexCount, meshlet.indexCount);
+        }
+        outputOffset = offset;
+    }
+    workgroupBarrier();
+
+    let offset = outputOffset;
+    if (offset == invalidOffset)
+    {
+        return;
+    }
+    for (var i = lane; i < meshlet.indexCount; i += 64u)
+    {
+        culledIndices[offset + i] = loadIndex(meshlet.firstIndex + i);
+    }
+}
@@ -0,0 +1,78 @@
+/**
+ * Mip level generation, one dispatch per level: each invocation computes a texel of
+ * nextLevel from the texels of previousLevel it covers, with the same weights as
+ * MipGenerator on the CPU (2 taps along even dimensions, 3 along odd ones).
+ */
+
+// Whether texels are sRGB-encoded, and are then averaged in linear space
+override srgb: bool = false;
+
+@group(0) @binding(0) var previousLevel: texture_2d<f32>;
+@group(0) @binding(1) var nextLevel: texture_storage_2d<rgba8unorm, write>;
+
+// Texels of the previous level covered by texel i of the next one, along a dimension of the given size
+struct Taps
+{
+    first: u32,
+    count: u32,
+    weights: vec3f,
+};
+
+fn taps(size: u32, i: u32) -> Taps
+{
+    if (size == 1u)
+    {
+        return Taps(0u, 1u, vec3f(1.0, 0.0, 0.0));
+    }
+    if (size % 2u == 0u)
+    {
+        return Taps(2u * i, 2u, vec3f(0.5, 0.5, 0.0));
+    }
+    // size = 2m + 1: texel i covers [i * size / m, (i + 1) * size / m)
+    let m = f32(size / 2u);
+    let fi = f32(i);
+    return Taps(2u * i, 3u, vec3f(m - fi, m, fi + 1.0) / f32(size));
+}
+
+fn toLinear(c: vec3f) -> vec3f
+{
+    return select(pow((c + 0.055) / 1.055, vec3f(2.4)), c / 12.92, c <= vec3f(0.04045));
+}
+
+fn toSrgb(l: vec3f) -> vec3f
+{
+    return select(1.055 * pow(l, vec3f(1.0 / 2.4)) - 0.055, l * 12.92, l <= vec3f(0.0031308));
+}
+
+@compute @workgroup_size(8, 8)
+fn cs_main(@builtin(global_invocation_id) id: vec3u)
+{
+    let size = textureDimensions(nextLevel);
+    if (id.x >= size.x || id.y >= size.y)
+    {
+        return;
+    }
+
+    let previousSize = textureDimensions(previousLevel);
+    let tx = taps(previousSize.x, id.x);
+    let ty = taps(previousSize.y, id.y);
+
+    var sum = vec4f(0.0);
+    for (var j = 0u; j < ty.count; j++)
+    {
+        for (var i = 0u; i < tx.count; i++)
+        {
+            var texel = textureLoad(previousLevel, vec2u(tx.first + i, ty.first + j), 0);
+            if (srgb)
+            {
+                texel = vec4f(toLinear(texel.rgb), texel.a);
+            }
+            sum += ty.weights[j] * tx.weights[i] * texel;
+        }
+    }
+    if (srgb)
+    {
+        sum = vec4f(toSrgb(sum.rgb), sum.a);
+    }
+    textureStore(nextLevel, id.xy, sum);
+}
@@ -0,0 +1,87 @@
+/**
+ * Instance culling, one invocation per instance: the instances whose bounding sphere
+ * may be visible are appended to visibleInstances, then drawn by the indirect draw of
+ * every submesh.
+ */
+
+// The same structure as ObjectCullUniforms in C++
+struct ObjectCullUniforms
+{
+    // Frustum planes in world space, the inside being positive
+    planes: array<vec4f, 6>,
+    // Bounding sphere of the mesh in model space
+    boundsCenter: vec3f,
+    boundsRadius: f32,
+    instanceCount: u32,
+    submeshCount: u32,
+};
+
+// Layout of the arguments of drawIndexedIndirect
+struct DrawIndexedIndirectArgs
+{
+    indexCount: u32,
+    instanceCount: u32,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+};
+
+// Records of InstanceBuffer::Instance are 9 words apart, where a struct of two vec4f and a u32 would take 12
+const instanceWords = 9u;
+
+@group(0) @binding(0) var<uniform> uCull: ObjectCullUniforms;
+@group(0) @binding(1) var<storage, read> instances: array<u32>;
+@group(0) @binding(2) var<storage, read_write> visibleInstances: array<u32>;
+@group(0) @binding(3) var<storage, read_write> visibleCount: atomic<u32>;
+@group(0) @binding(4) var<storage, read_write> drawArgs: array<DrawIndexedIndirectArgs>;
+
+fn loadVec4(word: u32) -> vec4f
+{
+    return bitcast<vec4f>(vec4u(instances[word], instances[word + 1u], instances[word + 2u], instances[word + 3u]));
+}
+
+// Rotation of v by the unit quaternion q
+fn rotate(q: vec4f, v: vec3f) -> vec3f
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+@compute @workgroup_size(64)
+fn cs_cull(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groupCount: vec3u, @builtin(local_invocation_index) lane: u32)
+{
+    // Instances are spread over two dimensions to stay within maxComputeWorkgroupsPerDimension
+    let instanceIndex = (group.x + group.y * groupCount.x) * 64u + lane;
+    if (instanceIndex >= uCull.instanceCount)
+    {
+        return;
+    }
+    let first = instanceIndex * instanceWords;
+    let positionScale = loadVec4(first);
+    let rotation = loadVec4(first + 4u);
+
+    let center = positionScale.xyz + rotate(rotation, uCull.boundsCenter * positionScale.w);
+    let radius = uCull.boundsRadius * abs(positionScale.w);
+    for (var i = 0u; i < 6u; i++)
+    {
+        if (dot(uCull.planes[i].xyz, center) + uCull.planes[i].w < -radius)
+        {
+            return;
+        }
+    }
+
+    let slot = atomicAdd(&visibleCount, 1u);
+    for (var i = 0u; i < instanceWords; i++)
+    {
+        visibleInstances[slot * instanceWords + i] = instances[first + i];
+    }
+}
+
+// Dispatched after cs_cull: every submesh draws all the visible instances
+@compute @workgroup_size(64)
+fn cs_draw_args(@builtin(global_invocation_id) id: vec3u)
+{
+    if (id.x < uCull.submeshCount)
+    {
+        drawArgs[id.x].instanceCount = atomicLoad(&visibleCount);
+    }
+}
@@ -6,9 +6,20 @@ struct VertexInput
     @location(3) uv: vec2f,
 };
 
+// Quantized counterpart of VertexInput (see ResourceManager::PackedVertexAttributes),
+// the vertex fetch already normalizes every component
+struct PackedVertexInput 
+{
+    @location(0) position: vec4f, // unorm16, relative to the mesh bounds
+    @location(1) normal: vec2f,   // snorm16, octahedral encoding
+	@location(2) color: vec4f,    // unorm8
+    @location(3) uv: vec2f,       // unorm16, relative to the mesh uv bounds
+};
+
 struct VertexOutput 
 {
-    @builtin(position) position: vec4f,
+    // Invariant so that the depth prepass and the main pass compute the very same depth
+    @builtin(position) @invariant position: vec4f,
     // The location here does not refer to a vertex attribute, it just means
     // that this field must be handled by the rasterizer.
     // (It can also refer to another field of another struct that would be used
@@ -16,54 +27,234 @@ struct VertexOutput
     @location(0) color: vec3f,
 	@location(1) normal: vec3f,
     @location(2) uv: vec2f,
+    @location(3) tint: vec3f,
 };
 
 /**
- * A structure holding the value of our uniforms
+ * A structure holding the value of our uniforms, per frame
  */
  struct MyUniforms 
  {
 	proj: mat4x4f,
     view: mat4x4f,
-    model: mat4x4f,
     color: vec4f,
+    positionOffset: vec4f,
+    positionScale: vec4f,
+    uvOffsetScale: vec4f,
     time: f32,
  };
 
 // The memory location of the uniform is given by a pair of a *bind group* and a *binding*
 @group(0) @binding(0) var<uniform> uMyUniforms: MyUniforms;
-@group(0) @binding(1) var gradientTexture: texture_2d<f32>;
-@group(0) @binding(2) var textureSampler: sampler;
+@group(0) @binding(1) var textureSampler: sampler;
 
-@vertex
-fn vs_main(in: VertexInput) -> VertexOutput 
+// Per object, at its dynamic offset in the object uniform arena (see UniformArena)
+struct ObjectUniforms
+{
+    model: mat4x4f,
+};
+@group(1) @binding(0) var<uniform> uObject: ObjectUniforms;
+
+// What a vertex entry point draws the mesh with
+struct Object
+{
+    model: mat4x4f,
+    tint: vec3f,
+};
+
+// INSTANCING is defined by the app (see Application::shader_defines)
+#if INSTANCING
+// Per instance, from the instance buffer (see InstanceBuffer::Instance)
+struct InstanceInput
+{
+    @location(4) positionScale: vec4f, // xyz: position, w: uniform scale
+    @location(5) rotation: vec4f,      // unit quaternion
+    @location(6) tint: vec4f,          // unorm8
+};
+
+fn instanceObject(instance: InstanceInput) -> Object
+{
+    // Columns of the rotation matrix of the quaternion, scaled
+    let q = instance.rotation;
+    let s = instance.positionScale.w;
+    let x = vec3f(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y)) * s;
+    let y = vec3f(2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x)) * s;
+    let z = vec3f(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y)) * s;
+    let model = mat4x4f(vec4f(x, 0.0), vec4f(y, 0.0), vec4f(z, 0.0), vec4f(instance.positionScale.xyz, 1.0));
+    return Object(model, instance.tint.rgb);
+}
+
+// Extra parameter of the vertex entry points, and the object they draw
+#define INSTANCE_INPUT , instance: InstanceInput
+#define OBJECT instanceObject(instance)
+#else
+#define INSTANCE_INPUT , @builtin(instance_index) instance: u32
+#define OBJECT Object(uObject.model, vec3f(1.0))
+#endif
+
+// Where the texture of the material is: in the texture pool (see TexturePool), or the virtual texture cache
+struct MaterialUniforms
+{
+    page: u32,
+    layer: u32,
+    // Offset of the header of the virtual texture in vtIndirection, vtNone for pooled textures
+    virtualTexture: u32,
+};
+
+// Per material: the pages of the texture pool, shared by all materials, and the uniforms of the material at its dynamic offset
+@group(2) @binding(0) var page0: texture_2d_array<f32>;
+@group(2) @binding(1) var page1: texture_2d_array<f32>;
+@group(2) @binding(2) var page2: texture_2d_array<f32>;
+@group(2) @binding(3) var page3: texture_2d_array<f32>;
+@group(2) @binding(4) var page4: texture_2d_array<f32>;
+@group(2) @binding(5) var page5: texture_2d_array<f32>;
+@group(2) @binding(6) var page6: texture_2d_array<f32>;
+@group(2) @binding(7) var page7: texture_2d_array<f32>;
+@group(2) @binding(8) var<uniform> uMaterial: MaterialUniforms;
+
+// VIRTUAL_TEXTURING is defined by the app (see Application::shader_defines)
+#if VIRTUAL_TEXTURING
+#include "virtual-texture.wgsl"
+#endif
+
+// Specialization of each pipeline, see Application::MaterialShading: the branches on these compile away
+override materialShading: u32 = 1u;
+const shadingVertexColor = 0u;
+const shadingPooledTexture = 1u;
+const shadingVirtualTexture = 2u;
+override lit: bool = false;
+
+fn transformPosition(position: vec3f, object: Object) -> vec4f
+{
+    return uMyUniforms.proj * uMyUniforms.view * object.model * vec4f(position, 1.0);
+}
+
+// Shared by both vertex entry points (which cannot call each other)
+fn transformVertex(in: VertexInput, object: Object) -> VertexOutput
 {
     var out: VertexOutput;
-    out.position = uMyUniforms.proj * uMyUniforms.view * uMyUniforms.model * vec4f(in.position, 1.0);
+    out.position = transformPosition(in.position, object);
     out.color = in.color;
-	out.normal = (uMyUniforms.model * vec4f(in.normal, 0.0)).xyz;
+	out.normal = (object.model * vec4f(in.normal, 0.0)).xyz;
     out.uv = in.uv * 1.0;
+    out.tint = object.tint;
     return out;
 }
 
+@vertex
+fn vs_main(in: VertexInput INSTANCE_INPUT) -> VertexOutput 
+{
+    return transformVertex(in, OBJECT);
+}
+
+// Inverse of the octahedral mapping done by ResourceManager::quantize_vertices
+fn octDecode(e: vec2f) -> vec3f
+{
+    var n = vec3f(e, 1.0 - abs(e.x) - abs(e.y));
+    let t = max(-n.z, 0.0);
+    n.x += select(t, -t, n.x >= 0.0);
+    n.y += select(t, -t, n.y >= 0.0);
+    return normalize(n);
+}
+
+fn decodePosition(position: vec4f) -> vec3f
+{
+    return uMyUniforms.positionOffset.xyz + position.xyz * uMyUniforms.positionScale.xyz;
+}
+
+@vertex
+fn vs_main_packed(packed: PackedVertexInput INSTANCE_INPUT) -> VertexOutput 
+{
+    var in: VertexInput;
+    in.position = decodePosition(packed.position);
+    in.normal = octDecode(packed.normal);
+    in.color = packed.color.rgb;
+    in.uv = uMyUniforms.uvOffsetScale.xy + packed.uv * uMyUniforms.uvOffsetScale.zw;
+    return transformVertex(in, OBJECT);
+}
+
+// Depth-only entry points, reading nothing but the position attribute
+@vertex
+fn vs_depth(@location(0) position: vec3f INSTANCE_INPUT) -> @builtin(position) @invariant vec4f
+{
+    return transformPosition(position, OBJECT);
+}
+
+@vertex
+fn vs_depth_packed(@location(0) position: vec4f INSTANCE_INPUT) -> @builtin(position) @invariant vec4f
+{
+    return transformPosition(decodePosition(position), OBJECT);
+}
+
+// Textures cannot be indexed dynamically, but the page is uniform over a draw, so branching on it keeps
+// textureSample in uniform control flow
+fn sampleMaterial(uv: vec2f) -> vec4f
+{
+    let layer = uMaterial.layer;
+    switch uMaterial.page
+    {
+        case 1u: { return textureSample(page1, textureSampler, uv, layer); }
+        case 2u: { return textureSample(page2, textureSampler, uv, layer); }
+        case 3u: { return textureSample(page3, textureSampler, uv, layer); }
+        case 4u: { return textureSample(page4, textureSampler, uv, layer); }
+        case 5u: { return textureSample(page5, textureSampler, uv, layer); }
+        case 6u: { return textureSample(page6, textureSampler, uv, layer); }
+        case 7u: { return textureSample(page7, textureSampler, uv, layer); }
+        default: { return textureSample(page0, textureSampler, uv, layer); }
+    }
+}
+
+#if VIRTUAL_TEXTURING
+// Tile of the virtual texture the pixel needs, packed as texture << 26 | level << 22 | row << 11 | column
+// (see VirtualTextureCache::request), or the page and layer of its pooled texture for the residency manager
+@fragment
+fn fs_feedback(in: VertexOutput) -> @location(0) u32
+{
+    if materialShading == shadingVertexColor
+    {
+        return vtNone;
+    }
+    if materialShading == shadingPooledTexture
+    {
+        return vtPooledTexture | (uMaterial.page << 16u) | uMaterial.layer;
+    }
+    let base = uMaterial.virtualTexture;
+    let level = vtLevel(base, dpdx(in.uv), dpdy(in.uv), vtFeedbackBias);
+    let tile = vtTile(base, in.uv, level);
+    return (vtIndirection[base + 1u] << 26u) | (level << 22u) | (tile.y << 11u) | tile.x;
+}
+#endif
+
+// Two directional lights
+fn shade(normal: vec3f) -> vec3f
+{
+    let lightDirection1 = vec3f(0.5, -0.9, 0.1);
+    let lightDirection2 = vec3f(0.2, 0.4, 0.3);
+    let lightColor1 = vec3f(1.0, 0.9, 0.6);
+    let lightColor2 = vec3f(0.6, 0.9, 1.0);
+    let shading1 = max(0.0, dot(lightDirection1, normal));
+    let shading2 = max(0.0, dot(lightDirection2, normal));
+    return shading1 * lightColor1 + shading2 * lightColor2;
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f 
 {
-	// let normal = normalize(in.normal);
-
-	// // We multiply the scene's color with our global uniform (this is one
-    // // possible use of the color uniform, among many others).
-    // //let color = in.color * uMyUniforms.color.rgb;
-    // let lightDirection1 = vec3f(0.5, -0.9, 0.1);
-    // let lightDirection2 = vec3f(0.2, 0.4, 0.3);
-	// let lightColor1 = vec3f(1.0, 0.9, 0.6);
-    // let lightColor2 = vec3f(0.6, 0.9, 1.0);
-    // let shading1 = max(0.0, dot(lightDirection1, normal));
-    // let shading2 = max(0.0, dot(lightDirection2, normal));
-    // let shading = shading1 * lightColor1 + shading2 * lightColor2;
-    // let color = in.color * shading;
-
-    // return vec4f(color, uMyUniforms.color.a);
-    let color = textureSample(gradientTexture, textureSampler, in.uv).rgb;
+    var color = in.color;
+    if materialShading == shadingPooledTexture
+    {
+        color = sampleMaterial(in.uv).rgb;
+    }
+#if VIRTUAL_TEXTURING
+    else if materialShading == shadingVirtualTexture
+    {
+        color = sampleVirtual(uMaterial.virtualTexture, in.uv, dpdx(in.uv), dpdy(in.uv)).rgb;
+    }
+#endif
+    color *= in.tint;
+    if lit
+    {
+        color *= shade(normalize(in.normal));
+    }
     return vec4f(color, 1.0);
-}
\ No newline at end of file
+}
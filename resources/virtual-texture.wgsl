@@ -0,0 +1,54 @@
+// Included by shader.wgsl
+// Virtual textures (see VirtualTextureCache): the atlas of resident tiles, and for each texture a header
+// followed by an entry per tile of each level, pointing at the finest resident tile covering it
+@group(2) @binding(9) var vtAtlas: texture_2d<f32>;
+@group(2) @binding(10) var<storage, read> vtIndirection: array<u32>;
+
+// As in TiledTexture and VirtualTextureCache
+const vtTileSize = 128.0;
+const vtBorder = 4.0;
+const vtPaddedTileSize = 136.0;
+const vtNone = 0xffffffffu;
+// Feedback of pooled textures, see VirtualTextureCache::PooledTexture
+const vtPooledTexture = 0xfc000000u;
+// Added to the level the feedback pass requests, which runs at a lower resolution than the screen
+override vtFeedbackBias: f32 = 0.0;
+
+fn vtLevelSize(base: u32, level: u32) -> vec2f
+{
+    let size = vtIndirection[base + 5u + 2u * level];
+    return vec2f(f32(size & 0xffffu), f32(size >> 16u));
+}
+
+// Mip level of a virtual texture, from the derivatives of uv
+fn vtLevel(base: u32, duvdx: vec2f, duvdy: vec2f, bias: f32) -> u32
+{
+    let size = vtLevelSize(base, 0u);
+    let texels = max(length(duvdx * size), length(duvdy * size));
+    let level = floor(log2(max(texels, 1e-6)) + bias + 0.5);
+    return u32(clamp(level, 0.0, f32(vtIndirection[base] - 1u)));
+}
+
+// Tile of a level covering uv, which wraps around as the sampler repeats
+fn vtTile(base: u32, uv: vec2f, level: u32) -> vec2u
+{
+    let size = vtLevelSize(base, level);
+    let tiles = vec2u(ceil(size / vtTileSize));
+    return min(vec2u(fract(uv) * size / vtTileSize), tiles - 1u);
+}
+
+fn sampleVirtual(base: u32, uv: vec2f, duvdx: vec2f, duvdy: vec2f) -> vec4f
+{
+    let level = vtLevel(base, duvdx, duvdy, 0.0);
+    let tile = vtTile(base, uv, level);
+    let columns = u32(ceil(vtLevelSize(base, level).x / vtTileSize));
+    let entry = vtIndirection[base + vtIndirection[base + 4u + 2u * level] + tile.y * columns + tile.x];
+
+    // The resident tile may belong to a coarser level than the one asked for
+    let residentLevel = (entry >> 16u) & 0xffu;
+    let texel = fract(uv) * vtLevelSize(base, residentLevel);
+    let inTile = texel - floor(texel / vtTileSize) * vtTileSize;
+    let slot = vec2f(f32(entry & 0xffu), f32((entry >> 8u) & 0xffu));
+    let atlasUv = (slot * vtPaddedTileSize + vtBorder + inTile) / vec2f(textureDimensions(vtAtlas));
+    return textureSampleLevel(vtAtlas, textureSampler, atlasUv, 0.0);
+}
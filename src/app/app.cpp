@@ -1,39 +1,61 @@
 #include "app.h"
 #include "../util/resource-manager.h"
+#include "../util/gpu-memory.h"
 
 #include <glfw3webgpu.h>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <unordered_set>
+
 using VertexAttributes = ResourceManager::VertexAttributes;
+using PackedVertexAttributes = ResourceManager::PackedVertexAttributes;
 
 bool Application::initialize()
 {
-    if (!init_window_and_device())
-        return false;
-    if (!init_swap_chain())
-        return false;
-    if (!init_depth_buffer())
-        return false;
-    if (!init_render_pipeline())
-        return false;
-    if (!init_texture())
-        return false;
-    if (!init_geometry())
-        return false;
-    if (!init_uniforms())
-        return false;
-    if (!init_bind_group())
-        return false;
-    return true;
+    // Loading files overlaps with creating the device, WebGPU objects are created on this thread only
+    using Thread = StartupGraph::Thread;
+    StartupGraph startup(thread_pool);
+    auto device_stage = startup.add("device", Thread::Main, [this]() { return init_window_and_device(); });
+    auto mesh = startup.add("mesh", Thread::Worker, [this]() { return load_mesh(); });
+    auto shader = startup.add("shader", Thread::Worker, [this]() { return load_shader(); });
+    auto swap_chain_stage = startup.add("swap chain", Thread::Main, [this]() { return init_swap_chain(); }, {device_stage});
+    auto depth_buffer = startup.add("depth buffer", Thread::Main, [this]() { return init_depth_buffer(); }, {swap_chain_stage});
+    auto feedback_buffer = startup.add("feedback buffer", Thread::Main, [this]() { return init_feedback_buffer(); }, {swap_chain_stage});
+    auto geometry = startup.add("geometry", Thread::Main, [this]() { return init_geometry(); }, {device_stage, mesh});
+    // The geometry decides on the vertex layout of the pipeline
+    auto render_pipeline = startup.add("render pipeline", Thread::Main, [this]() { return init_render_pipeline(); },
+                                       {geometry, shader, depth_buffer, feedback_buffer});
+    // Materials come with the geometry
+    auto texture = startup.add("texture", Thread::Main, [this]() { return init_texture(); }, {geometry});
+    auto uniforms = startup.add("uniforms", Thread::Main, [this]() { return init_uniforms(); }, {texture});
+    auto bind_group = startup.add("bind group", Thread::Main, [this]() { return init_bind_group(); }, {render_pipeline, uniforms});
+    startup.add("meshlet culling", Thread::Main, [this]() { return init_meshlet_culling(); }, {bind_group});
+    startup.add("object culling", Thread::Main, [this]() { return init_object_culling(); }, {bind_group});
+
+    bool success = startup.run();
+    startup.report();
+    return success;
 }
 
 void Application::tick()
 {
     glfwPollEvents();
+    pipeline_cache->poll();
+    update_shader_reload();
+    update_pending_textures();
+    update_virtual_textures();
+    update_residency();
+    update_material_bind_group();
+    update_object_uniforms();
+    draw_list.build(draws, object_offsets);
+    depth_draw_list.build(depth_draws, object_offsets);
 
     // Update uniform buffer
     uniforms.time = static_cast<float>(glfwGetTime());
-    queue.writeBuffer(uniform_buffer, offsetof(MyUniforms, time), &uniforms.time, sizeof(MyUniforms::time));
+    uploader->upload_buffer(uniform_buffer, offsetof(MyUniforms, time), &uniforms.time, sizeof(MyUniforms::time));
 
     TextureView next_texture = swap_chain.getCurrentTextureView();
     if (!next_texture)
@@ -46,6 +68,15 @@ void Application::tick()
     command_encoder_desc.label = "Command Encoder";
     CommandEncoder encoder = device.createCommandEncoder(command_encoder_desc);
 
+    if (cull_pipeline)
+    {
+        cull_meshlets(encoder);
+    }
+    if (object_cull_pipeline)
+    {
+        cull_objects(encoder);
+    }
+
     RenderPassDescriptor render_pass_desc = {};
 
     RenderPassColorAttachment render_pass_color_attachment = {};
@@ -76,29 +107,198 @@ void Application::tick()
 
     render_pass_desc.depthStencilAttachment = &depth_stencil_attachment;
     render_pass_desc.timestampWrites = nullptr;
-    RenderPassEncoder render_pass = encoder.beginRenderPass(render_pass_desc);
 
-    render_pass.setPipeline(pipeline);
+    // Geometry bindings and draws, shared by the depth prepass and the main pass
+    auto bind_geometry = [&](RenderPassEncoder& pass) {
+        if (position_stream_size > 0)
+        {
+            pass.setVertexBuffer(0, vertex_buffer, 0, position_stream_size);
+            pass.setVertexBuffer(1, vertex_buffer, position_stream_size, vertex_buffer.getSize() - position_stream_size);
+        }
+        else
+        {
+            pass.setVertexBuffer(0, vertex_buffer, 0, vertex_buffer.getSize());
+        }
 
-    render_pass.setVertexBuffer(0, vertex_buffer, 0, vertex_count * sizeof(VertexAttributes));
+        if (cull_pipeline)
+        {
+            // Only the meshlets that survived culling, counted on the GPU
+            pass.setIndexBuffer(culled_index_buffer, IndexFormat::Uint32, 0, culled_index_buffer.getSize());
+        }
+        else if (index_buffer)
+        {
+            pass.setIndexBuffer(index_buffer, index_format, 0, index_buffer.getSize());
+        }
+    };
+    // After the vertex buffers of the geometry, as many as the pipeline of the pass reads
+    auto bind_instances = [&](RenderPassEncoder& pass, uint32_t slot) {
+        // Only the instances that survived culling, as many as object_draw_args_buffer draws
+        if (object_cull_pipeline)
+            pass.setVertexBuffer(slot, visible_instance_buffer, 0, instances->byte_size());
+        else if (instancing)
+            pass.setVertexBuffer(slot, instances->buffer(), 0, instances->byte_size());
+    };
+    const uint32_t instance_count = instancing ? instances->size() : 1;
+    auto draw_submesh = [&](RenderPassEncoder& pass, uint32_t index) {
+        const ResourceManager::Submesh& submesh = submeshes[index];
+        if (cull_pipeline)
+        {
+            pass.drawIndexedIndirect(draw_args_buffer, index * sizeof(DrawIndexedIndirectArgs));
+        }
+        else if (object_cull_pipeline)
+        {
+            pass.drawIndexedIndirect(object_draw_args_buffer, index * sizeof(DrawIndexedIndirectArgs));
+        }
+        else if (index_buffer)
+        {
+            pass.drawIndexed(submesh.index_count, instance_count, submesh.first_index, 0, 0);
+        }
+        else
+        {
+            // Streamed geometry comes without indices
+            pass.draw(submesh.index_count, instance_count, submesh.first_index, 0);
+        }
+    };
+    const uint32_t instance_slot = position_stream_size > 0 ? 2 : 1;
+
+    // Replay a draw list, all objects sharing the same bind groups at the dynamic offsets of their uniforms, with the
+    // pipeline specialized for the shading of each material (none for the depth prepass, which sets its own)
+    using PipelineVariants = std::array<PipelineCache::Key, MaterialShadingCount>;
+    auto draw_list_commands = [&](RenderPassEncoder& pass, const DrawList& list, const PipelineVariants* variants) {
+        RenderPipeline pipeline = nullptr;
+        for (const DrawList::Command& command : list.commands())
+        {
+            switch (command.type)
+            {
+            case DrawList::CommandType::SetPipeline:
+                if (variants)
+                {
+                    pipeline = pipeline_cache->get((*variants)[command.value]);
+                    if (pipeline)
+                        pass.setPipeline(pipeline);
+                }
+                break;
+            case DrawList::CommandType::SetMaterial:
+                if (variants)
+                {
+                    uint32_t material_offset = command.value * material_uniform_stride;
+                    pass.setBindGroup(2, material_bind_group, 1, &material_offset);
+                }
+                break;
+            case DrawList::CommandType::SetObject:
+                pass.setBindGroup(1, object_bind_group, 1, &command.value);
+                break;
+            case DrawList::CommandType::Draw:
+                // Unless its pipeline failed to compile
+                if (!variants || pipeline)
+                    draw_submesh(pass, command.value);
+                break;
+            }
+        }
+    };
+
+    RenderPipeline depth_pipeline = depth_prepass ? pipeline_cache->get(depth_pipeline_key) : nullptr;
+    if (depth_pipeline)
+    {
+        // Depth only: a pipeline without color target cannot run in the color pass
+        RenderPassDescriptor depth_pass_desc = {};
+        depth_pass_desc.colorAttachmentCount = 0;
+        depth_pass_desc.depthStencilAttachment = &depth_stencil_attachment;
+        depth_pass_desc.timestampWrites = nullptr;
+        RenderPassEncoder depth_pass = encoder.beginRenderPass(depth_pass_desc);
+
+        depth_pass.setPipeline(depth_pipeline);
+        bind_geometry(depth_pass);
+        // After the position stream alone
+        bind_instances(depth_pass, 1);
+        depth_pass.setBindGroup(0, bind_group, 0, nullptr);
+        draw_list_commands(depth_pass, depth_draw_list, nullptr);
+        depth_pass.end();
+        depth_pass.release();
+
+        // The main pass tests against the depth laid down here
+        depth_stencil_attachment.depthLoadOp = LoadOp::Load;
+    }
+
+    RenderPassEncoder render_pass = encoder.beginRenderPass(render_pass_desc);
+
+    bind_geometry(render_pass);
+    bind_instances(render_pass, instance_slot);
 
     // Set binding group
     render_pass.setBindGroup(0, bind_group, 0, nullptr);
 
-    render_pass.draw(vertex_count, 1, 0, 0);
+    draw_list_commands(render_pass, draw_list, &pipeline_keys);
 
     render_pass.end();
     render_pass.release();
 
+    if (virtual_texturing && (virtual_textures->texture_count() > 0 || residency->texture_count() > 0) && feedback_state == FeedbackState::Idle)
+    {
+        // Low-resolution pass writing the virtual texture tile or pooled texture each pixel samples, read back once the copy is done
+        RenderPassColorAttachment feedback_color_attachment = {};
+        feedback_color_attachment.view = feedback_texture_view;
+        feedback_color_attachment.resolveTarget = nullptr;
+        feedback_color_attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+        feedback_color_attachment.loadOp = LoadOp::Clear;
+        feedback_color_attachment.storeOp = StoreOp::Store;
+        // VirtualTextureCache::None
+        feedback_color_attachment.clearValue = Color{4294967295.0, 0.0, 0.0, 0.0};
+
+        RenderPassDepthStencilAttachment feedback_depth_attachment = depth_stencil_attachment;
+        feedback_depth_attachment.view = feedback_depth_texture_view;
+        feedback_depth_attachment.depthLoadOp = LoadOp::Clear;
+        feedback_depth_attachment.depthStoreOp = StoreOp::Discard;
+
+        RenderPassDescriptor feedback_pass_desc = {};
+        feedback_pass_desc.colorAttachmentCount = 1;
+        feedback_pass_desc.colorAttachments = &feedback_color_attachment;
+        feedback_pass_desc.depthStencilAttachment = &feedback_depth_attachment;
+        feedback_pass_desc.timestampWrites = nullptr;
+        RenderPassEncoder feedback_pass = encoder.beginRenderPass(feedback_pass_desc);
+
+        bind_geometry(feedback_pass);
+        bind_instances(feedback_pass, instance_slot);
+        feedback_pass.setBindGroup(0, bind_group, 0, nullptr);
+        draw_list_commands(feedback_pass, draw_list, &feedback_pipeline_keys);
+        feedback_pass.end();
+        feedback_pass.release();
+
+        ImageCopyTexture feedback_source;
+        feedback_source.texture = feedback_texture;
+        feedback_source.mipLevel = 0;
+        feedback_source.origin = {0, 0, 0};
+        feedback_source.aspect = TextureAspect::All;
+        ImageCopyBuffer feedback_destination;
+        feedback_destination.buffer = feedback_readback_buffer;
+        feedback_destination.layout.offset = 0;
+        feedback_destination.layout.bytesPerRow = feedback_bytes_per_row;
+        feedback_destination.layout.rowsPerImage = feedback_height;
+        encoder.copyTextureToBuffer(feedback_source, feedback_destination, {feedback_width, feedback_height, 1});
+        feedback_state = FeedbackState::Copied;
+    }
+
     next_texture.release();
 
     CommandBufferDescriptor cmd_buffer_descriptor{};
     cmd_buffer_descriptor.label = "Command buffer";
     CommandBuffer command = encoder.finish(cmd_buffer_descriptor);
     encoder.release();
+    // The uploads of the frame run first
+    uploader->submit();
     queue.submit(command);
     command.release();
 
+    if (feedback_state == FeedbackState::Copied)
+    {
+        feedback_state = FeedbackState::Mapping;
+        auto on_mapped = [this](BufferMapAsyncStatus status) {
+            // A failed mapping (e.g. the buffer was destroyed by a resize) just skips this feedback
+            feedback_state = status == BufferMapAsyncStatus::Success ? FeedbackState::Mapped : FeedbackState::Idle;
+        };
+        feedback_map_callback = feedback_readback_buffer.mapAsync(MapMode::Read, 0, feedback_readback_buffer.getSize(), on_mapped);
+    }
+
     swap_chain.present();
 
 #ifdef WEBGPU_BACKEND_DAWN
@@ -109,11 +309,14 @@ void Application::tick()
 
 void Application::terminate()
 {
+    terminate_object_culling();
+    terminate_meshlet_culling();
     terminate_bind_group();
     terminate_uniforms();
     terminate_geometry();
     terminate_texture();
     terminate_render_pipeline();
+    terminate_feedback_buffer();
     terminate_depth_buffer();
     terminate_swap_chain();
     terminate_window_and_device();
@@ -127,12 +330,14 @@ bool Application::is_running()
 void Application::on_resize()
 {
     // Terminate in reverse order
+    terminate_feedback_buffer();
     terminate_depth_buffer();
     terminate_swap_chain();
 
     // Re-initialise depth buffer and swap chain with correct win res
     init_swap_chain();
     init_depth_buffer();
+    init_feedback_buffer();
 
     update_projection_matrix();
 }
@@ -240,26 +445,42 @@ bool Application::init_window_and_device()
 
     std::cout << "Requesting device..." << std::endl;
     RequiredLimits required_limits = Default;
-    required_limits.limits.maxVertexAttributes = 4;
-    required_limits.limits.maxVertexBuffers = 1;
-    required_limits.limits.maxBufferSize = 150000 * sizeof(VertexAttributes);
+    required_limits.limits.maxVertexAttributes = 4 + InstanceBuffer::AttributeCount;
+    // Positions and the other attributes with the Split vertex layout, then instances
+    required_limits.limits.maxVertexBuffers = 3;
+    // Big (e.g. streamed) meshes can take as much as the adapter allows
+    required_limits.limits.maxBufferSize = supported_limits.limits.maxBufferSize;
+    // Meshlet culling binds whole index buffers as storage
+    required_limits.limits.maxStorageBufferBindingSize = supported_limits.limits.maxStorageBufferBindingSize;
     required_limits.limits.maxVertexBufferArrayStride = sizeof(VertexAttributes);
     required_limits.limits.minStorageBufferOffsetAlignment = supported_limits.limits.minStorageBufferOffsetAlignment;
     required_limits.limits.minUniformBufferOffsetAlignment = supported_limits.limits.minUniformBufferOffsetAlignment;
-    required_limits.limits.maxInterStageShaderComponents = 8;
-    required_limits.limits.maxBindGroups = 1;
-    required_limits.limits.maxUniformBuffersPerShaderStage = 1;
-    required_limits.limits.maxUniformBufferBindingSize = 16 * 4 * sizeof(float);
+    required_limits.limits.maxInterStageShaderComponents = 11;
+    // Per-frame resources, then per-object ones, then per-material ones
+    required_limits.limits.maxBindGroups = 3;
+    // MyUniforms, and ObjectUniforms and MaterialUniforms at a dynamic offset
+    required_limits.limits.maxUniformBuffersPerShaderStage = 3;
+    required_limits.limits.maxDynamicUniformBuffersPerPipelineLayout = 2;
+    required_limits.limits.maxUniformBufferBindingSize = sizeof(MyUniforms);
     // Allow textures up to 2K
     required_limits.limits.maxTextureDimension1D = 2048;
     required_limits.limits.maxTextureDimension2D = 2048;
-    required_limits.limits.maxTextureArrayLayers = 1;
-    required_limits.limits.maxSampledTexturesPerShaderStage = 1;
+    // Texture pool pages hold as many textures of a size as the adapter allows
+    required_limits.limits.maxTextureArrayLayers = supported_limits.limits.maxTextureArrayLayers;
+    // The pages of the texture pool and the virtual texture atlas
+    required_limits.limits.maxSampledTexturesPerShaderStage = TexturePool::MaxPages + 1;
     required_limits.limits.maxSamplersPerShaderStage = 1;
 
+    // Sample block-compressed textures as they are when the adapter can, they are transcoded to RGBA8 otherwise
+    std::vector<FeatureName> required_features;
+    texture_compression_bc = adapter.hasFeature(FeatureName::TextureCompressionBC);
+    if (texture_compression_bc)
+        required_features.push_back(FeatureName::TextureCompressionBC);
+
     DeviceDescriptor device_desc;
     device_desc.label = "My Device";
-    device_desc.requiredFeatureCount = 0;
+    device_desc.requiredFeatureCount = required_features.size();
+    device_desc.requiredFeatures = (WGPUFeatureName*)required_features.data();
     device_desc.requiredLimits = &required_limits;
     device_desc.defaultQueue.label = "The default queue";
     device = adapter.requestDevice(device_desc);
@@ -274,6 +495,7 @@ bool Application::init_window_and_device()
     });
 
     queue = device.getQueue();
+    uploader = std::make_unique<StagingUploader>(device);
 
 #ifdef WEBGPU_BACKEND_WGPU
     swap_chain_format = surface.getPreferredFormat(adapter);
@@ -287,6 +509,7 @@ bool Application::init_window_and_device()
 
 void Application::terminate_window_and_device()
 {
+    uploader.reset();
     queue.release();
     device.release();
     surface.release();
@@ -336,7 +559,7 @@ bool Application::init_depth_buffer()
     depth_texture_desc.usage = TextureUsage::RenderAttachment;
     depth_texture_desc.viewFormatCount = 1;
     depth_texture_desc.viewFormats = (WGPUTextureFormat*)&depth_texture_format;
-    depth_texture = device.createTexture(depth_texture_desc);
+    depth_texture = GpuMemory::create_texture(device, depth_texture_desc);
     std::cout << "Depth texture: " << depth_texture << std::endl;
 
     // Create the view of the depth texture manipulated by the rasterizer
@@ -357,17 +580,210 @@ bool Application::init_depth_buffer()
 void Application::terminate_depth_buffer()
 {
     depth_texture_view.release();
-    depth_texture.destroy();
-    depth_texture.release();
+    GpuMemory::destroy(depth_texture);
+}
+
+bool Application::init_feedback_buffer()
+{
+    if (!virtual_texturing)
+        return true;
+
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    feedback_width = std::max(static_cast<uint32_t>(width) / feedback_divisor, 1u);
+    feedback_height = std::max(static_cast<uint32_t>(height) / feedback_divisor, 1u);
+
+    // Tile requests, copied out for the CPU to read
+    TextureDescriptor feedback_texture_desc;
+    feedback_texture_desc.dimension = TextureDimension::_2D;
+    feedback_texture_desc.format = TextureFormat::R32Uint;
+    feedback_texture_desc.mipLevelCount = 1;
+    feedback_texture_desc.sampleCount = 1;
+    feedback_texture_desc.size = {feedback_width, feedback_height, 1};
+    feedback_texture_desc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+    feedback_texture_desc.viewFormatCount = 0;
+    feedback_texture_desc.viewFormats = nullptr;
+    feedback_texture = GpuMemory::create_texture(device, feedback_texture_desc);
+
+    TextureViewDescriptor feedback_texture_view_desc;
+    feedback_texture_view_desc.aspect = TextureAspect::All;
+    feedback_texture_view_desc.baseArrayLayer = 0;
+    feedback_texture_view_desc.arrayLayerCount = 1;
+    feedback_texture_view_desc.baseMipLevel = 0;
+    feedback_texture_view_desc.mipLevelCount = 1;
+    feedback_texture_view_desc.dimension = TextureViewDimension::_2D;
+    feedback_texture_view_desc.format = TextureFormat::R32Uint;
+    feedback_texture_view = feedback_texture.createView(feedback_texture_view_desc);
+
+    // Only the closest surface requests tiles
+    feedback_texture_desc.format = depth_texture_format;
+    feedback_texture_desc.usage = TextureUsage::RenderAttachment;
+    feedback_depth_texture = GpuMemory::create_texture(device, feedback_texture_desc);
+    feedback_texture_view_desc.aspect = TextureAspect::DepthOnly;
+    feedback_texture_view_desc.format = depth_texture_format;
+    feedback_depth_texture_view = feedback_depth_texture.createView(feedback_texture_view_desc);
+
+    // Rows of texture-to-buffer copies are aligned to 256 bytes
+    feedback_bytes_per_row = (feedback_width * sizeof(uint32_t) + 255) / 256 * 256;
+    BufferDescriptor buffer_desc;
+    buffer_desc.label = "Virtual texture feedback";
+    buffer_desc.size = uint64_t(feedback_bytes_per_row) * feedback_height;
+    buffer_desc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+    buffer_desc.mappedAtCreation = false;
+    feedback_readback_buffer = GpuMemory::create_buffer(device, buffer_desc);
+    feedback_state = FeedbackState::Idle;
+
+    return feedback_texture_view != nullptr && feedback_depth_texture_view != nullptr && feedback_readback_buffer != nullptr;
+}
+
+void Application::terminate_feedback_buffer()
+{
+    if (!feedback_readback_buffer)
+        return;
+
+    // The callback of a pending mapping fires (with an error) once the buffer is destroyed
+    GpuMemory::destroy(feedback_readback_buffer);
+    while (feedback_state == FeedbackState::Mapping)
+    {
+        ResourceManager::poll_device(device);
+    }
+    feedback_map_callback.reset();
+    feedback_state = FeedbackState::Idle;
+
+    feedback_depth_texture_view.release();
+    GpuMemory::destroy(feedback_depth_texture);
+    feedback_texture_view.release();
+    GpuMemory::destroy(feedback_texture);
+}
+
+bool Application::load_shader()
+{
+    return ResourceManager::load_shader_source(RESOURCE_DIR "/shader.wgsl", startup_shader_source, shader_defines(), &startup_shader_files);
 }
 
 bool Application::init_render_pipeline()
 {
+    shader_cache = std::make_unique<ShaderCache>(device);
+    pipeline_cache = std::make_unique<PipelineCache>(device, *shader_cache, &thread_pool);
+    // Before describing the pipelines, so that those the previous run drew with compile in the background from then on
+    pipeline_cache->load(RESOURCE_DIR "/shader.wgsl.pipelines");
+
+    // Create binding layouts
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(2, Default);
+
+    // The uniform buffer binding that we already had
+    BindGroupLayoutEntry& binding_layout = binding_layout_entries[0];
+    binding_layout.binding = 0;
+    binding_layout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
+    binding_layout.buffer.type = BufferBindingType::Uniform;
+    binding_layout.buffer.minBindingSize = sizeof(MyUniforms);
+
+    // The texture sampler binding
+    BindGroupLayoutEntry& sampler_binding_layout = binding_layout_entries[1];
+    sampler_binding_layout.binding = 1;
+    sampler_binding_layout.visibility = ShaderStage::Fragment;
+    sampler_binding_layout.sampler.type = SamplerBindingType::Filtering;
+
+    // Create a bind group layout
+    BindGroupLayoutDescriptor bind_group_layout_desc{};
+    bind_group_layout_desc.entryCount = (uint32_t)binding_layout_entries.size();
+    bind_group_layout_desc.entries = binding_layout_entries.data();
+    bind_group_layout = pipeline_cache->bind_group_layout(bind_group_layout_desc);
+
+    // The uniforms of an object, selected by dynamic offset
+    BindGroupLayoutEntry object_binding_layout = Default;
+    object_binding_layout.binding = 0;
+    object_binding_layout.visibility = ShaderStage::Vertex;
+    object_binding_layout.buffer.type = BufferBindingType::Uniform;
+    object_binding_layout.buffer.hasDynamicOffset = true;
+    object_binding_layout.buffer.minBindingSize = sizeof(ObjectUniforms);
+    BindGroupLayoutDescriptor object_bind_group_layout_desc{};
+    object_bind_group_layout_desc.entryCount = 1;
+    object_bind_group_layout_desc.entries = &object_binding_layout;
+    object_bind_group_layout = pipeline_cache->bind_group_layout(object_bind_group_layout_desc);
+
+    // The pages of the texture pool, the uniforms of the material selected by dynamic offset, and the virtual texture
+    // atlas with its indirection
+    std::vector<BindGroupLayoutEntry> material_binding_layout_entries(TexturePool::MaxPages + 3, Default);
+    for (uint32_t page = 0; page < TexturePool::MaxPages; ++page)
+    {
+        BindGroupLayoutEntry& texture_binding_layout = material_binding_layout_entries[page];
+        texture_binding_layout.binding = page;
+        texture_binding_layout.visibility = ShaderStage::Fragment;
+        texture_binding_layout.texture.sampleType = TextureSampleType::Float;
+        texture_binding_layout.texture.viewDimension = TextureViewDimension::_2DArray;
+    }
+    BindGroupLayoutEntry& material_uniform_binding_layout = material_binding_layout_entries[TexturePool::MaxPages];
+    material_uniform_binding_layout.binding = TexturePool::MaxPages;
+    material_uniform_binding_layout.visibility = ShaderStage::Fragment;
+    material_uniform_binding_layout.buffer.type = BufferBindingType::Uniform;
+    material_uniform_binding_layout.buffer.hasDynamicOffset = true;
+    material_uniform_binding_layout.buffer.minBindingSize = sizeof(MaterialUniforms);
+    BindGroupLayoutEntry& atlas_binding_layout = material_binding_layout_entries[TexturePool::MaxPages + 1];
+    atlas_binding_layout.binding = TexturePool::MaxPages + 1;
+    atlas_binding_layout.visibility = ShaderStage::Fragment;
+    atlas_binding_layout.texture.sampleType = TextureSampleType::Float;
+    atlas_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
+    BindGroupLayoutEntry& indirection_binding_layout = material_binding_layout_entries[TexturePool::MaxPages + 2];
+    indirection_binding_layout.binding = TexturePool::MaxPages + 2;
+    indirection_binding_layout.visibility = ShaderStage::Fragment;
+    indirection_binding_layout.buffer.type = BufferBindingType::ReadOnlyStorage;
+    indirection_binding_layout.buffer.minBindingSize = sizeof(uint32_t);
+
+    BindGroupLayoutDescriptor material_bind_group_layout_desc{};
+    material_bind_group_layout_desc.entryCount = (uint32_t)material_binding_layout_entries.size();
+    material_bind_group_layout_desc.entries = material_binding_layout_entries.data();
+    material_bind_group_layout = pipeline_cache->bind_group_layout(material_bind_group_layout_desc);
+
+    // Create the pipeline layout
+    pipeline_layout = pipeline_cache->pipeline_layout({bind_group_layout, object_bind_group_layout, material_bind_group_layout});
+    // The depth prepass binds no material
+    depth_pipeline_layout = pipeline_cache->pipeline_layout({bind_group_layout, object_bind_group_layout});
+    if (!bind_group_layout || !object_bind_group_layout || !material_bind_group_layout || !pipeline_layout || !depth_pipeline_layout)
+        return false;
+
     std::cout << "Creating shader module..." << std::endl;
-    shader_module = ResourceManager::load_shader_module(RESOURCE_DIR "/shader.wgsl", device);
+    shader_module = shader_cache->get(startup_shader_source);
     std::cout << "Shader module: " << shader_module << std::endl;
+    startup_shader_source.clear();
+    if (!shader_module)
+        return false;
+    if (shader_hot_reload)
+    {
+        for (const std::filesystem::path& file : startup_shader_files)
+        {
+            shader_watcher.watch(file);
+        }
+    }
+
+    // Compiled on first draw, or from now on in the background if the previous run drew with them
+    std::cout << "Describing render pipelines..." << std::endl;
+    create_render_pipelines(shader_module, nullptr);
+    const PipelineCache::Stats& stats = pipeline_cache->stats();
+    std::cout << "Render pipelines: " << stats.pipeline_count << " (" << stats.background_compile_count << " precompiling)" << std::endl;
+    return true;
+}
+
+ShaderPreprocessor::Defines Application::shader_defines() const
+{
+    ShaderPreprocessor::Defines defines;
+    defines["VIRTUAL_TEXTURING"] = virtual_texturing ? "1" : "0";
+    defines["INSTANCING"] = instancing ? "1" : "0";
+    return defines;
+}
+
+void Application::create_render_pipelines(ShaderModule module, PipelineReload* reload)
+{
+    // At startup, compiled on first draw. On reload, right away in the background, and update_shader_reload swaps
+    // them in when all are compiled.
+    auto create_pipeline = [&](const RenderPipelineDescriptor& desc, PipelineCache::Key& target) {
+        target = pipeline_cache->add(desc);
+        if (!reload)
+            return;
+        pipeline_cache->compile_async(target);
+        reload->keys.push_back(target);
+    };
 
-    std::cout << "Creating render pipeline..." << std::endl;
     RenderPipelineDescriptor pipeline_desc;
 
     // Vertex fetch
@@ -393,17 +809,63 @@ bool Application::init_render_pipeline()
     vertex_attribs[3].format = VertexFormat::Float32x2;
     vertex_attribs[3].offset = offsetof(VertexAttributes, uv);
 
-    VertexBufferLayout vertex_buffer_layout;
-    vertex_buffer_layout.attributeCount = (uint32_t)vertex_attribs.size();
-    vertex_buffer_layout.attributes = vertex_attribs.data();
-    vertex_buffer_layout.arrayStride = sizeof(VertexAttributes);
-    vertex_buffer_layout.stepMode = VertexStepMode::Vertex;
+    uint32_t vertex_stride = sizeof(VertexAttributes);
+    uint32_t position_stride = sizeof(VertexAttributes::position);
+
+    // Same locations, read from the compact layout and decoded in vs_main_packed
+    const bool quantized = geometry_options.encoding == ResourceManager::VertexEncoding::Quantized;
+    if (quantized)
+    {
+        vertex_attribs[0].format = VertexFormat::Unorm16x4;
+        vertex_attribs[0].offset = offsetof(PackedVertexAttributes, position);
+        vertex_attribs[1].format = VertexFormat::Snorm16x2;
+        vertex_attribs[1].offset = offsetof(PackedVertexAttributes, normal);
+        vertex_attribs[2].format = VertexFormat::Unorm8x4;
+        vertex_attribs[2].offset = offsetof(PackedVertexAttributes, color);
+        vertex_attribs[3].format = VertexFormat::Unorm16x2;
+        vertex_attribs[3].offset = offsetof(PackedVertexAttributes, uv);
+        vertex_stride = sizeof(PackedVertexAttributes);
+        position_stride = sizeof(PackedVertexAttributes::position);
+    }
 
-    pipeline_desc.vertex.bufferCount = 1;
-    pipeline_desc.vertex.buffers = &vertex_buffer_layout;
+    std::vector<VertexBufferLayout> vertex_buffer_layouts(1);
+    vertex_buffer_layouts[0].attributeCount = (uint32_t)vertex_attribs.size();
+    vertex_buffer_layouts[0].attributes = vertex_attribs.data();
+    vertex_buffer_layouts[0].arrayStride = vertex_stride;
+    vertex_buffer_layouts[0].stepMode = VertexStepMode::Vertex;
 
-    pipeline_desc.vertex.module = shader_module;
-    pipeline_desc.vertex.entryPoint = "vs_main";
+    // Split layout: the position alone in the first stream, the other attributes (moved up by the position size) in the second one
+    if (position_stream_size > 0)
+    {
+        for (size_t i = 1; i < vertex_attribs.size(); ++i)
+        {
+            vertex_attribs[i].offset -= position_stride;
+        }
+        vertex_buffer_layouts[0].attributeCount = 1;
+        vertex_buffer_layouts[0].arrayStride = position_stride;
+
+        VertexBufferLayout& attribute_buffer_layout = vertex_buffer_layouts.emplace_back();
+        attribute_buffer_layout.attributeCount = (uint32_t)vertex_attribs.size() - 1;
+        attribute_buffer_layout.attributes = vertex_attribs.data() + 1;
+        attribute_buffer_layout.arrayStride = vertex_stride - position_stride;
+        attribute_buffer_layout.stepMode = VertexStepMode::Vertex;
+    }
+
+    // One record per instance, after the vertex attributes
+    const std::array<VertexAttribute, InstanceBuffer::AttributeCount> instance_attribs = InstanceBuffer::attributes(4);
+    VertexBufferLayout instance_buffer_layout;
+    instance_buffer_layout.attributeCount = (uint32_t)instance_attribs.size();
+    instance_buffer_layout.attributes = instance_attribs.data();
+    instance_buffer_layout.arrayStride = sizeof(InstanceBuffer::Instance);
+    instance_buffer_layout.stepMode = VertexStepMode::Instance;
+    if (instancing)
+        vertex_buffer_layouts.push_back(instance_buffer_layout);
+
+    pipeline_desc.vertex.bufferCount = (uint32_t)vertex_buffer_layouts.size();
+    pipeline_desc.vertex.buffers = vertex_buffer_layouts.data();
+
+    pipeline_desc.vertex.module = module;
+    pipeline_desc.vertex.entryPoint = quantized ? "vs_main_packed" : "vs_main";
     pipeline_desc.vertex.constantCount = 0;
     pipeline_desc.vertex.constants = nullptr;
 
@@ -414,10 +876,16 @@ bool Application::init_render_pipeline()
 
     FragmentState fragment_state;
     pipeline_desc.fragment = &fragment_state;
-    fragment_state.module = shader_module;
+    fragment_state.module = module;
     fragment_state.entryPoint = "fs_main";
-    fragment_state.constantCount = 0;
-    fragment_state.constants = nullptr;
+
+    // Specialization constants of the fragment entry points, the shading set per pipeline
+    std::vector<ConstantEntry> constants(2, Default);
+    constants[0].key = "materialShading";
+    constants[1].key = "lit";
+    constants[1].value = lighting ? 1.0 : 0.0;
+    fragment_state.constantCount = (uint32_t)constants.size();
+    fragment_state.constants = constants.data();
 
     BlendState blend_state;
     blend_state.color.srcFactor = BlendFactor::SrcAlpha;
@@ -436,8 +904,9 @@ bool Application::init_render_pipeline()
     fragment_state.targets = &color_target;
 
     DepthStencilState depth_stencil_state = Default;
-    depth_stencil_state.depthCompare = CompareFunction::Less;
-    depth_stencil_state.depthWriteEnabled = true;
+    // After a depth prepass, only the closest surface is left to shade
+    depth_stencil_state.depthCompare = depth_prepass ? CompareFunction::LessEqual : CompareFunction::Less;
+    depth_stencil_state.depthWriteEnabled = !depth_prepass;
     depth_stencil_state.format = depth_texture_format;
     depth_stencil_state.stencilReadMask = 0;
     depth_stencil_state.stencilWriteMask = 0;
@@ -448,53 +917,138 @@ bool Application::init_render_pipeline()
     pipeline_desc.multisample.mask = ~0u;
     pipeline_desc.multisample.alphaToCoverageEnabled = false;
 
-    // Create binding layouts
-    std::vector<BindGroupLayoutEntry> binding_layout_entries(3, Default);
-
-    // The uniform buffer binding that we already had
-    BindGroupLayoutEntry& binding_layout = binding_layout_entries[0];
-    binding_layout.binding = 0;
-    binding_layout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
-    binding_layout.buffer.type = BufferBindingType::Uniform;
-    binding_layout.buffer.minBindingSize = sizeof(MyUniforms);
+    pipeline_desc.layout = pipeline_layout;
 
-    // The texture binding
-    BindGroupLayoutEntry& texture_binding_layout = binding_layout_entries[1];
-    texture_binding_layout.binding = 1;
-    texture_binding_layout.visibility = ShaderStage::Fragment;
-    texture_binding_layout.texture.sampleType = TextureSampleType::Float;
-    texture_binding_layout.texture.viewDimension = TextureViewDimension::_2D;
-
-    // The texture sampler binding
-    BindGroupLayoutEntry& sampler_binding_layout = binding_layout_entries[2];
-    sampler_binding_layout.binding = 2;
-    sampler_binding_layout.visibility = ShaderStage::Fragment;
-    sampler_binding_layout.sampler.type = SamplerBindingType::Filtering;
-
-    // Create a bind group layout
-    BindGroupLayoutDescriptor bind_group_layout_desc{};
-    bind_group_layout_desc.entryCount = (uint32_t)binding_layout_entries.size();
-    bind_group_layout_desc.entries = binding_layout_entries.data();
-    bind_group_layout = device.createBindGroupLayout(bind_group_layout_desc);
-
-    // Create the pipeline layout
-    PipelineLayoutDescriptor layout_desc{};
-    layout_desc.bindGroupLayoutCount = 1;
-    layout_desc.bindGroupLayouts = (WGPUBindGroupLayout*)&bind_group_layout;
-    PipelineLayout layout = device.createPipelineLayout(layout_desc);
-    pipeline_desc.layout = layout;
+    // Pipelines of virtual textures only exist with virtual texturing, as does their code in shader.wgsl
+    const uint32_t shading_count = virtual_texturing ? MaterialShadingCount : static_cast<uint32_t>(MaterialShading::VirtualTexture);
+    for (uint32_t shading = 0; shading < shading_count; ++shading)
+    {
+        constants[0].value = shading;
+        create_pipeline(pipeline_desc, reload ? reload->pipeline_keys[shading] : pipeline_keys[shading]);
+    }
 
-    pipeline = device.createRenderPipeline(pipeline_desc);
-    std::cout << "Render pipeline: " << pipeline << std::endl;
+    if (virtual_texturing)
+    {
+        // Same geometry and bindings, writing tile requests to an R32Uint target. Derivatives are feedback_divisor
+        // times bigger at its resolution, which the bias compensates for. Lighting does not matter to it.
+        constants[1].key = "vtFeedbackBias";
+        constants[1].value = -std::log2(static_cast<double>(feedback_divisor));
+        ColorTargetState feedback_target;
+        feedback_target.format = TextureFormat::R32Uint;
+        feedback_target.blend = nullptr;
+        feedback_target.writeMask = ColorWriteMask::All;
+        fragment_state.entryPoint = "fs_feedback";
+        fragment_state.targets = &feedback_target;
+
+        DepthStencilState feedback_depth_state = depth_stencil_state;
+        feedback_depth_state.depthCompare = CompareFunction::Less;
+        feedback_depth_state.depthWriteEnabled = true;
+        pipeline_desc.depthStencil = &feedback_depth_state;
+
+        for (uint32_t shading = 0; shading < shading_count; ++shading)
+        {
+            constants[0].value = shading;
+            create_pipeline(pipeline_desc, reload ? reload->feedback_pipeline_keys[shading] : feedback_pipeline_keys[shading]);
+        }
+        pipeline_desc.depthStencil = &depth_stencil_state;
+    }
 
-    return pipeline != nullptr;
+    if (depth_prepass)
+    {
+        // Binds the first vertex stream only (and instances), and no material
+        std::vector<VertexBufferLayout> depth_buffer_layouts = {vertex_buffer_layouts[0]};
+        depth_buffer_layouts[0].attributeCount = 1;
+        if (instancing)
+            depth_buffer_layouts.push_back(instance_buffer_layout);
+        pipeline_desc.vertex.bufferCount = (uint32_t)depth_buffer_layouts.size();
+        pipeline_desc.vertex.buffers = depth_buffer_layouts.data();
+        pipeline_desc.vertex.entryPoint = quantized ? "vs_depth_packed" : "vs_depth";
+        pipeline_desc.fragment = nullptr;
+
+        depth_stencil_state.depthCompare = CompareFunction::Less;
+        depth_stencil_state.depthWriteEnabled = true;
+        pipeline_desc.layout = depth_pipeline_layout;
+        create_pipeline(pipeline_desc, reload ? reload->depth_pipeline_key : depth_pipeline_key);
+    }
 }
 
 void Application::terminate_render_pipeline()
 {
-    pipeline.release();
+    if (pipeline_reload)
+    {
+        pipeline_reload->shader_module.release();
+        pipeline_reload.reset();
+    }
+
+    // For the next startup to precompile the pipelines drawn with
+    pipeline_cache->save(RESOURCE_DIR "/shader.wgsl.pipelines");
+    pipeline_keys = {};
+    feedback_pipeline_keys = {};
+    depth_pipeline_key = 0;
     shader_module.release();
-    bind_group_layout.release();
+    // Waits for the pipelines compiling in the background, and releases them along with the layouts
+    pipeline_cache.reset();
+    shader_cache.reset();
+    depth_pipeline_layout = nullptr;
+    pipeline_layout = nullptr;
+    material_bind_group_layout = nullptr;
+    object_bind_group_layout = nullptr;
+    bind_group_layout = nullptr;
+}
+
+void Application::update_shader_reload()
+{
+    if (pipeline_reload)
+    {
+        bool failed = false;
+        for (PipelineCache::Key key : pipeline_reload->keys)
+        {
+            PipelineCache::Status status = pipeline_cache->status(key);
+            if (status == PipelineCache::Status::Compiling)
+                return;
+            failed = failed || status == PipelineCache::Status::Failed;
+        }
+
+        if (failed)
+        {
+            std::cerr << "Could not reload shader.wgsl, keeping the previous pipelines" << std::endl;
+        }
+        else
+        {
+            std::swap(shader_module, pipeline_reload->shader_module);
+            pipeline_keys = pipeline_reload->pipeline_keys;
+            feedback_pipeline_keys = pipeline_reload->feedback_pipeline_keys;
+            depth_pipeline_key = pipeline_reload->depth_pipeline_key;
+            std::cout << "Reloaded shader.wgsl" << std::endl;
+        }
+        // The previous module on success, the new one otherwise. Pipelines stay cached, for reverting to a source.
+        pipeline_reload->shader_module.release();
+        pipeline_reload.reset();
+        return;
+    }
+
+    if (!shader_hot_reload || shader_watcher.poll().empty())
+        return;
+
+    std::vector<std::filesystem::path> shader_files;
+    ShaderModule module = shader_cache->load(RESOURCE_DIR "/shader.wgsl", shader_defines(), &shader_files);
+    if (!module)
+        return;
+    // Includes may have been added
+    for (const std::filesystem::path& file : shader_files)
+    {
+        shader_watcher.watch(file);
+    }
+    // Saved without changes (or reverted to the source in use)
+    if (module == shader_module)
+    {
+        module.release();
+        return;
+    }
+
+    pipeline_reload = std::make_unique<PipelineReload>();
+    pipeline_reload->shader_module = module;
+    create_render_pipelines(module, pipeline_reload.get());
 }
 
 bool Application::init_texture()
@@ -513,56 +1067,165 @@ bool Application::init_texture()
     sampler_desc.maxAnisotropy = 1;
     sampler = device.createSampler(sampler_desc);
 
-    // Create a texture
-    texture = ResourceManager::load_texture(RESOURCE_DIR "/fourareen2K_albedo.jpg", device, &texture_view);
-    if (!texture)
+    if (gpu_mip_maps)
     {
-        std::cerr << "Could not load texture!" << std::endl;
-        return false;
+        gpu_mip_generator = std::make_unique<GpuMipGenerator>(device);
+    }
+    SupportedLimits device_limits;
+    device.getLimits(&device_limits);
+    texture_pool = std::make_unique<TexturePool>(device, device_limits.limits.maxTextureArrayLayers, gpu_mip_generator.get());
+    virtual_textures = std::make_unique<VirtualTextureCache>(device, thread_pool);
+    residency = std::make_unique<ResidencyManager>(gpu_memory_budget);
+
+    // Every texture starts out as a 1x1 placeholder and is decoded on the thread pool, to be swapped in once
+    // ready (see update_pending_textures), so that the first frame does not wait for any of them.
+    // Images tiled by the texture encoder tool are streamed instead, and need no placeholder
+    auto add_virtual = [&](const std::filesystem::path& path, MaterialTexture& material_texture) {
+        if (virtual_texturing)
+            material_texture.virtual_texture = virtual_textures->add(path, uploader.get());
+        return material_texture.virtual_texture != VirtualTextureCache::None;
+    };
+
+    texture.path = RESOURCE_DIR "/fourareen2K_albedo.jpg";
+    if (!add_virtual(texture.path, texture))
+    {
+        if (!texture_pool->add_color(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f), texture.slot, uploader.get()))
+            return false;
+        load_texture_async(-1);
+    }
+
+    // Load the textures of the materials, once per file, with the diffuse color of the material as placeholder
+    std::map<std::filesystem::path, int32_t> slots;
+    material_texture_slots.assign(materials.size(), -1);
+    for (size_t i = 0; i < materials.size(); ++i)
+    {
+        const std::filesystem::path& texture_path = materials[i].diffuse_texture;
+        if (texture_path.empty())
+            continue;
+
+        auto [it, inserted] = slots.try_emplace(texture_path, static_cast<int32_t>(material_textures.size()));
+        if (inserted)
+        {
+            MaterialTexture& material_texture = material_textures.emplace_back();
+            material_texture.path = texture_path;
+            if (!add_virtual(texture_path, material_texture))
+            {
+                if (!texture_pool->add_color(glm::vec4(materials[i].diffuse, 1.0f), material_texture.slot, uploader.get()))
+                    return false;
+                load_texture_async(it->second);
+            }
+        }
+        material_texture_slots[i] = it->second;
     }
-    std::cout << "Texture: " << texture << std::endl;
-    std::cout << "Texture view: " << texture_view << std::endl;
 
-    return texture_view != nullptr;
+    return true;
 }
 
 void Application::terminate_texture()
 {
-    texture_view.release();
-    texture.destroy();
-    texture.release();
+    // Images still being decoded are dropped when their task completes
+    pending_textures.clear();
+
+    material_textures.clear();
+    material_texture_slots.clear();
+    residency.reset();
+    virtual_textures.reset();
+    texture_pool.reset();
     sampler.release();
+    gpu_mip_generator.reset();
 }
 
-bool Application::init_geometry()
+bool Application::load_mesh()
 {
-    // Load mesh data from OBJ file
-    std::vector<VertexAttributes> vertex_data;
-    bool success = ResourceManager::load_geometry_from_obj(RESOURCE_DIR "/fourareen.obj", vertex_data);
+    const std::filesystem::path obj_path = RESOURCE_DIR "/fourareen.obj";
+
+    // Load mesh data from the binary cache of the OBJ file (baked on first launch)
+    startup_mesh = std::make_unique<MeshCache>();
+    std::error_code ec;
+    if (std::filesystem::file_size(obj_path, ec) >= geometry_streaming_threshold && !ec)
+    {
+        // Too big to be parsed whole: from its cache if there is one, otherwise streamed by init_geometry
+        if (!startup_mesh->open(obj_path, geometry_options))
+            startup_mesh.reset();
+        return true;
+    }
+
+    // Opens the cache (once), or parses the OBJ file and bakes it
+    bool success = ResourceManager::load_geometry_cached(obj_path, *startup_mesh, geometry_options, &thread_pool);
     if (!success)
     {
         std::cerr << "Could not load geometry!" << std::endl;
         return false;
     }
+    return true;
+}
 
-    // Create vertex buffer
-    BufferDescriptor buffer_desc;
-    buffer_desc.size = vertex_data.size() * sizeof(VertexAttributes);
-    buffer_desc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-    buffer_desc.mappedAtCreation = false;
-    vertex_buffer = device.createBuffer(buffer_desc);
-    queue.writeBuffer(vertex_buffer, 0, vertex_data.data(), buffer_desc.size);
+bool Application::init_geometry()
+{
+    const std::filesystem::path obj_path = RESOURCE_DIR "/fourareen.obj";
 
-    vertex_count = static_cast<int>(vertex_data.size());
+    if (!startup_mesh)
+    {
+        geometry_options.encoding = ResourceManager::VertexEncoding::Float32;
+        geometry_options.layout = ResourceManager::VertexLayout::Interleaved;
+        vertex_quantization = {};
+        position_stream_size = 0;
+
+        // Too big to be loaded whole: stream it to the GPU (without indices) within a bounded amount of memory
+        uint32_t streamed_vertex_count = 0;
+        vertex_buffer = ResourceManager::stream_geometry_from_obj(obj_path, device, streamed_vertex_count, geometry_staging_budget);
+        vertex_count = static_cast<int>(streamed_vertex_count);
+        if (!vertex_buffer)
+        {
+            std::cerr << "Could not load geometry!" << std::endl;
+            return false;
+        }
+        // Drawn as a whole with the default material
+        submeshes = {{0, streamed_vertex_count, -1}};
+        materials.clear();
+        return true;
+    }
 
-    return vertex_buffer != nullptr;
+    // Create vertex and index buffers, filled straight from the mapped cache
+    const MeshCache& mesh = *startup_mesh;
+    vertex_buffer = ResourceManager::create_buffer_with_data(device, BufferUsage::Vertex, mesh.vertex_data(), mesh.vertex_data_size());
+    vertex_count = static_cast<int>(mesh.header().vertex_count);
+    vertex_quantization = mesh.header().quantization;
+    position_stream_size = mesh.position_data_size();
+
+    // Also read by the meshlet culling pass
+    index_buffer = ResourceManager::create_buffer_with_data(device, BufferUsage::Index | BufferUsage::Storage, mesh.index_data(), mesh.index_data_size());
+    index_format = mesh.index_format();
+    index_count = mesh.header().index_count;
+
+    submeshes.assign(mesh.submeshes(), mesh.submeshes() + mesh.header().submesh_count);
+    materials = mesh.materials();
+    bounds_center = (mesh.header().bounds_min + mesh.header().bounds_max) * 0.5f;
+    bounds_radius = glm::length(mesh.header().bounds_max - mesh.header().bounds_min) * 0.5f;
+
+    meshlet_count = mesh.header().meshlet_count;
+    if (meshlet_count > 0)
+    {
+        meshlet_buffer = ResourceManager::create_buffer_with_data(device, BufferUsage::Storage, mesh.meshlets(), mesh.meshlet_data_size());
+    }
+    startup_mesh.reset();
+
+    return vertex_buffer != nullptr && index_buffer != nullptr;
 }
 
 void Application::terminate_geometry()
 {
-    vertex_buffer.destroy();
-    vertex_buffer.release();
+    GpuMemory::destroy(meshlet_buffer);
+    meshlet_count = 0;
+
+    GpuMemory::destroy(index_buffer);
+    index_count = 0;
+    submeshes.clear();
+    materials.clear();
+
+    GpuMemory::destroy(vertex_buffer);
     vertex_count = 0;
+    position_stream_size = 0;
 }
 
 bool Application::init_uniforms()
@@ -572,31 +1235,141 @@ bool Application::init_uniforms()
     buffer_desc.size = sizeof(MyUniforms);
     buffer_desc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
     buffer_desc.mappedAtCreation = false;
-    uniform_buffer = device.createBuffer(buffer_desc);
+    uniform_buffer = GpuMemory::create_buffer(device, buffer_desc);
 
     // Upload the initial value of the uniforms
-    uniforms.model = glm::mat4(1.0);
     uniforms.view = glm::lookAt(glm::vec3(-2.0f, -3.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0, 0, 1));
     uniforms.proj = glm::perspective(45 * PI / 180, 1280.0f / 720.0f, 0.01f, 100.0f);
     uniforms.time = 1.0f;
     uniforms.color = {0.0f, 1.0f, 0.4f, 1.0f};
-    queue.writeBuffer(uniform_buffer, 0, &uniforms, sizeof(MyUniforms));
+    uniforms.position_offset = glm::vec4(vertex_quantization.position_offset, 0.0f);
+    uniforms.position_scale = glm::vec4(vertex_quantization.position_scale, 0.0f);
+    uniforms.uv_offset_scale = glm::vec4(vertex_quantization.uv_offset, vertex_quantization.uv_scale);
+    uploader->upload_buffer(uniform_buffer, 0, &uniforms, sizeof(MyUniforms));
 
     update_view_matrix();
 
-    return uniform_buffer != nullptr;
+    // One MaterialUniforms per material and one for submeshes without material, at offsets the device can bind
+    SupportedLimits device_limits;
+    device.getLimits(&device_limits);
+    const uint32_t alignment = device_limits.limits.minUniformBufferOffsetAlignment;
+    material_uniform_stride = (sizeof(MaterialUniforms) + alignment - 1) / alignment * alignment;
+    buffer_desc.size = uint64_t(material_uniform_stride) * (materials.size() + 1);
+    material_uniform_buffer = GpuMemory::create_buffer(device, buffer_desc);
+    update_material_uniforms();
+
+    // A square grid of objects centered on the origin, the first one at the origin when alone
+    const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(object_count))));
+    const float grid_center = 0.5f * static_cast<float>(columns - 1) * object_spacing;
+    object_transforms.clear();
+    for (uint32_t i = 0; i < object_count; ++i)
+    {
+        glm::vec3 position = glm::vec3(static_cast<float>(i % columns), static_cast<float>(i / columns), 0.0f) * object_spacing;
+        object_transforms.push_back(glm::translate(glm::mat4(1.0f), position - glm::vec3(grid_center, grid_center, 0.0f)));
+    }
+    object_uniforms = std::make_unique<UniformArena>(device, static_cast<uint32_t>(sizeof(ObjectUniforms)), object_count);
+    if (instancing)
+    {
+        // Translations only, as the grid above
+        instances = std::make_unique<InstanceBuffer>(device, object_count);
+        for (const glm::mat4& transform : object_transforms)
+        {
+            InstanceBuffer::Instance instance;
+            instance.position_scale = glm::vec4(glm::vec3(transform[3]), 1.0f);
+            instances->add(instance);
+        }
+    }
+
+    return uniform_buffer != nullptr && material_uniform_buffer != nullptr && object_uniforms->buffer() != nullptr;
 }
 
 void Application::terminate_uniforms()
 {
-    uniform_buffer.destroy();
-    uniform_buffer.release();
+    object_offsets.clear();
+    object_transforms.clear();
+    instances.reset();
+    object_uniforms.reset();
+    GpuMemory::destroy(material_uniform_buffer);
+    GpuMemory::destroy(uniform_buffer);
+}
+
+MaterialUniforms Application::material_uniforms(int32_t material) const
+{
+    int32_t slot = material >= 0 ? material_texture_slots[material] : -1;
+    const MaterialTexture& material_texture = slot >= 0 ? material_textures[slot] : texture;
+    return {material_texture.slot.page, material_texture.slot.layer, material_texture.virtual_texture, 0};
+}
+
+MaterialShading Application::material_shading(int32_t material) const
+{
+    if (material >= 0 && materials[material].diffuse_texture.empty())
+        return MaterialShading::VertexColor;
+    int32_t slot = material >= 0 ? material_texture_slots[material] : -1;
+    const MaterialTexture& material_texture = slot >= 0 ? material_textures[slot] : texture;
+    return material_texture.virtual_texture != VirtualTextureCache::None ? MaterialShading::VirtualTexture : MaterialShading::PooledTexture;
+}
+
+void Application::update_draws()
+{
+    // Sort draws by shading then material, so that each pipeline and dynamic offset is set once whatever the submesh count
+    const uint32_t no_material = static_cast<uint32_t>(materials.size());
+    draws.clear();
+    depth_draws.clear();
+    for (uint32_t i = 0; i < submeshes.size(); ++i)
+    {
+        int32_t material = submeshes[i].material;
+        draws.push_back({i, material >= 0 ? static_cast<uint32_t>(material) : no_material, static_cast<uint32_t>(material_shading(material))});
+        // A single run, each object offset being set once
+        depth_draws.push_back({i, 0, 0});
+    }
+    std::stable_sort(draws.begin(), draws.end(), [](const DrawList::Draw& a, const DrawList::Draw& b) {
+        return a.shading != b.shading ? a.shading < b.shading : a.material < b.material;
+    });
+}
+
+void Application::update_material_uniforms()
+{
+    std::vector<uint8_t> data(material_uniform_buffer.getSize(), 0);
+    for (size_t i = 0; i <= materials.size(); ++i)
+    {
+        // The last entry is the one of submeshes without material
+        MaterialUniforms entry = material_uniforms(i < materials.size() ? static_cast<int32_t>(i) : -1);
+        memcpy(data.data() + i * material_uniform_stride, &entry, sizeof(MaterialUniforms));
+    }
+    uploader->upload_buffer(material_uniform_buffer, 0, data.data(), data.size());
+}
+
+void Application::update_object_uniforms()
+{
+    object_uniforms->reset();
+    if (instancing)
+    {
+        // The object bind group is set all the same, for the one draw of all instances
+        object_offsets = {object_uniforms->push(ObjectUniforms{glm::mat4(1.0f)})};
+        instances->upload(*uploader);
+    }
+    else
+    {
+        object_offsets.resize(object_transforms.size());
+        for (size_t i = 0; i < object_transforms.size(); ++i)
+        {
+            object_offsets[i] = object_uniforms->push(ObjectUniforms{object_transforms[i]});
+        }
+    }
+    object_uniforms->upload(*uploader);
+
+    if (object_uniforms->generation() != object_bind_group_generation)
+    {
+        object_bind_group.release();
+        object_bind_group = create_object_bind_group();
+        object_bind_group_generation = object_uniforms->generation();
+    }
 }
 
 bool Application::init_bind_group()
 {
     // Create a binding
-    std::vector<BindGroupEntry> bindings(3);
+    std::vector<BindGroupEntry> bindings(2);
 
     bindings[0].binding = 0;
     bindings[0].buffer = uniform_buffer;
@@ -604,10 +1377,7 @@ bool Application::init_bind_group()
     bindings[0].size = sizeof(MyUniforms);
 
     bindings[1].binding = 1;
-    bindings[1].textureView = texture_view;
-
-    bindings[2].binding = 2;
-    bindings[2].sampler = sampler;
+    bindings[1].sampler = sampler;
 
     BindGroupDescriptor bind_group_desc;
     bind_group_desc.layout = bind_group_layout;
@@ -615,14 +1385,545 @@ bool Application::init_bind_group()
     bind_group_desc.entries = bindings.data();
     bind_group = device.createBindGroup(bind_group_desc);
 
-    return bind_group != nullptr;
+    object_bind_group = create_object_bind_group();
+    object_bind_group_generation = object_uniforms->generation();
+    material_bind_group = create_material_bind_group();
+    // Both only ever increase, so their sum changes whenever either does
+    material_bind_group_generation = texture_pool->generation() + virtual_textures->generation();
+
+    update_draws();
+
+    return bind_group != nullptr && object_bind_group != nullptr && material_bind_group != nullptr;
+}
+
+BindGroup Application::create_object_bind_group()
+{
+    // Bound at the offset of each object in turn
+    BindGroupEntry binding;
+    binding.binding = 0;
+    binding.buffer = object_uniforms->buffer();
+    binding.offset = 0;
+    binding.size = sizeof(ObjectUniforms);
+
+    BindGroupDescriptor object_bind_group_desc;
+    object_bind_group_desc.layout = object_bind_group_layout;
+    object_bind_group_desc.entryCount = 1;
+    object_bind_group_desc.entries = &binding;
+    return device.createBindGroup(object_bind_group_desc);
+}
+
+BindGroup Application::create_material_bind_group()
+{
+    // Bindings past the pages in use repeat page 0, as every binding of the layout must be filled
+    std::vector<BindGroupEntry> bindings(TexturePool::MaxPages + 3);
+    for (uint32_t page = 0; page < TexturePool::MaxPages; ++page)
+    {
+        bindings[page].binding = page;
+        bindings[page].textureView = texture_pool->page_view(page);
+    }
+    BindGroupEntry& material_uniform_binding = bindings[TexturePool::MaxPages];
+    material_uniform_binding.binding = TexturePool::MaxPages;
+    material_uniform_binding.buffer = material_uniform_buffer;
+    material_uniform_binding.offset = 0;
+    material_uniform_binding.size = sizeof(MaterialUniforms);
+    bindings[TexturePool::MaxPages + 1].binding = TexturePool::MaxPages + 1;
+    bindings[TexturePool::MaxPages + 1].textureView = virtual_textures->atlas_view();
+    Buffer indirection_buffer = virtual_textures->indirection_buffer();
+    bindings[TexturePool::MaxPages + 2].binding = TexturePool::MaxPages + 2;
+    bindings[TexturePool::MaxPages + 2].buffer = indirection_buffer;
+    bindings[TexturePool::MaxPages + 2].offset = 0;
+    bindings[TexturePool::MaxPages + 2].size = indirection_buffer.getSize();
+
+    BindGroupDescriptor material_bind_group_desc;
+    material_bind_group_desc.layout = material_bind_group_layout;
+    material_bind_group_desc.entryCount = (uint32_t)bindings.size();
+    material_bind_group_desc.entries = bindings.data();
+    return device.createBindGroup(material_bind_group_desc);
+}
+
+void Application::load_texture_async(int32_t slot, bool restream)
+{
+    const bool cpu_mip_maps = !gpu_mip_generator || !gpu_mip_generator->is_valid();
+    // Albedo and diffuse maps are sRGB-encoded. Images encoded by the texture encoder tool load from their container.
+    const std::filesystem::path& path = (slot >= 0 ? material_textures[slot] : texture).path;
+    pending_textures.push_back({slot, ResourceManager::load_image_async(path, thread_pool, true, cpu_mip_maps, texture_compression_bc), restream});
+}
+
+void Application::update_pending_textures()
+{
+    bool textures_changed = false;
+    for (auto it = pending_textures.begin(); it != pending_textures.end();)
+    {
+        if (it->image.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++it;
+            continue;
+        }
+
+        ResourceManager::Image image = it->image.get();
+        MaterialTexture& material_texture = it->slot >= 0 ? material_textures[it->slot] : texture;
+        const uint32_t residency_key = static_cast<uint32_t>(it->slot + 1);
+        TexturePool::Slot loaded;
+        if (texture_pool->add(image, loaded, uploader.get()))
+        {
+            texture_pool->remove(material_texture.slot);
+            material_texture.slot = loaded;
+            if (it->restream)
+                residency->restreamed(residency_key, true);
+            else
+                residency->add(residency_key, texture_pool->bytes(loaded));
+            material_texture.full_shape = texture_pool->shape(loaded);
+            textures_changed = true;
+        }
+        else if (it->restream)
+        {
+            std::cerr << "Could not restream texture " << material_texture.path << ", keeping its evicted levels" << std::endl;
+            residency->restreamed(residency_key, false);
+            material_texture.full_shape = texture_pool->shape(material_texture.slot);
+        }
+        else if (it->slot >= 0)
+        {
+            std::cerr << "Could not load texture " << material_texture.path << ", using the default texture" << std::endl;
+            texture_pool->remove(material_texture.slot);
+            std::replace(material_texture_slots.begin(), material_texture_slots.end(), it->slot, -1);
+            textures_changed = true;
+        }
+        else
+        {
+            std::cerr << "Could not load texture " << material_texture.path << "!" << std::endl;
+        }
+        it = pending_textures.erase(it);
+    }
+
+    if (textures_changed)
+    {
+        trim_texture_pool();
+        update_material_uniforms();
+        update_draws();
+    }
+}
+
+void Application::update_virtual_textures()
+{
+    if (feedback_state == FeedbackState::Mapped)
+    {
+        const uint8_t* feedback = static_cast<const uint8_t*>(feedback_readback_buffer.getConstMappedRange(0, feedback_readback_buffer.getSize()));
+        std::unordered_set<uint32_t> pooled_textures;
+        for (uint32_t row = 0; row < feedback_height; ++row)
+        {
+            const uint32_t* values = reinterpret_cast<const uint32_t*>(feedback + size_t(row) * feedback_bytes_per_row);
+            virtual_textures->request(values, feedback_width);
+            for (uint32_t x = 0; x < feedback_width; ++x)
+            {
+                if (values[x] != VirtualTextureCache::None && (values[x] & VirtualTextureCache::PooledTexture) == VirtualTextureCache::PooledTexture)
+                    pooled_textures.insert(values[x]);
+            }
+        }
+        feedback_readback_buffer.unmap();
+        feedback_state = FeedbackState::Idle;
+
+        for (uint32_t value : pooled_textures)
+        {
+            TexturePool::Slot seen = {(value >> 16) & 0x3ff, value & 0xffff};
+            for (int32_t slot = -1; slot < static_cast<int32_t>(material_textures.size()); ++slot)
+            {
+                if ((slot >= 0 ? material_textures[slot] : texture).slot == seen)
+                    residency->touch(static_cast<uint32_t>(slot + 1));
+            }
+        }
+    }
+    virtual_textures->update(uploader.get());
+}
+
+void Application::update_residency()
+{
+    bool textures_changed = false;
+    auto evict = [&](uint32_t key) {
+        MaterialTexture& material_texture = key > 0 ? material_textures[key - 1] : texture;
+        TexturePool::Slot& slot = material_texture.slot;
+        if (std::min(texture_pool->width(slot), texture_pool->height(slot)) / 2 < residency_min_texture_size)
+            return false;
+        if (!texture_pool->demote(slot, 1, uploader.get()))
+            return false;
+
+        ResidencyManager::Stats stats = residency->stats();
+        std::cout << "Evicted texture " << material_texture.path << " down to " << texture_pool->width(slot) << "x" << texture_pool->height(slot)
+                  << " (" << (stats.usage >> 20) << " MB used, " << (stats.budget >> 20) << " MB budget)" << std::endl;
+        textures_changed = true;
+        return true;
+    };
+    auto restream = [&](uint32_t key) {
+        int32_t slot = static_cast<int32_t>(key) - 1;
+        std::cout << "Restreaming texture " << (slot >= 0 ? material_textures[slot] : texture).path << std::endl;
+        load_texture_async(slot, true);
+        return true;
+    };
+    auto bytes = [&](uint32_t key, bool restream) -> int64_t {
+        const MaterialTexture& material_texture = key > 0 ? material_textures[key - 1] : texture;
+        if (restream)
+            return texture_pool->replace_bytes(material_texture.full_shape, material_texture.slot);
+        return texture_pool->demote_bytes(material_texture.slot, 1);
+    };
+    residency->update(evict, restream, bytes);
+
+    if (textures_changed)
+    {
+        trim_texture_pool();
+        update_material_uniforms();
+    }
+}
+
+void Application::trim_texture_pool()
+{
+    std::vector<TexturePool::Move> moves;
+    texture_pool->trim(moves, uploader.get());
+    for (const TexturePool::Move& move : moves)
+    {
+        if (texture.slot == move.from)
+            texture.slot = move.to;
+        for (MaterialTexture& material_texture : material_textures)
+        {
+            if (material_texture.slot == move.from)
+                material_texture.slot = move.to;
+        }
+    }
+}
+
+void Application::update_material_bind_group()
+{
+    // A page of the texture pool was created or grew, or the virtual texture atlas or indirection was replaced
+    uint64_t generation = texture_pool->generation() + virtual_textures->generation();
+    if (generation != material_bind_group_generation)
+    {
+        material_bind_group.release();
+        material_bind_group = create_material_bind_group();
+        material_bind_group_generation = generation;
+    }
 }
 
 void Application::terminate_bind_group()
 {
+    material_bind_group.release();
+    object_bind_group.release();
+    draws.clear();
+    depth_draws.clear();
+    draw_list.clear();
+    depth_draw_list.clear();
     bind_group.release();
 }
 
+bool Application::init_meshlet_culling()
+{
+    // Streamed geometry has no meshlets, it is drawn as a whole
+    if (!meshlet_culling || meshlet_count == 0 || object_count != 1 || instancing)
+        return true;
+
+    std::cout << "Creating meshlet culling pipeline..." << std::endl;
+    cull_shader_module = shader_cache->load(RESOURCE_DIR "/cull.wgsl");
+    if (!cull_shader_module)
+        return false;
+
+    // Uniforms, meshlets, source indices, culled indices, draw arguments
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(5, Default);
+    for (uint32_t i = 0; i < binding_layout_entries.size(); ++i)
+    {
+        binding_layout_entries[i].binding = i;
+        binding_layout_entries[i].visibility = ShaderStage::Compute;
+    }
+    binding_layout_entries[0].buffer.type = BufferBindingType::Uniform;
+    binding_layout_entries[0].buffer.minBindingSize = sizeof(CullUniforms);
+    binding_layout_entries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+    binding_layout_entries[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+    binding_layout_entries[3].buffer.type = BufferBindingType::Storage;
+    binding_layout_entries[4].buffer.type = BufferBindingType::Storage;
+    binding_layout_entries[4].buffer.minBindingSize = sizeof(DrawIndexedIndirectArgs);
+
+    BindGroupLayoutDescriptor bind_group_layout_desc{};
+    bind_group_layout_desc.entryCount = (uint32_t)binding_layout_entries.size();
+    bind_group_layout_desc.entries = binding_layout_entries.data();
+    cull_bind_group_layout = device.createBindGroupLayout(bind_group_layout_desc);
+
+    PipelineLayoutDescriptor layout_desc{};
+    layout_desc.bindGroupLayoutCount = 1;
+    layout_desc.bindGroupLayouts = (WGPUBindGroupLayout*)&cull_bind_group_layout;
+    PipelineLayout layout = device.createPipelineLayout(layout_desc);
+
+    ComputePipelineDescriptor pipeline_desc;
+    pipeline_desc.layout = layout;
+    pipeline_desc.compute.module = cull_shader_module;
+    pipeline_desc.compute.entryPoint = "cs_main";
+    pipeline_desc.compute.constantCount = 0;
+    pipeline_desc.compute.constants = nullptr;
+    cull_pipeline = device.createComputePipeline(pipeline_desc);
+    layout.release();
+    std::cout << "Meshlet culling pipeline: " << cull_pipeline << std::endl;
+
+    // Buffers written by the culling pass, then read by the render pass
+    BufferDescriptor buffer_desc;
+    buffer_desc.mappedAtCreation = false;
+    buffer_desc.size = uint64_t(index_count) * sizeof(uint32_t);
+    buffer_desc.usage = BufferUsage::Storage | BufferUsage::Index;
+    culled_index_buffer = GpuMemory::create_buffer(device, buffer_desc);
+
+    // Each submesh is drawn from its own range of culled_index_buffer, which starts out empty every frame
+    draw_args_reset.clear();
+    for (const ResourceManager::Submesh& submesh : submeshes)
+    {
+        draw_args_reset.push_back({0, 1, submesh.first_index, 0, 0});
+    }
+    buffer_desc.size = draw_args_reset.size() * sizeof(DrawIndexedIndirectArgs);
+    buffer_desc.usage = BufferUsage::Storage | BufferUsage::Indirect | BufferUsage::CopyDst;
+    draw_args_buffer = GpuMemory::create_buffer(device, buffer_desc);
+
+    buffer_desc.size = sizeof(CullUniforms);
+    buffer_desc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+    cull_uniform_buffer = GpuMemory::create_buffer(device, buffer_desc);
+
+    std::vector<BindGroupEntry> bindings(5);
+    Buffer buffers[] = {cull_uniform_buffer, meshlet_buffer, index_buffer, culled_index_buffer, draw_args_buffer};
+    for (uint32_t i = 0; i < bindings.size(); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].buffer = buffers[i];
+        bindings[i].offset = 0;
+        bindings[i].size = buffers[i].getSize();
+    }
+
+    BindGroupDescriptor bind_group_desc;
+    bind_group_desc.layout = cull_bind_group_layout;
+    bind_group_desc.entryCount = (uint32_t)bindings.size();
+    bind_group_desc.entries = bindings.data();
+    cull_bind_group = device.createBindGroup(bind_group_desc);
+
+    return cull_pipeline != nullptr && cull_bind_group != nullptr;
+}
+
+void Application::terminate_meshlet_culling()
+{
+    if (!cull_pipeline)
+        return;
+
+    cull_bind_group.release();
+    GpuMemory::destroy(cull_uniform_buffer);
+    GpuMemory::destroy(draw_args_buffer);
+    GpuMemory::destroy(culled_index_buffer);
+    cull_pipeline.release();
+    cull_pipeline = nullptr;
+    cull_bind_group_layout.release();
+    cull_shader_module.release();
+}
+
+void Application::cull_meshlets(CommandEncoder& encoder)
+{
+    // Frustum planes in model space (Gribb & Hartmann), with a [0, 1] depth range
+    const glm::mat4& model = object_transforms[0];
+    glm::mat4 m = glm::transpose(uniforms.proj * uniforms.view * model);
+    glm::vec4 planes[6] = {m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[2], m[3] - m[2]};
+
+    CullUniforms cull_uniforms = {};
+    for (int i = 0; i < 6; ++i)
+        cull_uniforms.planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+    cull_uniforms.camera_position = glm::vec3(glm::inverse(uniforms.view * model)[3]);
+    cull_uniforms.meshlet_count = meshlet_count;
+    cull_uniforms.short_indices = index_format == IndexFormat::Uint16;
+    cull_uniforms.cone_culling = meshlet_cone_culling;
+    uploader->upload_buffer(cull_uniform_buffer, 0, &cull_uniforms, sizeof(CullUniforms));
+
+    // index_count is accumulated by the culling pass
+    uploader->upload_buffer(draw_args_buffer, 0, draw_args_reset.data(), draw_args_reset.size() * sizeof(DrawIndexedIndirectArgs));
+
+    ComputePassDescriptor compute_pass_desc;
+    compute_pass_desc.label = "Meshlet culling";
+    compute_pass_desc.timestampWrites = nullptr;
+    ComputePassEncoder compute_pass = encoder.beginComputePass(compute_pass_desc);
+    compute_pass.setPipeline(cull_pipeline);
+    compute_pass.setBindGroup(0, cull_bind_group, 0, nullptr);
+
+    // One workgroup per meshlet, wrapped into rows to stay within the default maxComputeWorkgroupsPerDimension
+    constexpr uint32_t max_groups_per_dimension = 65535;
+    uint32_t groups_x = std::min(meshlet_count, max_groups_per_dimension);
+    uint32_t groups_y = (meshlet_count + groups_x - 1) / groups_x;
+    compute_pass.dispatchWorkgroups(groups_x, groups_y, 1);
+
+    compute_pass.end();
+    compute_pass.release();
+}
+
+bool Application::init_object_culling()
+{
+    // Streamed geometry has no index buffer to draw indirectly
+    if (!object_culling || !instancing || !index_buffer)
+        return true;
+
+    std::cout << "Creating object culling pipelines..." << std::endl;
+    object_cull_shader_module = shader_cache->load(RESOURCE_DIR "/object-cull.wgsl");
+    if (!object_cull_shader_module)
+        return false;
+
+    // Uniforms, instances, visible instances, visible count, draw arguments
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(5, Default);
+    for (uint32_t i = 0; i < binding_layout_entries.size(); ++i)
+    {
+        binding_layout_entries[i].binding = i;
+        binding_layout_entries[i].visibility = ShaderStage::Compute;
+    }
+    binding_layout_entries[0].buffer.type = BufferBindingType::Uniform;
+    binding_layout_entries[0].buffer.minBindingSize = sizeof(ObjectCullUniforms);
+    binding_layout_entries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+    binding_layout_entries[2].buffer.type = BufferBindingType::Storage;
+    binding_layout_entries[3].buffer.type = BufferBindingType::Storage;
+    binding_layout_entries[3].buffer.minBindingSize = sizeof(uint32_t);
+    binding_layout_entries[4].buffer.type = BufferBindingType::Storage;
+    binding_layout_entries[4].buffer.minBindingSize = sizeof(DrawIndexedIndirectArgs);
+
+    BindGroupLayoutDescriptor bind_group_layout_desc{};
+    bind_group_layout_desc.entryCount = (uint32_t)binding_layout_entries.size();
+    bind_group_layout_desc.entries = binding_layout_entries.data();
+    object_cull_bind_group_layout = device.createBindGroupLayout(bind_group_layout_desc);
+
+    PipelineLayoutDescriptor layout_desc{};
+    layout_desc.bindGroupLayoutCount = 1;
+    layout_desc.bindGroupLayouts = (WGPUBindGroupLayout*)&object_cull_bind_group_layout;
+    PipelineLayout layout = device.createPipelineLayout(layout_desc);
+
+    // Both entry points share the bind group, the second one running once the first one counted the visible instances
+    ComputePipelineDescriptor pipeline_desc;
+    pipeline_desc.layout = layout;
+    pipeline_desc.compute.module = object_cull_shader_module;
+    pipeline_desc.compute.entryPoint = "cs_cull";
+    pipeline_desc.compute.constantCount = 0;
+    pipeline_desc.compute.constants = nullptr;
+    object_cull_pipeline = device.createComputePipeline(pipeline_desc);
+    pipeline_desc.compute.entryPoint = "cs_draw_args";
+    object_draw_args_pipeline = device.createComputePipeline(pipeline_desc);
+    layout.release();
+    std::cout << "Object culling pipeline: " << object_cull_pipeline << std::endl;
+
+    // Every submesh draws all the visible instances, their count being the only argument left to the GPU
+    std::vector<DrawIndexedIndirectArgs> draw_args;
+    for (const ResourceManager::Submesh& submesh : submeshes)
+    {
+        draw_args.push_back({submesh.index_count, 0, submesh.first_index, 0, 0});
+    }
+    BufferDescriptor buffer_desc;
+    buffer_desc.mappedAtCreation = false;
+    buffer_desc.size = draw_args.size() * sizeof(DrawIndexedIndirectArgs);
+    buffer_desc.usage = BufferUsage::Storage | BufferUsage::Indirect | BufferUsage::CopyDst;
+    object_draw_args_buffer = GpuMemory::create_buffer(device, buffer_desc);
+    uploader->upload_buffer(object_draw_args_buffer, 0, draw_args.data(), buffer_desc.size);
+
+    buffer_desc.size = sizeof(uint32_t);
+    buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+    visible_count_buffer = GpuMemory::create_buffer(device, buffer_desc);
+
+    buffer_desc.size = sizeof(ObjectCullUniforms);
+    buffer_desc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+    object_cull_uniform_buffer = GpuMemory::create_buffer(device, buffer_desc);
+
+    create_object_cull_bind_group();
+
+    return object_cull_pipeline != nullptr && object_draw_args_pipeline != nullptr && object_cull_bind_group != nullptr;
+}
+
+void Application::terminate_object_culling()
+{
+    if (!object_cull_pipeline)
+        return;
+
+    object_cull_bind_group.release();
+    GpuMemory::destroy(visible_instance_buffer);
+    GpuMemory::destroy(visible_count_buffer);
+    GpuMemory::destroy(object_draw_args_buffer);
+    GpuMemory::destroy(object_cull_uniform_buffer);
+    object_draw_args_pipeline.release();
+    object_cull_pipeline.release();
+    object_cull_pipeline = nullptr;
+    object_cull_bind_group_layout.release();
+    object_cull_shader_module.release();
+}
+
+void Application::create_object_cull_bind_group()
+{
+    if (object_cull_bind_group)
+        object_cull_bind_group.release();
+    // Destroyed once the draws already submitted with it complete
+    GpuMemory::destroy(visible_instance_buffer);
+
+    BufferDescriptor buffer_desc;
+    buffer_desc.label = "Visible instances";
+    buffer_desc.mappedAtCreation = false;
+    buffer_desc.size = uint64_t(instances->stats().capacity) * sizeof(InstanceBuffer::Instance);
+    buffer_desc.usage = BufferUsage::Storage | BufferUsage::Vertex;
+    visible_instance_buffer = GpuMemory::create_buffer(device, buffer_desc);
+
+    std::vector<BindGroupEntry> bindings(5);
+    Buffer buffers[] = {object_cull_uniform_buffer, instances->buffer(), visible_instance_buffer, visible_count_buffer,
+                        object_draw_args_buffer};
+    for (uint32_t i = 0; i < bindings.size(); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].buffer = buffers[i];
+        bindings[i].offset = 0;
+        bindings[i].size = buffers[i].getSize();
+    }
+
+    BindGroupDescriptor bind_group_desc;
+    bind_group_desc.layout = object_cull_bind_group_layout;
+    bind_group_desc.entryCount = (uint32_t)bindings.size();
+    bind_group_desc.entries = bindings.data();
+    object_cull_bind_group = device.createBindGroup(bind_group_desc);
+    object_cull_bind_group_generation = instances->generation();
+}
+
+void Application::cull_objects(CommandEncoder& encoder)
+{
+    // The instances uploaded this frame may have moved to a bigger buffer
+    if (instances->generation() != object_cull_bind_group_generation)
+        create_object_cull_bind_group();
+
+    // Frustum planes in world space (Gribb & Hartmann), with a [0, 1] depth range
+    glm::mat4 m = glm::transpose(uniforms.proj * uniforms.view);
+    glm::vec4 planes[6] = {m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[2], m[3] - m[2]};
+
+    ObjectCullUniforms cull_uniforms = {};
+    for (int i = 0; i < 6; ++i)
+        cull_uniforms.planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+    cull_uniforms.bounds_center = bounds_center;
+    cull_uniforms.bounds_radius = bounds_radius;
+    cull_uniforms.instance_count = instances->size();
+    cull_uniforms.submesh_count = static_cast<uint32_t>(submeshes.size());
+    uploader->upload_buffer(object_cull_uniform_buffer, 0, &cull_uniforms, sizeof(ObjectCullUniforms));
+
+    // Counted up by the culling pass
+    const uint32_t visible_count = 0;
+    uploader->upload_buffer(visible_count_buffer, 0, &visible_count, sizeof(uint32_t));
+
+    ComputePassDescriptor compute_pass_desc;
+    compute_pass_desc.label = "Object culling";
+    compute_pass_desc.timestampWrites = nullptr;
+    ComputePassEncoder compute_pass = encoder.beginComputePass(compute_pass_desc);
+    compute_pass.setBindGroup(0, object_cull_bind_group, 0, nullptr);
+
+    // One invocation per instance, workgroups wrapped into rows to stay within the default maxComputeWorkgroupsPerDimension
+    constexpr uint32_t workgroup_size = 64;
+    constexpr uint32_t max_groups_per_dimension = 65535;
+    const uint32_t group_count = (instances->size() + workgroup_size - 1) / workgroup_size;
+    if (group_count > 0)
+    {
+        uint32_t groups_x = std::min(group_count, max_groups_per_dimension);
+        uint32_t groups_y = (group_count + groups_x - 1) / groups_x;
+        compute_pass.setPipeline(object_cull_pipeline);
+        compute_pass.dispatchWorkgroups(groups_x, groups_y, 1);
+    }
+
+    // Storage written by a dispatch is visible to the next one
+    compute_pass.setPipeline(object_draw_args_pipeline);
+    compute_pass.dispatchWorkgroups((cull_uniforms.submesh_count + workgroup_size - 1) / workgroup_size, 1, 1);
+
+    compute_pass.end();
+    compute_pass.release();
+}
+
 void Application::update_projection_matrix()
 {
     int width, height;
@@ -632,7 +1933,7 @@ void Application::update_projection_matrix()
         return;
     float ratio = width / (float)height;
     uniforms.proj = glm::perspective(45 * PI / 180, ratio, 0.01f, 100.0f);
-    queue.writeBuffer(uniform_buffer, offsetof(MyUniforms, proj), &uniforms.proj, sizeof(MyUniforms::proj));
+    uploader->upload_buffer(uniform_buffer, offsetof(MyUniforms, proj), &uniforms.proj, sizeof(MyUniforms::proj));
 }
 
 void Application::update_view_matrix()
@@ -643,7 +1944,7 @@ void Application::update_view_matrix()
     float sy = sin(camera_state.angles.y);
     glm::vec3 position = glm::vec3(cx * cy, sx * cy, sy) * std::exp(-camera_state.zoom);
     uniforms.view = glm::lookAt(position, glm::vec3(0.0f), glm::vec3(0, 0, 1));
-    queue.writeBuffer(uniform_buffer, offsetof(MyUniforms, view), &uniforms.view, sizeof(MyUniforms::view));
+    uploader->upload_buffer(uniform_buffer, offsetof(MyUniforms, view), &uniforms.view, sizeof(MyUniforms::view));
 }
 
 void Application::update_drag_inertia()
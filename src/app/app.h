@@ -2,23 +2,108 @@
 
 #include <webgpu/webgpu.hpp>
 
+#include "../util/thread-pool.h"
+#include "../util/resource-manager.h"
+#include "../util/mesh-cache.h"
+#include "../util/gpu-mip-generator.h"
+#include "../util/staging-uploader.h"
+#include "../util/texture-pool.h"
+#include "../util/virtual-texture-cache.h"
+#include "../util/residency-manager.h"
+#include "../util/shader-cache.h"
+#include "../util/file-watcher.h"
+#include "../util/pipeline-cache.h"
+#include "../util/startup-graph.h"
+#include "../util/uniform-arena.h"
+#include "../util/instance-buffer.h"
+#include "../util/draw-list.h"
+
+#include <array>
+
 using namespace wgpu;
 
 struct GLFWwindow;
 
 // The same structure as in the shader, replicated in C++
+// Per frame: the camera, and what every object shares
 struct MyUniforms
 {
     glm::mat4 proj;
     glm::mat4 view;
-    glm::mat4 model;
     glm::vec4 color;
+    // Decoding of quantized vertices (see ResourceManager::VertexQuantization)
+    glm::vec4 position_offset; // xyz
+    glm::vec4 position_scale;  // xyz
+    glm::vec4 uv_offset_scale; // xy: offset, zw: scale
     float time;
     float _pad[3];
 };
 // Have the compiler check byte alignment
 static_assert(sizeof(MyUniforms) % 16 == 0);
 
+// The same structure as in the shader, per object at its dynamic offset in the object uniform arena
+struct ObjectUniforms
+{
+    glm::mat4 model;
+};
+static_assert(sizeof(ObjectUniforms) % 16 == 0);
+
+// The same structure as in the shader: where the texture of a material lives, in the texture pool or the virtual texture cache
+struct MaterialUniforms
+{
+    uint32_t page;
+    uint32_t layer;
+    // Offset of the virtual texture in the indirection buffer, VirtualTextureCache::None for pooled textures
+    uint32_t virtual_texture;
+    uint32_t _pad;
+};
+static_assert(sizeof(MaterialUniforms) % 16 == 0);
+
+// How the main pass colors a material, each by its own specialization of the render pipelines (the materialShading
+// override constant of shader.wgsl), so that no draw branches on it at runtime
+enum class MaterialShading : uint32_t
+{
+    // Materials without texture
+    VertexColor,
+    PooledTexture,
+    VirtualTexture,
+};
+constexpr uint32_t MaterialShadingCount = 3;
+
+// The same structure as in cull.wgsl
+struct CullUniforms
+{
+    glm::vec4 planes[6];
+    glm::vec3 camera_position;
+    uint32_t meshlet_count;
+    uint32_t short_indices;
+    uint32_t cone_culling;
+    uint32_t _pad[2];
+};
+static_assert(sizeof(CullUniforms) % 16 == 0);
+
+// The same structure as in object-cull.wgsl
+struct ObjectCullUniforms
+{
+    glm::vec4 planes[6];
+    glm::vec3 bounds_center;
+    float bounds_radius;
+    uint32_t instance_count;
+    uint32_t submesh_count;
+    uint32_t _pad[2];
+};
+static_assert(sizeof(ObjectCullUniforms) % 16 == 0);
+
+// Layout of the arguments of drawIndexedIndirect
+struct DrawIndexedIndirectArgs
+{
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t base_vertex;
+    uint32_t first_instance;
+};
+
 struct CameraState
 {
     // angles.x is the rotation of the camera around the global vertical axis, affected by mouse.x
@@ -79,12 +164,27 @@ class Application
     bool init_depth_buffer();
     void terminate_depth_buffer();
 
+    bool init_feedback_buffer();
+    void terminate_feedback_buffer();
+
+    // Preprocess shader.wgsl on a worker, while the device is created
+    bool load_shader();
     bool init_render_pipeline();
     void terminate_render_pipeline();
+    // Names defined for the preprocessing of shader.wgsl
+    ShaderPreprocessor::Defines shader_defines() const;
+    struct PipelineReload;
+    // Describe the render pipelines of a shader module to the pipeline cache, every MaterialShading specialization of
+    // them: into their members, or on the side into a reload, where they are compiled in the background
+    void create_render_pipelines(ShaderModule module, PipelineReload* reload);
+    // Rebuild the render pipelines without blocking once shader.wgsl changes, and swap them in when all are ready
+    void update_shader_reload();
 
     bool init_texture();
     void terminate_texture();
 
+    // Open or bake the mesh cache on a worker, while the device is created
+    bool load_mesh();
     bool init_geometry();
     void terminate_geometry();
 
@@ -93,6 +193,49 @@ class Application
 
     bool init_bind_group();
     void terminate_bind_group();
+    BindGroup create_material_bind_group();
+    BindGroup create_object_bind_group();
+
+    // Where the texture of a material is, -1 standing for submeshes without material
+    MaterialUniforms material_uniforms(int32_t material) const;
+    MaterialShading material_shading(int32_t material) const;
+    // Rebuild the draws, again once a texture falls back to the default one as its shading may change
+    void update_draws();
+    // Upload the MaterialUniforms of every material
+    void update_material_uniforms();
+    // Upload the ObjectUniforms of every object for the frame, with a single copy, or the instances that changed
+    void update_object_uniforms();
+    // Rebuild the material bind group if the texture pool or the virtual texture cache replaced a resource it holds
+    void update_material_bind_group();
+
+    // Decode the image of a material texture on the thread pool (index in material_textures, -1 for the default
+    // texture), to be swapped in by update_pending_textures
+    void load_texture_async(int32_t slot, bool restream = false);
+    // Swap the textures whose image finished decoding in for their placeholder, or for their evicted levels
+    void update_pending_textures();
+
+    // Request the tiles seen by the last feedback pass read back, mark the pooled textures it saw as used, and
+    // stream tiles into the virtual texture atlas
+    void update_virtual_textures();
+
+    // Evict or restream a texture if GPU memory is over or well under budget
+    void update_residency();
+    // Give the memory of the layers freed in the texture pool back, and follow the textures it moves
+    void trim_texture_pool();
+
+    bool init_meshlet_culling();
+    void terminate_meshlet_culling();
+
+    // Record the compute pass filling culled_index_buffer and draw_args_buffer for this frame
+    void cull_meshlets(CommandEncoder& encoder);
+
+    bool init_object_culling();
+    void terminate_object_culling();
+    // Size visible_instance_buffer for the capacity of the instance buffer, and bind both
+    void create_object_cull_bind_group();
+
+    // Record the compute pass filling visible_instance_buffer and object_draw_args_buffer for this frame
+    void cull_objects(CommandEncoder& encoder);
 
     // Camera Related
     void update_projection_matrix();
@@ -107,9 +250,14 @@ class Application
     Device device = nullptr;
     Queue queue = nullptr;
     TextureFormat swap_chain_format = TextureFormat::Undefined;
+    // Every upload goes through it, and is submitted ahead of the commands of the frame
+    std::unique_ptr<StagingUploader> uploader;
     // Keep the error callback alive
     std::unique_ptr<ErrorCallback> error_callback_handle;
 
+    // Workers for CPU-heavy loading
+    ThreadPool thread_pool;
+
     // Camera
     CameraState camera_state;
     DragState drag;
@@ -122,24 +270,209 @@ class Application
     Texture depth_texture = nullptr;
     TextureView depth_texture_view = nullptr;
 
+    // Virtual Texture Feedback
+    // Rendered at 1/feedback_divisor of the window resolution
+    uint32_t feedback_divisor = 8;
+    uint32_t feedback_width = 0;
+    uint32_t feedback_height = 0;
+    Texture feedback_texture = nullptr;
+    TextureView feedback_texture_view = nullptr;
+    Texture feedback_depth_texture = nullptr;
+    TextureView feedback_depth_texture_view = nullptr;
+    // The feedback of one frame at a time is copied to the readback buffer, and read once mapped
+    Buffer feedback_readback_buffer = nullptr;
+    uint32_t feedback_bytes_per_row = 0;
+    enum class FeedbackState
+    {
+        Idle,
+        Copied,
+        Mapping,
+        Mapped,
+    };
+    FeedbackState feedback_state = FeedbackState::Idle;
+    std::unique_ptr<BufferMapCallback> feedback_map_callback;
+
     // Render Pipeline
+    // Owned by the pipeline cache, as are object_bind_group_layout and material_bind_group_layout
     BindGroupLayout bind_group_layout = nullptr;
+    PipelineLayout pipeline_layout = nullptr;
+    PipelineLayout depth_pipeline_layout = nullptr;
+    // Every shader module goes through it, so that unchanged sources are compiled once
+    std::unique_ptr<ShaderCache> shader_cache;
+    // Every render pipeline goes through it, compiled on first draw unless the previous run drew with it
+    std::unique_ptr<PipelineCache> pipeline_cache;
     ShaderModule shader_module = nullptr;
-    RenderPipeline pipeline = nullptr;
+    // From load_shader to init_render_pipeline
+    std::string startup_shader_source;
+    std::vector<std::filesystem::path> startup_shader_files;
+    // Keys into the pipeline cache, indexed by MaterialShading
+    std::array<PipelineCache::Key, MaterialShadingCount> pipeline_keys{};
+    // Shade with two directional lights (the lit override constant of shader.wgsl)
+    bool lighting = false;
+    // Lay down depth with positions only before shading, so that each pixel is shaded once.
+    // Best with the Split vertex layout, where this pass only fetches the position stream.
+    bool depth_prepass = false;
+    PipelineCache::Key depth_pipeline_key = 0;
+    // Write the virtual texture tile each pixel samples (fs_feedback), indexed by MaterialShading
+    std::array<PipelineCache::Key, MaterialShadingCount> feedback_pipeline_keys{};
+    // Rebuild the pipelines when shader.wgsl is saved, while the previous ones keep drawing
+    bool shader_hot_reload = true;
+    FileWatcher shader_watcher;
+    struct PipelineReload
+    {
+        ShaderModule shader_module = nullptr;
+        std::array<PipelineCache::Key, MaterialShadingCount> pipeline_keys{};
+        std::array<PipelineCache::Key, MaterialShadingCount> feedback_pipeline_keys{};
+        PipelineCache::Key depth_pipeline_key = 0;
+        // Every key above, to wait for
+        std::vector<PipelineCache::Key> keys;
+    };
+    std::unique_ptr<PipelineReload> pipeline_reload;
 
     // Texture
+    // Build mip chains on the GPU rather than on the main thread
+    bool gpu_mip_maps = true;
+    // Whether the device samples BC textures, otherwise texture containers are transcoded to RGBA8 as they load
+    bool texture_compression_bc = false;
+    std::unique_ptr<GpuMipGenerator> gpu_mip_generator;
     Sampler sampler = nullptr;
-    Texture texture = nullptr;
-    TextureView texture_view = nullptr;
+    // Every texture, packed into the texture array pages the material bind group holds
+    std::unique_ptr<TexturePool> texture_pool;
+    // Textures baked as tiled textures (see TiledTexture) are streamed through the virtual texture cache instead,
+    // whatever their size, from what the feedback pass sees
+    bool virtual_texturing = true;
+    std::unique_ptr<VirtualTextureCache> virtual_textures;
+    struct MaterialTexture
+    {
+        // Source image, loaded again to restream the texture after an eviction
+        std::filesystem::path path;
+        TexturePool::Slot slot;
+        // Page shape of the texture at full resolution, for what restreaming it would cost
+        TexturePool::Shape full_shape;
+        // Offset of the texture in the indirection buffer of the cache if virtual
+        uint32_t virtual_texture = VirtualTextureCache::None;
+    };
+    // Used by materials without a (loadable) texture
+    MaterialTexture texture;
+    // Material textures, loaded once per distinct file
+    std::vector<MaterialTexture> material_textures;
+    // Index in material_textures of the texture of each material, -1 for the default texture
+    std::vector<int32_t> material_texture_slots;
+    // Textures decoding on the thread pool, whose slot holds a 1x1 placeholder in the meantime
+    // (or the lower levels it was evicted to, when restreamed)
+    struct PendingTexture
+    {
+        // Index in material_textures, -1 for the default texture
+        int32_t slot;
+        std::future<ResourceManager::Image> image;
+        bool restream = false;
+    };
+    std::vector<PendingTexture> pending_textures;
+
+    // GPU Memory Budget
+    // Over it, the least recently seen pooled textures lose their finest levels, down to residency_min_texture_size
+    uint64_t gpu_memory_budget = uint64_t(256) << 20;
+    uint32_t residency_min_texture_size = 128;
+    // Keyed by index in material_textures + 1, 0 for the default texture
+    std::unique_ptr<ResidencyManager> residency;
 
     // Geometry
+    // Host memory the streaming upload may use for vertex data
+    uint64_t geometry_staging_budget = 64 << 20;
+    // OBJ files from this size on are streamed to the GPU rather than loaded whole (unless already cached). Loading a
+    // file whole takes a few times its size in host memory, streaming it the staging budget plus its attribute pools.
+    uint64_t geometry_streaming_threshold = uint64_t(GEOMETRY_STREAMING_THRESHOLD_MB) << 20;
+    // How the cached mesh is baked, streamed meshes always use Float32 vertices and are not optimized
+    ResourceManager::GeometryOptions geometry_options;
+    // From load_mesh to init_geometry, null when the mesh is streamed
+    std::unique_ptr<MeshCache> startup_mesh;
+    ResourceManager::VertexQuantization vertex_quantization;
     Buffer vertex_buffer = nullptr;
     int vertex_count = 0;
+    // With the Split layout, the bytes of vertex_buffer holding positions (bound to slot 0, the rest to slot 1)
+    uint64_t position_stream_size = 0;
+    Buffer index_buffer = nullptr;
+    IndexFormat index_format = IndexFormat::Undefined;
+    uint32_t index_count = 0;
+    // Bounding sphere of the mesh in model space
+    glm::vec3 bounds_center = {0.0f, 0.0f, 0.0f};
+    float bounds_radius = 0.0f;
+    // Ranges of the index buffer (of the vertex buffer for streamed geometry) per material
+    std::vector<ResourceManager::Submesh> submeshes;
+    std::vector<ResourceManager::Material> materials;
 
     // Uniforms
     Buffer uniform_buffer = nullptr;
     MyUniforms uniforms;
+    // Copies of the mesh on a grid, object_spacing apart, each drawn with a transform of its own
+    uint32_t object_count = 1;
+    float object_spacing = 1.5f;
+    std::vector<glm::mat4> object_transforms;
+    // Their ObjectUniforms, pushed again every frame, and the dynamic offset of each
+    std::unique_ptr<UniformArena> object_uniforms;
+    std::vector<uint32_t> object_offsets;
+    // Draw the objects as instances of the mesh instead, all of them in one draw per submesh, their transforms read
+    // from an instance buffer (the INSTANCING path of shader.wgsl) and uploaded when they change only
+    bool instancing = false;
+    std::unique_ptr<InstanceBuffer> instances;
+    // One MaterialUniforms per material followed by the one of submeshes without material,
+    // material_uniform_stride bytes apart to be selected by dynamic offset
+    Buffer material_uniform_buffer = nullptr;
+    uint32_t material_uniform_stride = 0;
 
     // Bind Group
+    BindGroupLayout object_bind_group_layout = nullptr;
+    BindGroupLayout material_bind_group_layout = nullptr;
     BindGroup bind_group = nullptr;
+    // Shared by all objects, which only differ by their dynamic offset in the object uniform arena.
+    // Rebuilt when the arena grows.
+    BindGroup object_bind_group = nullptr;
+    uint32_t object_bind_group_generation = 0;
+    // Shared by all materials, which only differ by their dynamic offset in material_uniform_buffer.
+    // Rebuilt when the texture pool replaces a page view.
+    BindGroup material_bind_group = nullptr;
+    uint64_t material_bind_group_generation = 0;
+
+    // Submesh draws, sorted by shading then material so that each pipeline and dynamic offset is set only once per pass,
+    // and those of the depth prepass, where materials do not matter
+    std::vector<DrawList::Draw> draws;
+    std::vector<DrawList::Draw> depth_draws;
+    // Their commands for the objects of the frame
+    DrawList draw_list;
+    DrawList depth_draw_list;
+
+    // Meshlet Culling
+    // With a single object only, whose model space the meshlets are culled in, and without instancing
+    bool meshlet_culling = true;
+    // Only correct when back faces are never visible, which the render pipeline does not ensure (CullMode::None)
+    bool meshlet_cone_culling = false;
+    uint32_t meshlet_count = 0;
+    Buffer meshlet_buffer = nullptr;
+    Buffer culled_index_buffer = nullptr;
+    // One DrawIndexedIndirectArgs per submesh, and their value at the start of a frame
+    Buffer draw_args_buffer = nullptr;
+    std::vector<DrawIndexedIndirectArgs> draw_args_reset;
+    Buffer cull_uniform_buffer = nullptr;
+    ShaderModule cull_shader_module = nullptr;
+    BindGroupLayout cull_bind_group_layout = nullptr;
+    ComputePipeline cull_pipeline = nullptr;
+    BindGroup cull_bind_group = nullptr;
+
+    // Object Culling
+    // With instancing, cull the instances against the frustum on the GPU and draw the visible ones with one indirect
+    // draw per submesh, so that the CPU work of a frame does not depend on the instance count
+    bool object_culling = true;
+    // Records of the visible instances, compacted in no particular order, bound instead of the instance buffer
+    Buffer visible_instance_buffer = nullptr;
+    Buffer visible_count_buffer = nullptr;
+    // One DrawIndexedIndirectArgs per submesh, of which the culling pass writes instance_count only
+    Buffer object_draw_args_buffer = nullptr;
+    Buffer object_cull_uniform_buffer = nullptr;
+    ShaderModule object_cull_shader_module = nullptr;
+    BindGroupLayout object_cull_bind_group_layout = nullptr;
+    ComputePipeline object_cull_pipeline = nullptr;
+    ComputePipeline object_draw_args_pipeline = nullptr;
+    // Rebuilt when the instance buffer grows
+    BindGroup object_cull_bind_group = nullptr;
+    uint32_t object_cull_bind_group_generation = 0;
 };
\ No newline at end of file
@@ -0,0 +1,65 @@
+#include "draw-list.h"
+
+void DrawList::build(const std::vector<Draw>& draws, const std::vector<uint32_t>& object_offsets)
+{
+    clear();
+
+    uint32_t current_shading = ~0u;
+    uint32_t current_material = ~0u;
+    uint32_t current_offset = ~0u;
+    for (size_t first = 0; first < draws.size();)
+    {
+        // The run of draws sharing the shading and material of the first one
+        size_t last = first + 1;
+        while (last < draws.size() && draws[last].shading == draws[first].shading && draws[last].material == draws[first].material)
+            ++last;
+
+        if (draws[first].shading != current_shading)
+        {
+            current_shading = draws[first].shading;
+            push(CommandType::SetPipeline, current_shading);
+        }
+        if (draws[first].material != current_material)
+        {
+            current_material = draws[first].material;
+            push(CommandType::SetMaterial, current_material);
+        }
+        for (uint32_t offset : object_offsets)
+        {
+            if (offset != current_offset)
+            {
+                current_offset = offset;
+                push(CommandType::SetObject, offset);
+            }
+            for (size_t i = first; i < last; ++i)
+                push(CommandType::Draw, draws[i].submesh);
+        }
+        first = last;
+    }
+}
+
+void DrawList::clear()
+{
+    list.clear();
+    counters = {};
+}
+
+void DrawList::push(CommandType type, uint32_t value)
+{
+    list.push_back({type, value});
+    switch (type)
+    {
+    case CommandType::SetPipeline:
+        ++counters.pipeline_count;
+        break;
+    case CommandType::SetMaterial:
+        ++counters.material_bind_count;
+        break;
+    case CommandType::SetObject:
+        ++counters.object_bind_count;
+        break;
+    case CommandType::Draw:
+        ++counters.draw_count;
+        break;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// The commands of a pass drawing the submeshes of a mesh once per object, built on the CPU so that they can be
+// replayed into any render pass, and counted without a GPU. Submeshes of the same shading and material form a run:
+// its pipeline and material offset are set once, and each object offset once for the whole run rather than per
+// submesh. An offset that did not change is not set again, so with a single offset (one object, or instancing, where
+// the instance buffer holds the transforms) the object bind group is set once per pass.
+class DrawList
+{
+  public:
+    struct Draw
+    {
+        uint32_t submesh;
+        // Index of its MaterialUniforms
+        uint32_t material;
+        // Index of its pipeline specialization
+        uint32_t shading;
+    };
+
+    enum class CommandType : uint8_t
+    {
+        // value: shading
+        SetPipeline,
+        // value: material
+        SetMaterial,
+        // value: dynamic offset of the object uniforms
+        SetObject,
+        // value: submesh
+        Draw,
+    };
+
+    struct Command
+    {
+        CommandType type;
+        uint32_t value;
+    };
+
+    struct Stats
+    {
+        // Of the last build, that is of one pass
+        uint32_t pipeline_count = 0;
+        uint32_t material_bind_count = 0;
+        uint32_t object_bind_count = 0;
+        uint32_t draw_count = 0;
+    };
+
+    // Replace the commands with those drawing draws (sorted by shading then material) for each object offset
+    void build(const std::vector<Draw>& draws, const std::vector<uint32_t>& object_offsets);
+    void clear();
+
+    const std::vector<Command>& commands() const { return list; }
+    const Stats& stats() const { return counters; }
+
+  private:
+    void push(CommandType type, uint32_t value);
+
+    std::vector<Command> list;
+    Stats counters;
+};
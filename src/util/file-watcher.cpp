@@ -0,0 +1,34 @@
+#include "file-watcher.h"
+
+#include <algorithm>
+
+void FileWatcher::watch(const path& path)
+{
+    std::error_code ec;
+    auto last_write_time = std::filesystem::last_write_time(path, ec);
+    auto it = std::find_if(files.begin(), files.end(), [&](const File& file) { return file.file_path == path; });
+    if (it != files.end())
+        it->last_write_time = last_write_time;
+    else
+        files.push_back({path, last_write_time});
+}
+
+std::vector<FileWatcher::path> FileWatcher::poll()
+{
+    std::vector<path> changed;
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_poll < interval)
+        return changed;
+    last_poll = now;
+
+    for (File& file : files)
+    {
+        std::error_code ec;
+        auto last_write_time = std::filesystem::last_write_time(file.file_path, ec);
+        if (ec || last_write_time == file.last_write_time)
+            continue;
+        file.last_write_time = last_write_time;
+        changed.push_back(file.file_path);
+    }
+    return changed;
+}
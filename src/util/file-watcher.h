@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+// Tells which of a set of files were written to, by polling their modification time. Meant to be polled every
+// frame: the files are only looked at once per interval, the other polls returning nothing.
+class FileWatcher
+{
+  public:
+    using path = std::filesystem::path;
+
+    explicit FileWatcher(std::chrono::milliseconds interval = std::chrono::milliseconds(250)) : interval(interval) {}
+
+    // Watch a file (again) from its current modification time
+    void watch(const path& path);
+
+    // Files modified since they were watched or last returned. Files missing for now, e.g. while an editor saves
+    // them by replacing them, are returned once they are back.
+    std::vector<path> poll();
+
+  private:
+    struct File
+    {
+        path file_path;
+        std::filesystem::file_time_type last_write_time;
+    };
+
+    std::chrono::milliseconds interval;
+    std::chrono::steady_clock::time_point last_poll;
+    std::vector<File> files;
+};
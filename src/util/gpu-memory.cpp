@@ -0,0 +1,152 @@
+#include "gpu-memory.h"
+#include "mip-generator.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+using namespace wgpu;
+
+// Size of every live texture and buffer, by handle
+struct Allocations
+{
+    std::mutex mutex;
+    std::unordered_map<const void*, uint64_t> textures;
+    std::unordered_map<const void*, uint64_t> buffers;
+    GpuMemory::Stats stats;
+};
+
+static Allocations& allocations()
+{
+    static Allocations allocations;
+    return allocations;
+}
+
+static void track(std::unordered_map<const void*, uint64_t>& sizes, uint64_t& bytes, uint32_t& count, const void* handle, uint64_t size)
+{
+    Allocations& all = allocations();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    if (!sizes.emplace(handle, size).second)
+        return;
+    bytes += size;
+    ++count;
+    all.stats.peak_bytes = std::max(all.stats.peak_bytes, all.stats.usage());
+}
+
+static void untrack(std::unordered_map<const void*, uint64_t>& sizes, uint64_t& bytes, uint32_t& count, const void* handle)
+{
+    Allocations& all = allocations();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    auto it = sizes.find(handle);
+    if (it == sizes.end())
+        return;
+    bytes -= it->second;
+    --count;
+    sizes.erase(it);
+}
+
+Texture GpuMemory::create_texture(Device device, const TextureDescriptor& descriptor)
+{
+    Texture texture = device.createTexture(descriptor);
+    if (texture)
+    {
+        Allocations& all = allocations();
+        track(all.textures, all.stats.texture_bytes, all.stats.texture_count, static_cast<WGPUTexture>(texture), texture_size(descriptor));
+    }
+    return texture;
+}
+
+Buffer GpuMemory::create_buffer(Device device, const BufferDescriptor& descriptor)
+{
+    Buffer buffer = device.createBuffer(descriptor);
+    if (buffer)
+    {
+        Allocations& all = allocations();
+        track(all.buffers, all.stats.buffer_bytes, all.stats.buffer_count, static_cast<WGPUBuffer>(buffer), descriptor.size);
+    }
+    return buffer;
+}
+
+void GpuMemory::destroy(Texture& texture)
+{
+    if (!texture)
+        return;
+    Allocations& all = allocations();
+    untrack(all.textures, all.stats.texture_bytes, all.stats.texture_count, static_cast<WGPUTexture>(texture));
+    texture.destroy();
+    texture.release();
+    texture = nullptr;
+}
+
+void GpuMemory::destroy(Buffer& buffer)
+{
+    if (!buffer)
+        return;
+    Allocations& all = allocations();
+    untrack(all.buffers, all.stats.buffer_bytes, all.stats.buffer_count, static_cast<WGPUBuffer>(buffer));
+    buffer.destroy();
+    buffer.release();
+    buffer = nullptr;
+}
+
+void GpuMemory::block_layout(TextureFormat format, uint32_t& block_size, uint32_t& block_bytes)
+{
+    block_size = 1;
+    switch (format)
+    {
+    case TextureFormat::R8Unorm:
+        block_bytes = 1;
+        break;
+    case TextureFormat::RG8Unorm:
+    case TextureFormat::R16Float:
+        block_bytes = 2;
+        break;
+    case TextureFormat::RGBA16Float:
+    case TextureFormat::RG32Float:
+        block_bytes = 8;
+        break;
+    case TextureFormat::RGBA32Float:
+        block_bytes = 16;
+        break;
+    case TextureFormat::BC1RGBAUnorm:
+    case TextureFormat::BC1RGBAUnormSrgb:
+        block_size = 4;
+        block_bytes = 8;
+        break;
+    case TextureFormat::BC3RGBAUnorm:
+    case TextureFormat::BC3RGBAUnormSrgb:
+    case TextureFormat::BC7RGBAUnorm:
+    case TextureFormat::BC7RGBAUnormSrgb:
+        block_size = 4;
+        block_bytes = 16;
+        break;
+    default:
+        // RGBA8, BGRA8, 32-bit single channel and depth formats
+        block_bytes = 4;
+        break;
+    }
+}
+
+uint64_t GpuMemory::texture_size(const TextureDescriptor& descriptor)
+{
+    uint32_t block_size, block_bytes;
+    block_layout(descriptor.format, block_size, block_bytes);
+    uint64_t size = 0;
+    for (uint32_t level = 0; level < descriptor.mipLevelCount; ++level)
+    {
+        uint64_t block_columns = (MipGenerator::level_size(descriptor.size.width, level) + block_size - 1) / block_size;
+        uint64_t block_rows = (MipGenerator::level_size(descriptor.size.height, level) + block_size - 1) / block_size;
+        // Array layers stay the same at every level, depth slices of 3D textures do not
+        uint64_t layers = descriptor.dimension == TextureDimension::_3D ? MipGenerator::level_size(descriptor.size.depthOrArrayLayers, level)
+                                                                       : descriptor.size.depthOrArrayLayers;
+        size += block_bytes * block_columns * block_rows * layers;
+    }
+    return size * descriptor.sampleCount;
+}
+
+GpuMemory::Stats GpuMemory::stats()
+{
+    Allocations& all = allocations();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    return all.stats;
+}
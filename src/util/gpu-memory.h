@@ -0,0 +1,37 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+// Every texture and buffer of the app is created and destroyed through here, so that the GPU memory they take is
+// known at all times: WebGPU itself reports none. Sizes are those of the texels and bytes requested, without the
+// padding and alignment the driver may add.
+class GpuMemory
+{
+  public:
+    struct Stats
+    {
+        uint64_t texture_bytes = 0;
+        uint64_t buffer_bytes = 0;
+        uint32_t texture_count = 0;
+        uint32_t buffer_count = 0;
+        // Highest texture_bytes + buffer_bytes since startup
+        uint64_t peak_bytes = 0;
+
+        uint64_t usage() const { return texture_bytes + buffer_bytes; }
+    };
+
+    static wgpu::Texture create_texture(wgpu::Device device, const wgpu::TextureDescriptor& descriptor);
+    static wgpu::Buffer create_buffer(wgpu::Device device, const wgpu::BufferDescriptor& descriptor);
+
+    // Destroy and release a texture or buffer created above, and reset it to null (no-op on null)
+    static void destroy(wgpu::Texture& texture);
+    static void destroy(wgpu::Buffer& buffer);
+
+    // Texel size of the blocks of a format, and their size in bytes
+    static void block_layout(wgpu::TextureFormat format, uint32_t& block_size, uint32_t& block_bytes);
+
+    // Bytes taken by all the levels, layers and samples of a texture
+    static uint64_t texture_size(const wgpu::TextureDescriptor& descriptor);
+
+    static Stats stats();
+};
@@ -0,0 +1,136 @@
+#include "gpu-mip-generator.h"
+#include "resource-manager.h"
+
+#include <vector>
+
+using namespace wgpu;
+
+GpuMipGenerator::GpuMipGenerator(Device device) : device(device)
+{
+    queue = device.getQueue();
+
+    shader_module = ResourceManager::load_shader_module(RESOURCE_DIR "/mipmap.wgsl", device);
+    if (!shader_module)
+    {
+        std::cerr << "Could not load the mipmap shader" << std::endl;
+        return;
+    }
+
+    // Previous level, next level
+    std::vector<BindGroupLayoutEntry> binding_layout_entries(2, Default);
+    binding_layout_entries[0].binding = 0;
+    binding_layout_entries[0].visibility = ShaderStage::Compute;
+    binding_layout_entries[0].texture.sampleType = TextureSampleType::Float;
+    binding_layout_entries[0].texture.viewDimension = TextureViewDimension::_2D;
+    binding_layout_entries[1].binding = 1;
+    binding_layout_entries[1].visibility = ShaderStage::Compute;
+    binding_layout_entries[1].storageTexture.access = StorageTextureAccess::WriteOnly;
+    binding_layout_entries[1].storageTexture.format = TextureFormat::RGBA8Unorm;
+    binding_layout_entries[1].storageTexture.viewDimension = TextureViewDimension::_2D;
+
+    BindGroupLayoutDescriptor bind_group_layout_desc{};
+    bind_group_layout_desc.entryCount = (uint32_t)binding_layout_entries.size();
+    bind_group_layout_desc.entries = binding_layout_entries.data();
+    bind_group_layout = device.createBindGroupLayout(bind_group_layout_desc);
+
+    PipelineLayoutDescriptor layout_desc{};
+    layout_desc.bindGroupLayoutCount = 1;
+    layout_desc.bindGroupLayouts = (WGPUBindGroupLayout*)&bind_group_layout;
+    PipelineLayout layout = device.createPipelineLayout(layout_desc);
+
+    for (uint32_t srgb = 0; srgb < 2; ++srgb)
+    {
+        ConstantEntry constant = Default;
+        constant.key = "srgb";
+        constant.value = srgb;
+
+        ComputePipelineDescriptor pipeline_desc;
+        pipeline_desc.layout = layout;
+        pipeline_desc.compute.module = shader_module;
+        pipeline_desc.compute.entryPoint = "cs_main";
+        pipeline_desc.compute.constantCount = 1;
+        pipeline_desc.compute.constants = &constant;
+        pipelines[srgb] = device.createComputePipeline(pipeline_desc);
+    }
+    layout.release();
+}
+
+GpuMipGenerator::~GpuMipGenerator()
+{
+    for (ComputePipeline& pipeline : pipelines)
+    {
+        if (pipeline)
+            pipeline.release();
+    }
+    if (bind_group_layout)
+        bind_group_layout.release();
+    if (shader_module)
+        shader_module.release();
+    queue.release();
+}
+
+void GpuMipGenerator::generate(Texture texture, Extent3D size, uint32_t level_count, bool srgb, uint32_t layer)
+{
+    if (!is_valid() || level_count < 2)
+        return;
+
+    // A single-level view of each level of the layer, sampled as the previous level and written as the next one
+    std::vector<TextureView> views(level_count);
+    for (uint32_t level = 0; level < level_count; ++level)
+    {
+        TextureViewDescriptor view_desc;
+        view_desc.aspect = TextureAspect::All;
+        view_desc.baseArrayLayer = layer;
+        view_desc.arrayLayerCount = 1;
+        view_desc.baseMipLevel = level;
+        view_desc.mipLevelCount = 1;
+        view_desc.dimension = TextureViewDimension::_2D;
+        view_desc.format = TextureFormat::RGBA8Unorm;
+        views[level] = texture.createView(view_desc);
+    }
+
+    CommandEncoder encoder = device.createCommandEncoder(CommandEncoderDescriptor{});
+    ComputePassDescriptor compute_pass_desc;
+    compute_pass_desc.label = "Mip generation";
+    compute_pass_desc.timestampWrites = nullptr;
+    ComputePassEncoder compute_pass = encoder.beginComputePass(compute_pass_desc);
+    compute_pass.setPipeline(pipelines[srgb ? 1 : 0]);
+
+    // Each dispatch is its own usage scope, so a level written by one dispatch can be read by the next one
+    std::vector<BindGroup> bind_groups(level_count - 1);
+    for (uint32_t level = 1; level < level_count; ++level)
+    {
+        std::vector<BindGroupEntry> bindings(2);
+        bindings[0].binding = 0;
+        bindings[0].textureView = views[level - 1];
+        bindings[1].binding = 1;
+        bindings[1].textureView = views[level];
+
+        BindGroupDescriptor bind_group_desc;
+        bind_group_desc.layout = bind_group_layout;
+        bind_group_desc.entryCount = (uint32_t)bindings.size();
+        bind_group_desc.entries = bindings.data();
+        bind_groups[level - 1] = device.createBindGroup(bind_group_desc);
+
+        uint32_t width = std::max(size.width >> level, 1u);
+        uint32_t height = std::max(size.height >> level, 1u);
+        compute_pass.setBindGroup(0, bind_groups[level - 1], 0, nullptr);
+        compute_pass.dispatchWorkgroups((width + 7) / 8, (height + 7) / 8, 1);
+    }
+
+    compute_pass.end();
+    compute_pass.release();
+
+    CommandBufferDescriptor cmd_buffer_descriptor{};
+    cmd_buffer_descriptor.label = "Mip generation";
+    CommandBuffer command = encoder.finish(cmd_buffer_descriptor);
+    encoder.release();
+    queue.submit(command);
+    command.release();
+
+    // The submitted work keeps what it uses alive
+    for (BindGroup& bind_group : bind_groups)
+        bind_group.release();
+    for (TextureView& view : views)
+        view.release();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+// GPU counterpart of MipGenerator: fills the mip chain of an RGBA8Unorm texture from its
+// level 0 with a compute pipeline (mipmap.wgsl), one dispatch per level, so that only level 0
+// goes through the CPU and the queue. Created once per device and reused for every texture.
+class GpuMipGenerator
+{
+  public:
+    explicit GpuMipGenerator(wgpu::Device device);
+    ~GpuMipGenerator();
+
+    GpuMipGenerator(const GpuMipGenerator&) = delete;
+    GpuMipGenerator& operator=(const GpuMipGenerator&) = delete;
+
+    // Whether the pipelines could be created
+    bool is_valid() const { return pipelines[0] && pipelines[1]; }
+
+    // Compute levels 1 to level_count - 1 of the texture from level 0, filtering in linear space if srgb.
+    // The texture needs the TextureBinding and StorageBinding usages. The work is submitted to the queue
+    // right away, hence runs after whatever was written to level 0 before. For array textures, only the given layer is filled.
+    void generate(wgpu::Texture texture, wgpu::Extent3D size, uint32_t level_count, bool srgb, uint32_t layer = 0);
+
+  private:
+    wgpu::Device device = nullptr;
+    wgpu::Queue queue = nullptr;
+    wgpu::ShaderModule shader_module = nullptr;
+    wgpu::BindGroupLayout bind_group_layout = nullptr;
+    // Without and with sRGB decoding
+    wgpu::ComputePipeline pipelines[2] = {nullptr, nullptr};
+};
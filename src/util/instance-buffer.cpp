@@ -0,0 +1,123 @@
+#include "instance-buffer.h"
+#include "gpu-memory.h"
+#include "staging-uploader.h"
+
+#include <algorithm>
+
+using namespace wgpu;
+
+static Buffer create_vertex_buffer(Device device, uint32_t capacity)
+{
+    BufferDescriptor buffer_desc;
+    buffer_desc.label = "Instances";
+    buffer_desc.size = uint64_t(capacity) * sizeof(InstanceBuffer::Instance);
+    buffer_desc.usage = BufferUsage::CopyDst | BufferUsage::Vertex | BufferUsage::Storage;
+    buffer_desc.mappedAtCreation = false;
+    return GpuMemory::create_buffer(device, buffer_desc);
+}
+
+std::array<VertexAttribute, InstanceBuffer::AttributeCount> InstanceBuffer::attributes(uint32_t first_location)
+{
+    std::array<VertexAttribute, AttributeCount> attribs;
+    attribs[0].shaderLocation = first_location;
+    attribs[0].format = VertexFormat::Float32x4;
+    attribs[0].offset = offsetof(Instance, position_scale);
+    attribs[1].shaderLocation = first_location + 1;
+    attribs[1].format = VertexFormat::Float32x4;
+    attribs[1].offset = offsetof(Instance, rotation);
+    attribs[2].shaderLocation = first_location + 2;
+    attribs[2].format = VertexFormat::Unorm8x4;
+    attribs[2].offset = offsetof(Instance, tint);
+    return attribs;
+}
+
+InstanceBuffer::InstanceBuffer(Device device, uint32_t capacity) : device(device)
+{
+    counters.capacity = std::max(capacity, 1u);
+    vertex_buffer = create_vertex_buffer(device, counters.capacity);
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    GpuMemory::destroy(vertex_buffer);
+}
+
+uint32_t InstanceBuffer::add(const Instance& instance)
+{
+    instances.push_back(instance);
+    is_changed.push_back(false);
+    const uint32_t index = size() - 1;
+    mark(index);
+    counters.instance_count = size();
+    return index;
+}
+
+void InstanceBuffer::set(uint32_t index, const Instance& instance)
+{
+    instances[index] = instance;
+    mark(index);
+}
+
+void InstanceBuffer::clear()
+{
+    instances.clear();
+    changed.clear();
+    is_changed.clear();
+    counters.instance_count = 0;
+}
+
+void InstanceBuffer::mark(uint32_t index)
+{
+    if (is_changed[index])
+        return;
+    is_changed[index] = true;
+    changed.push_back(index);
+}
+
+void InstanceBuffer::upload(StagingUploader& uploader)
+{
+    counters.uploaded_instance_count = 0;
+    counters.copy_count = 0;
+    if (changed.empty())
+        return;
+
+    if (instances.size() > counters.capacity)
+    {
+        // Destroyed once the draws already submitted with it complete. Every record goes to the new one.
+        counters.capacity = std::max(size(), counters.capacity * 2);
+        GpuMemory::destroy(vertex_buffer);
+        vertex_buffer = create_vertex_buffer(device, counters.capacity);
+        ++counters.grow_count;
+        changed.resize(instances.size());
+        for (uint32_t i = 0; i < size(); ++i)
+        {
+            changed[i] = i;
+        }
+    }
+
+    std::sort(changed.begin(), changed.end());
+    auto copy = [&](uint32_t first, uint32_t last) {
+        const uint64_t count = last - first + 1;
+        uploader.upload_buffer(vertex_buffer, first * sizeof(Instance), &instances[first], count * sizeof(Instance));
+        counters.uploaded_instance_count += static_cast<uint32_t>(count);
+        ++counters.copy_count;
+    };
+    uint32_t first = changed[0];
+    uint32_t last = first;
+    for (uint32_t index : changed)
+    {
+        if (index - last > MergeDistance)
+        {
+            copy(first, last);
+            first = index;
+        }
+        last = index;
+    }
+    copy(first, last);
+
+    for (uint32_t index : changed)
+    {
+        is_changed[index] = false;
+    }
+    changed.clear();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <vector>
+
+class StagingUploader;
+
+// Per-instance records of an instanced mesh, in a vertex buffer read with VertexStepMode::Instance, so that any number
+// of copies of the mesh is one draw. Records are changed on a CPU copy and upload() sends only those changed since
+// the last upload, one copy per run of them. The buffer can be bound as storage too, e.g. to cull instances on the GPU.
+class InstanceBuffer
+{
+  public:
+    // The same structure as InstanceInput in the shader
+    struct Instance
+    {
+        // xyz: position, w: uniform scale
+        glm::vec4 position_scale = {0.0f, 0.0f, 0.0f, 1.0f};
+        // Unit quaternion: xyz the axis times sin(angle / 2), w cos(angle / 2)
+        glm::vec4 rotation = {0.0f, 0.0f, 0.0f, 1.0f};
+        // RGBA8, multiplied with the color of the mesh
+        uint32_t tint = 0xffffffff;
+    };
+    static_assert(sizeof(Instance) % 4 == 0);
+
+    static constexpr uint32_t AttributeCount = 3;
+    // Runs of changed records fewer than this many records apart are sent as one copy, unchanged ones in between
+    static constexpr uint32_t MergeDistance = 16;
+
+    struct Stats
+    {
+        uint32_t instance_count = 0;
+        uint32_t capacity = 0;
+        // Of the last upload
+        uint32_t uploaded_instance_count = 0;
+        uint32_t copy_count = 0;
+        // Times the buffer had to be recreated bigger
+        uint32_t grow_count = 0;
+    };
+
+    // Attributes of the records, at shader locations first_location and up
+    static std::array<wgpu::VertexAttribute, AttributeCount> attributes(uint32_t first_location);
+
+    InstanceBuffer(wgpu::Device device, uint32_t capacity = 1024);
+    ~InstanceBuffer();
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    uint32_t add(const Instance& instance);
+    void set(uint32_t index, const Instance& instance);
+    const Instance& get(uint32_t index) const { return instances[index]; }
+    uint32_t size() const { return static_cast<uint32_t>(instances.size()); }
+    void clear();
+
+    // Copy the records changed or added since the last call, all of them into a bigger buffer if they do not fit
+    void upload(StagingUploader& uploader);
+
+    wgpu::Buffer buffer() const { return vertex_buffer; }
+    // Increments whenever buffer() changes, for bind groups on it to be created again
+    uint32_t generation() const { return counters.grow_count; }
+    // Bytes of the buffer holding records
+    uint64_t byte_size() const { return uint64_t(instances.size()) * sizeof(Instance); }
+
+    const Stats& stats() const { return counters; }
+
+  private:
+    void mark(uint32_t index);
+
+    wgpu::Device device = nullptr;
+    wgpu::Buffer vertex_buffer = nullptr;
+    std::vector<Instance> instances;
+    // Indices of the records changed since the last upload, each once
+    std::vector<uint32_t> changed;
+    std::vector<bool> is_changed;
+    Stats counters;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+
+// A read-only view of a whole file, memory-mapped so that its bytes can be
+// handed to the GPU (or parsed) without being copied into an intermediate buffer.
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Map the file at the given path, return false if it cannot be opened
+    bool open(const std::filesystem::path& path);
+
+    // Unmap the file (called automatically on destruction)
+    void close();
+
+    bool is_open() const { return bytes != nullptr; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return byte_count; }
+
+  private:
+    const uint8_t* bytes = nullptr;
+    size_t byte_count = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
@@ -0,0 +1,336 @@
+#include "mesh-cache.h"
+
+#include <fstream>
+#include <cstring>
+
+using VertexAttributes = ResourceManager::VertexAttributes;
+using PackedVertexAttributes = ResourceManager::PackedVertexAttributes;
+using VertexEncoding = ResourceManager::VertexEncoding;
+using VertexLayout = ResourceManager::VertexLayout;
+using GeometryOptions = ResourceManager::GeometryOptions;
+using Submesh = ResourceManager::Submesh;
+using Material = ResourceManager::Material;
+
+static uint32_t vertex_stride(VertexEncoding encoding)
+{
+    return encoding == VertexEncoding::Quantized ? sizeof(PackedVertexAttributes) : sizeof(VertexAttributes);
+}
+
+// Positions come first in both encodings, which is what lets the Split layout cut vertices in two
+static_assert(offsetof(VertexAttributes, position) == 0 && offsetof(PackedVertexAttributes, position) == 0);
+
+static uint32_t position_stride(VertexEncoding encoding)
+{
+    return encoding == VertexEncoding::Quantized ? sizeof(PackedVertexAttributes::position) : sizeof(VertexAttributes::position);
+}
+
+// Copy interleaved vertices as a stream of their first position_stride bytes followed by a stream of the rest
+static void split_vertex_streams(const uint8_t* vertices, size_t vertex_count, uint32_t stride, uint32_t position_stride, uint8_t* out)
+{
+    const uint32_t attribute_stride = stride - position_stride;
+    uint8_t* positions = out;
+    uint8_t* attributes = out + vertex_count * position_stride;
+    for (size_t i = 0; i < vertex_count; ++i)
+    {
+        memcpy(positions + i * position_stride, vertices + i * stride, position_stride);
+        memcpy(attributes + i * attribute_stride, vertices + i * stride + position_stride, attribute_stride);
+    }
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// FNV-1a, stable across runs and platforms (unlike std::hash)
+static uint64_t hash_string(const std::string& str)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : str)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+MeshCache::path MeshCache::cache_path_for(const path& source)
+{
+    path cache_path = source;
+    cache_path += ".meshcache";
+    return cache_path;
+}
+
+bool MeshCache::make_key(const path& source, Header& header)
+{
+    std::error_code ec;
+    header.source_size = std::filesystem::file_size(source, ec);
+    if (ec)
+        return false;
+    auto mtime = std::filesystem::last_write_time(source, ec);
+    if (ec)
+        return false;
+    header.source_mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    header.source_path_hash = hash_string(std::filesystem::weakly_canonical(source, ec).generic_string());
+    return true;
+}
+
+// The material libraries an OBJ file refers to (names of its mtllib lines), each followed by '\n'
+static std::string material_libraries(const MeshCache::path& source)
+{
+    std::string libraries;
+    MappedFile file;
+    if (!file.open(source))
+        return libraries;
+
+    auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    const char* text = reinterpret_cast<const char*>(file.data());
+    const char* end = text + file.size();
+    for (const char* line = text; line < end;)
+    {
+        const char* line_end = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!line_end)
+            line_end = end;
+        const char* p = line;
+        while (p < line_end && is_space(*p))
+            ++p;
+        if (line_end - p > 7 && memcmp(p, "mtllib", 6) == 0 && is_space(p[6]))
+        {
+            for (p += 7; p < line_end;)
+            {
+                while (p < line_end && is_space(*p))
+                    ++p;
+                const char* name = p;
+                while (p < line_end && !is_space(*p))
+                    ++p;
+                if (p > name)
+                {
+                    libraries.append(name, p);
+                    libraries += '\n';
+                }
+            }
+        }
+        line = line_end + 1;
+    }
+    return libraries;
+}
+
+// Of the sizes and modification times of the libraries
+static uint64_t library_key(const MeshCache::path& source, const std::string& libraries)
+{
+    // Missing libraries count as such, so that adding them later invalidates the cache too
+    std::string key;
+    for (size_t begin = 0, end; (end = libraries.find('\n', begin)) != std::string::npos; begin = end + 1)
+    {
+        const MeshCache::path library = source.parent_path() / libraries.substr(begin, end - begin);
+        std::error_code ec;
+        const uintmax_t size = std::filesystem::file_size(library, ec);
+        const int64_t mtime = ec ? 0 : static_cast<int64_t>(std::filesystem::last_write_time(library, ec).time_since_epoch().count());
+        key += libraries.substr(begin, end - begin) + ':' + (ec ? std::string("missing") : std::to_string(size) + ':' + std::to_string(mtime)) + '\n';
+    }
+    return hash_string(key);
+}
+
+bool MeshCache::bake(const path& source, const std::vector<VertexAttributes>& vertices, const std::vector<uint32_t>& indices,
+                     const std::vector<Submesh>& submeshes, const std::vector<Material>& materials, const GeometryOptions& options, float source_load_ms)
+{
+    VertexEncoding encoding = options.encoding;
+    mapping.close();
+
+    Header header = {};
+    header.magic = Magic;
+    header.version = Version;
+    make_key(source, header);
+
+    std::vector<uint8_t> packed_indices;
+    wgpu::IndexFormat index_format = ResourceManager::pack_indices(indices, vertices.size(), packed_indices);
+
+    std::vector<PackedVertexAttributes> packed_vertices;
+    header.vertex_encoding = encoding;
+    header.optimized = options.optimize;
+    if (encoding == VertexEncoding::Quantized)
+    {
+        header.quantization = ResourceManager::quantize_vertices(vertices, packed_vertices);
+    }
+    const void* vertex_blob = encoding == VertexEncoding::Quantized ? static_cast<const void*>(packed_vertices.data()) : vertices.data();
+
+    header.vertex_layout = options.layout;
+    header.position_stride = options.layout == VertexLayout::Split ? position_stride(encoding) : 0;
+    header.vertex_stride = vertex_stride(encoding);
+    header.vertex_count = static_cast<uint32_t>(vertices.size());
+    header.index_stride = index_format == wgpu::IndexFormat::Uint16 ? 2 : 4;
+    header.index_count = static_cast<uint32_t>(indices.size());
+    header.vertex_offset = align_up(sizeof(Header), 16);
+    header.index_offset = align_up(header.vertex_offset + vertices.size() * header.vertex_stride, 16);
+    header.index_size = packed_indices.size();
+    header.source_load_ms = source_load_ms;
+
+    std::vector<MeshOptimizer::Meshlet> meshlets = MeshOptimizer::build_meshlets(vertices, indices, submeshes);
+    header.meshlet_offset = align_up(header.index_offset + header.index_size, 16);
+    header.meshlet_count = static_cast<uint32_t>(meshlets.size());
+
+    header.submesh_offset = align_up(header.meshlet_offset + meshlets.size() * sizeof(MeshOptimizer::Meshlet), 16);
+    header.submesh_count = static_cast<uint32_t>(submeshes.size());
+
+    std::string strings;
+    std::vector<MaterialRecord> material_records;
+    for (const Material& material : materials)
+    {
+        MaterialRecord& record = material_records.emplace_back();
+        record = {};
+        record.diffuse = material.diffuse;
+        record.name_offset = static_cast<uint32_t>(strings.size());
+        record.name_size = static_cast<uint32_t>(material.name.size());
+        strings += material.name;
+        std::string texture = material.diffuse_texture.generic_string();
+        record.diffuse_texture_offset = static_cast<uint32_t>(strings.size());
+        record.diffuse_texture_size = static_cast<uint32_t>(texture.size());
+        strings += texture;
+    }
+    header.material_offset = align_up(header.submesh_offset + submeshes.size() * sizeof(Submesh), 16);
+    header.material_count = static_cast<uint32_t>(materials.size());
+    header.string_offset = header.material_offset + material_records.size() * sizeof(MaterialRecord);
+    header.string_size = strings.size();
+
+    const std::string libraries = material_libraries(source);
+    header.library_offset = header.string_offset + header.string_size;
+    header.library_size = libraries.size();
+    header.library_key = library_key(source, libraries);
+
+    header.bounds_min = vertices.empty() ? glm::vec3(0.0f) : vertices[0].position;
+    header.bounds_max = header.bounds_min;
+    for (const VertexAttributes& v : vertices)
+    {
+        header.bounds_min = glm::min(header.bounds_min, v.position);
+        header.bounds_max = glm::max(header.bounds_max, v.position);
+    }
+
+    baked.assign(header.library_offset + header.library_size, 0);
+    memcpy(baked.data(), &header, sizeof(Header));
+    if (options.layout == VertexLayout::Split)
+    {
+        split_vertex_streams(static_cast<const uint8_t*>(vertex_blob), vertices.size(), header.vertex_stride, header.position_stride,
+                             baked.data() + header.vertex_offset);
+    }
+    else
+    {
+        memcpy(baked.data() + header.vertex_offset, vertex_blob, vertices.size() * header.vertex_stride);
+    }
+    memcpy(baked.data() + header.index_offset, packed_indices.data(), packed_indices.size());
+    memcpy(baked.data() + header.meshlet_offset, meshlets.data(), meshlets.size() * sizeof(MeshOptimizer::Meshlet));
+    memcpy(baked.data() + header.submesh_offset, submeshes.data(), submeshes.size() * sizeof(Submesh));
+    memcpy(baked.data() + header.material_offset, material_records.data(), material_records.size() * sizeof(MaterialRecord));
+    memcpy(baked.data() + header.string_offset, strings.data(), strings.size());
+    memcpy(baked.data() + header.library_offset, libraries.data(), libraries.size());
+
+    // Write to a temporary file first so that a concurrent reader never sees a partial cache
+    path cache_path = cache_path_for(source);
+    path tmp_path = cache_path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            std::cerr << "Could not write mesh cache " << cache_path << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(baked.data()), baked.size());
+        if (!file)
+        {
+            std::cerr << "Could not write mesh cache " << cache_path << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, cache_path, ec);
+    if (ec)
+    {
+        std::cerr << "Could not write mesh cache " << cache_path << ": " << ec.message() << std::endl;
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::open(const path& source, const GeometryOptions& options)
+{
+    baked.clear();
+    if (!mapping.open(cache_path_for(source)))
+        return false;
+
+    Header expected = {};
+    if (!make_key(source, expected) || mapping.size() < sizeof(Header))
+    {
+        mapping.close();
+        return false;
+    }
+
+    const Header& h = header();
+    bool valid = h.magic == Magic && h.version == Version;
+    valid = valid && h.source_path_hash == expected.source_path_hash && h.source_size == expected.source_size && h.source_mtime == expected.source_mtime;
+    valid = valid && h.vertex_encoding == options.encoding && h.optimized == uint32_t(options.optimize);
+    valid = valid && h.vertex_stride == vertex_stride(options.encoding) && (h.index_stride == 2 || h.index_stride == 4);
+    valid = valid && h.vertex_layout == options.layout;
+    valid = valid && h.position_stride == (options.layout == VertexLayout::Split ? position_stride(options.encoding) : 0);
+    // Without overflowing on corrupt offsets and sizes
+    auto fits = [&](uint64_t offset, uint64_t size) { return offset <= mapping.size() && size <= mapping.size() - offset; };
+    valid = valid && fits(h.vertex_offset, uint64_t(h.vertex_count) * h.vertex_stride);
+    valid = valid && h.index_size >= uint64_t(h.index_count) * h.index_stride && fits(h.index_offset, h.index_size);
+    valid = valid && fits(h.meshlet_offset, uint64_t(h.meshlet_count) * sizeof(MeshOptimizer::Meshlet));
+    valid = valid && fits(h.submesh_offset, uint64_t(h.submesh_count) * sizeof(Submesh));
+    valid = valid && fits(h.material_offset, uint64_t(h.material_count) * sizeof(MaterialRecord));
+    valid = valid && fits(h.string_offset, h.string_size);
+    valid = valid && fits(h.library_offset, h.library_size);
+    // What the blobs hold is indexed with as it is, on the CPU too: submeshes must stay within the index blob and refer
+    // to a material of the table (or none), meshlets within the range of their submesh
+    for (uint32_t i = 0; valid && i < h.submesh_count; ++i)
+    {
+        const Submesh& submesh = submeshes()[i];
+        valid = uint64_t(submesh.first_index) + submesh.index_count <= h.index_count;
+        valid = valid && submesh.material >= -1 && submesh.material < int64_t(h.material_count);
+    }
+    for (uint32_t i = 0; valid && i < h.meshlet_count; ++i)
+    {
+        const MeshOptimizer::Meshlet& meshlet = meshlets()[i];
+        valid = meshlet.submesh < h.submesh_count && meshlet.vertex_count <= h.vertex_count;
+        if (valid)
+        {
+            const Submesh& submesh = submeshes()[meshlet.submesh];
+            valid = meshlet.first_index >= submesh.first_index &&
+                    uint64_t(meshlet.first_index) + meshlet.index_count <= uint64_t(submesh.first_index) + submesh.index_count;
+        }
+    }
+    if (valid)
+    {
+        const std::string libraries(reinterpret_cast<const char*>(bytes() + h.library_offset), h.library_size);
+        valid = h.library_key == library_key(source, libraries);
+    }
+    if (!valid)
+    {
+        mapping.close();
+        return false;
+    }
+    return true;
+}
+
+std::vector<Material> MeshCache::materials() const
+{
+    const Header& h = header();
+    const MaterialRecord* records = reinterpret_cast<const MaterialRecord*>(bytes() + h.material_offset);
+    const char* strings = reinterpret_cast<const char*>(bytes() + h.string_offset);
+
+    std::vector<Material> materials(h.material_count);
+    for (uint32_t i = 0; i < h.material_count; ++i)
+    {
+        const MaterialRecord& record = records[i];
+        // Never read past the string blob, even from a corrupt record
+        auto read_string = [&](uint32_t offset, uint32_t size) {
+            return uint64_t(offset) + size <= h.string_size ? std::string(strings + offset, size) : std::string();
+        };
+        materials[i].name = read_string(record.name_offset, record.name_size);
+        materials[i].diffuse = record.diffuse;
+        materials[i].diffuse_texture = read_string(record.diffuse_texture_offset, record.diffuse_texture_size);
+    }
+    return materials;
+}
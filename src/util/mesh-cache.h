@@ -0,0 +1,139 @@
+#pragma once
+
+#include "mapped-file.h"
+#include "resource-manager.h"
+#include "mesh-optimizer.h"
+
+#include <vector>
+#include <filesystem>
+
+// Versioned binary container holding a mesh that went through the geometry
+// pipeline, baked next to its source file (e.g. "fourareen.obj.meshcache").
+// Subsequent launches map it and upload the blobs as they are, skipping the
+// text parsing entirely.
+//
+// File layout (native endianness):
+//   Header
+//   vertex blob: vertex_count * vertex_stride bytes, at vertex_offset, either
+//                VertexAttributes or PackedVertexAttributes depending on vertex_encoding,
+//                interleaved or split in two streams depending on vertex_layout
+//   index blob: index_count * index_stride bytes (padded to 4), at index_offset
+//   meshlet blob: meshlet_count MeshOptimizer::Meshlet, at meshlet_offset
+//   submesh blob: submesh_count ResourceManager::Submesh, at submesh_offset
+//   material blob: material_count MaterialRecord, at material_offset
+//   string blob: string_size bytes of material names and paths, at string_offset
+//   library blob: library_size bytes of the material libraries (mtllib) of the source, relative to its directory and
+//                 each followed by '\n', at library_offset
+class MeshCache
+{
+  public:
+    using path = std::filesystem::path;
+
+    static constexpr uint32_t Magic = 0x434D4757; // "WGMC"
+    static constexpr uint32_t Version = 6;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+
+        // Key identifying the source the cache was baked from
+        uint64_t source_path_hash;
+        uint64_t source_size;
+        int64_t source_mtime;
+
+        // Blobs
+        uint32_t vertex_stride;
+        uint32_t vertex_count;
+        uint32_t index_stride; // 2 or 4 bytes
+        uint32_t index_count;
+        uint64_t vertex_offset;
+        uint64_t index_offset;
+        uint64_t index_size;
+
+        // Object-space bounding box
+        glm::vec3 bounds_min;
+        glm::vec3 bounds_max;
+
+        // How long producing the mesh from the source took, for comparison
+        float source_load_ms;
+
+        // Layout of the vertex blob, and how to decode it when quantized
+        ResourceManager::VertexEncoding vertex_encoding;
+        ResourceManager::VertexQuantization quantization;
+        // With the Split layout, the position stream takes the first vertex_count * position_stride bytes
+        // of the vertex blob and the other attributes the rest (position_stride is 0 when interleaved)
+        ResourceManager::VertexLayout vertex_layout;
+        uint32_t position_stride;
+        // Whether the mesh went through MeshOptimizer
+        uint32_t optimized;
+
+        // Meshlets covering the index blob, in order
+        uint64_t meshlet_offset;
+        uint32_t meshlet_count;
+
+        // Submeshes, and the material table they refer to
+        uint32_t submesh_count;
+        uint64_t submesh_offset;
+        uint64_t material_offset;
+        uint32_t material_count;
+        uint32_t _pad;
+        uint64_t string_offset;
+        uint64_t string_size;
+
+        // The materials come from the libraries too: key of their sizes and modification times
+        uint64_t library_offset;
+        uint64_t library_size;
+        uint64_t library_key;
+    };
+
+    // Serialized ResourceManager::Material, whose strings live in the string blob
+    struct MaterialRecord
+    {
+        glm::vec3 diffuse;
+        uint32_t name_offset;
+        uint32_t name_size;
+        uint32_t diffuse_texture_offset;
+        uint32_t diffuse_texture_size;
+        uint32_t _pad;
+    };
+
+    // Where the cache of a given source file lives
+    static path cache_path_for(const path& source);
+
+    // Serialize an indexed mesh into the cache of the given source file. The resulting
+    // container stays available through the accessors even if writing it to disk fails.
+    bool bake(const path& source, const std::vector<ResourceManager::VertexAttributes>& vertices, const std::vector<uint32_t>& indices,
+              const std::vector<ResourceManager::Submesh>& submeshes, const std::vector<ResourceManager::Material>& materials,
+              const ResourceManager::GeometryOptions& options, float source_load_ms);
+
+    // Map the cache of the given source file, return false if it is missing, stale, corrupt or baked with other options
+    bool open(const path& source, const ResourceManager::GeometryOptions& options);
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(bytes()); }
+
+    const void* vertex_data() const { return bytes() + header().vertex_offset; }
+    uint64_t vertex_data_size() const { return uint64_t(header().vertex_count) * header().vertex_stride; }
+    // Size of the position stream at the start of the vertex blob, 0 when interleaved
+    uint64_t position_data_size() const { return uint64_t(header().vertex_count) * header().position_stride; }
+
+    const void* index_data() const { return bytes() + header().index_offset; }
+    uint64_t index_data_size() const { return header().index_size; }
+    wgpu::IndexFormat index_format() const { return header().index_stride == 2 ? wgpu::IndexFormat::Uint16 : wgpu::IndexFormat::Uint32; }
+
+    const MeshOptimizer::Meshlet* meshlets() const { return reinterpret_cast<const MeshOptimizer::Meshlet*>(bytes() + header().meshlet_offset); }
+    uint64_t meshlet_data_size() const { return uint64_t(header().meshlet_count) * sizeof(MeshOptimizer::Meshlet); }
+
+    const ResourceManager::Submesh* submeshes() const { return reinterpret_cast<const ResourceManager::Submesh*>(bytes() + header().submesh_offset); }
+
+    // Deserialize the material table
+    std::vector<ResourceManager::Material> materials() const;
+
+  private:
+    static bool make_key(const path& source, Header& header);
+    const uint8_t* bytes() const { return mapping.is_open() ? mapping.data() : baked.data(); }
+
+    MappedFile mapping;
+    // Used instead of the mapping right after baking
+    std::vector<uint8_t> baked;
+};
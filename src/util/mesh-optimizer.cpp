@@ -0,0 +1,396 @@
+#include "mesh-optimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+using VertexAttributes = ResourceManager::VertexAttributes;
+
+static_assert(sizeof(MeshOptimizer::Meshlet) == 48, "Meshlet must match its WGSL counterpart in cull.wgsl");
+
+namespace
+{
+// Triangles using each vertex, in CSR form
+struct Adjacency
+{
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> triangles;
+
+    Adjacency(const std::vector<uint32_t>& indices, size_t vertex_count) : offsets(vertex_count + 1, 0), triangles(indices.size())
+    {
+        for (uint32_t index : indices)
+            ++offsets[index + 1];
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+            triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    uint32_t count(uint32_t vertex) const { return offsets[vertex + 1] - offsets[vertex]; }
+};
+
+// FIFO cache simulation, where a vertex is cached if it was transformed less than cache_size misses ago
+struct FifoCache
+{
+    std::vector<uint32_t> timestamps;
+    uint32_t time;
+    unsigned size;
+
+    FifoCache(size_t vertex_count, unsigned cache_size) : timestamps(vertex_count, 0), time(cache_size + 1), size(cache_size) {}
+
+    bool cached(uint32_t vertex) const { return time - timestamps[vertex] <= size; }
+
+    // Return the number of misses (0 or 1)
+    unsigned access(uint32_t vertex)
+    {
+        if (cached(vertex))
+            return 0;
+        timestamps[vertex] = time++;
+        return 1;
+    }
+
+    void flush() { time += size + 1; }
+};
+} // namespace
+
+// Tipsify, also returning the first triangle of each run that did not continue from the cache ("hard" cluster boundaries)
+static std::vector<uint32_t> tipsify(std::vector<uint32_t>& indices, size_t vertex_count, unsigned cache_size)
+{
+    size_t triangle_count = indices.size() / 3;
+    Adjacency adjacency(indices, vertex_count);
+
+    std::vector<uint32_t> live_triangles(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v)
+        live_triangles[v] = adjacency.count(static_cast<uint32_t>(v));
+
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> dead_ends;
+    std::vector<uint32_t> candidates;
+    FifoCache cache(vertex_count, cache_size);
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    std::vector<uint32_t> clusters;
+
+    uint32_t scan_cursor = 0;
+    int64_t fanning = vertex_count > 0 && triangle_count > 0 ? static_cast<int64_t>(indices[0]) : -1;
+    bool new_cluster = true;
+
+    while (fanning >= 0)
+    {
+        if (new_cluster)
+        {
+            clusters.push_back(static_cast<uint32_t>(result.size() / 3));
+            new_cluster = false;
+        }
+
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        uint32_t f = static_cast<uint32_t>(fanning);
+        for (uint32_t i = adjacency.offsets[f]; i < adjacency.offsets[f + 1]; ++i)
+        {
+            uint32_t t = adjacency.triangles[i];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[3 * t + k];
+                result.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                --live_triangles[v];
+                cache.access(v);
+            }
+        }
+
+        // Prefer the candidate that will still be in the cache once all its triangles are emitted, and is the oldest
+        fanning = -1;
+        int64_t best_priority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live_triangles[v] == 0)
+                continue;
+            int64_t priority = 0;
+            int64_t age = cache.time - cache.timestamps[v];
+            if (age + 2 * int64_t(live_triangles[v]) <= cache_size)
+                priority = age;
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                fanning = v;
+            }
+        }
+        if (fanning >= 0)
+            continue;
+
+        // Dead end: go back to a recently used vertex, or scan for any vertex with triangles left
+        new_cluster = true;
+        while (!dead_ends.empty() && fanning < 0)
+        {
+            uint32_t v = dead_ends.back();
+            dead_ends.pop_back();
+            if (live_triangles[v] > 0)
+                fanning = v;
+        }
+        while (fanning < 0 && scan_cursor < vertex_count)
+        {
+            if (live_triangles[scan_cursor] > 0)
+                fanning = scan_cursor;
+            ++scan_cursor;
+        }
+    }
+
+    indices = std::move(result);
+    return clusters;
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count, unsigned cache_size)
+{
+    CacheStats stats;
+    if (indices.empty())
+        return stats;
+
+    FifoCache cache(vertex_count, cache_size);
+    std::vector<bool> referenced(vertex_count, false);
+    size_t misses = 0;
+    size_t referenced_count = 0;
+    for (uint32_t v : indices)
+    {
+        misses += cache.access(v);
+        if (!referenced[v])
+        {
+            referenced[v] = true;
+            ++referenced_count;
+        }
+    }
+
+    stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+    stats.atvr = static_cast<float>(misses) / referenced_count;
+    return stats;
+}
+
+void MeshOptimizer::optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count)
+{
+    tipsify(indices, vertex_count, CacheSize);
+}
+
+void MeshOptimizer::optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<VertexAttributes>& vertices, float threshold)
+{
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    std::vector<uint32_t> hard_clusters = tipsify(indices, vertices.size(), CacheSize);
+    hard_clusters.push_back(static_cast<uint32_t>(triangle_count));
+
+    // Split hard clusters further wherever the cache behavior so far is close to that of the whole cluster,
+    // so that reordering them costs little locality
+    std::vector<uint32_t> clusters;
+    FifoCache cache(vertices.size(), CacheSize);
+    for (size_t cluster = 0; cluster + 1 < hard_clusters.size(); ++cluster)
+    {
+        uint32_t begin = hard_clusters[cluster], end = hard_clusters[cluster + 1];
+
+        cache.flush();
+        size_t cluster_misses = 0;
+        for (uint32_t t = begin; t < end; ++t)
+            for (int k = 0; k < 3; ++k)
+                cluster_misses += cache.access(indices[3 * t + k]);
+        float cluster_acmr = static_cast<float>(cluster_misses) / (end - begin);
+
+        cache.flush();
+        clusters.push_back(begin);
+        uint32_t start = begin;
+        size_t misses = 0;
+        for (uint32_t t = begin; t < end; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+                misses += cache.access(indices[3 * t + k]);
+            if (t + 1 < end && static_cast<float>(misses) / (t + 1 - start) <= cluster_acmr * threshold)
+            {
+                clusters.push_back(t + 1);
+                start = t + 1;
+                misses = 0;
+                cache.flush();
+            }
+        }
+    }
+    clusters.push_back(static_cast<uint32_t>(triangle_count));
+
+    // Sort clusters by how much they face away from the center of the mesh
+    auto position = [&](size_t i) { return vertices[indices[i]].position; };
+    glm::vec3 mesh_centroid(0.0f);
+    for (uint32_t index : indices)
+        mesh_centroid += vertices[index].position;
+    mesh_centroid /= static_cast<float>(indices.size());
+
+    size_t cluster_count = clusters.size() - 1;
+    std::vector<float> sort_keys(cluster_count);
+    for (size_t cluster = 0; cluster < cluster_count; ++cluster)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (uint32_t t = clusters[cluster]; t < clusters[cluster + 1]; ++t)
+        {
+            glm::vec3 a = position(3 * t), b = position(3 * t + 1), c = position(3 * t + 2);
+            glm::vec3 n = glm::cross(b - a, c - a);
+            float triangle_area = glm::length(n);
+            centroid += (a + b + c) * (triangle_area / 3.0f);
+            normal += n;
+            area += triangle_area;
+        }
+        centroid = area > 0.0f ? centroid / area : position(3 * clusters[cluster]);
+        float normal_length = glm::length(normal);
+        sort_keys[cluster] = normal_length > 0.0f ? glm::dot(centroid - mesh_centroid, normal / normal_length) : 0.0f;
+    }
+
+    std::vector<uint32_t> order(cluster_count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sort_keys[a] > sort_keys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t cluster : order)
+        result.insert(result.end(), indices.begin() + 3 * clusters[cluster], indices.begin() + 3 * clusters[cluster + 1]);
+    indices = std::move(result);
+}
+
+void MeshOptimizer::optimize_vertex_fetch(std::vector<VertexAttributes>& vertices, std::vector<uint32_t>& indices)
+{
+    constexpr uint32_t Unused = ~0u;
+    std::vector<uint32_t> remap(vertices.size(), Unused);
+    std::vector<VertexAttributes> result;
+    result.reserve(vertices.size());
+
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] == Unused)
+        {
+            remap[index] = static_cast<uint32_t>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices = std::move(result);
+}
+
+// Fill in the bounds of a meshlet whose index range is set
+static void compute_meshlet_bounds(MeshOptimizer::Meshlet& meshlet, const std::vector<VertexAttributes>& vertices, const std::vector<uint32_t>& indices)
+{
+    auto position = [&](uint32_t i) { return vertices[indices[i]].position; };
+    uint32_t begin = meshlet.first_index, end = meshlet.first_index + meshlet.index_count;
+
+    // Sphere around the bounding box, tightened to the farthest vertex
+    glm::vec3 box_min = position(begin), box_max = box_min;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        box_min = glm::min(box_min, position(i));
+        box_max = glm::max(box_max, position(i));
+    }
+    meshlet.center = 0.5f * (box_min + box_max);
+    meshlet.radius = 0.0f;
+    for (uint32_t i = begin; i < end; ++i)
+        meshlet.radius = std::max(meshlet.radius, glm::length(position(i) - meshlet.center));
+
+    // Cone around the average normal, spread by the triangle normal that deviates most from it
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.index_count / 3);
+    glm::vec3 axis(0.0f);
+    for (uint32_t i = begin; i < end; i += 3)
+    {
+        glm::vec3 n = glm::cross(position(i + 1) - position(i), position(i + 2) - position(i));
+        float length = glm::length(n);
+        if (length > 0.0f)
+        {
+            normals.push_back(n / length);
+            axis += n / length;
+        }
+    }
+
+    meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.cone_cutoff = 2.0f;
+    float axis_length = glm::length(axis);
+    if (normals.empty() || axis_length == 0.0f)
+        return;
+    meshlet.cone_axis = axis / axis_length;
+
+    float min_dot = 1.0f;
+    for (const glm::vec3& n : normals)
+        min_dot = std::min(min_dot, glm::dot(n, meshlet.cone_axis));
+
+    // Cones wider than a hemisphere (give or take) cannot be culled
+    if (min_dot > 0.1f)
+        meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+std::vector<MeshOptimizer::Meshlet> MeshOptimizer::build_meshlets(const std::vector<VertexAttributes>& vertices, const std::vector<uint32_t>& indices,
+                                                                   const std::vector<Submesh>& submeshes)
+{
+    std::vector<Meshlet> meshlets;
+    // Last meshlet each vertex was added to, to count unique vertices
+    std::vector<uint32_t> owner(vertices.size(), ~0u);
+
+    for (uint32_t s = 0; s < submeshes.size(); ++s)
+    {
+        uint32_t begin = submeshes[s].first_index, end = begin + submeshes[s].index_count;
+
+        Meshlet meshlet = {};
+        meshlet.first_index = begin;
+        meshlet.submesh = s;
+        for (uint32_t i = begin; i + 2 < end; i += 3)
+        {
+            uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            auto count_new_vertices = [&](uint32_t id) {
+                return unsigned(owner[a] != id) + unsigned(owner[b] != id && b != a) + unsigned(owner[c] != id && c != a && c != b);
+            };
+
+            uint32_t id = static_cast<uint32_t>(meshlets.size());
+            unsigned new_vertices = count_new_vertices(id);
+            if (meshlet.vertex_count + new_vertices > MeshletMaxVertices || meshlet.index_count / 3 == MeshletMaxTriangles)
+            {
+                compute_meshlet_bounds(meshlet, vertices, indices);
+                meshlets.push_back(meshlet);
+                meshlet = {};
+                meshlet.first_index = i;
+                meshlet.submesh = s;
+                new_vertices = count_new_vertices(++id);
+            }
+
+            owner[a] = owner[b] = owner[c] = id;
+            meshlet.vertex_count += new_vertices;
+            meshlet.index_count += 3;
+        }
+        if (meshlet.index_count > 0)
+        {
+            compute_meshlet_bounds(meshlet, vertices, indices);
+            meshlets.push_back(meshlet);
+        }
+    }
+    return meshlets;
+}
+
+void MeshOptimizer::optimize(std::vector<VertexAttributes>& vertices, std::vector<uint32_t>& indices, const std::vector<Submesh>& submeshes)
+{
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    CacheStats before = analyze_vertex_cache(indices, vertices.size());
+
+    // Triangles stay within their submesh, the overdraw pass includes the vertex cache one
+    std::vector<uint32_t> range;
+    for (const Submesh& submesh : submeshes)
+    {
+        auto begin = indices.begin() + submesh.first_index;
+        range.assign(begin, begin + submesh.index_count);
+        optimize_overdraw(range, vertices);
+        std::copy(range.begin(), range.end(), begin);
+    }
+    optimize_vertex_fetch(vertices, indices);
+    CacheStats after = analyze_vertex_cache(indices, vertices.size());
+
+    float ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+    std::cout << "Optimized mesh in " << ms << " ms: ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> "
+              << after.atvr << std::endl;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "resource-manager.h"
+
+#include <vector>
+
+// Reordering passes for indexed triangle lists, meant to run once when a mesh
+// is baked (see ResourceManager::load_geometry_cached) so that they cost nothing
+// at runtime. Apply either the vertex cache or the overdraw pass (which starts
+// with the former), then the vertex fetch one.
+class MeshOptimizer
+{
+  public:
+    using VertexAttributes = ResourceManager::VertexAttributes;
+    using Submesh = ResourceManager::Submesh;
+
+    // Post-transform cache size assumed by the passes and the analysis
+    static constexpr unsigned CacheSize = 16;
+
+    // Meshlet limits, the usual mesh shader sizes
+    static constexpr unsigned MeshletMaxVertices = 64;
+    static constexpr unsigned MeshletMaxTriangles = 124;
+
+    // A run of consecutive triangles of a submesh, with what is needed to cull it as a whole.
+    // The same structure as in cull.wgsl.
+    struct Meshlet
+    {
+        // Bounding sphere
+        glm::vec3 center;
+        float radius;
+        // Normal cone: every triangle faces away from any viewpoint v with
+        // dot(center - v, cone_axis) >= cone_cutoff * length(center - v) + radius (cone_cutoff > 1 if it never does)
+        glm::vec3 cone_axis;
+        float cone_cutoff;
+        uint32_t first_index;
+        uint32_t index_count;
+        uint32_t vertex_count;
+        uint32_t submesh;
+    };
+
+    struct CacheStats
+    {
+        // Average cache miss ratio: transformed vertices per triangle (0.5 at best, 3 at worst)
+        float acmr = 0.0f;
+        // Average transformed vertex ratio: transformed vertices per referenced vertex (1 at best)
+        float atvr = 0.0f;
+    };
+
+    // Simulate a FIFO post-transform cache over the triangles
+    static CacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count, unsigned cache_size = CacheSize);
+
+    // Reorder triangles for vertex cache locality (Tipsify, Sander et al. 2007)
+    static void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count);
+
+    // Optimize for the vertex cache, then reorder clusters of triangles so that outward facing ones come first,
+    // reducing overdraw while keeping the ACMR within threshold times that of the cache-optimized order
+    static void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<VertexAttributes>& vertices, float threshold = 1.05f);
+
+    // Renumber vertices in the order triangles first use them, dropping unreferenced ones
+    static void optimize_vertex_fetch(std::vector<VertexAttributes>& vertices, std::vector<uint32_t>& indices);
+
+    // Split the triangles of each submesh, in their current order, into meshlets of at most MeshletMaxVertices unique
+    // vertices and MeshletMaxTriangles triangles. Run after the other passes, whose cache locality makes meshlets compact.
+    static std::vector<Meshlet> build_meshlets(const std::vector<VertexAttributes>& vertices, const std::vector<uint32_t>& indices,
+                                               const std::vector<Submesh>& submeshes);
+
+    // Run the overdraw (hence vertex cache) pass within each submesh, then the vertex fetch pass, printing ACMR/ATVR before and after
+    static void optimize(std::vector<VertexAttributes>& vertices, std::vector<uint32_t>& indices, const std::vector<Submesh>& submeshes);
+};
@@ -0,0 +1,393 @@
+#include "mip-generator.h"
+
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MIP_GENERATOR_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MIP_GENERATOR_TARGET(isa)
+#else
+// Compile the kernel for its instruction set whatever the flags of the translation unit, it only runs if the CPU supports it
+#define MIP_GENERATOR_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MIP_GENERATOR_NEON
+#include <arm_neon.h>
+#endif
+
+// Average 2x2 blocks of texels from two consecutive rows into dst_width texels, rounding to nearest.
+// All kernels produce the very same bytes.
+using RowKernel = void (*)(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dst_width);
+
+static void downsample_row_scalar(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dst_width)
+{
+    for (uint32_t x = 0; x < dst_width; ++x)
+    {
+        const uint8_t* p0 = row0 + 8 * x;
+        const uint8_t* p1 = row1 + 8 * x;
+        for (uint32_t c = 0; c < 4; ++c)
+        {
+            dst[4 * x + c] = static_cast<uint8_t>((p0[c] + p0[4 + c] + p1[c] + p1[4 + c] + 2) >> 2);
+        }
+    }
+}
+
+#ifdef MIP_GENERATOR_X86
+MIP_GENERATOR_TARGET("sse2")
+static void downsample_row_sse2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dst_width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    uint32_t x = 0;
+    // 8 source texels (two registers) per row give 4 texels
+    for (; x + 4 <= dst_width; x += 4)
+    {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x + 16));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x + 16));
+
+        // Vertical sums, two texels per 16-bit register
+        __m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+        // Horizontal sums of neighbouring texels
+        __m128i d01 = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+        __m128i d23 = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67), _mm_unpackhi_epi64(s45, s67));
+        d01 = _mm_srli_epi16(_mm_add_epi16(d01, two), 2);
+        d23 = _mm_srli_epi16(_mm_add_epi16(d23, two), 2);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), _mm_packus_epi16(d01, d23));
+    }
+    downsample_row_scalar(row0 + 8 * x, row1 + 8 * x, dst + 4 * x, dst_width - x);
+}
+
+MIP_GENERATOR_TARGET("avx2")
+static void downsample_row_avx2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dst_width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two = _mm256_set1_epi16(2);
+    uint32_t x = 0;
+    // 16 source texels (two registers) per row give 8 texels. Unpacking works within 128-bit lanes,
+    // so each register yields texels {0, 1} in its low lane and {2, 3} in its high lane.
+    for (; x + 8 <= dst_width; x += 8)
+    {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 8 * x));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 8 * x + 32));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 8 * x));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 8 * x + 32));
+
+        __m256i lo0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+        __m256i hi0 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+        __m256i lo1 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+        __m256i hi1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+
+        __m256i d0 = _mm256_add_epi16(_mm256_unpacklo_epi64(lo0, hi0), _mm256_unpackhi_epi64(lo0, hi0));
+        __m256i d1 = _mm256_add_epi16(_mm256_unpacklo_epi64(lo1, hi1), _mm256_unpackhi_epi64(lo1, hi1));
+        d0 = _mm256_srli_epi16(_mm256_add_epi16(d0, two), 2);
+        d1 = _mm256_srli_epi16(_mm256_add_epi16(d1, two), 2);
+
+        // Packing is per lane too: texels come out as {0, 1}, {4, 5}, {2, 3}, {6, 7}
+        __m256i packed = _mm256_packus_epi16(d0, d1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    downsample_row_scalar(row0 + 8 * x, row1 + 8 * x, dst + 4 * x, dst_width - x);
+}
+#endif
+
+#ifdef MIP_GENERATOR_NEON
+static void downsample_row_neon(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dst_width)
+{
+    uint32_t x = 0;
+    // De-interleaving loads split 8 source texels into even and odd ones, giving 4 texels
+    for (; x + 4 <= dst_width; x += 4)
+    {
+        uint32x4x2_t a = vld2q_u32(reinterpret_cast<const uint32_t*>(row0 + 8 * x));
+        uint32x4x2_t b = vld2q_u32(reinterpret_cast<const uint32_t*>(row1 + 8 * x));
+        uint8x16_t a_even = vreinterpretq_u8_u32(a.val[0]), a_odd = vreinterpretq_u8_u32(a.val[1]);
+        uint8x16_t b_even = vreinterpretq_u8_u32(b.val[0]), b_odd = vreinterpretq_u8_u32(b.val[1]);
+
+        uint16x8_t lo = vaddl_u8(vget_low_u8(a_even), vget_low_u8(a_odd));
+        lo = vaddw_u8(vaddw_u8(lo, vget_low_u8(b_even)), vget_low_u8(b_odd));
+        uint16x8_t hi = vaddl_u8(vget_high_u8(a_even), vget_high_u8(a_odd));
+        hi = vaddw_u8(vaddw_u8(hi, vget_high_u8(b_even)), vget_high_u8(b_odd));
+
+        // Rounding narrowing shift: (sum + 2) >> 2
+        vst1q_u8(dst + 4 * x, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+    }
+    downsample_row_scalar(row0 + 8 * x, row1 + 8 * x, dst + 4 * x, dst_width - x);
+}
+#endif
+
+static RowKernel row_kernel(MipGenerator::Isa isa)
+{
+    switch (isa)
+    {
+#ifdef MIP_GENERATOR_X86
+    case MipGenerator::Isa::SSE2:
+        return downsample_row_sse2;
+    case MipGenerator::Isa::AVX2:
+        return downsample_row_avx2;
+#endif
+#ifdef MIP_GENERATOR_NEON
+    case MipGenerator::Isa::NEON:
+        return downsample_row_neon;
+#endif
+    default:
+        return downsample_row_scalar;
+    }
+}
+
+namespace
+{
+// Conversions between 8-bit sRGB and linear values in [0, 1], or in [0, LinearMax] for the integer kernel of even sizes
+struct SrgbTables
+{
+    static constexpr uint32_t LinearSteps = 4096;
+    // Four values of at most LinearMax sum to 16 bits, whose top 12 index from_linear after rounding
+    static constexpr uint32_t LinearMax = 4 * LinearSteps;
+
+    float to_linear[256];
+    uint8_t from_linear[LinearSteps + 1];
+    uint16_t to_linear16[256];
+
+    SrgbTables()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            float c = i / 255.0f;
+            to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            to_linear16[i] = static_cast<uint16_t>(to_linear[i] * LinearMax + 0.5f);
+        }
+        for (uint32_t i = 0; i <= LinearSteps; ++i)
+        {
+            float l = static_cast<float>(i) / LinearSteps;
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            from_linear[i] = static_cast<uint8_t>(c * 255.0f + 0.5f);
+        }
+    }
+
+    uint8_t encode(float linear) const { return from_linear[static_cast<uint32_t>(linear * LinearSteps + 0.5f)]; }
+};
+
+// Texels of the previous level covered by a texel of the next one, along one dimension
+struct Taps
+{
+    uint32_t first;
+    uint32_t count;
+    float weights[3];
+};
+} // namespace
+
+static const SrgbTables& srgb_tables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+static std::vector<Taps> compute_taps(uint32_t size)
+{
+    std::vector<Taps> taps(MipGenerator::level_size(size, 1));
+    const uint32_t m = static_cast<uint32_t>(taps.size());
+    for (uint32_t i = 0; i < m; ++i)
+    {
+        if (size == 1)
+        {
+            taps[i] = {0, 1, {1.0f, 0.0f, 0.0f}};
+        }
+        else if (size % 2 == 0)
+        {
+            taps[i] = {2 * i, 2, {0.5f, 0.5f, 0.0f}};
+        }
+        else
+        {
+            // size = 2m + 1: texel i covers [i * size / m, (i + 1) * size / m) of the previous level
+            const float n = static_cast<float>(size);
+            taps[i] = {2 * i, 3, {(m - i) / n, m / n, (i + 1) / n}};
+        }
+    }
+    return taps;
+}
+
+// Any size, any color space: separable weights over up to 3x3 texels, accumulated in float
+static void downsample_generic(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst, bool srgb)
+{
+    const std::vector<Taps> x_taps = compute_taps(width);
+    const std::vector<Taps> y_taps = compute_taps(height);
+    const SrgbTables* tables = srgb ? &srgb_tables() : nullptr;
+
+    uint8_t* out = dst;
+    for (const Taps& ty : y_taps)
+    {
+        for (const Taps& tx : x_taps)
+        {
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (uint32_t j = 0; j < ty.count; ++j)
+            {
+                const uint8_t* row = src + 4 * size_t(ty.first + j) * width;
+                for (uint32_t i = 0; i < tx.count; ++i)
+                {
+                    const uint8_t* p = row + 4 * (tx.first + i);
+                    const float w = ty.weights[j] * tx.weights[i];
+                    for (uint32_t c = 0; c < 3; ++c)
+                    {
+                        sum[c] += w * (tables ? tables->to_linear[p[c]] : p[c]);
+                    }
+                    sum[3] += w * p[3];
+                }
+            }
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                out[c] = tables ? tables->encode(sum[c]) : static_cast<uint8_t>(sum[c] + 0.5f);
+            }
+            out[3] = static_cast<uint8_t>(sum[3] + 0.5f);
+            out += 4;
+        }
+    }
+}
+
+// Even sizes in sRGB: color values go through a table to 16-bit linear values, are summed in integers, and come back
+// through from_linear; alpha rounds as with the 8-bit kernels. Table lookups dominate, and building SIMD vectors out of
+// them or gathering them with AVX2 measured slower than this, so it serves every instruction set.
+static void downsample_srgb_row(const SrgbTables& tables, const uint8_t* row0, const uint8_t* row1, uint8_t* dst, uint32_t dst_width)
+{
+    const uint16_t* to_linear = tables.to_linear16;
+    for (uint32_t x = 0; x < dst_width; ++x)
+    {
+        const uint8_t* p0 = row0 + 8 * x;
+        const uint8_t* p1 = row1 + 8 * x;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            const uint32_t sum = to_linear[p0[c]] + to_linear[p0[4 + c]] + to_linear[p1[c]] + to_linear[p1[4 + c]];
+            dst[4 * x + c] = tables.from_linear[(sum + 8) >> 4];
+        }
+        dst[4 * x + 3] = static_cast<uint8_t>((p0[3] + p0[7] + p1[3] + p1[7] + 2) >> 2);
+    }
+}
+
+MipGenerator::Isa MipGenerator::detect_isa()
+{
+    static const Isa best = [] {
+        for (Isa isa : {Isa::AVX2, Isa::NEON, Isa::SSE2})
+        {
+            if (is_supported(isa))
+                return isa;
+        }
+        return Isa::Scalar;
+    }();
+    return best;
+}
+
+bool MipGenerator::is_supported(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::Scalar:
+        return true;
+#ifdef MIP_GENERATOR_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+    case Isa::SSE2: {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+    }
+    case Isa::AVX2: {
+        int info[4];
+        __cpuid(info, 1);
+        // The OS must save the AVX registers (OSXSAVE, then XCR0 bits 1 and 2)
+        if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+#else
+    case Isa::SSE2:
+        return __builtin_cpu_supports("sse2");
+    case Isa::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#endif
+#ifdef MIP_GENERATOR_NEON
+    case Isa::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* MipGenerator::isa_name(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::SSE2:
+        return "SSE2";
+    case Isa::AVX2:
+        return "AVX2";
+    case Isa::NEON:
+        return "NEON";
+    default:
+        return "scalar";
+    }
+}
+
+void MipGenerator::downsample(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst, bool srgb, Isa isa)
+{
+    if (width % 2 != 0 || height % 2 != 0)
+    {
+        downsample_generic(src, width, height, dst, srgb);
+        return;
+    }
+
+    const uint32_t dst_width = width / 2;
+    if (srgb)
+    {
+        const SrgbTables& tables = srgb_tables();
+        for (uint32_t y = 0; y < height / 2; ++y)
+        {
+            const uint8_t* row0 = src + 4 * size_t(2 * y) * width;
+            downsample_srgb_row(tables, row0, row0 + 4 * size_t(width), dst + 4 * size_t(y) * dst_width, dst_width);
+        }
+        return;
+    }
+
+    RowKernel kernel = row_kernel(is_supported(isa) ? isa : Isa::Scalar);
+    for (uint32_t y = 0; y < height / 2; ++y)
+    {
+        const uint8_t* row0 = src + 4 * size_t(2 * y) * width;
+        kernel(row0, row0 + 4 * size_t(width), dst + 4 * size_t(y) * dst_width, dst_width);
+    }
+}
+
+void MipGenerator::generate(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t level_count, bool srgb,
+                            const std::function<void(uint32_t, const uint8_t*, uint32_t, uint32_t)>& visit, Isa isa)
+{
+    if (level_count == 0)
+        return;
+    visit(0, pixels, width, height);
+
+    // Level 1 goes to buffers[1] and sets its capacity, level 2 to buffers[0], and smaller levels reuse them in turn
+    std::vector<uint8_t> buffers[2];
+    const uint8_t* previous = pixels;
+    uint32_t previous_width = width;
+    uint32_t previous_height = height;
+    for (uint32_t level = 1; level < level_count; ++level)
+    {
+        uint32_t level_width = level_size(width, level);
+        uint32_t level_height = level_size(height, level);
+        std::vector<uint8_t>& buffer = buffers[level % 2];
+        buffer.resize(4 * size_t(level_width) * level_height);
+
+        downsample(previous, previous_width, previous_height, buffer.data(), srgb, isa);
+        visit(level, buffer.data(), level_width, level_height);
+
+        previous = buffer.data();
+        previous_width = level_width;
+        previous_height = level_height;
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// CPU generation of the mip chain of RGBA8 images, as uploaded by ResourceManager::load_texture.
+// Each level is a box filter of the previous one. Along an odd dimension every texel of the next level
+// covers 3 texels with polyphase weights, so that no texel of the previous level is ever dropped.
+// The common case of even dimensions runs a SIMD kernel picked at runtime for the running CPU.
+class MipGenerator
+{
+  public:
+    // Instruction sets the even-size kernel is written for
+    enum class Isa
+    {
+        Scalar,
+        SSE2,
+        AVX2,
+        NEON,
+    };
+
+    // Best instruction set available on the running CPU
+    static Isa detect_isa();
+    static bool is_supported(Isa isa);
+    static const char* isa_name(Isa isa);
+
+    // Size of a dimension at a given level: halved and rounded down at each level, never below 1
+    static uint32_t level_size(uint32_t size, uint32_t level) { return size >> level > 0 ? size >> level : 1; }
+
+    // Compute the level following the width x height image src into dst (level_size(width, 1) x level_size(height, 1) texels).
+    // With srgb, color channels are averaged in linear space (alpha always is linear): for even sizes, through lookup
+    // tables to and from 16-bit linear values, with the same integer kernel for every instruction set.
+    static void downsample(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst, bool srgb, Isa isa);
+
+    // Call visit(level, pixels, width, height) for each of the level_count levels of the chain starting at pixels,
+    // which is handed as is as level 0. Later levels are computed into two ping-pong buffers, so a visited level
+    // only stays valid until the next call to visit.
+    static void generate(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t level_count, bool srgb,
+                         const std::function<void(uint32_t level, const uint8_t* pixels, uint32_t width, uint32_t height)>& visit,
+                         Isa isa = detect_isa());
+};
@@ -0,0 +1,857 @@
+#include "obj-parser.h"
+#include "mapped-file.h"
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+
+namespace
+{
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+inline bool is_digit(char c)
+{
+    return static_cast<unsigned int>(c - '0') < 10u;
+}
+
+// Port of tinyobj's tryParseDouble, kept operation for operation so that we get the very same
+// bits. The only change is that we never dereference s_end (tinyobj does, on its NUL-terminated
+// line copies, where it can only be a delimiter).
+bool try_parse_double(const char* s, const char* s_end, double* result)
+{
+    if (s >= s_end)
+        return false;
+
+    double mantissa = 0.0;
+    int exponent = 0;
+    char sign = '+';
+    char exp_sign = '+';
+    const char* curr = s;
+    int read = 0;
+    bool end_not_reached = false;
+    bool leading_decimal_dots = false;
+
+    if (*curr == '+' || *curr == '-')
+    {
+        sign = *curr;
+        curr++;
+        if ((curr != s_end) && (*curr == '.'))
+            leading_decimal_dots = true;
+    }
+    else if (is_digit(*curr))
+    {
+    }
+    else if (*curr == '.')
+    {
+        leading_decimal_dots = true;
+    }
+    else
+    {
+        return false;
+    }
+
+    // Integer part
+    end_not_reached = (curr != s_end);
+    if (!leading_decimal_dots)
+    {
+        while (end_not_reached && is_digit(*curr))
+        {
+            mantissa *= 10;
+            mantissa += static_cast<int>(*curr - 0x30);
+            curr++;
+            read++;
+            end_not_reached = (curr != s_end);
+        }
+        if (read == 0)
+            return false;
+    }
+
+    if (!end_not_reached)
+        goto assemble;
+
+    // Decimal part
+    if (*curr == '.')
+    {
+        curr++;
+        read = 1;
+        end_not_reached = (curr != s_end);
+        while (end_not_reached && is_digit(*curr))
+        {
+            static const double pow_lut[] = {
+                1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+            };
+            const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+            mantissa += static_cast<int>(*curr - 0x30) * (read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+            read++;
+            curr++;
+            end_not_reached = (curr != s_end);
+        }
+    }
+    else if (*curr == 'e' || *curr == 'E')
+    {
+    }
+    else
+    {
+        goto assemble;
+    }
+
+    if (!end_not_reached)
+        goto assemble;
+
+    // Exponent part
+    if (*curr == 'e' || *curr == 'E')
+    {
+        curr++;
+        end_not_reached = (curr != s_end);
+        if (end_not_reached && (*curr == '+' || *curr == '-'))
+        {
+            exp_sign = *curr;
+            curr++;
+        }
+        else if (end_not_reached && is_digit(*curr))
+        {
+        }
+        else
+        {
+            return false;
+        }
+
+        read = 0;
+        end_not_reached = (curr != s_end);
+        while (end_not_reached && is_digit(*curr))
+        {
+            if (exponent > (2147483647 / 10))
+                return false;
+            exponent *= 10;
+            exponent += static_cast<int>(*curr - 0x30);
+            curr++;
+            read++;
+            end_not_reached = (curr != s_end);
+        }
+        exponent *= (exp_sign == '+' ? 1 : -1);
+        if (read == 0)
+            return false;
+    }
+
+assemble:
+    *result = (sign == '+' ? 1 : -1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+    return true;
+}
+
+// A position within one line, the line terminator excluded
+struct Cursor
+{
+    const char* p;
+    const char* end;
+
+    char at(size_t i) const { return p + i < end ? p[i] : '\0'; }
+
+    void skip_spaces()
+    {
+        while (p < end && is_space(*p))
+            ++p;
+    }
+
+    // Equivalent of tinyobj's `token += strcspn(token, "/ \t\r")`
+    void skip_to_separator()
+    {
+        while (p < end && *p != '/' && !is_space(*p) && *p != '\r')
+            ++p;
+    }
+
+    const char* token_end() const
+    {
+        const char* e = p;
+        while (e < end && !is_space(*e) && *e != '\r')
+            ++e;
+        return e;
+    }
+};
+
+// Equivalent of tinyobj's parseReal, falling back to the default when the token is not a number
+float parse_real(Cursor& c, double default_value = 0.0)
+{
+    c.skip_spaces();
+    const char* e = c.token_end();
+    double val = default_value;
+    try_parse_double(c.p, e, &val);
+    c.p = e;
+    return static_cast<float>(val);
+}
+
+bool parse_real(Cursor& c, float* out)
+{
+    c.skip_spaces();
+    const char* e = c.token_end();
+    double val;
+    bool ret = try_parse_double(c.p, e, &val);
+    if (ret)
+        *out = static_cast<float>(val);
+    c.p = e;
+    return ret;
+}
+
+// Equivalent of atoi(token) (the cursor does not move)
+int parse_int(const Cursor& c)
+{
+    const char* p = c.p;
+    while (p < c.end && (is_space(*p) || *p == '\v' || *p == '\f'))
+        ++p;
+    bool negative = false;
+    if (p < c.end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+    long long value = 0;
+    while (p < c.end && is_digit(*p))
+        value = value * 10 + (*p++ - '0');
+    return static_cast<int>(negative ? -value : value);
+}
+
+// A face corner as written in the file. Relative (negative) indices are resolved against the
+// counts local to the chunk, and rebased once the counts of the previous chunks are known.
+struct Corner
+{
+    int v, vt, vn;
+    uint8_t relative;
+};
+
+constexpr uint8_t RelativeV = 1;
+constexpr uint8_t RelativeVt = 2;
+constexpr uint8_t RelativeVn = 4;
+
+// A usemtl or mtllib line, applied in file order once every chunk is parsed
+struct MaterialDirective
+{
+    // Number of faces of the chunk before the directive
+    uint32_t face;
+    bool library;
+    std::string argument;
+};
+
+// A g or o line, starting a shape
+struct ShapeStart
+{
+    // Number of faces of the chunk before the line, then of triangles once triangulated
+    uint32_t face;
+    size_t triangle;
+    std::string name;
+};
+
+struct Chunk
+{
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    // Weights are the optional fourth value of positions, as tinyobj keeps it
+    std::vector<float> v, vc, vn, vt, weights;
+    std::vector<Corner> corners;
+    // Corner count of each kept face (3 or 4)
+    std::vector<uint8_t> face_sizes;
+    // Local position count at each quad, to detect forward references
+    std::vector<uint32_t> quad_v_counts;
+    std::vector<MaterialDirective> material_directives;
+
+    // Material of the faces before the first directive, then of each face once directives are applied
+    int start_material = -1;
+    std::vector<std::pair<uint32_t, int>> material_changes;
+    std::vector<int> material_ids;
+
+    // Smoothing group of the faces before the first s line, then the changes and the group of each face
+    unsigned start_smoothing = 0;
+    std::vector<std::pair<uint32_t, unsigned>> smoothing_changes;
+    std::vector<unsigned> smoothing_ids;
+
+    std::vector<ShapeStart> shape_starts;
+
+    size_t v_base = 0, vn_base = 0, vt_base = 0;
+    std::vector<tinyobj::index_t> indices;
+
+    bool unsupported = false;
+};
+
+// Equivalent of tinyobj's fixIndex, deferring relative indices to the merge
+bool fix_index(int idx, size_t local_count, int& out, bool& relative)
+{
+    relative = false;
+    if (idx > 0)
+    {
+        out = idx - 1;
+        return true;
+    }
+    if (idx < 0)
+    {
+        out = static_cast<int>(local_count) + idx;
+        relative = true;
+        return true;
+    }
+    // Zero indices are reported (or rejected) by tinyobj with a line number, let it handle those
+    return false;
+}
+
+// Equivalent of tinyobj's parseTriple
+bool parse_corner(Cursor& c, const Chunk& chunk, Corner& corner)
+{
+    corner = {-1, -1, -1, 0};
+    bool relative;
+
+    if (!fix_index(parse_int(c), chunk.v.size() / 3, corner.v, relative))
+        return false;
+    corner.relative |= relative ? RelativeV : 0;
+
+    c.skip_to_separator();
+    if (c.at(0) != '/')
+        return true;
+    c.p++;
+
+    // i//k
+    if (c.at(0) == '/')
+    {
+        c.p++;
+        if (!fix_index(parse_int(c), chunk.vn.size() / 3, corner.vn, relative))
+            return false;
+        corner.relative |= relative ? RelativeVn : 0;
+        c.skip_to_separator();
+        return true;
+    }
+
+    // i/j/k or i/j
+    if (!fix_index(parse_int(c), chunk.vt.size() / 2, corner.vt, relative))
+        return false;
+    corner.relative |= relative ? RelativeVt : 0;
+
+    c.skip_to_separator();
+    if (c.at(0) != '/')
+        return true;
+
+    // i/j/k
+    c.p++;
+    if (!fix_index(parse_int(c), chunk.vn.size() / 3, corner.vn, relative))
+        return false;
+    corner.relative |= relative ? RelativeVn : 0;
+    c.skip_to_separator();
+    return true;
+}
+
+void parse_line(Cursor c, Chunk& chunk)
+{
+    c.skip_spaces();
+    if (c.p == c.end || c.at(0) == '#')
+        return;
+
+    // Vertex, with optional colors (tinyobj's parseVertexWithColor)
+    if (c.at(0) == 'v' && is_space(c.at(1)))
+    {
+        c.p += 2;
+        float x = parse_real(c);
+        float y = parse_real(c);
+        float z = parse_real(c);
+        float r, g, b;
+        if (!parse_real(c, &r))
+        {
+            r = g = b = 1.0f;
+        }
+        else if (!parse_real(c, &g))
+        {
+            g = b = 1.0f;
+        }
+        else if (!parse_real(c, &b))
+        {
+            r = g = b = 1.0f;
+        }
+        chunk.v.insert(chunk.v.end(), {x, y, z});
+        chunk.vc.insert(chunk.vc.end(), {r, g, b});
+        chunk.weights.push_back(r);
+        return;
+    }
+
+    // Normal
+    if (c.at(0) == 'v' && c.at(1) == 'n' && is_space(c.at(2)))
+    {
+        c.p += 3;
+        float x = parse_real(c);
+        float y = parse_real(c);
+        float z = parse_real(c);
+        chunk.vn.insert(chunk.vn.end(), {x, y, z});
+        return;
+    }
+
+    // Texcoord
+    if (c.at(0) == 'v' && c.at(1) == 't' && is_space(c.at(2)))
+    {
+        c.p += 3;
+        float x = parse_real(c);
+        float y = parse_real(c);
+        chunk.vt.insert(chunk.vt.end(), {x, y});
+        return;
+    }
+
+    // Skin weights, lines and points can make tinyobj fail, and tags go to its shapes: leave those files to it
+    if ((c.at(0) == 'v' && c.at(1) == 'w' && is_space(c.at(2))) || ((c.at(0) == 'l' || c.at(0) == 'p' || c.at(0) == 't') && is_space(c.at(1))))
+    {
+        chunk.unsupported = true;
+        return;
+    }
+
+    // Face
+    if (c.at(0) == 'f' && is_space(c.at(1)))
+    {
+        c.p += 2;
+        c.skip_spaces();
+
+        size_t first = chunk.corners.size();
+        while (c.p < c.end && c.at(0) != '\r')
+        {
+            Corner corner;
+            if (!parse_corner(c, chunk, corner))
+            {
+                chunk.unsupported = true;
+                return;
+            }
+            chunk.corners.push_back(corner);
+            while (c.p < c.end && (is_space(*c.p) || *c.p == '\r'))
+                ++c.p;
+        }
+
+        size_t corner_count = chunk.corners.size() - first;
+        if (corner_count < 3 || corner_count > 4)
+        {
+            // tinyobj skips degenerated faces, but they still decide whether a shape without triangles is output.
+            // It ear-clips larger polygons.
+            chunk.unsupported = true;
+        }
+        else
+        {
+            chunk.face_sizes.push_back(static_cast<uint8_t>(corner_count));
+            if (corner_count == 4)
+                chunk.quad_v_counts.push_back(static_cast<uint32_t>(chunk.v.size() / 3));
+        }
+        return;
+    }
+
+    // Material use (tinyobj matches the keyword without requiring a separator)
+    if (c.end - c.p >= 6 && strncmp(c.p, "usemtl", 6) == 0)
+    {
+        c.p += 6;
+        c.skip_spaces();
+        const char* e = c.token_end();
+        chunk.material_directives.push_back({static_cast<uint32_t>(chunk.face_sizes.size()), false, std::string(c.p, e)});
+        return;
+    }
+
+    // Material library, the rest of the line holding the file names
+    if (c.end - c.p >= 7 && strncmp(c.p, "mtllib", 6) == 0 && is_space(c.at(6)))
+    {
+        c.p += 7;
+        chunk.material_directives.push_back({static_cast<uint32_t>(chunk.face_sizes.size()), true, std::string(c.p, c.end)});
+        return;
+    }
+
+    // Group, named after the words that follow joined by single spaces
+    if (c.at(0) == 'g' && is_space(c.at(1)))
+    {
+        c.p += 2;
+        std::string name;
+        for (c.skip_spaces(); c.p < c.end; c.skip_spaces())
+        {
+            const char* e = c.token_end();
+            name += name.empty() ? "" : " ";
+            name.append(c.p, e);
+            c.p = e;
+        }
+        chunk.shape_starts.push_back({static_cast<uint32_t>(chunk.face_sizes.size()), 0, name});
+        return;
+    }
+
+    // Object, named after the rest of the line
+    if (c.at(0) == 'o' && is_space(c.at(1)))
+    {
+        chunk.shape_starts.push_back({static_cast<uint32_t>(chunk.face_sizes.size()), 0, std::string(c.p + 2, c.end)});
+        return;
+    }
+
+    // Smoothing group, "off" or a number (negative ones turning it off)
+    if (c.at(0) == 's' && is_space(c.at(1)))
+    {
+        c.p += 2;
+        c.skip_spaces();
+        if (c.p == c.end)
+            return;
+        unsigned id = 0;
+        if (!(c.end - c.p >= 3 && strncmp(c.p, "off", 3) == 0))
+            id = static_cast<unsigned>(std::max(parse_int(c), 0));
+        chunk.smoothing_changes.emplace_back(static_cast<uint32_t>(chunk.face_sizes.size()), id);
+        return;
+    }
+
+    // Anything else does not change the output
+}
+
+// Equivalent of tinyobj's SplitString
+std::vector<std::string> split_file_names(const std::string& s)
+{
+    std::vector<std::string> names;
+    std::string name;
+    bool escaping = false;
+    for (char ch : s)
+    {
+        if (escaping)
+        {
+            escaping = false;
+        }
+        else if (ch == '\\')
+        {
+            escaping = true;
+            continue;
+        }
+        else if (ch == ' ')
+        {
+            if (!name.empty())
+                names.push_back(name);
+            name.clear();
+            continue;
+        }
+        name += ch;
+    }
+    names.push_back(name);
+    return names;
+}
+
+// Apply the material directives of every chunk in file order, loading libraries and resolving
+// material names the way tinyobj does, so that each chunk knows the material of each face
+void resolve_materials(std::vector<Chunk>& chunks, const std::filesystem::path& base_dir, std::vector<tinyobj::material_t>& materials)
+{
+    tinyobj::MaterialFileReader reader(base_dir.string());
+    std::set<std::string> loaded_files;
+    std::map<std::string, int> material_map;
+    int material = -1;
+
+    for (Chunk& chunk : chunks)
+    {
+        chunk.start_material = material;
+        for (const MaterialDirective& directive : chunk.material_directives)
+        {
+            if (!directive.library)
+            {
+                auto it = material_map.find(directive.argument);
+                int new_material = it != material_map.end() ? it->second : -1;
+                if (it == material_map.end())
+                    std::cout << "material [ '" << directive.argument << "' ] not found in .mtl" << std::endl;
+                if (new_material != material)
+                {
+                    material = new_material;
+                    chunk.material_changes.emplace_back(directive.face, material);
+                }
+                continue;
+            }
+
+            // Like tinyobj, stop at the first file of the list that loads (skipping those already loaded)
+            bool found = false;
+            for (const std::string& file_name : split_file_names(directive.argument))
+            {
+                if (loaded_files.count(file_name) > 0)
+                {
+                    found = true;
+                    continue;
+                }
+
+                std::string warn, err;
+                bool ok = reader(file_name, &materials, &material_map, &warn, &err);
+                if (!warn.empty())
+                    std::cout << warn;
+                if (!err.empty())
+                    std::cerr << err;
+                if (ok)
+                {
+                    found = true;
+                    loaded_files.insert(file_name);
+                    break;
+                }
+            }
+            if (!found)
+                std::cout << "Failed to load material file(s). Use default material." << std::endl;
+        }
+        std::vector<MaterialDirective>().swap(chunk.material_directives);
+    }
+}
+
+void parse_chunk(Chunk& chunk)
+{
+    const char* p = chunk.begin;
+    while (p < chunk.end && !chunk.unsupported)
+    {
+        // Lines end with \n, \r\n or a lone \r, like in tinyobj's safeGetline
+        const char* nl = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+        if (!nl)
+            nl = chunk.end;
+        const char* cr = static_cast<const char*>(memchr(p, '\r', nl - p));
+        const char* line_end = cr ? cr : nl;
+
+        parse_line(Cursor{p, line_end}, chunk);
+
+        if (cr && cr + 1 < nl)
+            p = cr + 1;
+        else
+            p = nl < chunk.end ? nl + 1 : chunk.end;
+    }
+}
+
+bool resolve(const Corner& corner, const Chunk& chunk, tinyobj::index_t& idx)
+{
+    idx.vertex_index = corner.v + ((corner.relative & RelativeV) ? static_cast<int>(chunk.v_base) : 0);
+    idx.texcoord_index = corner.vt + ((corner.relative & RelativeVt) ? static_cast<int>(chunk.vt_base) : 0);
+    idx.normal_index = corner.vn + ((corner.relative & RelativeVn) ? static_cast<int>(chunk.vn_base) : 0);
+    // Relative indices pointing before the first element are an error in tinyobj
+    return !((corner.relative & RelativeV) && idx.vertex_index < 0) && !((corner.relative & RelativeVt) && idx.texcoord_index < 0) &&
+           !((corner.relative & RelativeVn) && idx.normal_index < 0);
+}
+
+// Resolve corners and split quads along their shortest diagonal, like tinyobj's exportGroupsToShape
+void triangulate_chunk(Chunk& chunk, const std::vector<float>& v)
+{
+    size_t triangle_count = 0;
+    for (uint8_t size : chunk.face_sizes)
+        triangle_count += size - 2;
+    chunk.indices.reserve(3 * triangle_count);
+
+    chunk.material_ids.reserve(triangle_count);
+    chunk.smoothing_ids.reserve(triangle_count);
+
+    size_t corner = 0;
+    size_t quad = 0;
+    int material = chunk.start_material;
+    unsigned smoothing = chunk.start_smoothing;
+    size_t next_change = 0, next_smoothing_change = 0, next_shape = 0;
+    for (uint32_t face = 0; face < chunk.face_sizes.size(); ++face)
+    {
+        uint8_t size = chunk.face_sizes[face];
+        while (next_change < chunk.material_changes.size() && chunk.material_changes[next_change].first <= face)
+            material = chunk.material_changes[next_change++].second;
+        while (next_smoothing_change < chunk.smoothing_changes.size() && chunk.smoothing_changes[next_smoothing_change].first <= face)
+            smoothing = chunk.smoothing_changes[next_smoothing_change++].second;
+        while (next_shape < chunk.shape_starts.size() && chunk.shape_starts[next_shape].face <= face)
+            chunk.shape_starts[next_shape++].triangle = chunk.material_ids.size();
+        chunk.material_ids.insert(chunk.material_ids.end(), size - 2, material);
+        chunk.smoothing_ids.insert(chunk.smoothing_ids.end(), size - 2, smoothing);
+
+        tinyobj::index_t idx[4];
+        for (uint8_t k = 0; k < size; ++k)
+        {
+            if (!resolve(chunk.corners[corner + k], chunk, idx[k]))
+            {
+                chunk.unsupported = true;
+                return;
+            }
+        }
+        corner += size;
+
+        if (size == 3)
+        {
+            chunk.indices.insert(chunk.indices.end(), {idx[0], idx[1], idx[2]});
+            continue;
+        }
+
+        // tinyobj skips quads with out of range indices, based on the positions read when the face
+        // gets flushed (at the next group/object/material change). Only references to already read
+        // positions are guaranteed to give the same outcome.
+        const int known_positions = static_cast<int>(chunk.v_base + chunk.quad_v_counts[quad++]);
+        for (int k = 0; k < 4; ++k)
+        {
+            if (idx[k].vertex_index < 0 || idx[k].vertex_index >= known_positions)
+            {
+                chunk.unsupported = true;
+                return;
+            }
+        }
+
+        size_t vi0 = size_t(idx[0].vertex_index);
+        size_t vi1 = size_t(idx[1].vertex_index);
+        size_t vi2 = size_t(idx[2].vertex_index);
+        size_t vi3 = size_t(idx[3].vertex_index);
+
+        float e02x = v[vi2 * 3 + 0] - v[vi0 * 3 + 0];
+        float e02y = v[vi2 * 3 + 1] - v[vi0 * 3 + 1];
+        float e02z = v[vi2 * 3 + 2] - v[vi0 * 3 + 2];
+        float e13x = v[vi3 * 3 + 0] - v[vi1 * 3 + 0];
+        float e13y = v[vi3 * 3 + 1] - v[vi1 * 3 + 1];
+        float e13z = v[vi3 * 3 + 2] - v[vi1 * 3 + 2];
+
+        float sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+        float sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+
+        if (sqr02 < sqr13)
+            chunk.indices.insert(chunk.indices.end(), {idx[0], idx[1], idx[2], idx[0], idx[2], idx[3]});
+        else
+            chunk.indices.insert(chunk.indices.end(), {idx[0], idx[1], idx[3], idx[1], idx[2], idx[3]});
+    }
+    // Shapes started after the last face
+    for (; next_shape < chunk.shape_starts.size(); ++next_shape)
+        chunk.shape_starts[next_shape].triangle = chunk.material_ids.size();
+}
+
+// Copy each chunk's array (selected by member) at its offset in the merged array
+template <typename T>
+void gather(ThreadPool& pool, std::vector<Chunk>& chunks, std::vector<T> Chunk::*member, std::vector<T>& merged)
+{
+    std::vector<size_t> offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); ++i)
+        offsets[i + 1] = offsets[i] + (chunks[i].*member).size();
+
+    merged.resize(offsets.back());
+    pool.parallel_for(chunks.size(), [&](size_t i) {
+        std::vector<T>& part = chunks[i].*member;
+        std::copy(part.begin(), part.end(), merged.begin() + offsets[i]);
+        std::vector<T>().swap(part);
+    });
+}
+
+// Copy each chunk's per-triangle array (selected by member, scale elements per triangle) into the shapes, shape s
+// holding triangles [shape_firsts[s], shape_firsts[s + 1]) of the file; triangle_offsets holds the first of each chunk
+template <typename T>
+void scatter(ThreadPool& pool, std::vector<Chunk>& chunks, std::vector<T> Chunk::*member, size_t scale, const std::vector<size_t>& triangle_offsets,
+             const std::vector<size_t>& shape_firsts, std::vector<tinyobj::shape_t>& shapes, std::vector<T> tinyobj::mesh_t::*target)
+{
+    for (size_t s = 0; s < shapes.size(); ++s)
+        (shapes[s].mesh.*target).resize((shape_firsts[s + 1] - shape_firsts[s]) * scale);
+
+    pool.parallel_for(chunks.size(), [&](size_t i) {
+        std::vector<T>& part = chunks[i].*member;
+        const size_t first = triangle_offsets[i], last = triangle_offsets[i + 1];
+        size_t s = std::upper_bound(shape_firsts.begin(), shape_firsts.end(), first) - shape_firsts.begin();
+        for (s = s > 0 ? s - 1 : 0; s < shapes.size() && shape_firsts[s] < last; ++s)
+        {
+            const size_t begin = std::max(first, shape_firsts[s]);
+            const size_t end = std::min(last, shape_firsts[s + 1]);
+            std::copy(part.begin() + (begin - first) * scale, part.begin() + (end - first) * scale,
+                      (shapes[s].mesh.*target).begin() + (begin - shape_firsts[s]) * scale);
+        }
+        std::vector<T>().swap(part);
+    });
+}
+} // namespace
+
+bool ParallelObjParser::parse(const std::filesystem::path& path, ThreadPool& pool, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+                              std::vector<tinyobj::material_t>& materials)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const char* data_end = data + file.size();
+
+    // A few chunks per thread balances uneven lines (faces are longer than vertices)
+    constexpr size_t min_chunk_size = 1 << 20;
+    size_t chunk_count = std::max<size_t>(1, std::min<size_t>(8 * (pool.size() + 1), file.size() / min_chunk_size));
+    size_t chunk_size = file.size() / chunk_count + 1;
+
+    std::vector<Chunk> chunks;
+    chunks.reserve(chunk_count);
+    const char* begin = data;
+    while (begin < data_end)
+    {
+        const char* end = begin + std::min<size_t>(chunk_size, data_end - begin);
+        // Extend the chunk to the start of the next line
+        const char* nl = end < data_end ? static_cast<const char*>(memchr(end, '\n', data_end - end)) : nullptr;
+        end = nl ? nl + 1 : data_end;
+
+        Chunk& chunk = chunks.emplace_back();
+        chunk.begin = begin;
+        chunk.end = end;
+        begin = end;
+    }
+
+    // 1. Tokenize and parse every chunk independently
+    pool.parallel_for(chunks.size(), [&](size_t i) { parse_chunk(chunks[i]); });
+
+    for (const Chunk& chunk : chunks)
+    {
+        if (chunk.unsupported)
+            return false;
+    }
+
+    // 2. Prefix sums of the element counts give each chunk's base for relative indices
+    size_t v_count = 0, vn_count = 0, vt_count = 0;
+    for (Chunk& chunk : chunks)
+    {
+        chunk.v_base = v_count;
+        chunk.vn_base = vn_count;
+        chunk.vt_base = vt_count;
+        v_count += chunk.v.size() / 3;
+        vn_count += chunk.vn.size() / 3;
+        vt_count += chunk.vt.size() / 2;
+    }
+
+    materials.clear();
+    resolve_materials(chunks, path.parent_path(), materials);
+
+    // Smoothing groups carry over from chunk to chunk
+    unsigned smoothing = 0;
+    for (Chunk& chunk : chunks)
+    {
+        chunk.start_smoothing = smoothing;
+        if (!chunk.smoothing_changes.empty())
+            smoothing = chunk.smoothing_changes.back().second;
+    }
+
+    attrib = tinyobj::attrib_t();
+    gather(pool, chunks, &Chunk::v, attrib.vertices);
+    gather(pool, chunks, &Chunk::vc, attrib.colors);
+    gather(pool, chunks, &Chunk::vn, attrib.normals);
+    gather(pool, chunks, &Chunk::vt, attrib.texcoords);
+    gather(pool, chunks, &Chunk::weights, attrib.vertex_weights);
+
+    // 3. Resolve and triangulate faces, now that every position is known
+    pool.parallel_for(chunks.size(), [&](size_t i) {
+        triangulate_chunk(chunks[i], attrib.vertices);
+        std::vector<Corner>().swap(chunks[i].corners);
+    });
+
+    for (const Chunk& chunk : chunks)
+    {
+        if (chunk.unsupported)
+            return false;
+    }
+
+    // 4. Split the triangles into shapes at g and o lines, those without any being left out like tinyobj does
+    std::vector<size_t> triangle_offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); ++i)
+        triangle_offsets[i + 1] = triangle_offsets[i] + chunks[i].material_ids.size();
+
+    shapes.clear();
+    std::vector<size_t> shape_firsts;
+    std::string name;
+    size_t first = 0;
+    auto add_shape = [&](size_t end) {
+        if (end > first)
+        {
+            shapes.emplace_back().name = name;
+            shape_firsts.push_back(first);
+        }
+    };
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        for (ShapeStart& start : chunks[i].shape_starts)
+        {
+            add_shape(triangle_offsets[i] + start.triangle);
+            first = triangle_offsets[i] + start.triangle;
+            name = std::move(start.name);
+        }
+    }
+    add_shape(triangle_offsets.back());
+    shape_firsts.push_back(triangle_offsets.back());
+
+    scatter(pool, chunks, &Chunk::indices, 3, triangle_offsets, shape_firsts, shapes, &tinyobj::mesh_t::indices);
+    scatter(pool, chunks, &Chunk::material_ids, 1, triangle_offsets, shape_firsts, shapes, &tinyobj::mesh_t::material_ids);
+    scatter(pool, chunks, &Chunk::smoothing_ids, 1, triangle_offsets, shape_firsts, shapes, &tinyobj::mesh_t::smoothing_group_ids);
+    for (size_t s = 0; s < shapes.size(); ++s)
+        shapes[s].mesh.num_face_vertices.assign(shape_firsts[s + 1] - shape_firsts[s], 3);
+
+    return true;
+}
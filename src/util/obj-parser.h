@@ -0,0 +1,24 @@
+#pragma once
+
+#include "tiny_obj_loader.h"
+
+#include <filesystem>
+#include <vector>
+
+class ThreadPool;
+
+// Parallel parser for the geometry subset of the OBJ format (v, vn, vt, f, with g, o, s, usemtl and mtllib), meant
+// for very large meshes. The file is memory-mapped and split into newline-aligned chunks that are parsed
+// concurrently, then merged with prefix-summed offsets.
+//
+// The result is exactly what tinyobj::LoadObj would produce: vertices with their weights, normals, texcoords, colors,
+// materials, and one shape per group or object holding faces, with their (triangulated) corners, material ids and
+// smoothing groups. MTL files are looked up next to the OBJ file. Whenever the file uses something whose outcome we
+// do not reproduce bit for bit (polygons with more than 4 corners or fewer than 3, lines/points, skin weights, tags,
+// forward or invalid indices, ...), parse() returns false and the caller is expected to fall back to tinyobj.
+class ParallelObjParser
+{
+  public:
+    static bool parse(const std::filesystem::path& path, ThreadPool& pool, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+                      std::vector<tinyobj::material_t>& materials);
+};
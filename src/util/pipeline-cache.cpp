@@ -0,0 +1,612 @@
+#include "pipeline-cache.h"
+#include "resource-manager.h"
+#include "shader-cache.h"
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <string>
+
+using namespace wgpu;
+
+// FNV-1a, 64 bit, fed field by field: whole structs would bring their padding in
+class Hasher
+{
+  public:
+    void add_bytes(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    // Integers, booleans, enums and flags
+    template <typename T>
+    void add(T value)
+    {
+        uint64_t widened = static_cast<uint64_t>(value);
+        add_bytes(&widened, sizeof(widened));
+    }
+    void add(double value) { add_bytes(&value, sizeof(value)); }
+    void add(float value) { add_bytes(&value, sizeof(value)); }
+    // Null and empty strings hash the same
+    void add_string(const char* text) { add_bytes(text ? text : "", text ? std::strlen(text) + 1 : 1); }
+
+    uint64_t value() const { return hash; }
+
+  private:
+    uint64_t hash = 14695981039346656037ull;
+};
+
+struct PipelineCache::Pipeline
+{
+    // Copies of everything the descriptor points to. Strings in a deque, which never moves them as it grows.
+    std::deque<std::string> strings;
+    std::vector<ConstantEntry> vertex_constants;
+    std::vector<ConstantEntry> fragment_constants;
+    std::vector<std::vector<VertexAttribute>> attributes;
+    std::vector<VertexBufferLayout> buffers;
+    std::vector<BlendState> blends;
+    std::vector<ColorTargetState> targets;
+    DepthStencilState depth_stencil;
+    FragmentState fragment;
+    RenderPipelineDescriptor descriptor;
+
+    Status status = Status::Idle;
+    // Looked up by get(), hence saved to be precompiled at the next startup
+    bool used = false;
+    RenderPipeline pipeline = nullptr;
+    std::unique_ptr<CreateRenderPipelineAsyncCallback> callback;
+    // Compiling on the thread pool, published on the main thread
+    std::future<RenderPipeline> compiled;
+
+    void finish(RenderPipeline result)
+    {
+        pipeline = result;
+        status = result ? Status::Ready : Status::Failed;
+    }
+
+    void copy(const RenderPipelineDescriptor& source)
+    {
+        auto keep = [&](const char* text) -> const char* { return text ? strings.emplace_back(text).c_str() : nullptr; };
+
+        descriptor = source;
+        descriptor.label = keep(source.label);
+
+        descriptor.vertex.entryPoint = keep(source.vertex.entryPoint);
+        vertex_constants.assign(source.vertex.constants, source.vertex.constants + source.vertex.constantCount);
+        for (ConstantEntry& constant : vertex_constants)
+        {
+            constant.key = keep(constant.key);
+        }
+        descriptor.vertex.constants = vertex_constants.data();
+
+        attributes.resize(source.vertex.bufferCount);
+        buffers.assign(source.vertex.buffers, source.vertex.buffers + source.vertex.bufferCount);
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            attributes[i].assign(buffers[i].attributes, buffers[i].attributes + buffers[i].attributeCount);
+            buffers[i].attributes = attributes[i].data();
+        }
+        descriptor.vertex.buffers = buffers.data();
+
+        if (source.depthStencil)
+        {
+            depth_stencil = *source.depthStencil;
+            descriptor.depthStencil = &depth_stencil;
+        }
+
+        if (source.fragment)
+        {
+            fragment = *source.fragment;
+            fragment.entryPoint = keep(fragment.entryPoint);
+            fragment_constants.assign(fragment.constants, fragment.constants + fragment.constantCount);
+            for (ConstantEntry& constant : fragment_constants)
+            {
+                constant.key = keep(constant.key);
+            }
+            fragment.constants = fragment_constants.data();
+
+            blends.resize(fragment.targetCount);
+            targets.assign(fragment.targets, fragment.targets + fragment.targetCount);
+            for (size_t i = 0; i < targets.size(); ++i)
+            {
+                if (targets[i].blend)
+                {
+                    blends[i] = *targets[i].blend;
+                    targets[i].blend = &blends[i];
+                }
+            }
+            fragment.targets = targets.data();
+            descriptor.fragment = &fragment;
+        }
+    }
+
+    // Of the whole state, the layout and shader modules by the keys given to them
+    Key hash(const ShaderCache& shaders, Key layout) const;
+    // The same state as other, layout and shader module handles included
+    bool matches(const RenderPipelineDescriptor& other) const;
+};
+
+static void hash_stage(Hasher& hasher, const ShaderCache& shaders, ShaderModule module, const char* entry_point,
+                       const ConstantEntry* constants, size_t constant_count)
+{
+    hasher.add(shaders.hash(module));
+    hasher.add_string(entry_point);
+    hasher.add(constant_count);
+    for (size_t i = 0; i < constant_count; ++i)
+    {
+        hasher.add_string(constants[i].key);
+        hasher.add(constants[i].value);
+    }
+}
+
+static void hash_stencil_face(Hasher& hasher, const StencilFaceState& face)
+{
+    hasher.add(face.compare);
+    hasher.add(face.failOp);
+    hasher.add(face.depthFailOp);
+    hasher.add(face.passOp);
+}
+
+static void hash_blend_component(Hasher& hasher, const BlendComponent& component)
+{
+    hasher.add(component.operation);
+    hasher.add(component.srcFactor);
+    hasher.add(component.dstFactor);
+}
+
+PipelineCache::Key PipelineCache::Pipeline::hash(const ShaderCache& shaders, Key layout) const
+{
+    Hasher hasher;
+    hasher.add(layout);
+
+    hash_stage(hasher, shaders, descriptor.vertex.module, descriptor.vertex.entryPoint, vertex_constants.data(), vertex_constants.size());
+    hasher.add(buffers.size());
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        hasher.add(buffers[i].arrayStride);
+        hasher.add(buffers[i].stepMode);
+        hasher.add(attributes[i].size());
+        for (const VertexAttribute& attribute : attributes[i])
+        {
+            hasher.add(attribute.format);
+            hasher.add(attribute.offset);
+            hasher.add(attribute.shaderLocation);
+        }
+    }
+
+    hasher.add(descriptor.primitive.topology);
+    hasher.add(descriptor.primitive.stripIndexFormat);
+    hasher.add(descriptor.primitive.frontFace);
+    hasher.add(descriptor.primitive.cullMode);
+
+    hasher.add(descriptor.depthStencil != nullptr);
+    if (descriptor.depthStencil)
+    {
+        hasher.add(depth_stencil.format);
+        hasher.add(depth_stencil.depthWriteEnabled);
+        hasher.add(depth_stencil.depthCompare);
+        hash_stencil_face(hasher, depth_stencil.stencilFront);
+        hash_stencil_face(hasher, depth_stencil.stencilBack);
+        hasher.add(depth_stencil.stencilReadMask);
+        hasher.add(depth_stencil.stencilWriteMask);
+        hasher.add(depth_stencil.depthBias);
+        hasher.add(depth_stencil.depthBiasSlopeScale);
+        hasher.add(depth_stencil.depthBiasClamp);
+    }
+
+    hasher.add(descriptor.multisample.count);
+    hasher.add(descriptor.multisample.mask);
+    hasher.add(descriptor.multisample.alphaToCoverageEnabled);
+
+    hasher.add(descriptor.fragment != nullptr);
+    if (descriptor.fragment)
+    {
+        hash_stage(hasher, shaders, fragment.module, fragment.entryPoint, fragment_constants.data(), fragment_constants.size());
+        hasher.add(targets.size());
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            hasher.add(targets[i].format);
+            hasher.add(targets[i].writeMask);
+            hasher.add(targets[i].blend != nullptr);
+            if (targets[i].blend)
+            {
+                hash_blend_component(hasher, blends[i].color);
+                hash_blend_component(hasher, blends[i].alpha);
+            }
+        }
+    }
+    return hasher.value();
+}
+
+static bool same_string(const char* a, const char* b)
+{
+    return std::strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static bool same_stage(ShaderModule module_a, const char* entry_point_a, const ConstantEntry* constants_a, size_t constant_count_a,
+                       ShaderModule module_b, const char* entry_point_b, const ConstantEntry* constants_b, size_t constant_count_b)
+{
+    if (module_a != module_b || !same_string(entry_point_a, entry_point_b) || constant_count_a != constant_count_b)
+        return false;
+    for (size_t i = 0; i < constant_count_a; ++i)
+    {
+        if (!same_string(constants_a[i].key, constants_b[i].key) || constants_a[i].value != constants_b[i].value)
+            return false;
+    }
+    return true;
+}
+
+static bool same_stencil_face(const StencilFaceState& a, const StencilFaceState& b)
+{
+    return a.compare == b.compare && a.failOp == b.failOp && a.depthFailOp == b.depthFailOp && a.passOp == b.passOp;
+}
+
+static bool same_blend_component(const BlendComponent& a, const BlendComponent& b)
+{
+    return a.operation == b.operation && a.srcFactor == b.srcFactor && a.dstFactor == b.dstFactor;
+}
+
+bool PipelineCache::Pipeline::matches(const RenderPipelineDescriptor& other) const
+{
+    if (descriptor.layout != other.layout)
+        return false;
+
+    if (!same_stage(descriptor.vertex.module, descriptor.vertex.entryPoint, vertex_constants.data(), vertex_constants.size(),
+                    other.vertex.module, other.vertex.entryPoint, other.vertex.constants, other.vertex.constantCount))
+        return false;
+    if (buffers.size() != other.vertex.bufferCount)
+        return false;
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        const VertexBufferLayout& buffer = other.vertex.buffers[i];
+        if (buffers[i].arrayStride != buffer.arrayStride || buffers[i].stepMode != buffer.stepMode || attributes[i].size() != buffer.attributeCount)
+            return false;
+        for (size_t j = 0; j < attributes[i].size(); ++j)
+        {
+            const VertexAttribute& attribute = buffer.attributes[j];
+            if (attributes[i][j].format != attribute.format || attributes[i][j].offset != attribute.offset ||
+                attributes[i][j].shaderLocation != attribute.shaderLocation)
+                return false;
+        }
+    }
+
+    const PrimitiveState& primitive = other.primitive;
+    if (descriptor.primitive.topology != primitive.topology || descriptor.primitive.stripIndexFormat != primitive.stripIndexFormat ||
+        descriptor.primitive.frontFace != primitive.frontFace || descriptor.primitive.cullMode != primitive.cullMode)
+        return false;
+
+    if ((descriptor.depthStencil != nullptr) != (other.depthStencil != nullptr))
+        return false;
+    if (other.depthStencil)
+    {
+        const DepthStencilState& state = *other.depthStencil;
+        if (depth_stencil.format != state.format || depth_stencil.depthWriteEnabled != state.depthWriteEnabled ||
+            depth_stencil.depthCompare != state.depthCompare || !same_stencil_face(depth_stencil.stencilFront, state.stencilFront) ||
+            !same_stencil_face(depth_stencil.stencilBack, state.stencilBack) || depth_stencil.stencilReadMask != state.stencilReadMask ||
+            depth_stencil.stencilWriteMask != state.stencilWriteMask || depth_stencil.depthBias != state.depthBias ||
+            depth_stencil.depthBiasSlopeScale != state.depthBiasSlopeScale || depth_stencil.depthBiasClamp != state.depthBiasClamp)
+            return false;
+    }
+
+    if (descriptor.multisample.count != other.multisample.count || descriptor.multisample.mask != other.multisample.mask ||
+        descriptor.multisample.alphaToCoverageEnabled != other.multisample.alphaToCoverageEnabled)
+        return false;
+
+    if ((descriptor.fragment != nullptr) != (other.fragment != nullptr))
+        return false;
+    if (other.fragment)
+    {
+        const FragmentState& state = *other.fragment;
+        if (!same_stage(fragment.module, fragment.entryPoint, fragment_constants.data(), fragment_constants.size(), state.module,
+                        state.entryPoint, state.constants, state.constantCount))
+            return false;
+        if (targets.size() != state.targetCount)
+            return false;
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            const ColorTargetState& target = state.targets[i];
+            if (targets[i].format != target.format || targets[i].writeMask != target.writeMask ||
+                (targets[i].blend != nullptr) != (target.blend != nullptr))
+                return false;
+            if (target.blend && (!same_blend_component(blends[i].color, target.blend->color) ||
+                                 !same_blend_component(blends[i].alpha, target.blend->alpha)))
+                return false;
+        }
+    }
+    return true;
+}
+
+static PipelineCache::Key hash_bind_group_layout(const BindGroupLayoutDescriptor& descriptor)
+{
+    Hasher hasher;
+    hasher.add(descriptor.entryCount);
+    for (size_t i = 0; i < descriptor.entryCount; ++i)
+    {
+        const BindGroupLayoutEntry entry = descriptor.entries[i];
+        hasher.add(entry.binding);
+        hasher.add(entry.visibility);
+        hasher.add(entry.buffer.type);
+        hasher.add(entry.buffer.hasDynamicOffset);
+        hasher.add(entry.buffer.minBindingSize);
+        hasher.add(entry.sampler.type);
+        hasher.add(entry.texture.sampleType);
+        hasher.add(entry.texture.viewDimension);
+        hasher.add(entry.texture.multisampled);
+        hasher.add(entry.storageTexture.access);
+        hasher.add(entry.storageTexture.format);
+        hasher.add(entry.storageTexture.viewDimension);
+    }
+    return hasher.value();
+}
+
+PipelineCache::PipelineCache(Device device, const ShaderCache& shaders, ThreadPool* pool) : device(device), shaders(shaders), pool(pool)
+{
+}
+
+PipelineCache::~PipelineCache()
+{
+    wait();
+    for (auto& [key, entry] : pipelines)
+    {
+        if (entry->pipeline)
+            entry->pipeline.release();
+    }
+    for (CachedPipelineLayout& entry : pipeline_layouts)
+    {
+        entry.layout.release();
+    }
+    for (CachedBindGroupLayout& entry : bind_group_layouts)
+    {
+        entry.layout.release();
+    }
+}
+
+BindGroupLayout PipelineCache::bind_group_layout(const BindGroupLayoutDescriptor& descriptor)
+{
+    const Key key = hash_bind_group_layout(descriptor);
+    for (const CachedBindGroupLayout& entry : bind_group_layouts)
+    {
+        if (entry.key == key)
+            return entry.layout;
+    }
+
+    BindGroupLayout layout = device.createBindGroupLayout(descriptor);
+    if (!layout)
+        return nullptr;
+    bind_group_layouts.push_back({key, layout});
+    counters.bind_group_layout_count = static_cast<uint32_t>(bind_group_layouts.size());
+    return layout;
+}
+
+PipelineLayout PipelineCache::pipeline_layout(const std::vector<BindGroupLayout>& layouts)
+{
+    // From the keys of the bind group layouts, which are stable across runs unlike their handles
+    Hasher hasher;
+    hasher.add(layouts.size());
+    for (const BindGroupLayout& layout : layouts)
+    {
+        auto it = std::find_if(bind_group_layouts.begin(), bind_group_layouts.end(),
+                               [&](const CachedBindGroupLayout& entry) { return entry.layout == layout; });
+        hasher.add(it != bind_group_layouts.end() ? it->key : 0);
+    }
+    const Key key = hasher.value();
+    for (const CachedPipelineLayout& entry : pipeline_layouts)
+    {
+        if (entry.key == key)
+            return entry.layout;
+    }
+
+    PipelineLayoutDescriptor descriptor{};
+    descriptor.bindGroupLayoutCount = static_cast<uint32_t>(layouts.size());
+    descriptor.bindGroupLayouts = (WGPUBindGroupLayout*)layouts.data();
+    PipelineLayout layout = device.createPipelineLayout(descriptor);
+    if (!layout)
+        return nullptr;
+    pipeline_layouts.push_back({key, layout});
+    counters.pipeline_layout_count = static_cast<uint32_t>(pipeline_layouts.size());
+    return layout;
+}
+
+PipelineCache::Key PipelineCache::add(const RenderPipelineDescriptor& descriptor)
+{
+    auto entry = std::make_unique<Pipeline>();
+    entry->copy(descriptor);
+
+    // Pipelines with a layout of their own (or none) cannot be told apart by it
+    PipelineLayout layout = descriptor.layout;
+    auto layout_entry = std::find_if(pipeline_layouts.begin(), pipeline_layouts.end(),
+                                     [&](const CachedPipelineLayout& candidate) { return candidate.layout == layout; });
+    const Key layout_key = layout_entry != pipeline_layouts.end() ? layout_entry->key : 0;
+    Key key = entry->hash(shaders, layout_key);
+
+    // A different pipeline under the key (told apart by an uncached layout, or a collision) moves on to the next one
+    auto it = pipelines.find(key);
+    for (; it != pipelines.end(); it = pipelines.find(++key))
+    {
+        if (it->second->matches(descriptor))
+            return key;
+    }
+    pipelines.emplace(key, std::move(entry));
+    counters.pipeline_count = static_cast<uint32_t>(pipelines.size());
+    if (std::find(warm_keys.begin(), warm_keys.end(), key) != warm_keys.end())
+        compile_async(key);
+    return key;
+}
+
+RenderPipeline PipelineCache::get(Key key)
+{
+    auto it = pipelines.find(key);
+    if (it == pipelines.end())
+        return nullptr;
+
+    Pipeline& entry = *it->second;
+    entry.used = true;
+    if (entry.status == Status::Ready || entry.status == Status::Compiling)
+        ++counters.hit_count;
+    if (entry.compiled.valid())
+    {
+        entry.finish(entry.compiled.get());
+    }
+    while (entry.status == Status::Compiling)
+    {
+        ResourceManager::poll_device(device);
+    }
+    if (entry.status == Status::Idle)
+    {
+        entry.pipeline = device.createRenderPipeline(entry.descriptor);
+        entry.status = entry.pipeline ? Status::Ready : Status::Failed;
+        ++counters.blocking_compile_count;
+    }
+    return entry.pipeline;
+}
+
+void PipelineCache::compile_async(Key key)
+{
+    auto it = pipelines.find(key);
+    if (it == pipelines.end() || it->second->status != Status::Idle)
+        return;
+
+    Pipeline& entry = *it->second;
+    ++counters.background_compile_count;
+#ifdef WEBGPU_BACKEND_WGPU
+    // wgpu-native does not implement createRenderPipelineAsync, but its device may be used from any thread
+    if (!pool)
+    {
+        entry.finish(device.createRenderPipeline(entry.descriptor));
+        return;
+    }
+    entry.status = Status::Compiling;
+    const RenderPipelineDescriptor* descriptor = &entry.descriptor;
+    entry.compiled = pool->submit([device = device, descriptor]() mutable { return device.createRenderPipeline(*descriptor); });
+#else
+    // Set first, as the callback may run before createRenderPipelineAsync returns
+    entry.status = Status::Compiling;
+    Pipeline* target = &entry;
+    entry.callback = device.createRenderPipelineAsync(
+        entry.descriptor, [target](CreatePipelineAsyncStatus status, RenderPipeline pipeline, char const* message) {
+            if (status == CreatePipelineAsyncStatus::Success)
+            {
+                target->pipeline = pipeline;
+                target->status = Status::Ready;
+                return;
+            }
+            target->status = Status::Failed;
+            std::cerr << "Could not compile pipeline: " << (message ? message : "unknown error") << std::endl;
+        });
+#endif
+}
+
+PipelineCache::Status PipelineCache::status(Key key) const
+{
+    auto it = pipelines.find(key);
+    return it != pipelines.end() ? it->second->status : Status::Failed;
+}
+
+void PipelineCache::poll()
+{
+    for (auto& [key, entry] : pipelines)
+    {
+        if (entry->compiled.valid() && entry->compiled.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            entry->finish(entry->compiled.get());
+        }
+    }
+}
+
+bool PipelineCache::load(const path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    uint32_t header[3] = {};
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!file || header[0] != Magic || header[1] != Version)
+    {
+        std::cerr << "Ignoring outdated pipeline cache " << path << std::endl;
+        return false;
+    }
+    // The key count comes from the file: it must not claim more keys than the file holds
+    std::error_code error;
+    const uint64_t file_size = std::filesystem::file_size(path, error);
+    if (error || uint64_t(header[2]) * sizeof(Key) > file_size - sizeof(header))
+    {
+        std::cerr << "Ignoring truncated pipeline cache " << path << std::endl;
+        return false;
+    }
+    warm_keys.resize(header[2]);
+    file.read(reinterpret_cast<char*>(warm_keys.data()), warm_keys.size() * sizeof(Key));
+    if (!file)
+    {
+        std::cerr << "Ignoring truncated pipeline cache " << path << std::endl;
+        warm_keys.clear();
+        return false;
+    }
+
+    // Pipelines described before the keys were known
+    for (Key key : warm_keys)
+    {
+        compile_async(key);
+    }
+    return true;
+}
+
+bool PipelineCache::save(const path& path) const
+{
+    std::vector<Key> keys;
+    for (const auto& [key, entry] : pipelines)
+    {
+        if (entry->used)
+            keys.push_back(key);
+    }
+    const uint32_t header[3] = {Magic, Version, static_cast<uint32_t>(keys.size())};
+
+    // Write to a temporary file first so that a concurrent reader never sees a partial cache
+    std::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(Key));
+        if (!file)
+        {
+            std::cerr << "Could not write pipeline cache " << path << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec)
+    {
+        std::cerr << "Could not write pipeline cache " << path << ": " << ec.message() << std::endl;
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+void PipelineCache::wait()
+{
+    for (auto& [key, entry] : pipelines)
+    {
+        if (entry->compiled.valid())
+        {
+            entry->finish(entry->compiled.get());
+        }
+        while (entry->status == Status::Compiling)
+        {
+            ResourceManager::poll_device(device);
+        }
+        entry->callback.reset();
+    }
+}
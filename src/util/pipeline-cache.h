@@ -0,0 +1,118 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class ShaderCache;
+class ThreadPool;
+
+// Render pipelines, pipeline layouts and bind group layouts by hash of their full state (shader source, entry points,
+// override constants, vertex layout, primitive, depth and stencil, targets and blending, bindings), so that identical
+// ones are created once. Pipelines are described up front and compiled on first use; the keys of those used are saved
+// (e.g. on exit), and at the next startup the ones described again are precompiled in the background, so that they
+// are ready by the time they are first drawn with rather than compiled mid-frame: with createRenderPipelineAsync, or on
+// wgpu-native, which does not implement it, with createRenderPipeline on a worker of the thread pool (without a pool,
+// there the compilation blocks). Everything stays cached until the cache is destroyed.
+//
+// Keys hash the state, and add() compares the whole descriptor with that of the pipeline found under its key: layouts
+// not from pipeline_layout() (and the automatic one) all hash the same, so pipelines told apart only by them get the
+// next free key instead.
+//
+// File layout (native endianness): Magic, Version, key count (uint32_t each), then the keys (uint64_t each)
+class PipelineCache
+{
+  public:
+    using path = std::filesystem::path;
+    using Key = uint64_t;
+
+    static constexpr uint32_t Magic = 0x43504757; // "WGPC"
+    static constexpr uint32_t Version = 1;
+
+    enum class Status
+    {
+        // Described, not compiled yet
+        Idle,
+        Compiling,
+        Ready,
+        Failed,
+    };
+
+    struct Stats
+    {
+        uint32_t pipeline_count = 0;
+        uint32_t pipeline_layout_count = 0;
+        uint32_t bind_group_layout_count = 0;
+        // Since creation: lookups of a pipeline compiled before, pipelines compiled on first use (hence blocking)
+        // and in the background
+        uint64_t hit_count = 0;
+        uint64_t blocking_compile_count = 0;
+        uint64_t background_compile_count = 0;
+    };
+
+    // Shader modules must come from the shader cache, which hashes their source and is to outlive this cache, as is the
+    // pool
+    PipelineCache(wgpu::Device device, const ShaderCache& shaders, ThreadPool* pool = nullptr);
+    ~PipelineCache();
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    // Owned by the cache, not to be released
+    wgpu::BindGroupLayout bind_group_layout(const wgpu::BindGroupLayoutDescriptor& descriptor);
+    // Of bind group layouts from above, owned by the cache
+    wgpu::PipelineLayout pipeline_layout(const std::vector<wgpu::BindGroupLayout>& bind_group_layouts);
+
+    // Describe a pipeline, whose layout comes from above (the descriptor is copied). Precompiled in the background if
+    // used by a previous run and precompilation was started.
+    Key add(const wgpu::RenderPipelineDescriptor& descriptor);
+
+    // The pipeline described under a key, compiled now if it is not already (after waiting for its background
+    // compilation if underway). Null if compilation failed. Owned by the cache, not to be released.
+    wgpu::RenderPipeline get(Key key);
+
+    // Start compiling a pipeline in the background, if not compiled or compiling already
+    void compile_async(Key key);
+    Status status(Key key) const;
+    // Publish the pipelines compiled by the thread pool since the last call (their status turns Ready or Failed).
+    // On the main thread, once per frame.
+    void poll();
+
+    // Read the keys saved by a previous run, and precompile those described from then on (and before)
+    bool load(const path& path);
+    // Write the keys of the pipelines used so far
+    bool save(const path& path) const;
+
+    const Stats& stats() const { return counters; }
+
+  private:
+    struct Pipeline;
+
+    // Wait for background compilations to finish, as their callbacks and the thread pool write into the pipelines
+    void wait();
+
+    wgpu::Device device = nullptr;
+    const ShaderCache& shaders;
+    ThreadPool* pool = nullptr;
+
+    struct CachedBindGroupLayout
+    {
+        Key key;
+        wgpu::BindGroupLayout layout;
+    };
+    struct CachedPipelineLayout
+    {
+        Key key;
+        wgpu::PipelineLayout layout;
+    };
+    std::vector<CachedBindGroupLayout> bind_group_layouts;
+    std::vector<CachedPipelineLayout> pipeline_layouts;
+    std::unordered_map<Key, std::unique_ptr<Pipeline>> pipelines;
+
+    // Keys used by a previous run, to be precompiled once described
+    std::vector<Key> warm_keys;
+    Stats counters;
+};
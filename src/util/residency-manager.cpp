@@ -0,0 +1,134 @@
+#include "residency-manager.h"
+#include "gpu-memory.h"
+
+void ResidencyManager::add(uint32_t texture, uint64_t bytes)
+{
+    Texture& entry = textures[texture];
+    entry = {};
+    entry.full_bytes = bytes;
+    entry.last_used = frame;
+}
+
+void ResidencyManager::remove(uint32_t texture)
+{
+    textures.erase(texture);
+}
+
+void ResidencyManager::touch(uint32_t texture)
+{
+    auto it = textures.find(texture);
+    if (it != textures.end())
+        it->second.last_used = frame;
+}
+
+void ResidencyManager::update(const EvictFunction& evict, const RestreamFunction& restream, const BytesFunction& bytes)
+{
+    ++frame;
+    const uint64_t usage = GpuMemory::stats().usage();
+
+    // Estimates of the memory of a restreamed texture only hold once the reload lands
+    for (const auto& [key, texture] : textures)
+    {
+        if (texture.restreaming)
+            return;
+    }
+
+    if (usage > budget)
+    {
+        // Those whose eviction frees memory first, then those that leave usage as is, so that no more textures are
+        // evicted than needed. Least recently used first among those, the biggest first among those used as recently.
+        auto rank = [&](uint32_t key) {
+            int64_t change = bytes(key, false);
+            return change < 0 ? 0 : (change == 0 ? 1 : 2);
+        };
+        auto victim = textures.end();
+        int victim_rank = 0;
+        for (auto it = textures.begin(); it != textures.end(); ++it)
+        {
+            const Texture& texture = it->second;
+            if (!texture.evictable)
+                continue;
+            const int texture_rank = rank(it->first);
+            if (victim == textures.end() || texture_rank < victim_rank ||
+                (texture_rank == victim_rank && (texture.last_used < victim->second.last_used ||
+                                                 (texture.last_used == victim->second.last_used && texture.bytes() > victim->second.bytes()))))
+            {
+                victim = it;
+                victim_rank = texture_rank;
+            }
+        }
+        if (victim == textures.end())
+            return;
+
+        if (evict(victim->first))
+        {
+            ++victim->second.evicted_levels;
+            ++counters.eviction_count;
+            last_eviction_frame = frame;
+        }
+        else
+        {
+            victim->second.evictable = false;
+        }
+        return;
+    }
+
+    if (counters.eviction_count > 0 && frame - last_eviction_frame < restream_delay)
+        return;
+
+    // Most recently used first, if what its full resolution adds, pages growing included, fits within 7/8 of the budget
+    auto candidate = textures.end();
+    for (auto it = textures.begin(); it != textures.end(); ++it)
+    {
+        if (it->second.evicted_levels > 0 && (candidate == textures.end() || it->second.last_used > candidate->second.last_used))
+            candidate = it;
+    }
+    if (candidate == textures.end())
+        return;
+    Texture& texture = candidate->second;
+    if (static_cast<int64_t>(usage) + bytes(candidate->first, true) <= static_cast<int64_t>(budget - budget / 8))
+    {
+        // Set first, as the reload may be over before restream returns
+        texture.restreaming = true;
+        if (!restream(candidate->first))
+            texture.restreaming = false;
+    }
+}
+
+void ResidencyManager::restreamed(uint32_t texture, bool success)
+{
+    auto it = textures.find(texture);
+    if (it == textures.end())
+        return;
+
+    it->second.restreaming = false;
+    if (success)
+    {
+        it->second.evicted_levels = 0;
+        it->second.evictable = true;
+        ++counters.restream_count;
+    }
+    else
+    {
+        // Stays at the level it was evicted to for good, as its new full resolution
+        it->second.full_bytes = it->second.bytes();
+        it->second.evicted_levels = 0;
+    }
+}
+
+ResidencyManager::Stats ResidencyManager::stats() const
+{
+    GpuMemory::Stats memory = GpuMemory::stats();
+    Stats stats = counters;
+    stats.budget = budget;
+    stats.usage = memory.usage();
+    stats.peak_usage = memory.peak_bytes;
+    stats.texture_bytes = memory.texture_bytes;
+    stats.buffer_bytes = memory.buffer_bytes;
+    stats.texture_count = static_cast<uint32_t>(textures.size());
+    for (const auto& [key, texture] : textures)
+    {
+        stats.evicted_textures += texture.evicted_levels > 0 ? 1 : 0;
+    }
+    return stats;
+}
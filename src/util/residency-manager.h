@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+// Keeps the GPU memory tracked by GpuMemory within a budget. While over it, the least recently used texture is
+// evicted one mip level at a time (its finest level dropped, see TexturePool::demote); once usage is back under the
+// budget with room to spare, evicted textures are streamed back in at full resolution, the most recently used first.
+// At most one texture changes per update, so that each change shows in GpuMemory before the next is decided.
+//
+// Textures do not take and give back memory on their own (a texture pool page grows and shrinks many layers at a
+// time), so both decisions rely on what the caller reports a change would actually cost: evictions that free memory
+// right away go first, and a texture is only restreamed if what its reload adds fits.
+//
+// Textures are identified by keys of the caller's choosing, and evicted and restreamed by the caller.
+class ResidencyManager
+{
+  public:
+    struct Stats
+    {
+        uint64_t budget = 0;
+        // Tracked by GpuMemory, and its highest value since startup
+        uint64_t usage = 0;
+        uint64_t peak_usage = 0;
+        uint64_t texture_bytes = 0;
+        uint64_t buffer_bytes = 0;
+        // Textures managed, and how many of them are evicted to a lower level
+        uint32_t texture_count = 0;
+        uint32_t evicted_textures = 0;
+        // Since creation
+        uint64_t eviction_count = 0;
+        uint64_t restream_count = 0;
+    };
+
+    // Drop the finest level of a texture, return false if it cannot go any lower
+    using EvictFunction = std::function<bool(uint32_t texture)>;
+    // Start reloading a texture at full resolution, to be reported to restreamed() once done
+    using RestreamFunction = std::function<bool(uint32_t texture)>;
+    // GPU memory evicting one more level of a texture (restream false), or restreaming it, would take on, negative
+    // when the change gives memory back
+    using BytesFunction = std::function<int64_t(uint32_t texture, bool restream)>;
+
+    explicit ResidencyManager(uint64_t budget) : budget(budget) {}
+
+    void set_budget(uint64_t value) { budget = value; }
+
+    // Manage a texture resident at full resolution, taking bytes of GPU memory
+    void add(uint32_t texture, uint64_t bytes);
+    void remove(uint32_t texture);
+    uint32_t texture_count() const { return static_cast<uint32_t>(textures.size()); }
+
+    // Mark a texture as used this frame
+    void touch(uint32_t texture);
+
+    // Once per frame: evict or restream (at most) one texture
+    void update(const EvictFunction& evict, const RestreamFunction& restream, const BytesFunction& bytes);
+
+    // The reload started by the RestreamFunction is over, the texture being back at full resolution on success
+    void restreamed(uint32_t texture, bool success);
+
+    Stats stats() const;
+
+  private:
+    struct Texture
+    {
+        uint64_t full_bytes = 0;
+        uint32_t evicted_levels = 0;
+        uint64_t last_used = 0;
+        // Cleared when the EvictFunction refuses, until restreamed
+        bool evictable = true;
+        bool restreaming = false;
+
+        // Each level dropped divides the memory of the texture by about 4
+        uint64_t bytes() const { return full_bytes >> (2 * evicted_levels); }
+    };
+
+    uint64_t budget = 0;
+    std::unordered_map<uint32_t, Texture> textures;
+    uint64_t frame = 0;
+    // Restreaming only starts this many frames after the last eviction, so that textures do not bounce in and out
+    uint64_t restream_delay = 120;
+    uint64_t last_eviction_frame = 0;
+    Stats counters;
+};
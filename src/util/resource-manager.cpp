@@ -1,30 +1,52 @@
 #include "resource-manager.h"
+#include "mesh-cache.h"
+#include "mesh-optimizer.h"
+#include "obj-parser.h"
+#include "mapped-file.h"
+#include "mip-generator.h"
+#include "gpu-mip-generator.h"
+#include "gpu-memory.h"
+#include "texture-container.h"
+#include "staging-uploader.h"
+#include "staging-ring.h"
+#include "thread-pool.h"
 
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
 
 #include <fstream>
 #include <cstring>
+#include <unordered_map>
+#include <chrono>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif
 
 using namespace wgpu;
 
 ShaderModule ResourceManager::load_shader_module(const path& path, Device device)
 {
-    std::ifstream file(path);
-    if (!file.is_open())
+    std::string shader_source;
+    if (!load_shader_source(path, shader_source))
     {
         return nullptr;
     }
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    std::string shader_source(size, ' ');
-    file.seekg(0);
-    file.read(shader_source.data(), size);
+    return create_shader_module(shader_source, device);
+}
 
+bool ResourceManager::load_shader_source(const path& path, std::string& source, const ShaderPreprocessor::Defines& defines,
+                                         std::vector<std::filesystem::path>* files)
+{
+    return ShaderPreprocessor::process(path, defines, source, files);
+}
+
+ShaderModule ResourceManager::create_shader_module(const std::string& source, Device device)
+{
     ShaderModuleWGSLDescriptor shader_code_desc;
     shader_code_desc.chain.next = nullptr;
     shader_code_desc.chain.sType = SType::ShaderModuleWGSLDescriptor;
-    shader_code_desc.code = shader_source.c_str();
+    shader_code_desc.code = source.c_str();
     ShaderModuleDescriptor shader_desc;
     shader_desc.nextInChain = &shader_code_desc.chain;
 #ifdef WEBGPU_BACKEND_WGPU
@@ -35,17 +57,29 @@ ShaderModule ResourceManager::load_shader_module(const path& path, Device device
     return device.createShaderModule(shader_desc);
 }
 
-bool ResourceManager::load_geometry_from_obj(const path& path, std::vector<VertexAttributes>& vertexData)
+// Auxiliary function for load_geometry_from_obj
+static bool load_obj(const std::filesystem::path& path, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+                     std::vector<tinyobj::material_t>& materials, ThreadPool* pool)
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
+    // Below this size, spinning up the parallel parse costs more than it saves
+    constexpr uintmax_t parallel_parse_min_size = 16 << 20;
+
+    std::error_code ec;
+    if (pool && pool->size() > 0 && std::filesystem::file_size(path, ec) >= parallel_parse_min_size && !ec)
+    {
+        if (ParallelObjParser::parse(path, *pool, attrib, shapes, materials))
+        {
+            return true;
+        }
+        std::cout << "OBJ file uses features the parallel parser does not handle, parsing it serially" << std::endl;
+    }
 
     std::string warn;
     std::string err;
 
-    // Call the core loading procedure of TinyOBJLoader
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.string().c_str());
+    // Call the core loading procedure of TinyOBJLoader, looking for MTL files next to the OBJ file
+    std::string mtl_basedir = path.parent_path().string();
+    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.string().c_str(), mtl_basedir.c_str());
 
     // Check errors
     if (!warn.empty())
@@ -58,7 +92,32 @@ bool ResourceManager::load_geometry_from_obj(const path& path, std::vector<Verte
         std::cerr << err << std::endl;
     }
 
-    if (!ret)
+    return ret;
+}
+
+// Auxiliary function for load_geometry_from_obj, converting an OBJ corner to our (Z-up) vertex layout
+static ResourceManager::VertexAttributes make_vertex(const tinyobj::attrib_t& attrib, const tinyobj::index_t& idx)
+{
+    ResourceManager::VertexAttributes vertex;
+
+    vertex.position = {attrib.vertices[3 * idx.vertex_index + 0], -attrib.vertices[3 * idx.vertex_index + 2],
+                       attrib.vertices[3 * idx.vertex_index + 1]};
+
+    vertex.normal = {attrib.normals[3 * idx.normal_index + 0], -attrib.normals[3 * idx.normal_index + 2], attrib.normals[3 * idx.normal_index + 1]};
+
+    vertex.color = {attrib.colors[3 * idx.vertex_index + 0], attrib.colors[3 * idx.vertex_index + 1], attrib.colors[3 * idx.vertex_index + 2]};
+
+    vertex.uv = {attrib.texcoords[2 * idx.texcoord_index + 0], 1 - attrib.texcoords[2 * idx.texcoord_index + 1]};
+
+    return vertex;
+}
+
+bool ResourceManager::load_geometry_from_obj(const path& path, std::vector<VertexAttributes>& vertexData, ThreadPool* pool)
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    if (!load_obj(path, attrib, shapes, materials, pool))
     {
         return false;
     }
@@ -72,90 +131,633 @@ bool ResourceManager::load_geometry_from_obj(const path& path, std::vector<Verte
 
         for (size_t i = 0; i < shape.mesh.indices.size(); ++i)
         {
-            const tinyobj::index_t& idx = shape.mesh.indices[i];
+            vertexData[offset + i] = make_vertex(attrib, shape.mesh.indices[i]);
+        }
+    }
+
+    return true;
+}
+
+namespace
+{
+// Hashes and compares vertices bit-wise, so that only corners with exactly the same attributes get merged
+struct VertexHash
+{
+    size_t operator()(const ResourceManager::VertexAttributes& v) const
+    {
+        // FNV-1a over the raw bytes (the structure is tightly packed floats)
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(v); ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+};
+
+struct VertexEqual
+{
+    bool operator()(const ResourceManager::VertexAttributes& a, const ResourceManager::VertexAttributes& b) const
+    {
+        return memcmp(&a, &b, sizeof(a)) == 0;
+    }
+};
+} // namespace
+
+bool ResourceManager::load_geometry_from_obj(const path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData,
+                                             std::vector<Submesh>& submeshes, std::vector<Material>& materials, ThreadPool* pool)
+{
+    static_assert(sizeof(VertexAttributes) == 11 * sizeof(float), "VertexAttributes must not contain padding to be hashed bit-wise");
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> obj_materials;
+    if (!load_obj(path, attrib, shapes, obj_materials, pool))
+    {
+        return false;
+    }
+
+    materials.clear();
+    for (const tinyobj::material_t& obj_material : obj_materials)
+    {
+        Material& material = materials.emplace_back();
+        material.name = obj_material.name;
+        material.diffuse = {obj_material.diffuse[0], obj_material.diffuse[1], obj_material.diffuse[2]};
+        if (!obj_material.diffuse_texname.empty())
+        {
+            material.diffuse_texture = path.parent_path() / obj_material.diffuse_texname;
+        }
+    }
 
-            vertexData[offset + i].position = {attrib.vertices[3 * idx.vertex_index + 0], -attrib.vertices[3 * idx.vertex_index + 2],
-                                               attrib.vertices[3 * idx.vertex_index + 1]};
+    size_t corner_count = 0;
+    for (const auto& shape : shapes)
+    {
+        corner_count += shape.mesh.indices.size();
+    }
 
-            vertexData[offset + i].normal = {attrib.normals[3 * idx.normal_index + 0], -attrib.normals[3 * idx.normal_index + 2],
-                                             attrib.normals[3 * idx.normal_index + 1]};
+    vertexData.clear();
+    indexData.clear();
+    indexData.reserve(corner_count);
+
+    // Map each unique vertex to its position in vertexData
+    std::unordered_map<VertexAttributes, uint32_t, VertexHash, VertexEqual> unique_vertices;
+    unique_vertices.reserve(corner_count / 2);
+
+    // Material of each triangle, shifted by one so that "no material" (-1) comes first
+    std::vector<uint32_t> triangle_keys;
+    triangle_keys.reserve(corner_count / 3);
+    std::vector<uint32_t> key_counts(materials.size() + 1, 0);
+
+    for (const auto& shape : shapes)
+    {
+        for (const tinyobj::index_t& idx : shape.mesh.indices)
+        {
+            VertexAttributes vertex = make_vertex(attrib, idx);
+            auto [it, inserted] = unique_vertices.try_emplace(vertex, static_cast<uint32_t>(vertexData.size()));
+            if (inserted)
+            {
+                vertexData.push_back(vertex);
+            }
+            indexData.push_back(it->second);
+        }
 
-            vertexData[offset + i].color = {attrib.colors[3 * idx.vertex_index + 0], attrib.colors[3 * idx.vertex_index + 1],
-                                            attrib.colors[3 * idx.vertex_index + 2]};
+        for (size_t t = 0; t < shape.mesh.indices.size() / 3; ++t)
+        {
+            int material = t < shape.mesh.material_ids.size() ? shape.mesh.material_ids[t] : -1;
+            uint32_t key = material >= 0 && size_t(material) < materials.size() ? uint32_t(material) + 1 : 0;
+            triangle_keys.push_back(key);
+            ++key_counts[key];
+        }
+    }
+
+    // Group triangles by material (stable counting sort), one submesh per material in use
+    submeshes.clear();
+    std::vector<uint32_t> key_offsets(key_counts.size(), 0);
+    uint32_t first_index = 0;
+    for (size_t key = 0; key < key_counts.size(); ++key)
+    {
+        key_offsets[key] = first_index;
+        if (key_counts[key] > 0)
+        {
+            submeshes.push_back({first_index, 3 * key_counts[key], static_cast<int32_t>(key) - 1});
+        }
+        first_index += 3 * key_counts[key];
+    }
 
-            vertexData[offset + i].uv = {attrib.texcoords[2 * idx.texcoord_index + 0], 1 - attrib.texcoords[2 * idx.texcoord_index + 1]};
+    if (submeshes.size() > 1)
+    {
+        std::vector<uint32_t> grouped(indexData.size());
+        for (size_t t = 0; t < triangle_keys.size(); ++t)
+        {
+            uint32_t& offset = key_offsets[triangle_keys[t]];
+            std::copy_n(indexData.begin() + 3 * t, 3, grouped.begin() + offset);
+            offset += 3;
         }
+        indexData = std::move(grouped);
     }
 
+    std::cout << "Loaded " << corner_count << " corners into " << vertexData.size() << " unique vertices, " << submeshes.size() << " submeshes"
+              << std::endl;
+
     return true;
 }
 
-// Auxiliary function for load_texture
-static void write_mip_maps(Device device, Texture texture, Extent3D texture_size, uint32_t mip_level_count, const unsigned char* pixel_data)
+bool ResourceManager::load_geometry_cached(const path& path, MeshCache& cache, const GeometryOptions& options, ThreadPool* pool)
 {
-    Queue queue = device.getQueue();
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
 
-    // Arguments telling which part of the texture we upload to
-    ImageCopyTexture destination;
-    destination.texture = texture;
-    destination.origin = {0, 0, 0};
-    destination.aspect = TextureAspect::All;
+    if (cache.open(path, options))
+    {
+        float cache_ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+        float obj_ms = cache.header().source_load_ms;
+        std::cout << "Loaded geometry from cache in " << cache_ms << " ms (OBJ: " << obj_ms << " ms, " << obj_ms / std::max(cache_ms, 1e-3f)
+                  << "x faster)" << std::endl;
+        return true;
+    }
 
-    // Arguments telling how the C++ side pixel memory is laid out
-    TextureDataLayout source;
-    source.offset = 0;
+    std::vector<VertexAttributes> vertex_data;
+    std::vector<uint32_t> index_data;
+    std::vector<Submesh> submeshes;
+    std::vector<Material> materials;
+    if (!load_geometry_from_obj(path, vertex_data, index_data, submeshes, materials, pool))
+    {
+        return false;
+    }
+    float obj_ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+    std::cout << "Loaded geometry from OBJ in " << obj_ms << " ms, baking cache" << std::endl;
+
+    if (options.optimize)
+    {
+        MeshOptimizer::optimize(vertex_data, index_data, submeshes);
+    }
+
+    // Even if the cache cannot be written to disk, it still holds the data for this run
+    cache.bake(path, vertex_data, index_data, submeshes, materials, options, obj_ms);
 
-    // Create image data
-    Extent3D mip_level_size = texture_size;
-    std::vector<unsigned char> previous_level_pixels;
-    Extent3D previous_mip_level_size;
-    for (uint32_t level = 0; level < mip_level_count; ++level)
+    if (options.encoding == VertexEncoding::Quantized)
     {
-        // Pixel data for the current level
-        std::vector<unsigned char> pixels(4 * mip_level_size.width * mip_level_size.height);
-        if (level == 0)
+        const VertexQuantization& q = cache.header().quantization;
+        std::cout << "Quantized vertices: max position error " << q.max_position_error << " (" << 100.0f * q.max_position_error / glm::length(q.position_scale)
+                  << "% of the bounds diagonal), max normal error " << q.max_normal_error << " deg, max uv error " << q.max_uv_error << std::endl;
+    }
+    return true;
+}
+
+static_assert(sizeof(ResourceManager::PackedVertexAttributes) == 20, "PackedVertexAttributes must match the vertex layout of vs_main_packed");
+
+// Octahedral mapping of a unit vector to [-1, 1]^2
+static glm::vec2 oct_encode(glm::vec3 n)
+{
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        glm::vec2 sign_not_zero(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+        p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * sign_not_zero;
+    }
+    return p;
+}
+
+// Inverse of oct_encode, as done by vs_main_packed
+static glm::vec3 oct_decode(glm::vec2 p)
+{
+    glm::vec3 n(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+static uint16_t to_unorm16(float x)
+{
+    return static_cast<uint16_t>(std::round(glm::clamp(x, 0.0f, 1.0f) * 65535.0f));
+}
+
+static int16_t to_snorm16(float x)
+{
+    return static_cast<int16_t>(std::round(glm::clamp(x, -1.0f, 1.0f) * 32767.0f));
+}
+
+ResourceManager::VertexQuantization ResourceManager::quantize_vertices(const std::vector<VertexAttributes>& vertices,
+                                                                       std::vector<PackedVertexAttributes>& packed)
+{
+    VertexQuantization q;
+    packed.resize(vertices.size());
+    if (vertices.empty())
+    {
+        return q;
+    }
+
+    glm::vec3 position_min = vertices[0].position, position_max = vertices[0].position;
+    glm::vec2 uv_min = vertices[0].uv, uv_max = vertices[0].uv;
+    for (const VertexAttributes& v : vertices)
+    {
+        position_min = glm::min(position_min, v.position);
+        position_max = glm::max(position_max, v.position);
+        uv_min = glm::min(uv_min, v.uv);
+        uv_max = glm::max(uv_max, v.uv);
+    }
+
+    // Flat extents keep a unit scale so that decoding stays well defined
+    auto safe_extent = [](auto extent) { return glm::mix(extent, decltype(extent)(1.0f), glm::equal(extent, decltype(extent)(0.0f))); };
+    q.position_offset = position_min;
+    q.position_scale = safe_extent(position_max - position_min);
+    q.uv_offset = uv_min;
+    q.uv_scale = safe_extent(uv_max - uv_min);
+
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        const VertexAttributes& v = vertices[i];
+        PackedVertexAttributes& p = packed[i];
+
+        glm::vec3 position = (v.position - q.position_offset) / q.position_scale;
+        p.position[0] = to_unorm16(position.x);
+        p.position[1] = to_unorm16(position.y);
+        p.position[2] = to_unorm16(position.z);
+        p.position[3] = 0;
+
+        glm::vec3 normal = glm::length(v.normal) > 0.0f ? glm::normalize(v.normal) : glm::vec3(0.0f, 0.0f, 1.0f);
+        glm::vec2 oct = oct_encode(normal);
+        p.normal[0] = to_snorm16(oct.x);
+        p.normal[1] = to_snorm16(oct.y);
+
+        glm::vec3 color = glm::clamp(v.color, 0.0f, 1.0f);
+        p.color[0] = static_cast<uint8_t>(std::round(color.r * 255.0f));
+        p.color[1] = static_cast<uint8_t>(std::round(color.g * 255.0f));
+        p.color[2] = static_cast<uint8_t>(std::round(color.b * 255.0f));
+        p.color[3] = 255;
+
+        glm::vec2 uv = (v.uv - q.uv_offset) / q.uv_scale;
+        p.uv[0] = to_unorm16(uv.x);
+        p.uv[1] = to_unorm16(uv.y);
+
+        // Decode the same way the shader does to measure the error
+        glm::vec3 decoded_position = q.position_offset + glm::vec3(p.position[0], p.position[1], p.position[2]) / 65535.0f * q.position_scale;
+        glm::vec3 decoded_normal = oct_decode(glm::max(glm::vec2(p.normal[0], p.normal[1]) / 32767.0f, -1.0f));
+        glm::vec2 decoded_uv = q.uv_offset + glm::vec2(p.uv[0], p.uv[1]) / 65535.0f * q.uv_scale;
+
+        q.max_position_error = std::max(q.max_position_error, glm::length(decoded_position - v.position));
+        float cos_angle = glm::clamp(glm::dot(decoded_normal, normal), -1.0f, 1.0f);
+        q.max_normal_error = std::max(q.max_normal_error, glm::degrees(std::acos(cos_angle)));
+        q.max_uv_error = std::max(q.max_uv_error, glm::length(decoded_uv - v.uv));
+    }
+
+    return q;
+}
+
+// Auxiliary function for stream_geometry_from_obj, counting the triangles the faces of an OBJ file split into
+static uint64_t count_obj_triangles(const std::filesystem::path& path)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return 0;
+
+    const char* p = reinterpret_cast<const char*>(file.data());
+    const char* end = p + file.size();
+    uint64_t triangle_count = 0;
+    while (p < end)
+    {
+        const char* line_end = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!line_end)
+            line_end = end;
+
+        while (p < line_end && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (line_end - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            // Count the whitespace-separated corners
+            uint32_t corner_count = 0;
+            bool in_token = false;
+            for (p += 2; p < line_end; ++p)
+            {
+                bool separator = *p == ' ' || *p == '\t' || *p == '\r';
+                corner_count += (!separator && !in_token) ? 1 : 0;
+                in_token = !separator;
+            }
+            triangle_count += corner_count >= 3 ? corner_count - 2 : 0;
+        }
+        p = line_end + 1;
+    }
+    return triangle_count;
+}
+
+namespace
+{
+// State shared with the LoadObjWithCallback callbacks of stream_geometry_from_obj
+struct ObjStream
+{
+    tinyobj::attrib_t attrib;
+    StagingRing* ring = nullptr;
+    Buffer vertex_buffer = nullptr;
+    uint64_t capacity = 0; // in vertices
+
+    ResourceManager::VertexAttributes* chunk = nullptr;
+    uint64_t chunk_capacity = 0;
+    uint64_t chunk_size = 0;
+    uint64_t uploaded = 0;
+    bool overflow = false;
+    // No staging memory could be mapped
+    bool failed = false;
+
+    void flush()
+    {
+        if (chunk_size == 0)
+            return;
+        ring->submit(vertex_buffer, uploaded * sizeof(ResourceManager::VertexAttributes), chunk_size * sizeof(ResourceManager::VertexAttributes));
+        uploaded += chunk_size;
+        chunk_size = 0;
+        chunk = nullptr;
+    }
+
+    void emit(const tinyobj::index_t& idx)
+    {
+        if (uploaded + chunk_size >= capacity)
         {
-            // We cannot really avoid this copy since we need this
-            // in previous_level_pixels at the next iteration
-            memcpy(pixels.data(), pixel_data, pixels.size());
+            overflow = true;
+            return;
         }
-        else
+        if (failed)
+            return;
+        if (!chunk)
         {
-            // Create mip level data
-            for (uint32_t i = 0; i < mip_level_size.width; ++i)
+            chunk = reinterpret_cast<ResourceManager::VertexAttributes*>(ring->acquire());
+            if (!chunk)
             {
-                for (uint32_t j = 0; j < mip_level_size.height; ++j)
-                {
-                    unsigned char* p = &pixels[4 * (j * mip_level_size.width + i)];
-                    // Get the corresponding 4 pixels from the previous level
-                    unsigned char* p00 = &previous_level_pixels[4 * ((2 * j + 0) * previous_mip_level_size.width + (2 * i + 0))];
-                    unsigned char* p01 = &previous_level_pixels[4 * ((2 * j + 0) * previous_mip_level_size.width + (2 * i + 1))];
-                    unsigned char* p10 = &previous_level_pixels[4 * ((2 * j + 1) * previous_mip_level_size.width + (2 * i + 0))];
-                    unsigned char* p11 = &previous_level_pixels[4 * ((2 * j + 1) * previous_mip_level_size.width + (2 * i + 1))];
-                    // Average
-                    p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
-                    p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
-                    p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
-                    p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
-                }
+                failed = true;
+                return;
             }
         }
+        chunk[chunk_size++] = make_vertex(attrib, idx);
+        if (chunk_size == chunk_capacity)
+        {
+            flush();
+        }
+    }
+
+    // Resolve a raw OBJ index (1-based, negative for relative, 0 when absent)
+    static int fix_index(int idx, size_t count)
+    {
+        return idx > 0 ? idx - 1 : (idx < 0 ? static_cast<int>(count) + idx : -1);
+    }
 
-        // Upload data to the GPU texture
-        destination.mipLevel = level;
-        source.bytesPerRow = 4 * mip_level_size.width;
-        source.rowsPerImage = mip_level_size.height;
-        queue.writeTexture(destination, pixels.data(), pixels.size(), source, mip_level_size);
+    void add_face(tinyobj::index_t* indices, int count)
+    {
+        for (int k = 0; k < count; ++k)
+        {
+            indices[k].vertex_index = fix_index(indices[k].vertex_index, attrib.vertices.size() / 3);
+            indices[k].normal_index = fix_index(indices[k].normal_index, attrib.normals.size() / 3);
+            indices[k].texcoord_index = fix_index(indices[k].texcoord_index, attrib.texcoords.size() / 2);
+        }
 
-        previous_level_pixels = std::move(pixels);
-        previous_mip_level_size = mip_level_size;
-        mip_level_size.width /= 2;
-        mip_level_size.height /= 2;
+        if (count == 4)
+        {
+            // Split along the shortest diagonal, as tinyobj::LoadObj does
+            const std::vector<float>& v = attrib.vertices;
+            auto position = [&](int k) {
+                size_t i = 3 * size_t(indices[k].vertex_index);
+                return glm::vec3(v[i + 0], v[i + 1], v[i + 2]);
+            };
+            glm::vec3 e02 = position(2) - position(0);
+            glm::vec3 e13 = position(3) - position(1);
+            const int split02[] = {0, 1, 2, 0, 2, 3};
+            const int split13[] = {0, 1, 3, 1, 2, 3};
+            const int* order = glm::dot(e02, e02) < glm::dot(e13, e13) ? split02 : split13;
+            for (int k = 0; k < 6; ++k)
+                emit(indices[order[k]]);
+            return;
+        }
+
+        // Triangles, and a fan for larger polygons
+        for (int k = 2; k < count; ++k)
+        {
+            emit(indices[0]);
+            emit(indices[k - 1]);
+            emit(indices[k]);
+        }
+    }
+};
+} // namespace
+
+Buffer ResourceManager::stream_geometry_from_obj(const path& path, Device device, uint32_t& vertex_count, uint64_t staging_budget)
+{
+    vertex_count = 0;
+
+    // A first pass over the file tells how big the vertex buffer must be
+    uint64_t triangle_count = count_obj_triangles(path);
+    if (triangle_count == 0)
+    {
+        return nullptr;
+    }
+
+    // Geometry is de-indexed, which multi-GB files easily take beyond what a single buffer can hold. On Dawn, creating
+    // the buffer anyway would not fail but return an error buffer, so this is checked before parsing anything.
+    SupportedLimits device_limits;
+    device.getLimits(&device_limits);
+    const uint64_t buffer_size = 3 * triangle_count * sizeof(VertexAttributes);
+    if (buffer_size > device_limits.limits.maxBufferSize)
+    {
+        std::cerr << "Streamed geometry needs a " << (buffer_size >> 20) << " MB vertex buffer, over the "
+                  << (device_limits.limits.maxBufferSize >> 20) << " MB the device supports" << std::endl;
+        return nullptr;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return nullptr;
+    }
+
+    ObjStream stream;
+    stream.capacity = 3 * triangle_count;
+
+    BufferDescriptor buffer_desc;
+    buffer_desc.label = "Streamed vertex buffer";
+    buffer_desc.size = buffer_size;
+    buffer_desc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+    buffer_desc.mappedAtCreation = false;
+    stream.vertex_buffer = GpuMemory::create_buffer(device, buffer_desc);
+    if (!stream.vertex_buffer)
+    {
+        return nullptr;
+    }
+
+    // A few slots let the conversion of a chunk overlap with the copy of the previous ones
+    constexpr uint32_t slot_count = 4;
+    uint64_t slot_size = std::max<uint64_t>(staging_budget / slot_count / sizeof(VertexAttributes), 1) * sizeof(VertexAttributes);
+    StagingRing ring(device, slot_size, slot_count);
+    stream.ring = &ring;
+    stream.chunk_capacity = slot_size / sizeof(VertexAttributes);
+
+    tinyobj::callback_t callbacks;
+    callbacks.vertex_color_cb = [](void* user_data, float x, float y, float z, float r, float g, float b, bool) {
+        tinyobj::attrib_t& attrib = static_cast<ObjStream*>(user_data)->attrib;
+        attrib.vertices.insert(attrib.vertices.end(), {x, y, z});
+        attrib.colors.insert(attrib.colors.end(), {r, g, b});
+    };
+    callbacks.normal_cb = [](void* user_data, float x, float y, float z) {
+        tinyobj::attrib_t& attrib = static_cast<ObjStream*>(user_data)->attrib;
+        attrib.normals.insert(attrib.normals.end(), {x, y, z});
+    };
+    callbacks.texcoord_cb = [](void* user_data, float x, float y, float) {
+        tinyobj::attrib_t& attrib = static_cast<ObjStream*>(user_data)->attrib;
+        attrib.texcoords.insert(attrib.texcoords.end(), {x, y});
+    };
+    callbacks.index_cb = [](void* user_data, tinyobj::index_t* indices, int num_indices) {
+        static_cast<ObjStream*>(user_data)->add_face(indices, num_indices);
+    };
+
+    std::string warn;
+    std::string err;
+    bool ret = tinyobj::LoadObjWithCallback(file, callbacks, &stream, nullptr, &warn, &err);
+    stream.flush();
+    ring.finish();
+
+    if (!warn.empty())
+    {
+        std::cout << warn << std::endl;
+    }
+    if (!err.empty())
+    {
+        std::cerr << err << std::endl;
+    }
+    if (stream.failed)
+    {
+        std::cerr << "Could not map staging memory to stream geometry" << std::endl;
+    }
+    if (!ret || stream.overflow || stream.failed)
+    {
+        GpuMemory::destroy(stream.vertex_buffer);
+        return nullptr;
     }
 
+    vertex_count = static_cast<uint32_t>(stream.uploaded);
+    std::cout << "Streamed " << vertex_count << " vertices through " << slot_count << " x " << slot_size / (1 << 20) << " MB of staging memory"
+              << std::endl;
+    return stream.vertex_buffer;
+}
+
+IndexFormat ResourceManager::pack_indices(const std::vector<uint32_t>& indices, size_t vertex_count, std::vector<uint8_t>& packed)
+{
+    // 0xFFFF is reserved as the primitive restart value of Uint16 strips, so we keep it out of the range
+    const bool narrow = vertex_count < 0xFFFF;
+    const size_t stride = narrow ? sizeof(uint16_t) : sizeof(uint32_t);
+
+    packed.assign((indices.size() * stride + 3) & ~size_t(3), 0);
+    if (narrow)
+    {
+        uint16_t* dst = reinterpret_cast<uint16_t*>(packed.data());
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            dst[i] = static_cast<uint16_t>(indices[i]);
+        }
+    }
+    else
+    {
+        memcpy(packed.data(), indices.data(), indices.size() * sizeof(uint32_t));
+    }
+
+    return narrow ? IndexFormat::Uint16 : IndexFormat::Uint32;
+}
+
+Buffer ResourceManager::create_buffer_with_data(Device device, BufferUsage usage, const void* data, uint64_t size)
+{
+    assert(size % 4 == 0);
+
+    BufferDescriptor buffer_desc;
+    buffer_desc.size = size;
+    buffer_desc.usage = usage;
+    buffer_desc.mappedAtCreation = true;
+    Buffer buffer = GpuMemory::create_buffer(device, buffer_desc);
+    if (!buffer)
+        return nullptr;
+
+    memcpy(buffer.getMappedRange(0, size), data, size);
+    buffer.unmap();
+    return buffer;
+}
+
+void ResourceManager::poll_device(Device device)
+{
+#if defined(__EMSCRIPTEN__)
+    (void)device;
+    emscripten_sleep(1);
+#elif defined(WEBGPU_BACKEND_DAWN)
+    device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+    // Submitting an empty batch lets wgpu-native poll the device
+    Queue queue = device.getQueue();
+    queue.submit(0, nullptr);
+    queue.release();
+#endif
+}
+
+// Auxiliary function for load_texture, pixels being RGBA8 unless format is block-compressed.
+// Goes through the staging uploader if given, straight to the queue otherwise. Returns the size of the level in bytes.
+static size_t write_mip_level(Queue queue, StagingUploader* uploader, Texture texture, uint32_t layer, uint32_t level, const uint8_t* pixels,
+                              uint32_t width, uint32_t height, TextureFormat format = TextureFormat::RGBA8Unorm)
+{
+    // Arguments telling which part of the texture we upload to
+    ImageCopyTexture destination;
+    destination.texture = texture;
+    destination.mipLevel = level;
+    destination.origin = {0, 0, layer};
+    destination.aspect = TextureAspect::All;
+
+    // Compressed levels are copied as whole 4x4 blocks, even past the edge of the smallest ones
+    uint32_t block_size, block_bytes;
+    GpuMemory::block_layout(format, block_size, block_bytes);
+    uint32_t block_columns = (width + block_size - 1) / block_size;
+    uint32_t block_rows = (height + block_size - 1) / block_size;
+
+    Extent3D copy_size = {block_columns * block_size, block_rows * block_size, 1};
+    if (uploader)
+    {
+        uploader->upload_texture(destination, pixels, block_bytes * block_columns, block_rows, copy_size);
+        return size_t(block_bytes) * block_columns * block_rows;
+    }
+
+    // Arguments telling how the C++ side pixel memory is laid out
+    TextureDataLayout source;
+    source.offset = 0;
+    source.bytesPerRow = block_bytes * block_columns;
+    source.rowsPerImage = block_rows;
+    size_t size = size_t(block_bytes) * block_columns * block_rows;
+    queue.writeTexture(destination, pixels, size, source, copy_size);
+    return size;
+}
+
+// Auxiliary function for load_texture
+static void write_mip_maps(Device device, StagingUploader* uploader, Texture texture, uint32_t layer, Extent3D texture_size, uint32_t mip_level_count,
+                           const unsigned char* pixel_data, bool srgb)
+{
+    Queue queue = device.getQueue();
+
+    // Level 0 is uploaded straight from pixel_data, and uploads copy the data they are given,
+    // so the generator is free to reuse its buffers for the next levels
+    MipGenerator::generate(pixel_data, texture_size.width, texture_size.height, mip_level_count, srgb,
+                           [&](uint32_t level, const uint8_t* pixels, uint32_t width, uint32_t height) {
+                               write_mip_level(queue, uploader, texture, layer, level, pixels, width, height);
+                           });
+
     queue.release();
 }
 
+static TextureView create_texture_view(Texture texture, TextureFormat format, uint32_t mip_level_count)
+{
+    TextureViewDescriptor texture_view_desc;
+    texture_view_desc.aspect = TextureAspect::All;
+    texture_view_desc.baseArrayLayer = 0;
+    texture_view_desc.arrayLayerCount = 1;
+    texture_view_desc.baseMipLevel = 0;
+    texture_view_desc.mipLevelCount = mip_level_count;
+    texture_view_desc.dimension = TextureViewDimension::_2D;
+    texture_view_desc.format = format;
+    return texture.createView(texture_view_desc);
+}
+
 // Equivalent of std::bit_width that is available from C++20 onward
 static uint32_t bit_width(uint32_t m)
 {
@@ -170,44 +772,206 @@ static uint32_t bit_width(uint32_t m)
     }
 }
 
-Texture ResourceManager::load_texture(const path& path, Device device, TextureView* texture_view)
+void ResourceManager::Image::PixelDeleter::operator()(uint8_t* pixels) const
+{
+    stbi_image_free(pixels);
+}
+
+ResourceManager::Image ResourceManager::load_image(const path& path, bool srgb, bool cpu_mip_maps)
 {
+    Image image;
     int width, height, channels;
-    unsigned char* pixel_data = stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */);
+    image.pixels.reset(stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */));
     // If data is null, loading failed.
-    if (nullptr == pixel_data)
+    if (!image.pixels)
+        return image;
+
+    image.width = static_cast<uint32_t>(width);
+    image.height = static_cast<uint32_t>(height);
+    image.level_count = bit_width(std::max(image.width, image.height));
+    image.srgb = srgb;
+
+    if (cpu_mip_maps)
+    {
+        MipGenerator::generate(image.pixels.get(), image.width, image.height, image.level_count, srgb,
+                               [&](uint32_t level, const uint8_t* pixels, uint32_t level_width, uint32_t level_height) {
+                                   if (level > 0)
+                                       image.mip_levels.insert(image.mip_levels.end(), pixels, pixels + 4 * size_t(level_width) * level_height);
+                               });
+    }
+    return image;
+}
+
+ResourceManager::Image ResourceManager::load_image_container(const path& path, bool texture_compression_bc)
+{
+    Image image;
+    auto container = std::make_shared<TextureContainer>();
+    if (!container->open(path))
+        return image;
+
+    const TextureContainer::Header& header = container->header();
+    image.width = header.width;
+    image.height = header.height;
+    image.level_count = header.level_count;
+    image.srgb = header.srgb != 0;
+    if (texture_compression_bc || !TextureCompressor::is_compressed(header.format))
+    {
+        // Levels stay in the mapping until create_texture uploads them
+        image.format = TextureCompressor::texture_format(header.format);
+        image.container = container;
+    }
+    else
+    {
+        for (uint32_t level = 0; level < header.level_count; ++level)
+        {
+            size_t offset = image.level_data.size();
+            uint32_t width = container->level_width(level);
+            uint32_t height = container->level_height(level);
+            image.level_data.resize(offset + 4 * size_t(width) * height);
+            TextureCompressor::decompress(container->level_data(level), width, height, header.format, image.level_data.data() + offset);
+        }
+    }
+    return image;
+}
+
+std::future<ResourceManager::Image> ResourceManager::load_image_async(const path& path, ThreadPool& pool, bool srgb, bool cpu_mip_maps,
+                                                                      bool texture_compression_bc)
+{
+    return pool.submit([path, srgb, cpu_mip_maps, texture_compression_bc] {
+        Image image = load_image_container(path, texture_compression_bc);
+        return image.is_valid() ? std::move(image) : load_image(path, srgb, cpu_mip_maps);
+    });
+}
+
+bool ResourceManager::uses_gpu_mip_maps(const Image& image, GpuMipGenerator* gpu_mip_generator)
+{
+    const bool cpu_mip_maps = !image.mip_levels.empty() || image.container || !image.level_data.empty() || image.level_count < 2;
+    return !cpu_mip_maps && gpu_mip_generator && gpu_mip_generator->is_valid();
+}
+
+void ResourceManager::write_image(Device device, const Image& image, Texture texture, uint32_t layer, GpuMipGenerator* gpu_mip_generator,
+                                  StagingUploader* uploader)
+{
+    const Extent3D size = {image.width, image.height, 1};
+    if (image.container)
+    {
+        // Levels are copied straight from the mapping, there is no intermediate copy on our side
+        Queue queue = device.getQueue();
+        for (uint32_t level = 0; level < image.level_count; ++level)
+        {
+            write_mip_level(queue, uploader, texture, layer, level, image.container->level_data(level), image.container->level_width(level),
+                            image.container->level_height(level), image.format);
+        }
+        queue.release();
+    }
+    else if (!image.level_data.empty())
+    {
+        Queue queue = device.getQueue();
+        const uint8_t* level_data = image.level_data.data();
+        for (uint32_t level = 0; level < image.level_count; ++level)
+        {
+            uint32_t width = MipGenerator::level_size(image.width, level);
+            uint32_t height = MipGenerator::level_size(image.height, level);
+            level_data += write_mip_level(queue, uploader, texture, layer, level, level_data, width, height, image.format);
+        }
+        queue.release();
+    }
+    else if (!image.mip_levels.empty() || image.level_count < 2)
+    {
+        Queue queue = device.getQueue();
+        write_mip_level(queue, uploader, texture, layer, 0, image.pixels.get(), image.width, image.height);
+        const uint8_t* level_pixels = image.mip_levels.data();
+        for (uint32_t level = 1; level < image.level_count; ++level)
+        {
+            uint32_t width = MipGenerator::level_size(image.width, level);
+            uint32_t height = MipGenerator::level_size(image.height, level);
+            write_mip_level(queue, uploader, texture, layer, level, level_pixels, width, height);
+            level_pixels += 4 * size_t(width) * height;
+        }
+        queue.release();
+    }
+    else if (uses_gpu_mip_maps(image, gpu_mip_generator))
+    {
+        write_mip_maps(device, uploader, texture, layer, size, 1, image.pixels.get(), image.srgb);
+        // The generator submits right away, after level 0 only if its upload was submitted first
+        if (uploader)
+            uploader->submit();
+        gpu_mip_generator->generate(texture, size, image.level_count, image.srgb, layer);
+    }
+    else
+    {
+        write_mip_maps(device, uploader, texture, layer, size, image.level_count, image.pixels.get(), image.srgb);
+    }
+}
+
+Texture ResourceManager::create_texture(Device device, const Image& image, TextureView* texture_view, GpuMipGenerator* gpu_mip_generator,
+                                        StagingUploader* uploader)
+{
+    if (!image.is_valid())
         return nullptr;
 
-    // Use the width, height, channels and data variables here
     TextureDescriptor texture_desc;
     texture_desc.dimension = TextureDimension::_2D;
-    texture_desc.format = TextureFormat::RGBA8Unorm; // by convention for bmp, png and jpg file. Be careful with other formats.
-    texture_desc.size = {(unsigned int)width, (unsigned int)height, 1};
-    texture_desc.mipLevelCount = bit_width(std::max(texture_desc.size.width, texture_desc.size.height));
+    texture_desc.format = image.format; // RGBA8Unorm by convention for bmp, png and jpg file
+    texture_desc.size = {image.width, image.height, 1};
+    texture_desc.mipLevelCount = image.level_count;
     texture_desc.sampleCount = 1;
     texture_desc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
     texture_desc.viewFormatCount = 0;
     texture_desc.viewFormats = nullptr;
-    Texture texture = device.createTexture(texture_desc);
+    if (uses_gpu_mip_maps(image, gpu_mip_generator))
+    {
+        // Levels are written by the mipmap compute shader
+        texture_desc.usage = texture_desc.usage | TextureUsage::StorageBinding;
+    }
+    Texture texture = GpuMemory::create_texture(device, texture_desc);
 
     // Upload data to the GPU texture
-    write_mip_maps(device, texture, texture_desc.size, texture_desc.mipLevelCount, pixel_data);
-
-    stbi_image_free(pixel_data);
-    // (Do not use data after this)
+    write_image(device, image, texture, 0, gpu_mip_generator, uploader);
 
     if (texture_view)
     {
-        TextureViewDescriptor texture_view_desc;
-        texture_view_desc.aspect = TextureAspect::All;
-        texture_view_desc.baseArrayLayer = 0;
-        texture_view_desc.arrayLayerCount = 1;
-        texture_view_desc.baseMipLevel = 0;
-        texture_view_desc.mipLevelCount = texture_desc.mipLevelCount;
-        texture_view_desc.dimension = TextureViewDimension::_2D;
-        texture_view_desc.format = texture_desc.format;
-        *texture_view = texture.createView(texture_view_desc);
+        *texture_view = create_texture_view(texture, texture_desc.format, texture_desc.mipLevelCount);
     }
 
     return texture;
-}
\ No newline at end of file
+}
+
+Texture ResourceManager::create_placeholder_texture(Device device, glm::vec4 color, TextureView* texture_view)
+{
+    TextureDescriptor texture_desc;
+    texture_desc.dimension = TextureDimension::_2D;
+    texture_desc.format = TextureFormat::RGBA8Unorm;
+    texture_desc.size = {1, 1, 1};
+    texture_desc.mipLevelCount = 1;
+    texture_desc.sampleCount = 1;
+    texture_desc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+    texture_desc.viewFormatCount = 0;
+    texture_desc.viewFormats = nullptr;
+    Texture texture = GpuMemory::create_texture(device, texture_desc);
+
+    glm::vec4 clamped = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+    uint8_t pixel[4] = {uint8_t(clamped.r), uint8_t(clamped.g), uint8_t(clamped.b), uint8_t(clamped.a)};
+    Queue queue = device.getQueue();
+    write_mip_level(queue, nullptr, texture, 0, 0, pixel, 1, 1);
+    queue.release();
+
+    if (texture_view)
+    {
+        *texture_view = create_texture_view(texture, texture_desc.format, 1);
+    }
+    return texture;
+}
+
+Texture ResourceManager::load_texture(const path& path, Device device, TextureView* texture_view, bool srgb, GpuMipGenerator* gpu_mip_generator)
+{
+    // Without CPU mips, create_texture builds them on the GPU, or from level 0 as it uploads them
+    Image image = load_image(path, srgb, false);
+    return create_texture(device, image, texture_view, gpu_mip_generator);
+}
+
+Texture ResourceManager::load_texture_container(const path& path, Device device, TextureView* texture_view, bool texture_compression_bc)
+{
+    Image image = load_image_container(path, texture_compression_bc);
+    return create_texture(device, image, texture_view);
+}
@@ -1,9 +1,20 @@
 #pragma once
 
+#include "shader-preprocessor.h"
+
 #include <webgpu/webgpu.hpp>
 
 #include <vector>
+#include <string>
 #include <filesystem>
+#include <future>
+#include <memory>
+
+class MeshCache;
+class ThreadPool;
+class GpuMipGenerator;
+class TextureContainer;
+class StagingUploader;
 
 class ResourceManager
 {
@@ -21,13 +32,182 @@ class ResourceManager
         glm::vec2 uv;
     };
 
-    // Load a shader from a WGSL file into a new shader module
+    // The part of an MTL material we render with
+    struct Material
+    {
+        std::string name;
+        glm::vec3 diffuse = glm::vec3(1.0f);
+        // Diffuse map, resolved against the directory of the OBJ file (empty if none)
+        path diffuse_texture;
+    };
+
+    // A range of the index buffer whose triangles all use the same material
+    struct Submesh
+    {
+        uint32_t first_index;
+        uint32_t index_count;
+        // Index in the material table, -1 for faces without material
+        int32_t material;
+    };
+
+    // How vertices are stored in the vertex buffer
+    enum class VertexEncoding : uint32_t
+    {
+        // VertexAttributes as is (44 bytes)
+        Float32,
+        // PackedVertexAttributes (20 bytes), decoded by vs_main_packed
+        Quantized,
+    };
+
+    // How the vertex attributes are arranged in the vertex buffer
+    enum class VertexLayout : uint32_t
+    {
+        // One stream of whole vertices
+        Interleaved,
+        // The positions of all vertices, followed by the other attributes of all vertices: passes that only
+        // need positions (depth prepass, shadows) bind the first stream alone and fetch just the position bytes
+        Split,
+    };
+
+    // Compact counterpart of VertexAttributes, see quantize_vertices
+    struct PackedVertexAttributes
+    {
+        uint16_t position[4]; // unorm16 within the mesh bounds (w unused, there is no 3-component 16-bit format)
+        int16_t normal[2];    // snorm16 octahedral encoding
+        uint8_t color[4];     // unorm8 (a unused)
+        uint16_t uv[2];       // unorm16 within the mesh uv bounds
+    };
+
+    // What the shader needs to decode packed vertices, and how far they are from the originals
+    struct VertexQuantization
+    {
+        glm::vec3 position_offset = glm::vec3(0.0f);
+        glm::vec3 position_scale = glm::vec3(1.0f);
+        glm::vec2 uv_offset = glm::vec2(0.0f);
+        glm::vec2 uv_scale = glm::vec2(1.0f);
+
+        float max_position_error = 0.0f; // in mesh units
+        float max_normal_error = 0.0f;   // in degrees
+        float max_uv_error = 0.0f;
+    };
+
+    // How load_geometry_cached turns an OBJ file into GPU-ready buffers
+    struct GeometryOptions
+    {
+        VertexEncoding encoding = VertexEncoding::Float32;
+        VertexLayout layout = VertexLayout::Interleaved;
+        // Reorder triangles and vertices for the post-transform cache, overdraw and vertex fetch (see MeshOptimizer)
+        bool optimize = true;
+    };
+
+    // Load a shader from a WGSL file into a new shader module (see ShaderCache to reuse modules)
     static wgpu::ShaderModule load_shader_module(const path& path, wgpu::Device device);
+    // Read the WGSL source of a shader, run through ShaderPreprocessor with some names defined up front. Files
+    // receives every file read, includes included. Returns false if a file cannot be read or a directive is invalid.
+    static bool load_shader_source(const path& path, std::string& source, const ShaderPreprocessor::Defines& defines = {},
+                                   std::vector<std::filesystem::path>* files = nullptr);
+    static wgpu::ShaderModule create_shader_module(const std::string& source, wgpu::Device device);
+
+    // Load an 3D mesh from a standard .obj file into a vertex data buffer.
+    // When a thread pool is given, large files are parsed in parallel (see ParallelObjParser).
+    static bool load_geometry_from_obj(const path& path, std::vector<VertexAttributes>& vertexData, ThreadPool* pool = nullptr);
+
+    // Load an 3D mesh from a standard .obj file into a buffer of unique vertices
+    // and a triangle list indexing into it (corners sharing all attributes are merged).
+    // Triangles are grouped by material, one submesh per material in material order,
+    // and the materials come from the MTL files the OBJ refers to.
+    static bool load_geometry_from_obj(const path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData,
+                                       std::vector<Submesh>& submeshes, std::vector<Material>& materials, ThreadPool* pool = nullptr);
+
+    // Load an OBJ mesh through its binary cache, (re)baking the cache from the OBJ file when it is missing or stale
+    static bool load_geometry_cached(const path& path, MeshCache& cache, const GeometryOptions& options, ThreadPool* pool = nullptr);
+
+    // Quantize vertices to the packed layout, relative to their bounds, and measure the error it introduces
+    static VertexQuantization quantize_vertices(const std::vector<VertexAttributes>& vertices, std::vector<PackedVertexAttributes>& packed);
+
+    // Stream an OBJ mesh into a new (non-indexed) GPU vertex buffer, converting and uploading faces chunk by
+    // chunk through a staging ring, so that host memory spent on vertex data stays within staging_budget bytes
+    // however big the mesh is. Only the OBJ attribute pools are kept whole, as faces may index any of them.
+    static wgpu::Buffer stream_geometry_from_obj(const path& path, wgpu::Device device, uint32_t& vertex_count, uint64_t staging_budget = 64 << 20);
+
+    // Pack an index list into the narrowest index format able to address vertex_count vertices.
+    // The packed bytes are padded to a multiple of 4, as required by writeBuffer.
+    static wgpu::IndexFormat pack_indices(const std::vector<uint32_t>& indices, size_t vertex_count, std::vector<uint8_t>& packed);
+
+    // Create a buffer initialized with the given bytes, copied straight into its memory mapped at creation
+    // NB: size must be a multiple of 4
+    static wgpu::Buffer create_buffer_with_data(wgpu::Device device, wgpu::BufferUsage usage, const void* data, uint64_t size);
+
+    // Let the WebGPU implementation make progress on pending work and fire the related callbacks
+    static void poll_device(wgpu::Device device);
+
+    // An image file decoded to RGBA8 (see load_image), or the levels of its texture container (see load_image_container)
+    struct Image
+    {
+        struct PixelDeleter
+        {
+            void operator()(uint8_t* pixels) const;
+        };
+
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // Levels of the mip chain of its texture
+        uint32_t level_count = 0;
+        bool srgb = false;
+        // Level 0, null if the file could not be decoded
+        std::unique_ptr<uint8_t, PixelDeleter> pixels;
+        // Levels 1 and up, one after the other, when built on the CPU by load_image
+        std::vector<uint8_t> mip_levels;
+
+        // With load_image_container, the levels are in this format instead of pixels and mip_levels: either read
+        // from the mapped container, or transcoded into level_data, one after the other
+        wgpu::TextureFormat format = wgpu::TextureFormat::RGBA8Unorm;
+        std::shared_ptr<const TextureContainer> container;
+        std::vector<uint8_t> level_data;
+
+        bool is_valid() const { return pixels || container || !level_data.empty(); }
+    };
+
+    // Decode an image file, and build its mip chain too if cpu_mip_maps is set (see MipGenerator).
+    // Does not touch the GPU, so it may run on any thread.
+    static Image load_image(const path& path, bool srgb, bool cpu_mip_maps);
+
+    // Map the container baked from an image file by the texture encoder tool (see TextureContainer), whose levels are
+    // then uploaded straight from the mapping. BC levels are transcoded to RGBA8 unless the device has the
+    // TextureCompressionBC feature. Returns an invalid image if the image has no up-to-date container.
+    static Image load_image_container(const path& path, bool texture_compression_bc);
+
+    // Run load_image_container on the thread pool, falling back to load_image for images without container
+    static std::future<Image> load_image_async(const path& path, ThreadPool& pool, bool srgb, bool cpu_mip_maps, bool texture_compression_bc);
+
+    // Create a texture from a loaded image, or return nullptr if it failed to load. Mip levels missing from
+    // the image are built on the GPU if a GPU mip generator is given, and on the calling thread otherwise.
+    // Levels are uploaded through the staging uploader if given (to be submitted by the caller), through the queue otherwise.
+    static wgpu::Texture create_texture(wgpu::Device device, const Image& image, wgpu::TextureView* pTextureView = nullptr,
+                                        GpuMipGenerator* gpu_mip_generator = nullptr, StagingUploader* uploader = nullptr);
+
+    // Upload a loaded image into a layer of a texture of its size, format and level count, the way create_texture does
+    // (the texture needs the StorageBinding usage too when uses_gpu_mip_maps)
+    static void write_image(wgpu::Device device, const Image& image, wgpu::Texture texture, uint32_t layer = 0,
+                            GpuMipGenerator* gpu_mip_generator = nullptr, StagingUploader* uploader = nullptr);
+
+    // Whether write_image builds the mip levels of the image with the GPU mip generator
+    static bool uses_gpu_mip_maps(const Image& image, GpuMipGenerator* gpu_mip_generator);
+
+    // A 1x1 texture of a single color, to sample while the actual texture loads
+    static wgpu::Texture create_placeholder_texture(wgpu::Device device, glm::vec4 color, wgpu::TextureView* pTextureView = nullptr);
 
-    // Load an 3D mesh from a standard .obj file into a vertex data buffer
-    static bool load_geometry_from_obj(const path& path, std::vector<VertexAttributes>& vertexData);
+    // Load an image from a standard image file into a new texture object, along with its mip chain.
+    // Set srgb for sRGB-encoded images such as albedo maps, whose mip levels are then averaged in linear space.
+    // The mip chain is built on the CPU (see MipGenerator), or on the GPU from the uploaded level 0 when a
+    // GPU mip generator is given, which leaves the calling thread free as soon as level 0 is queued.
+    // NB: The texture must be destroyed after use (see GpuMemory::destroy)
+    static wgpu::Texture load_texture(const path& path, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr, bool srgb = false,
+                                      GpuMipGenerator* gpu_mip_generator = nullptr);
 
-    // Load an image from a standard image file into a new texture object
-    // NB: The texture must be destroyed after use
-    static wgpu::Texture load_texture(const path& path, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr);
+    // Load a texture from the container baked from an image file (see load_image_container), without decoding
+    // the image nor building mip levels. Returns nullptr if the image has no up-to-date container.
+    // NB: The texture must be destroyed after use (see GpuMemory::destroy)
+    static wgpu::Texture load_texture_container(const path& path, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr,
+                                                bool texture_compression_bc = false);
 };
\ No newline at end of file
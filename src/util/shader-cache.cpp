@@ -0,0 +1,69 @@
+#include "shader-cache.h"
+#include "resource-manager.h"
+
+using namespace wgpu;
+
+// FNV-1a, 64 bit
+static uint64_t hash_source(const std::string& source)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : source)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+ShaderCache::~ShaderCache()
+{
+    for (auto& [hash, entry] : modules)
+    {
+        entry.module.release();
+    }
+}
+
+ShaderModule ShaderCache::load(const path& path, const ShaderPreprocessor::Defines& defines, std::vector<std::filesystem::path>* files)
+{
+    std::string source;
+    if (!ResourceManager::load_shader_source(path, source, defines, files))
+    {
+        return nullptr;
+    }
+    return get(source);
+}
+
+ShaderModule ShaderCache::get(const std::string& source)
+{
+    const uint64_t hash = hash_source(source);
+    auto [begin, end] = modules.equal_range(hash);
+    for (auto it = begin; it != end; ++it)
+    {
+        if (it->second.source == source)
+        {
+            ++counters.hit_count;
+            it->second.module.reference();
+            return it->second.module;
+        }
+    }
+
+    // Modules that fail to compile are kept too: their errors were reported when they were created
+    ShaderModule module = ResourceManager::create_shader_module(source, device);
+    if (!module)
+        return nullptr;
+    ++counters.compile_count;
+    modules.emplace(hash, Entry{source, module});
+    counters.module_count = static_cast<uint32_t>(modules.size());
+    module.reference();
+    return module;
+}
+
+uint64_t ShaderCache::hash(ShaderModule module) const
+{
+    for (const auto& [source_hash, entry] : modules)
+    {
+        if (entry.module == module)
+            return source_hash;
+    }
+    return 0;
+}
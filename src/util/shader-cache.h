@@ -0,0 +1,58 @@
+#pragma once
+
+#include "shader-preprocessor.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shader modules by hash of their preprocessed WGSL source (see ShaderPreprocessor), so that loading a shader whose
+// source is unchanged (when pipelines are rebuilt, or an edit is reverted) reuses the module compiled the first time
+// instead of compiling it again. Modules stay cached until the cache is destroyed.
+class ShaderCache
+{
+  public:
+    using path = std::filesystem::path;
+
+    struct Stats
+    {
+        // Modules held
+        uint32_t module_count = 0;
+        // Since creation
+        uint64_t hit_count = 0;
+        uint64_t compile_count = 0;
+    };
+
+    explicit ShaderCache(wgpu::Device device) : device(device) {}
+    ~ShaderCache();
+
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    // Module of the WGSL source of a file preprocessed with some names defined, null if the file cannot be read or
+    // preprocessed. Files receives every file the source comes from, e.g. to watch them.
+    // NB: The caller owns a reference to the module and releases it as any other
+    wgpu::ShaderModule load(const path& path, const ShaderPreprocessor::Defines& defines = {}, std::vector<std::filesystem::path>* files = nullptr);
+    // Module of WGSL source, same ownership
+    wgpu::ShaderModule get(const std::string& source);
+
+    // Hash of the source of a module from this cache, 0 for other modules
+    uint64_t hash(wgpu::ShaderModule module) const;
+
+    const Stats& stats() const { return counters; }
+
+  private:
+    struct Entry
+    {
+        // Compared on lookup, as hashes may collide
+        std::string source;
+        wgpu::ShaderModule module = nullptr;
+    };
+
+    wgpu::Device device = nullptr;
+    std::unordered_multimap<uint64_t, Entry> modules;
+    Stats counters;
+};
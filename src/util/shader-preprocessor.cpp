@@ -0,0 +1,460 @@
+#include "shader-preprocessor.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using Defines = ShaderPreprocessor::Defines;
+
+// Defines referring to each other deeper than this are taken as a cycle
+static constexpr int max_expansion_depth = 16;
+
+static bool is_identifier_start(char c)
+{
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static bool is_identifier_char(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static std::string trim(const std::string& text)
+{
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return {};
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+// Replace the defined names of a line of code by their value, leaving comments, numbers and members (after a dot) alone
+static std::string expand(const std::string& text, const Defines& defines, int depth = 0)
+{
+    if (defines.empty() || depth > max_expansion_depth)
+        return text;
+
+    std::string expanded;
+    expanded.reserve(text.size());
+    size_t i = 0;
+    while (i < text.size())
+    {
+        if (text.compare(i, 2, "//") == 0)
+        {
+            expanded.append(text, i, std::string::npos);
+            break;
+        }
+        if (is_identifier_start(text[i]) || std::isdigit(static_cast<unsigned char>(text[i])))
+        {
+            size_t end = i + 1;
+            while (end < text.size() && (is_identifier_char(text[end]) || (std::isdigit(static_cast<unsigned char>(text[i])) && text[end] == '.')))
+            {
+                ++end;
+            }
+            std::string word = text.substr(i, end - i);
+            auto it = is_identifier_start(text[i]) ? defines.find(word) : defines.end();
+            if (it != defines.end() && (expanded.empty() || expanded.back() != '.'))
+                expanded += expand(it->second, defines, depth + 1);
+            else
+                expanded += word;
+            i = end;
+        }
+        else
+        {
+            expanded += text[i++];
+        }
+    }
+    return expanded;
+}
+
+// Recursive descent evaluation of the expression of #if and #elif
+class Expression
+{
+  public:
+    Expression(const std::string& text, const Defines& defines, int depth = 0) : text(text), defines(defines), depth(depth) {}
+
+    bool evaluate(int64_t& value)
+    {
+        if (!parse_or(value))
+            return false;
+        skip_spaces();
+        if (pos != text.size())
+            return fail("unexpected '" + text.substr(pos) + "'");
+        return true;
+    }
+
+    const std::string& error() const { return message; }
+
+  private:
+    bool fail(const std::string& what)
+    {
+        if (message.empty())
+            message = what;
+        return false;
+    }
+
+    void skip_spaces()
+    {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+        {
+            ++pos;
+        }
+    }
+
+    // Consume an operator, unless it is the start of a longer one (e.g. '<' of "<=", '!' of "!=")
+    bool match(const char* op)
+    {
+        skip_spaces();
+        size_t length = std::char_traits<char>::length(op);
+        if (text.compare(pos, length, op) != 0)
+            return false;
+        if (length == 1 && pos + 1 < text.size() && text[pos + 1] == '=' && (op[0] == '<' || op[0] == '>' || op[0] == '!'))
+            return false;
+        pos += length;
+        return true;
+    }
+
+    bool parse_or(int64_t& value)
+    {
+        if (!parse_and(value))
+            return false;
+        while (match("||"))
+        {
+            int64_t rhs;
+            if (!parse_and(rhs))
+                return false;
+            value = value || rhs;
+        }
+        return true;
+    }
+
+    bool parse_and(int64_t& value)
+    {
+        if (!parse_equality(value))
+            return false;
+        while (match("&&"))
+        {
+            int64_t rhs;
+            if (!parse_equality(rhs))
+                return false;
+            value = value && rhs;
+        }
+        return true;
+    }
+
+    bool parse_equality(int64_t& value)
+    {
+        if (!parse_relational(value))
+            return false;
+        while (true)
+        {
+            bool equal = match("==");
+            if (!equal && !match("!="))
+                return true;
+            int64_t rhs;
+            if (!parse_relational(rhs))
+                return false;
+            value = equal ? value == rhs : value != rhs;
+        }
+    }
+
+    bool parse_relational(int64_t& value)
+    {
+        if (!parse_additive(value))
+            return false;
+        while (true)
+        {
+            int op;
+            if (match("<="))
+                op = 0;
+            else if (match(">="))
+                op = 1;
+            else if (match("<"))
+                op = 2;
+            else if (match(">"))
+                op = 3;
+            else
+                return true;
+            int64_t rhs;
+            if (!parse_additive(rhs))
+                return false;
+            value = op == 0 ? value <= rhs : op == 1 ? value >= rhs : op == 2 ? value < rhs : value > rhs;
+        }
+    }
+
+    bool parse_additive(int64_t& value)
+    {
+        if (!parse_unary(value))
+            return false;
+        while (true)
+        {
+            bool add = match("+");
+            if (!add && !match("-"))
+                return true;
+            int64_t rhs;
+            if (!parse_unary(rhs))
+                return false;
+            value = add ? value + rhs : value - rhs;
+        }
+    }
+
+    bool parse_unary(int64_t& value)
+    {
+        if (match("!"))
+        {
+            if (!parse_unary(value))
+                return false;
+            value = !value;
+            return true;
+        }
+        if (match("-"))
+        {
+            if (!parse_unary(value))
+                return false;
+            value = -value;
+            return true;
+        }
+        return parse_primary(value);
+    }
+
+    bool parse_primary(int64_t& value)
+    {
+        skip_spaces();
+        if (match("("))
+        {
+            if (!parse_or(value))
+                return false;
+            return match(")") || fail("missing ')'");
+        }
+        if (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])))
+        {
+            size_t end = pos;
+            while (end < text.size() && is_identifier_char(text[end]))
+            {
+                ++end;
+            }
+            // Integer literals as in WGSL and C: decimal or 0x hexadecimal, with an optional u or i suffix
+            std::string literal = text.substr(pos, end - pos);
+            if (!literal.empty() && (literal.back() == 'u' || literal.back() == 'i'))
+                literal.pop_back();
+            char* parsed_end = nullptr;
+            value = std::strtoll(literal.c_str(), &parsed_end, 0);
+            if (literal.empty() || parsed_end != literal.c_str() + literal.size())
+                return fail("invalid number '" + text.substr(pos, end - pos) + "'");
+            pos = end;
+            return true;
+        }
+        if (pos < text.size() && is_identifier_start(text[pos]))
+        {
+            std::string name = read_name();
+            if (name == "defined")
+            {
+                bool parenthesized = match("(");
+                skip_spaces();
+                std::string defined = read_name();
+                if (defined.empty() || (parenthesized && !match(")")))
+                    return fail("invalid defined()");
+                value = defines.count(defined);
+                return true;
+            }
+
+            auto it = defines.find(name);
+            if (it == defines.end())
+            {
+                value = 0;
+                return true;
+            }
+            if (depth >= max_expansion_depth)
+                return fail("recursive definition of " + name);
+            Expression definition(it->second, defines, depth + 1);
+            if (!definition.evaluate(value))
+                return fail(name + " is not a number (" + definition.error() + ")");
+            return true;
+        }
+        return fail(pos < text.size() ? "unexpected '" + text.substr(pos) + "'" : "missing operand");
+    }
+
+    std::string read_name()
+    {
+        size_t begin = pos;
+        while (pos < text.size() && is_identifier_char(text[pos]))
+        {
+            ++pos;
+        }
+        return text.substr(begin, pos - begin);
+    }
+
+    const std::string& text;
+    const Defines& defines;
+    int depth = 0;
+    size_t pos = 0;
+    std::string message;
+};
+
+struct Preprocessing
+{
+    Defines defines;
+    std::vector<std::filesystem::path> files;
+    std::string source;
+};
+
+// One #if block and its #elif/#else branches
+struct Conditional
+{
+    // Whether the lines of the current branch are kept, and whether those of any branch so far were
+    bool active = false;
+    bool taken = false;
+    bool in_else = false;
+    // Whether the lines around the block are kept
+    bool parent_active = false;
+};
+
+static bool process_file(const std::filesystem::path& path, Preprocessing& state)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open shader " << path << std::endl;
+        return false;
+    }
+    state.files.push_back(path);
+
+    std::vector<Conditional> conditionals;
+    std::string line;
+    int line_number = 0;
+    auto active = [&]() { return conditionals.empty() || conditionals.back().active; };
+    auto fail = [&](const std::string& message) {
+        std::cerr << path.string() << ":" << line_number << ": " << message << std::endl;
+        return false;
+    };
+    // Value of the expression of #if and #elif, or of defined() for #ifdef and #ifndef
+    auto condition = [&](const std::string& keyword, const std::string& argument, bool& result) {
+        if (keyword == "ifdef" || keyword == "ifndef")
+        {
+            if (argument.empty())
+                return fail("#" + keyword + " without name");
+            result = state.defines.count(argument) == (keyword == "ifdef" ? 1 : 0);
+            return true;
+        }
+        int64_t value = 0;
+        Expression expression(argument, state.defines);
+        if (!expression.evaluate(value))
+            return fail("#" + keyword + ": " + expression.error());
+        result = value != 0;
+        return true;
+    };
+
+    while (std::getline(file, line))
+    {
+        ++line_number;
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] != '#')
+        {
+            if (active())
+                state.source += expand(line, state.defines);
+            state.source += '\n';
+            continue;
+        }
+
+        // Directives, trailing comments aside
+        std::string directive = line.substr(start + 1);
+        directive = trim(directive.substr(0, directive.find("//")));
+        size_t keyword_end = 0;
+        while (keyword_end < directive.size() && is_identifier_char(directive[keyword_end]))
+        {
+            ++keyword_end;
+        }
+        const std::string keyword = directive.substr(0, keyword_end);
+        const std::string argument = trim(directive.substr(keyword_end));
+
+        if (keyword == "if" || keyword == "ifdef" || keyword == "ifndef")
+        {
+            Conditional conditional;
+            conditional.parent_active = active();
+            if (conditional.parent_active && !condition(keyword, argument, conditional.taken))
+                return false;
+            conditional.active = conditional.parent_active && conditional.taken;
+            conditionals.push_back(conditional);
+        }
+        else if (keyword == "elif" || keyword == "else")
+        {
+            if (conditionals.empty())
+                return fail("#" + keyword + " without #if");
+            if (conditionals.back().in_else)
+                return fail("#" + keyword + " after #else");
+            Conditional& conditional = conditionals.back();
+            bool taken = keyword == "else";
+            if (!taken && conditional.parent_active && !conditional.taken && !condition(keyword, argument, taken))
+                return false;
+            conditional.active = conditional.parent_active && !conditional.taken && taken;
+            conditional.taken = conditional.taken || taken;
+            conditional.in_else = keyword == "else";
+        }
+        else if (keyword == "endif")
+        {
+            if (conditionals.empty())
+                return fail("#endif without #if");
+            conditionals.pop_back();
+        }
+        else if (!active())
+        {
+            // Any other directive is skipped along with the lines of its branch
+        }
+        else if (keyword == "define" || keyword == "undef")
+        {
+            size_t name_end = 0;
+            while (name_end < argument.size() && is_identifier_char(argument[name_end]))
+            {
+                ++name_end;
+            }
+            const std::string name = argument.substr(0, name_end);
+            if (name.empty() || !is_identifier_start(name[0]))
+                return fail("#" + keyword + " without name");
+            if (keyword == "undef")
+            {
+                state.defines.erase(name);
+            }
+            else
+            {
+                std::string value = trim(argument.substr(name_end));
+                state.defines[name] = value.empty() ? "1" : value;
+            }
+        }
+        else if (keyword == "include")
+        {
+            if (argument.size() < 2 || argument.front() != '"' || argument.back() != '"')
+                return fail("#include expects a \"file\"");
+            std::filesystem::path included = (path.parent_path() / argument.substr(1, argument.size() - 2)).lexically_normal();
+            bool seen = false;
+            for (const std::filesystem::path& file_path : state.files)
+            {
+                seen = seen || file_path.lexically_normal() == included;
+            }
+            if (!seen && !process_file(included, state))
+                return fail("included from here");
+        }
+        else
+        {
+            return fail("unknown directive #" + keyword);
+        }
+        state.source += '\n';
+    }
+
+    if (!conditionals.empty())
+        return fail("missing #endif");
+    return true;
+}
+
+bool ShaderPreprocessor::process(const path& path, const Defines& defines, std::string& source, std::vector<std::filesystem::path>* files)
+{
+    Preprocessing state;
+    state.defines = defines;
+    if (!process_file(path, state))
+        return false;
+
+    source = std::move(state.source);
+    if (files)
+        *files = std::move(state.files);
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+// The C-like preprocessor WGSL lacks, run on shader files before they are compiled:
+//   #include "file"              inserts a file, relative to the one including it, once per shader
+//   #define NAME [value]         replaces NAME with value (1 if none) in the lines that follow
+//   #undef NAME
+//   #if / #elif expression, #ifdef / #ifndef NAME, #else, #endif
+// Expressions are made of integers, names (0 if not defined), defined(NAME), parentheses and the operators
+// ! + - < <= > >= == != && ||. Lines removed are left empty, so that line numbers in compilation errors match the
+// main file up to its first include.
+class ShaderPreprocessor
+{
+  public:
+    using path = std::filesystem::path;
+    using Defines = std::map<std::string, std::string>;
+
+    // Preprocess a file with some names defined up front. Files receives every file read, the main one first.
+    // Returns false on error, reported to std::cerr with its file and line.
+    static bool process(const path& path, const Defines& defines, std::string& source, std::vector<std::filesystem::path>* files = nullptr);
+};
@@ -0,0 +1,101 @@
+#include "staging-ring.h"
+#include "resource-manager.h"
+#include "gpu-memory.h"
+
+using namespace wgpu;
+
+StagingRing::StagingRing(Device device, uint64_t slot_size, uint32_t slot_count) : device(device), size(slot_size)
+{
+    queue = device.getQueue();
+
+    slots.resize(slot_count);
+    for (Slot& slot : slots)
+    {
+        slot.buffer = create_slot_buffer();
+        slot.mapped = true;
+    }
+}
+
+Buffer StagingRing::create_slot_buffer()
+{
+    BufferDescriptor buffer_desc;
+    buffer_desc.label = "Staging ring slot";
+    buffer_desc.size = size;
+    buffer_desc.usage = BufferUsage::MapWrite | BufferUsage::CopySrc;
+    buffer_desc.mappedAtCreation = true;
+    return GpuMemory::create_buffer(device, buffer_desc);
+}
+
+StagingRing::~StagingRing()
+{
+    finish();
+    for (Slot& slot : slots)
+    {
+        GpuMemory::destroy(slot.buffer);
+    }
+    queue.release();
+}
+
+void StagingRing::wait_until_mapped(Slot& slot)
+{
+    while (!slot.mapped)
+    {
+        ResourceManager::poll_device(device);
+    }
+    slot.map_callback.reset();
+}
+
+uint8_t* StagingRing::acquire()
+{
+    Slot& slot = slots[current];
+    wait_until_mapped(slot);
+    uint8_t* data = slot.failed ? nullptr : static_cast<uint8_t*>(slot.buffer.getMappedRange(0, size));
+    if (!data)
+    {
+        // The slot could not be mapped again: a new buffer takes its place
+        GpuMemory::destroy(slot.buffer);
+        slot.buffer = create_slot_buffer();
+        data = static_cast<uint8_t*>(slot.buffer.getMappedRange(0, size));
+        slot.failed = data == nullptr;
+        if (!data)
+        {
+            std::cerr << "Could not access staging buffer" << std::endl;
+        }
+    }
+    return data;
+}
+
+void StagingRing::submit(Buffer dst, uint64_t dst_offset, uint64_t byte_count)
+{
+    Slot& slot = slots[current];
+    slot.buffer.unmap();
+    slot.mapped = false;
+
+    CommandEncoder encoder = device.createCommandEncoder(CommandEncoderDescriptor{});
+    encoder.copyBufferToBuffer(slot.buffer, 0, dst, dst_offset, byte_count);
+    CommandBuffer command = encoder.finish(CommandBufferDescriptor{});
+    encoder.release();
+    queue.submit(command);
+    command.release();
+
+    // The slot becomes writable again once the GPU is done reading from it
+    slot.map_callback = slot.buffer.mapAsync(MapMode::Write, 0, size, [&slot](BufferMapAsyncStatus status) {
+        if (status != BufferMapAsyncStatus::Success)
+        {
+            // Not handed out again, the next acquire replaces its buffer
+            std::cerr << "Could not map staging buffer: " << status << std::endl;
+            slot.failed = true;
+        }
+        slot.mapped = true;
+    });
+
+    current = (current + 1) % slots.size();
+}
+
+void StagingRing::finish()
+{
+    for (Slot& slot : slots)
+    {
+        wait_until_mapped(slot);
+    }
+}
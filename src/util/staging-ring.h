@@ -0,0 +1,50 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <memory>
+#include <vector>
+
+// A fixed set of staging buffers, filled through their mapped memory and copied into GPU-only
+// buffers. A slot is mapped again once the GPU is done copying from it, so the host memory used
+// for uploads never exceeds slot_size * slot_count, however much data goes through the ring.
+class StagingRing
+{
+  public:
+    StagingRing(wgpu::Device device, uint64_t slot_size, uint32_t slot_count);
+    ~StagingRing();
+
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    uint64_t slot_size() const { return size; }
+
+    // Mapped memory of the next slot (slot_size bytes), waiting for the GPU to release it if needed.
+    // Null if the slot cannot be mapped, not even with a new buffer (e.g. the device was lost).
+    uint8_t* acquire();
+
+    // Copy the first `byte_count` bytes of the acquired slot into dst at dst_offset
+    void submit(wgpu::Buffer dst, uint64_t dst_offset, uint64_t byte_count);
+
+    // Block until every submitted copy has completed
+    void finish();
+
+  private:
+    struct Slot
+    {
+        wgpu::Buffer buffer = nullptr;
+        // Once the GPU released the slot, failed telling whether it could be mapped again
+        bool mapped = false;
+        bool failed = false;
+        std::unique_ptr<wgpu::BufferMapCallback> map_callback;
+    };
+
+    void wait_until_mapped(Slot& slot);
+    wgpu::Buffer create_slot_buffer();
+
+    wgpu::Device device = nullptr;
+    wgpu::Queue queue = nullptr;
+    uint64_t size = 0;
+    std::vector<Slot> slots;
+    uint32_t current = 0;
+};
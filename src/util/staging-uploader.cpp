@@ -0,0 +1,236 @@
+#include "staging-uploader.h"
+#include "resource-manager.h"
+#include "gpu-memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace wgpu;
+
+// Required for the offset and bytesPerRow of buffer-to-texture copies
+static constexpr uint64_t TextureCopyAlignment = 256;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+StagingUploader::StagingUploader(Device device, uint64_t chunk_size, uint32_t max_chunks)
+    : device(device), chunk_size(chunk_size), max_chunks(max_chunks)
+{
+    queue = device.getQueue();
+}
+
+StagingUploader::~StagingUploader()
+{
+    submit();
+    for (std::unique_ptr<Chunk>& chunk : chunks)
+    {
+        while (!chunk->mapped)
+        {
+            ResourceManager::poll_device(device);
+        }
+        GpuMemory::destroy(chunk->buffer);
+    }
+    queue.release();
+}
+
+CommandEncoder& StagingUploader::recording_encoder()
+{
+    if (!encoder)
+    {
+        CommandEncoderDescriptor encoder_desc;
+        encoder_desc.label = "Staging uploads";
+        encoder = device.createCommandEncoder(encoder_desc);
+    }
+    return encoder;
+}
+
+void StagingUploader::drop_failed_chunks()
+{
+    for (auto it = chunks.begin(); it != chunks.end();)
+    {
+        Chunk& chunk = **it;
+        if (chunk.mapped && chunk.failed)
+        {
+            GpuMemory::destroy(chunk.buffer);
+            it = chunks.erase(it);
+            ++counters.failed_chunk_count;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+StagingUploader::Chunk* StagingUploader::acquire_chunk(uint64_t min_size)
+{
+    auto find_free = [&]() -> Chunk* {
+        for (std::unique_ptr<Chunk>& chunk : chunks)
+        {
+            bool recorded_from = std::find(recorded.begin(), recorded.end(), chunk.get()) != recorded.end();
+            if (chunk->mapped && !chunk->failed && !recorded_from && chunk->size >= min_size)
+                return chunk.get();
+        }
+        return nullptr;
+    };
+    auto any_failed = [&]() {
+        return std::any_of(chunks.begin(), chunks.end(), [](const std::unique_ptr<Chunk>& chunk) { return chunk->mapped && chunk->failed; });
+    };
+
+    while (true)
+    {
+        drop_failed_chunks();
+        Chunk* chunk = find_free();
+        bool created = false;
+        if (!chunk && (chunks.size() < max_chunks || min_size > chunk_size))
+        {
+            BufferDescriptor buffer_desc;
+            buffer_desc.label = "Staging chunk";
+            buffer_desc.size = std::max(chunk_size, align_up(min_size, TextureCopyAlignment));
+            buffer_desc.usage = BufferUsage::MapWrite | BufferUsage::CopySrc;
+            buffer_desc.mappedAtCreation = true;
+
+            chunks.push_back(std::make_unique<Chunk>());
+            chunk = chunks.back().get();
+            chunk->buffer = GpuMemory::create_buffer(device, buffer_desc);
+            chunk->size = buffer_desc.size;
+            ++counters.chunk_count;
+            created = true;
+        }
+        if (!chunk)
+        {
+            // Every chunk is in use: send what was recorded so far, and wait for the GPU to release a chunk, or for
+            // one to fail mapping and make room for a new one
+            ++counters.stall_count;
+            submit();
+            while (!(chunk = find_free()) && !any_failed())
+            {
+                ResourceManager::poll_device(device);
+            }
+            if (!chunk)
+                continue;
+        }
+
+        chunk->used = 0;
+        chunk->data = static_cast<uint8_t*>(chunk->buffer.getMappedRange(0, chunk->size));
+        if (chunk->data)
+        {
+            recorded.push_back(chunk);
+            return chunk;
+        }
+
+        std::cerr << "Could not access staging chunk" << std::endl;
+        chunk->failed = true;
+        if (created)
+        {
+            // Mapping is not going to work with a new chunk either
+            drop_failed_chunks();
+            return nullptr;
+        }
+    }
+}
+
+uint8_t* StagingUploader::allocate(uint64_t size, uint64_t alignment, Buffer& buffer, uint64_t& offset)
+{
+    Chunk* chunk = recorded.empty() ? nullptr : recorded.back();
+    if (!chunk || align_up(chunk->used, alignment) + size > chunk->size)
+    {
+        chunk = acquire_chunk(size);
+        if (!chunk)
+            return nullptr;
+    }
+    offset = align_up(chunk->used, alignment);
+    chunk->used = offset + size;
+    buffer = chunk->buffer;
+    return chunk->data + offset;
+}
+
+void StagingUploader::upload_buffer(Buffer dst, uint64_t dst_offset, const void* data, uint64_t size)
+{
+    Buffer staging = nullptr;
+    uint64_t offset = 0;
+    uint8_t* region = allocate(size, 4, staging, offset);
+    if (!region)
+        return;
+    memcpy(region, data, size);
+    recording_encoder().copyBufferToBuffer(staging, offset, dst, dst_offset, size);
+
+    counters.bytes_uploaded += size;
+    ++counters.upload_count;
+}
+
+void StagingUploader::upload_texture(const ImageCopyTexture& destination, const void* data, uint32_t row_bytes, uint32_t row_count, Extent3D size)
+{
+    const uint32_t padded_row_bytes = static_cast<uint32_t>(align_up(row_bytes, TextureCopyAlignment));
+    // Bands start on whole rows of blocks of the destination format
+    Texture texture = destination.texture;
+    uint32_t block_size, block_bytes;
+    GpuMemory::block_layout(texture.getFormat(), block_size, block_bytes);
+    const uint32_t band_rows = static_cast<uint32_t>(std::clamp<uint64_t>(chunk_size / padded_row_bytes, 1, row_count));
+    const uint8_t* rows = static_cast<const uint8_t*>(data);
+
+    for (uint32_t first_row = 0; first_row < row_count; first_row += band_rows)
+    {
+        const uint32_t band_row_count = std::min(band_rows, row_count - first_row);
+        ImageCopyBuffer source;
+        uint8_t* staging = allocate(uint64_t(padded_row_bytes) * band_row_count, TextureCopyAlignment, source.buffer, source.layout.offset);
+        if (!staging)
+            return;
+        for (uint32_t row = 0; row < band_row_count; ++row)
+        {
+            memcpy(staging + size_t(row) * padded_row_bytes, rows + size_t(first_row + row) * row_bytes, row_bytes);
+        }
+        source.layout.bytesPerRow = padded_row_bytes;
+        source.layout.rowsPerImage = band_row_count;
+
+        // The last band stops at the height of the copy, however many texel rows its last row of blocks holds
+        const uint32_t first_texel_row = first_row * block_size;
+        const uint32_t band_height = std::min(band_row_count * block_size, size.height - first_texel_row);
+        ImageCopyTexture band_destination = destination;
+        band_destination.origin.y += first_texel_row;
+        recording_encoder().copyBufferToTexture(source, band_destination, {size.width, band_height, 1});
+    }
+
+    counters.bytes_uploaded += uint64_t(row_bytes) * row_count;
+    ++counters.upload_count;
+}
+
+void StagingUploader::submit()
+{
+    if (!encoder)
+        return;
+
+    // Chunks cannot stay mapped while the GPU reads from them
+    for (Chunk* chunk : recorded)
+    {
+        chunk->buffer.unmap();
+        chunk->data = nullptr;
+        chunk->mapped = false;
+    }
+
+    CommandBufferDescriptor cmd_buffer_descriptor;
+    cmd_buffer_descriptor.label = "Staging uploads";
+    CommandBuffer command = encoder.finish(cmd_buffer_descriptor);
+    encoder.release();
+    encoder = nullptr;
+    queue.submit(command);
+    command.release();
+    ++counters.submit_count;
+
+    // A chunk can be written again once the GPU is done copying from it
+    for (Chunk* chunk : recorded)
+    {
+        chunk->map_callback = chunk->buffer.mapAsync(MapMode::Write, 0, chunk->size, [chunk](BufferMapAsyncStatus status) {
+            if (status != BufferMapAsyncStatus::Success)
+            {
+                // Not handed out again, the next acquire_chunk drops it
+                std::cerr << "Could not map staging chunk: " << status << std::endl;
+                chunk->failed = true;
+            }
+            chunk->mapped = true;
+        });
+    }
+    recorded.clear();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <memory>
+#include <vector>
+
+// Uploads of the whole app go through one pool of persistently mapped staging buffers (chunks): each upload is
+// written into an aligned region of the current chunk and its copy recorded into a single command encoder, which
+// submit() sends to the queue ahead of the frame. A chunk is mapped again, hence reused, once the GPU is done
+// copying from it, so that steady-state uploads allocate nothing and staging memory stays within
+// max_chunks * chunk_size (unlike Queue::writeBuffer/writeTexture, which stage every call on their own).
+class StagingUploader
+{
+  public:
+    struct Stats
+    {
+        // Since creation
+        uint64_t bytes_uploaded = 0;
+        uint64_t upload_count = 0;
+        uint64_t submit_count = 0;
+        // Chunks allocated so far, and how many times an upload had to wait for one to be released by the GPU
+        uint32_t chunk_count = 0;
+        uint64_t stall_count = 0;
+        // Chunks dropped because they could not be mapped again (e.g. the device was lost)
+        uint32_t failed_chunk_count = 0;
+    };
+
+    StagingUploader(wgpu::Device device, uint64_t chunk_size = 4 << 20, uint32_t max_chunks = 8);
+    ~StagingUploader();
+
+    StagingUploader(const StagingUploader&) = delete;
+    StagingUploader& operator=(const StagingUploader&) = delete;
+
+    // Copy size bytes into dst at dst_offset, nothing if no staging memory can be mapped
+    // NB: size and dst_offset must be multiples of 4
+    void upload_buffer(wgpu::Buffer dst, uint64_t dst_offset, const void* data, uint64_t size);
+
+    // Copy tightly packed rows into a mip level of a texture: row_count rows of row_bytes bytes (rows of blocks for
+    // block-compressed formats) covering size texels from the origin of destination. Levels bigger than a chunk
+    // are copied in bands of whole rows of blocks. Block-compressed copies must span whole blocks, so size is then
+    // the level size rounded up to them (that the last row of blocks of a level may go past).
+    void upload_texture(const wgpu::ImageCopyTexture& destination, const void* data, uint32_t row_bytes, uint32_t row_count, wgpu::Extent3D size);
+
+    // Submit the copies recorded since the last call, which then run before anything submitted afterwards
+    void submit();
+
+    const Stats& stats() const { return counters; }
+
+  private:
+    struct Chunk
+    {
+        wgpu::Buffer buffer = nullptr;
+        uint64_t size = 0;
+        uint64_t used = 0;
+        // Mapped memory while the chunk is mapped, null while the GPU may be reading from it
+        uint8_t* data = nullptr;
+        // Once the GPU released the chunk, failed telling whether it could be mapped again
+        bool mapped = true;
+        bool failed = false;
+        std::unique_ptr<wgpu::BufferMapCallback> map_callback;
+    };
+
+    // Region of size bytes in the current chunk, starting at a multiple of alignment, null if no chunk can be mapped
+    uint8_t* allocate(uint64_t size, uint64_t alignment, wgpu::Buffer& buffer, uint64_t& offset);
+    // A mapped chunk of at least min_size bytes that no recorded copy uses yet, null if even a new one cannot be mapped
+    Chunk* acquire_chunk(uint64_t min_size);
+    // Destroy the chunks whose mapping failed, for new ones to take their place
+    void drop_failed_chunks();
+    wgpu::CommandEncoder& recording_encoder();
+
+    wgpu::Device device = nullptr;
+    wgpu::Queue queue = nullptr;
+    uint64_t chunk_size = 0;
+    uint32_t max_chunks = 0;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    // Chunks the copies recorded since the last submit read from, the last one being filled
+    std::vector<Chunk*> recorded;
+    wgpu::CommandEncoder encoder = nullptr;
+    Stats counters;
+};
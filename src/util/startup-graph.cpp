@@ -0,0 +1,128 @@
+#include "startup-graph.h"
+
+#include <chrono>
+#include <iomanip>
+
+StartupGraph::Stage StartupGraph::add(const std::string& name, Thread thread, std::function<bool()> fn, const std::vector<Stage>& dependencies)
+{
+    Node& node = nodes.emplace_back();
+    node.timing.name = name;
+    node.timing.thread = thread;
+    node.fn = std::move(fn);
+    node.dependencies = dependencies;
+    return static_cast<Stage>(nodes.size() - 1);
+}
+
+bool StartupGraph::ready(const Node& node) const
+{
+    for (Stage dependency : node.dependencies)
+    {
+        if (nodes[dependency].state != State::Done)
+            return false;
+    }
+    return true;
+}
+
+bool StartupGraph::run()
+{
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    auto elapsed_ms = [&]() { return std::chrono::duration<float, std::milli>(clock::now() - start).count(); };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        // Start the worker stages now ready, and pick the next main thread one
+        std::vector<Stage> workers;
+        Node* main = nullptr;
+        for (Stage stage = 0; stage < nodes.size() && !failed; ++stage)
+        {
+            Node& node = nodes[stage];
+            if (node.state != State::Waiting || !ready(node))
+                continue;
+            if (node.timing.thread == Thread::Worker)
+            {
+                node.state = State::Running;
+                ++running_workers;
+                workers.push_back(stage);
+            }
+            else if (!main)
+            {
+                node.state = State::Running;
+                main = &node;
+            }
+        }
+
+        // Unlocked, as a pool without workers runs tasks right away
+        lock.unlock();
+        for (Stage stage : workers)
+        {
+            pool.submit([this, stage, &elapsed_ms]() {
+                Node& node = nodes[stage];
+                node.timing.start_ms = elapsed_ms();
+                bool success = node.fn();
+                std::lock_guard<std::mutex> guard(mutex);
+                node.timing.end_ms = elapsed_ms();
+                node.state = State::Done;
+                failed = failed || !success;
+                --running_workers;
+                completed.notify_one();
+            });
+        }
+        if (main)
+        {
+            main->timing.start_ms = elapsed_ms();
+            bool success = main->fn();
+            main->timing.end_ms = elapsed_ms();
+            lock.lock();
+            main->state = State::Done;
+            failed = failed || !success;
+            continue;
+        }
+        lock.lock();
+
+        if (running_workers == 0)
+        {
+            if (!workers.empty())
+                continue;
+            // Nothing left to run, or to wait for
+            break;
+        }
+        completed.wait(lock);
+    }
+
+    run_ms = elapsed_ms();
+    bool success = !failed;
+    for (const Node& node : nodes)
+    {
+        success = success && node.state == State::Done;
+    }
+    return success;
+}
+
+std::vector<StartupGraph::Timing> StartupGraph::timings() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Timing> result;
+    for (const Node& node : nodes)
+    {
+        if (node.state == State::Done)
+            result.push_back(node.timing);
+    }
+    return result;
+}
+
+void StartupGraph::report() const
+{
+    float sum_ms = 0.0f;
+    std::cout << "Startup stages:" << std::endl;
+    for (const Timing& timing : timings())
+    {
+        const float ms = timing.end_ms - timing.start_ms;
+        sum_ms += ms;
+        std::cout << "  " << std::left << std::setw(18) << timing.name << std::right << (timing.thread == Thread::Worker ? " worker " : " main   ")
+                  << std::fixed << std::setprecision(1) << std::setw(8) << timing.start_ms << " -> " << std::setw(8) << timing.end_ms
+                  << " ms (" << ms << " ms)" << std::endl;
+    }
+    std::cout << "Startup took " << run_ms << " ms, " << sum_ms << " ms of stages" << std::defaultfloat << std::endl;
+}
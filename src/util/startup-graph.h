@@ -0,0 +1,79 @@
+#pragma once
+
+#include "thread-pool.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Startup as a graph of stages, each run once all those it depends on have completed: CPU work (parsing files,
+// preprocessing shaders) on the thread pool, WebGPU object creation one stage at a time on the calling thread.
+// Worker stages overlap with each other and with the main thread ones, so that startup takes about as long as its
+// longest chain of stages rather than the sum of them all.
+class StartupGraph
+{
+  public:
+    using Stage = uint32_t;
+
+    enum class Thread
+    {
+        Worker,
+        Main,
+    };
+
+    struct Timing
+    {
+        std::string name;
+        Thread thread;
+        // Since run() was called
+        float start_ms = 0.0f;
+        float end_ms = 0.0f;
+    };
+
+    explicit StartupGraph(ThreadPool& pool) : pool(pool) {}
+
+    StartupGraph(const StartupGraph&) = delete;
+    StartupGraph& operator=(const StartupGraph&) = delete;
+
+    // A stage returning false on failure, after the stages it depends on (added before it)
+    Stage add(const std::string& name, Thread thread, std::function<bool()> fn, const std::vector<Stage>& dependencies = {});
+
+    // Run every stage. Returns false once one fails and the worker stages underway complete, the stages left never run.
+    bool run();
+
+    // Of the stages that ran, and the wall-clock time of the whole run
+    std::vector<Timing> timings() const;
+    float total_ms() const { return run_ms; }
+    // Print the span of every stage, then the total against the sum of the stages
+    void report() const;
+
+  private:
+    enum class State
+    {
+        Waiting,
+        Running,
+        Done,
+    };
+
+    struct Node
+    {
+        Timing timing;
+        std::function<bool()> fn;
+        std::vector<Stage> dependencies;
+        State state = State::Waiting;
+    };
+
+    bool ready(const Node& node) const;
+
+    ThreadPool& pool;
+    std::vector<Node> nodes;
+    float run_ms = 0.0f;
+
+    // Guards the state of the nodes, which worker stages update as they complete
+    mutable std::mutex mutex;
+    std::condition_variable completed;
+    uint32_t running_workers = 0;
+    bool failed = false;
+};
@@ -0,0 +1,522 @@
+#include "texture-compressor.h"
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+using Format = TextureCompressor::Format;
+
+// Texels of a 4x4 block, row by row
+using BlockTexels = uint8_t[16][4];
+
+// Interpolation weights of BC7 4-bit indices, out of 64
+static const uint32_t bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+const char* TextureCompressor::format_name(Format format)
+{
+    switch (format)
+    {
+    case Format::BC1:
+        return "BC1";
+    case Format::BC7:
+        return "BC7";
+    case Format::RGBA8:
+        return "RGBA8";
+    }
+    return "unknown";
+}
+
+wgpu::TextureFormat TextureCompressor::texture_format(Format format)
+{
+    switch (format)
+    {
+    case Format::BC1:
+        return wgpu::TextureFormat::BC1RGBAUnorm;
+    case Format::BC7:
+        return wgpu::TextureFormat::BC7RGBAUnorm;
+    case Format::RGBA8:
+        break;
+    }
+    return wgpu::TextureFormat::RGBA8Unorm;
+}
+
+uint32_t TextureCompressor::block_bytes(Format format)
+{
+    switch (format)
+    {
+    case Format::BC1:
+        return 8;
+    case Format::BC7:
+        return 16;
+    case Format::RGBA8:
+        break;
+    }
+    return 4;
+}
+
+uint64_t TextureCompressor::compressed_size(Format format, uint32_t width, uint32_t height)
+{
+    const uint32_t size = block_size(format);
+    return uint64_t((width + size - 1) / size) * ((height + size - 1) / size) * block_bytes(format);
+}
+
+static void load_block(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y, BlockTexels& texels)
+{
+    for (uint32_t y = 0; y < 4; ++y)
+    {
+        uint32_t row = std::min(block_y * 4 + y, height - 1);
+        for (uint32_t x = 0; x < 4; ++x)
+        {
+            uint32_t column = std::min(block_x * 4 + x, width - 1);
+            memcpy(texels[y * 4 + x], pixels + 4 * (size_t(row) * width + column), 4);
+        }
+    }
+}
+
+static void store_block(const BlockTexels& texels, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y, uint8_t* pixels)
+{
+    for (uint32_t y = 0; y < 4 && block_y * 4 + y < height; ++y)
+    {
+        for (uint32_t x = 0; x < 4 && block_x * 4 + x < width; ++x)
+        {
+            memcpy(pixels + 4 * (size_t(block_y * 4 + y) * width + block_x * 4 + x), texels[y * 4 + x], 4);
+        }
+    }
+}
+
+// Principal axis of the colors of a block around their mean, by power iteration on their covariance
+static glm::vec4 principal_axis(const glm::vec4 (&colors)[16], glm::vec4 mean)
+{
+    glm::mat4 covariance(0.0f);
+    for (const glm::vec4& color : colors)
+    {
+        glm::vec4 d = color - mean;
+        covariance += glm::outerProduct(d, d);
+    }
+
+    // The column of the largest variance cannot be orthogonal to the principal axis
+    int largest = 0;
+    for (int i = 1; i < 4; ++i)
+    {
+        if (covariance[i][i] > covariance[largest][largest])
+            largest = i;
+    }
+    glm::vec4 axis = covariance[largest];
+    for (int i = 0; i < 8; ++i)
+    {
+        glm::vec4 next = covariance * axis;
+        float length = glm::length(next);
+        if (length < 1e-6f)
+            break;
+        axis = next / length;
+    }
+    float length = glm::length(axis);
+    return length > 1e-6f ? axis / length : glm::vec4(0.0f);
+}
+
+// Ends of the segment along the principal axis that covers the colors of a block
+static void fit_endpoints(const glm::vec4 (&colors)[16], glm::vec4& low, glm::vec4& high)
+{
+    glm::vec4 mean(0.0f);
+    for (const glm::vec4& color : colors)
+        mean += color;
+    mean /= 16.0f;
+
+    glm::vec4 axis = principal_axis(colors, mean);
+    float t_min = 0.0f, t_max = 0.0f;
+    for (const glm::vec4& color : colors)
+    {
+        float t = glm::dot(color - mean, axis);
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+    low = glm::clamp(mean + axis * t_min, 0.0f, 255.0f);
+    high = glm::clamp(mean + axis * t_max, 0.0f, 255.0f);
+}
+
+// Least-squares endpoints for colors whose weight of endpoint1 is known (endpoint0 weighing 1 - weight).
+// Returns false when the weights are degenerate (e.g. all the same).
+static bool refit_endpoints(const glm::vec4 (&colors)[16], const float (&weights)[16], glm::vec4& endpoint0, glm::vec4& endpoint1)
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    glm::vec4 ax(0.0f), bx(0.0f);
+    for (int i = 0; i < 16; ++i)
+    {
+        float a = 1.0f - weights[i];
+        float b = weights[i];
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        ax += a * colors[i];
+        bx += b * colors[i];
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f)
+        return false;
+    endpoint0 = glm::clamp((bb * ax - ab * bx) / determinant, 0.0f, 255.0f);
+    endpoint1 = glm::clamp((aa * bx - ab * ax) / determinant, 0.0f, 255.0f);
+    return true;
+}
+
+static uint32_t squared_distance(const uint8_t* a, const uint8_t* b, int channels)
+{
+    uint32_t distance = 0;
+    for (int c = 0; c < channels; ++c)
+    {
+        int d = int(a[c]) - int(b[c]);
+        distance += uint32_t(d * d);
+    }
+    return distance;
+}
+
+// BC1
+
+static uint16_t to_rgb565(glm::vec4 color)
+{
+    uint32_t r = uint32_t(color.r * 31.0f / 255.0f + 0.5f);
+    uint32_t g = uint32_t(color.g * 63.0f / 255.0f + 0.5f);
+    uint32_t b = uint32_t(color.b * 31.0f / 255.0f + 0.5f);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+// The 4 colors a BC1 block picks from, as decoders compute them
+static void bc1_palette(uint16_t color0, uint16_t color1, uint8_t (&palette)[4][4])
+{
+    auto expand = [](uint16_t c, uint8_t(&rgba)[4]) {
+        uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        rgba[0] = uint8_t((r << 3) | (r >> 2));
+        rgba[1] = uint8_t((g << 2) | (g >> 4));
+        rgba[2] = uint8_t((b << 3) | (b >> 2));
+        rgba[3] = 255;
+    };
+    expand(color0, palette[0]);
+    expand(color1, palette[1]);
+    for (int c = 0; c < 3; ++c)
+    {
+        if (color0 > color1)
+        {
+            palette[2][c] = uint8_t((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = uint8_t((palette[0][c] + 2 * palette[1][c]) / 3);
+        }
+        else
+        {
+            palette[2][c] = uint8_t((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = color0 > color1 ? 255 : 0;
+}
+
+// Pick the closest color of each texel, ordering the endpoints for 4-color mode, and return the total error
+static uint32_t bc1_select(const BlockTexels& texels, uint16_t& color0, uint16_t& color1, uint32_t& indices)
+{
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    indices = 0;
+    uint8_t palette[4][4];
+    bc1_palette(color0, color1, palette);
+    // With equal endpoints, the block is in 3-color mode and index 0 is the only color
+    const uint32_t color_count = color0 == color1 ? 1 : 4;
+    uint32_t error = 0;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        uint32_t best = 0, best_distance = ~0u;
+        for (uint32_t j = 0; j < color_count; ++j)
+        {
+            uint32_t distance = squared_distance(texels[i], palette[j], 3);
+            if (distance < best_distance)
+            {
+                best = j;
+                best_distance = distance;
+            }
+        }
+        indices |= best << (2 * i);
+        error += best_distance;
+    }
+    return error;
+}
+
+static void encode_bc1_block(const BlockTexels& texels, uint8_t* block)
+{
+    glm::vec4 colors[16];
+    for (int i = 0; i < 16; ++i)
+        colors[i] = glm::vec4(texels[i][0], texels[i][1], texels[i][2], 0.0f);
+
+    glm::vec4 low, high;
+    fit_endpoints(colors, low, high);
+    uint16_t color0 = to_rgb565(high), color1 = to_rgb565(low);
+    uint32_t indices;
+    uint32_t error = bc1_select(texels, color0, color1, indices);
+
+    // Refine the endpoints once for the colors the texels picked
+    static const float weights_of_color1[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    float weights[16];
+    for (int i = 0; i < 16; ++i)
+        weights[i] = weights_of_color1[(indices >> (2 * i)) & 3];
+    if (error > 0 && refit_endpoints(colors, weights, high, low))
+    {
+        uint16_t refit0 = to_rgb565(high), refit1 = to_rgb565(low);
+        uint32_t refit_indices;
+        uint32_t refit_error = bc1_select(texels, refit0, refit1, refit_indices);
+        if (refit_error < error)
+        {
+            color0 = refit0;
+            color1 = refit1;
+            indices = refit_indices;
+        }
+    }
+
+    memcpy(block, &color0, 2);
+    memcpy(block + 2, &color1, 2);
+    memcpy(block + 4, &indices, 4);
+}
+
+static void decode_bc1_block(const uint8_t* block, BlockTexels& texels)
+{
+    uint16_t color0, color1;
+    uint32_t indices;
+    memcpy(&color0, block, 2);
+    memcpy(&color1, block + 2, 2);
+    memcpy(&indices, block + 4, 4);
+
+    uint8_t palette[4][4];
+    bc1_palette(color0, color1, palette);
+    for (int i = 0; i < 16; ++i)
+        memcpy(texels[i], palette[(indices >> (2 * i)) & 3], 4);
+}
+
+// BC7 mode 6
+
+// Fields of a 128-bit block are packed from the least significant bit of its first byte on
+struct BitWriter
+{
+    uint8_t* bytes;
+    uint32_t position = 0;
+
+    void write(uint32_t value, uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; ++i, ++position)
+        {
+            if ((value >> i) & 1)
+                bytes[position >> 3] |= uint8_t(1 << (position & 7));
+        }
+    }
+};
+
+struct BitReader
+{
+    const uint8_t* bytes;
+    uint32_t position = 0;
+
+    uint32_t read(uint32_t count)
+    {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < count; ++i, ++position)
+            value |= uint32_t((bytes[position >> 3] >> (position & 7)) & 1) << i;
+        return value;
+    }
+};
+
+// An endpoint as stored by mode 6: 7 bits per channel, and a low bit shared by the 4 channels
+struct Bc7Endpoint
+{
+    uint8_t channels[4];
+    uint8_t p;
+
+    uint8_t value(int c) const { return uint8_t((channels[c] << 1) | p); }
+};
+
+static Bc7Endpoint to_bc7_endpoint(glm::vec4 color)
+{
+    Bc7Endpoint best = {};
+    float best_error = 1e30f;
+    for (uint8_t p = 0; p < 2; ++p)
+    {
+        Bc7Endpoint endpoint = {};
+        endpoint.p = p;
+        float error = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            endpoint.channels[c] = uint8_t(std::clamp(int((color[c] - p) / 2.0f + 0.5f), 0, 127));
+            float d = endpoint.value(c) - color[c];
+            error += d * d;
+        }
+        if (error < best_error)
+        {
+            best = endpoint;
+            best_error = error;
+        }
+    }
+    return best;
+}
+
+static void bc7_palette(const Bc7Endpoint& endpoint0, const Bc7Endpoint& endpoint1, uint8_t (&palette)[16][4])
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int c = 0; c < 4; ++c)
+            palette[i][c] = uint8_t(((64 - bc7_weights[i]) * endpoint0.value(c) + bc7_weights[i] * endpoint1.value(c) + 32) >> 6);
+    }
+}
+
+static uint32_t bc7_select(const BlockTexels& texels, const Bc7Endpoint& endpoint0, const Bc7Endpoint& endpoint1, uint8_t (&indices)[16])
+{
+    uint8_t palette[16][4];
+    bc7_palette(endpoint0, endpoint1, palette);
+    uint32_t error = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        uint32_t best = 0, best_distance = ~0u;
+        for (uint32_t j = 0; j < 16; ++j)
+        {
+            uint32_t distance = squared_distance(texels[i], palette[j], 4);
+            if (distance < best_distance)
+            {
+                best = j;
+                best_distance = distance;
+            }
+        }
+        indices[i] = uint8_t(best);
+        error += best_distance;
+    }
+    return error;
+}
+
+static void encode_bc7_block(const BlockTexels& texels, uint8_t* block)
+{
+    glm::vec4 colors[16];
+    for (int i = 0; i < 16; ++i)
+        colors[i] = glm::vec4(texels[i][0], texels[i][1], texels[i][2], texels[i][3]);
+
+    glm::vec4 low, high;
+    fit_endpoints(colors, low, high);
+    Bc7Endpoint endpoint0 = to_bc7_endpoint(low), endpoint1 = to_bc7_endpoint(high);
+    uint8_t indices[16];
+    uint32_t error = bc7_select(texels, endpoint0, endpoint1, indices);
+
+    // Refine the endpoints once for the colors the texels picked
+    float weights[16];
+    for (int i = 0; i < 16; ++i)
+        weights[i] = bc7_weights[indices[i]] / 64.0f;
+    if (error > 0 && refit_endpoints(colors, weights, low, high))
+    {
+        Bc7Endpoint refit0 = to_bc7_endpoint(low), refit1 = to_bc7_endpoint(high);
+        uint8_t refit_indices[16];
+        if (bc7_select(texels, refit0, refit1, refit_indices) < error)
+        {
+            endpoint0 = refit0;
+            endpoint1 = refit1;
+            memcpy(indices, refit_indices, sizeof(indices));
+        }
+    }
+
+    // The most significant bit of the first index is implicitly 0: swap the endpoints if it is not,
+    // which mirrors the indices since the weights are symmetric
+    if (indices[0] >= 8)
+    {
+        std::swap(endpoint0, endpoint1);
+        for (uint8_t& index : indices)
+            index = uint8_t(15 - index);
+    }
+
+    memset(block, 0, 16);
+    BitWriter bits{block};
+    bits.write(1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; ++c)
+    {
+        bits.write(endpoint0.channels[c], 7);
+        bits.write(endpoint1.channels[c], 7);
+    }
+    bits.write(endpoint0.p, 1);
+    bits.write(endpoint1.p, 1);
+    bits.write(indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        bits.write(indices[i], 4);
+}
+
+static void decode_bc7_block(const uint8_t* block, BlockTexels& texels)
+{
+    if ((block[0] & 0x7F) != 1 << 6)
+    {
+        memset(texels, 0, sizeof(BlockTexels));
+        return;
+    }
+
+    BitReader bits{block};
+    bits.read(7);
+    Bc7Endpoint endpoint0, endpoint1;
+    for (int c = 0; c < 4; ++c)
+    {
+        endpoint0.channels[c] = uint8_t(bits.read(7));
+        endpoint1.channels[c] = uint8_t(bits.read(7));
+    }
+    endpoint0.p = uint8_t(bits.read(1));
+    endpoint1.p = uint8_t(bits.read(1));
+
+    uint8_t palette[16][4];
+    bc7_palette(endpoint0, endpoint1, palette);
+    for (int i = 0; i < 16; ++i)
+        memcpy(texels[i], palette[bits.read(i == 0 ? 3 : 4)], 4);
+}
+
+void TextureCompressor::compress(const uint8_t* pixels, uint32_t width, uint32_t height, Format format, uint8_t* blocks, ThreadPool* pool)
+{
+    if (!is_compressed(format))
+    {
+        memcpy(blocks, pixels, compressed_size(format, width, height));
+        return;
+    }
+
+    const uint32_t block_columns = (width + 3) / 4;
+    const uint32_t block_rows = (height + 3) / 4;
+    const uint32_t stride = block_bytes(format);
+    auto compress_row = [&](size_t block_y) {
+        BlockTexels texels;
+        uint8_t* block = blocks + block_y * block_columns * stride;
+        for (uint32_t block_x = 0; block_x < block_columns; ++block_x, block += stride)
+        {
+            load_block(pixels, width, height, block_x, static_cast<uint32_t>(block_y), texels);
+            if (format == Format::BC1)
+                encode_bc1_block(texels, block);
+            else
+                encode_bc7_block(texels, block);
+        }
+    };
+
+    if (pool)
+    {
+        pool->parallel_for(block_rows, compress_row);
+    }
+    else
+    {
+        for (uint32_t block_y = 0; block_y < block_rows; ++block_y)
+            compress_row(block_y);
+    }
+}
+
+void TextureCompressor::decompress(const uint8_t* blocks, uint32_t width, uint32_t height, Format format, uint8_t* pixels)
+{
+    if (!is_compressed(format))
+    {
+        memcpy(pixels, blocks, compressed_size(format, width, height));
+        return;
+    }
+
+    const uint32_t block_columns = (width + 3) / 4;
+    const uint32_t block_rows = (height + 3) / 4;
+    const uint32_t stride = block_bytes(format);
+    BlockTexels texels;
+    for (uint32_t block_y = 0; block_y < block_rows; ++block_y)
+    {
+        for (uint32_t block_x = 0; block_x < block_columns; ++block_x, blocks += stride)
+        {
+            if (format == Format::BC1)
+                decode_bc1_block(blocks, texels);
+            else
+                decode_bc7_block(blocks, texels);
+            store_block(texels, width, height, block_x, block_y, pixels);
+        }
+    }
+}
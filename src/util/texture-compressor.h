@@ -0,0 +1,48 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+
+class ThreadPool;
+
+// Block compression of RGBA8 images into the BC formats that GPUs sample as is, 4x4 texels per block.
+// Used offline by the texture encoder tool (see TextureContainer), and at load time to transcode the
+// blocks back to RGBA8 on devices without the TextureCompressionBC feature. RGBA8 itself is handled
+// as a format of 1x1 blocks stored as they are, for containers that only save the decoding.
+class TextureCompressor
+{
+  public:
+    enum class Format : uint32_t
+    {
+        // 8 bytes per block (1/8 of RGBA8): two 5:6:5 endpoints and 4 colors, opaque
+        BC1,
+        // 16 bytes per block (1/4 of RGBA8): encoded as mode 6, two 7:7:7:7 endpoints with a shared low bit
+        // each and 16 colors, alpha included
+        BC7,
+        // Uncompressed, 4 bytes per texel
+        RGBA8,
+    };
+
+    static const char* format_name(Format format);
+
+    // The matching texture format. Like the RGBA8Unorm textures of decoded images, it is Unorm: texels are
+    // sampled as they are stored, the shader does not expect any sRGB decoding.
+    static wgpu::TextureFormat texture_format(Format format);
+
+    static bool is_compressed(Format format) { return format != Format::RGBA8; }
+    // Side of the square blocks of texels, 4 for compressed formats
+    static uint32_t block_size(Format format) { return is_compressed(format) ? 4 : 1; }
+    static uint32_t block_bytes(Format format);
+
+    // Size of the blocks of a width x height image, partial blocks included
+    static uint64_t compressed_size(Format format, uint32_t width, uint32_t height);
+
+    // Encode a width x height RGBA8 image into compressed_size(format, width, height) bytes, one row of blocks after
+    // the other. Partial blocks repeat the last column and row of the image. Rows of blocks are spread over the pool if any.
+    static void compress(const uint8_t* pixels, uint32_t width, uint32_t height, Format format, uint8_t* blocks, ThreadPool* pool = nullptr);
+
+    // Decode blocks written by compress back to width x height RGBA8 pixels.
+    // NB: Only BC7 mode 6 is supported, blocks of any other mode decode to transparent black.
+    static void decompress(const uint8_t* blocks, uint32_t width, uint32_t height, Format format, uint8_t* pixels);
+};
@@ -0,0 +1,187 @@
+#include "texture-container.h"
+#include "mip-generator.h"
+#include "resource-manager.h"
+
+#include <fstream>
+#include <cstring>
+
+using Format = TextureCompressor::Format;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// FNV-1a, stable across runs and platforms (unlike std::hash)
+static uint64_t hash_string(const std::string& str)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : str)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool TextureContainer::source_key(const path& source, uint64_t& path_hash, uint64_t& size, int64_t& mtime)
+{
+    std::error_code ec;
+    size = std::filesystem::file_size(source, ec);
+    if (ec)
+        return false;
+    auto last_write = std::filesystem::last_write_time(source, ec);
+    if (ec)
+        return false;
+    mtime = static_cast<int64_t>(last_write.time_since_epoch().count());
+    path_hash = hash_string(std::filesystem::weakly_canonical(source, ec).generic_string());
+    return true;
+}
+
+static bool make_key(const std::filesystem::path& source, TextureContainer::Header& header)
+{
+    return TextureContainer::source_key(source, header.source_path_hash, header.source_size, header.source_mtime);
+}
+
+TextureContainer::path TextureContainer::baked_path_for(const path& source, const char* extension)
+{
+#ifdef BAKED_RESOURCE_DIR
+    // Files of the same name from different directories replace each other, which the source key tells apart
+    path baked_path = path(BAKED_RESOURCE_DIR) / source.filename();
+#else
+    path baked_path = source;
+#endif
+    baked_path += extension;
+    return baked_path;
+}
+
+TextureContainer::path TextureContainer::container_path_for(const path& source)
+{
+    return baked_path_for(source, ".wgtex");
+}
+
+bool TextureContainer::encode(const path& source, Format format, bool srgb, ThreadPool* pool)
+{
+    ResourceManager::Image image = ResourceManager::load_image(source, srgb, true);
+    if (!image.pixels)
+    {
+        std::cerr << "Could not load image " << source << std::endl;
+        return false;
+    }
+    if (TextureCompressor::is_compressed(format) && (image.width % 4 != 0 || image.height % 4 != 0))
+    {
+        std::cerr << "Storing " << source << " as RGBA8: " << image.width << "x" << image.height << " is not a multiple of 4x4 blocks" << std::endl;
+        format = Format::RGBA8;
+    }
+    if (image.level_count > MaxLevels)
+    {
+        std::cerr << "Could not compress " << source << ": too many mip levels" << std::endl;
+        return false;
+    }
+
+    Header header = {};
+    header.magic = Magic;
+    header.version = Version;
+    make_key(source, header);
+    header.format = format;
+    header.width = image.width;
+    header.height = image.height;
+    header.level_count = image.level_count;
+    header.srgb = srgb;
+
+    uint64_t size = align_up(sizeof(Header), 16);
+    for (uint32_t level = 0; level < image.level_count; ++level)
+    {
+        header.level_offsets[level] = size;
+        uint32_t width = MipGenerator::level_size(image.width, level);
+        uint32_t height = MipGenerator::level_size(image.height, level);
+        size = align_up(size + TextureCompressor::compressed_size(format, width, height), 16);
+    }
+
+    std::vector<uint8_t> encoded(size, 0);
+    memcpy(encoded.data(), &header, sizeof(Header));
+    const uint8_t* level_pixels = image.pixels.get();
+    for (uint32_t level = 0; level < image.level_count; ++level)
+    {
+        uint32_t width = MipGenerator::level_size(image.width, level);
+        uint32_t height = MipGenerator::level_size(image.height, level);
+        TextureCompressor::compress(level_pixels, width, height, format, encoded.data() + header.level_offsets[level], pool);
+        level_pixels = level == 0 ? image.mip_levels.data() : level_pixels + 4 * size_t(width) * height;
+    }
+
+    // Write to a temporary file first so that a concurrent reader never sees a partial container
+    path container_path = container_path_for(source);
+    path tmp_path = container_path;
+    tmp_path += ".tmp";
+    std::error_code ec;
+    std::filesystem::create_directories(container_path.parent_path(), ec);
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            std::cerr << "Could not write texture container " << container_path << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+        if (!file)
+        {
+            std::cerr << "Could not write texture container " << container_path << std::endl;
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, container_path, ec);
+    if (ec)
+    {
+        std::cerr << "Could not write texture container " << container_path << ": " << ec.message() << std::endl;
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool TextureContainer::open(const path& source)
+{
+    if (!mapping.open(container_path_for(source)))
+        return false;
+
+    Header expected = {};
+    if (!make_key(source, expected) || mapping.size() < sizeof(Header))
+    {
+        mapping.close();
+        return false;
+    }
+
+    const Header& h = header();
+    bool valid = h.magic == Magic && h.version == Version;
+    valid = valid && h.source_path_hash == expected.source_path_hash && h.source_size == expected.source_size && h.source_mtime == expected.source_mtime;
+    valid = valid && (h.format == Format::BC1 || h.format == Format::BC7 || h.format == Format::RGBA8);
+    valid = valid && h.width > 0 && h.height > 0 && h.width % TextureCompressor::block_size(h.format) == 0 &&
+            h.height % TextureCompressor::block_size(h.format) == 0;
+    valid = valid && h.level_count > 0 && h.level_count <= MaxLevels;
+    for (uint32_t level = 0; valid && level < h.level_count; ++level)
+    {
+        valid = h.level_offsets[level] + level_size(level) <= mapping.size();
+    }
+    if (!valid)
+    {
+        mapping.close();
+        return false;
+    }
+    return true;
+}
+
+uint32_t TextureContainer::level_width(uint32_t level) const
+{
+    return MipGenerator::level_size(header().width, level);
+}
+
+uint32_t TextureContainer::level_height(uint32_t level) const
+{
+    return MipGenerator::level_size(header().height, level);
+}
+
+uint64_t TextureContainer::level_size(uint32_t level) const
+{
+    return TextureCompressor::compressed_size(header().format, level_width(level), level_height(level));
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "mapped-file.h"
+#include "texture-compressor.h"
+
+#include <filesystem>
+
+class ThreadPool;
+
+// Versioned binary container holding a texture with its whole mip chain, block-compressed or RGBA8,
+// baked offline by the texture encoder tool (e.g. "fourareen2K_albedo.jpg.wgtex"), see baked_path_for.
+// When it is up to date, ResourceManager::load_image_container maps it rather than decoding the source
+// image, and levels the device can sample as they are get uploaded straight from the mapping.
+//
+// File layout (native endianness):
+//   Header
+//   level blobs: level_count levels, level 0 first, each TextureCompressor::compressed_size bytes at its
+//                offset (aligned to 16), rows of blocks tightly packed as writeTexture takes them
+class TextureContainer
+{
+  public:
+    using path = std::filesystem::path;
+
+    static constexpr uint32_t Magic = 0x58544757; // "WGTX"
+    static constexpr uint32_t Version = 2;
+    // Enough for a 32K texture
+    static constexpr uint32_t MaxLevels = 16;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+
+        // Key identifying the source the texture was encoded from
+        uint64_t source_path_hash;
+        uint64_t source_size;
+        int64_t source_mtime;
+
+        TextureCompressor::Format format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t level_count;
+        // Whether the mip levels were averaged in linear space
+        uint32_t srgb;
+        uint32_t _pad;
+        uint64_t level_offsets[MaxLevels];
+    };
+
+    // Where a file baked from a source image lives: in BAKED_RESOURCE_DIR when the build defines it (the build tree
+    // rather than the resources of the source tree), next to the source otherwise
+    static path baked_path_for(const path& source, const char* extension);
+    // Where the container of a given source image lives
+    static path container_path_for(const path& source);
+
+    // Key telling whether a file baked from a source image is still up to date with it
+    static bool source_key(const path& source, uint64_t& path_hash, uint64_t& size, int64_t& mtime);
+
+    // Decode a source image, build its mip chain and compress every level into its container.
+    // Compressed textures need dimensions that are multiples of 4, other images are stored as RGBA8.
+    static bool encode(const path& source, TextureCompressor::Format format, bool srgb, ThreadPool* pool = nullptr);
+
+    // Map the container of the given source image, return false if it is missing, stale or corrupt
+    bool open(const path& source);
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(mapping.data()); }
+
+    uint32_t level_width(uint32_t level) const;
+    uint32_t level_height(uint32_t level) const;
+    const uint8_t* level_data(uint32_t level) const { return mapping.data() + header().level_offsets[level]; }
+    uint64_t level_size(uint32_t level) const;
+
+  private:
+    MappedFile mapping;
+};
@@ -0,0 +1,407 @@
+#include "texture-pool.h"
+#include "gpu-memory.h"
+#include "gpu-mip-generator.h"
+#include "mip-generator.h"
+#include "staging-uploader.h"
+
+#include <algorithm>
+
+using namespace wgpu;
+
+TexturePool::TexturePool(Device device, uint32_t max_layers, GpuMipGenerator* gpu_mip_generator)
+    : device(device), max_layers(std::max(max_layers, 1u)), gpu_mip_generator(gpu_mip_generator)
+{
+    queue = device.getQueue();
+}
+
+TexturePool::~TexturePool()
+{
+    for (Page& page : pages)
+    {
+        if (page.view)
+            page.view.release();
+        GpuMemory::destroy(page.texture);
+    }
+    queue.release();
+}
+
+void TexturePool::create_page_texture(Page& page, uint32_t layer_capacity)
+{
+    TextureDescriptor texture_desc;
+    texture_desc.label = "Texture pool page";
+    texture_desc.dimension = TextureDimension::_2D;
+    texture_desc.format = page.format;
+    texture_desc.size = {page.width, page.height, layer_capacity};
+    texture_desc.mipLevelCount = page.level_count;
+    texture_desc.sampleCount = 1;
+    // Layers are copied over when the page grows or shrinks
+    texture_desc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst | TextureUsage::CopySrc;
+    texture_desc.viewFormatCount = 0;
+    texture_desc.viewFormats = nullptr;
+    if (page.format == TextureFormat::RGBA8Unorm && page.level_count > 1 && gpu_mip_generator && gpu_mip_generator->is_valid())
+    {
+        // Levels of images without mip chain are written by the mipmap compute shader
+        texture_desc.usage = texture_desc.usage | TextureUsage::StorageBinding;
+    }
+    page.texture = GpuMemory::create_texture(device, texture_desc);
+    page.layer_capacity = layer_capacity;
+
+    TextureViewDescriptor view_desc;
+    view_desc.aspect = TextureAspect::All;
+    view_desc.baseArrayLayer = 0;
+    view_desc.arrayLayerCount = layer_capacity;
+    view_desc.baseMipLevel = 0;
+    view_desc.mipLevelCount = page.level_count;
+    view_desc.dimension = TextureViewDimension::_2DArray;
+    view_desc.format = page.format;
+    page.view = page.texture.createView(view_desc);
+    ++view_generation;
+}
+
+// Whole blocks of a level, even past the edge of the smallest levels of block-compressed formats
+static Extent3D level_copy_size(TextureFormat format, uint32_t width, uint32_t height, uint32_t level, uint32_t layer_count)
+{
+    uint32_t block_size, block_bytes;
+    GpuMemory::block_layout(format, block_size, block_bytes);
+    width = (MipGenerator::level_size(width, level) + block_size - 1) / block_size * block_size;
+    height = (MipGenerator::level_size(height, level) + block_size - 1) / block_size * block_size;
+    return {width, height, layer_count};
+}
+
+void TexturePool::resize_page(Page& page, uint32_t layer_capacity, uint32_t copied_layers, const std::vector<Move>& moves, StagingUploader* uploader)
+{
+    // Writes recorded for the old texture must land before its layers are copied
+    if (uploader)
+        uploader->submit();
+
+    Texture old_texture = page.texture;
+    TextureView old_view = page.view;
+    create_page_texture(page, layer_capacity);
+
+    CommandEncoderDescriptor encoder_desc;
+    encoder_desc.label = "Texture pool resize";
+    CommandEncoder encoder = device.createCommandEncoder(encoder_desc);
+    for (uint32_t level = 0; level < page.level_count; ++level)
+    {
+        ImageCopyTexture source;
+        source.texture = old_texture;
+        source.mipLevel = level;
+        source.origin = {0, 0, 0};
+        source.aspect = TextureAspect::All;
+        ImageCopyTexture destination = source;
+        destination.texture = page.texture;
+        encoder.copyTextureToTexture(source, destination, level_copy_size(page.format, page.width, page.height, level, copied_layers));
+
+        for (const Move& move : moves)
+        {
+            source.origin.z = move.from.layer;
+            destination.origin.z = move.to.layer;
+            encoder.copyTextureToTexture(source, destination, level_copy_size(page.format, page.width, page.height, level, 1));
+        }
+    }
+    CommandBufferDescriptor cmd_buffer_desc;
+    cmd_buffer_desc.label = "Texture pool resize";
+    CommandBuffer command = encoder.finish(cmd_buffer_desc);
+    encoder.release();
+    queue.submit(command);
+    command.release();
+
+    // Frames already submitted may still sample the old texture, which destroy() waits for
+    old_view.release();
+    GpuMemory::destroy(old_texture);
+}
+
+bool TexturePool::grow(Page& page, StagingUploader* uploader)
+{
+    if (page.layer_capacity >= max_layers)
+    {
+        std::cerr << "Texture pool page of " << page.width << "x" << page.height << " textures is full (" << max_layers << " layers)" << std::endl;
+        return false;
+    }
+
+    resize_page(page, std::min(page.layer_capacity * 2, max_layers), page.layer_count, {}, uploader);
+    ++grow_count;
+    return true;
+}
+
+bool TexturePool::allocate(uint32_t width, uint32_t height, TextureFormat format, uint32_t level_count, Slot& slot, StagingUploader* uploader)
+{
+    auto it = std::find_if(pages.begin(), pages.end(), [&](const Page& page) {
+        return page.width == width && page.height == height && page.format == format && page.level_count == level_count;
+    });
+    if (it == pages.end())
+    {
+        if (pages.size() >= MaxPages)
+        {
+            std::cerr << "Texture pool cannot hold " << width << "x" << height << " textures: all " << MaxPages << " pages are in use" << std::endl;
+            return false;
+        }
+        Page page;
+        page.width = width;
+        page.height = height;
+        page.format = format;
+        page.level_count = level_count;
+        pages.push_back(std::move(page));
+        it = pages.end() - 1;
+    }
+    Page& page = *it;
+    if (!page.texture)
+    {
+        create_page_texture(page, 1);
+    }
+
+    uint32_t layer;
+    if (!page.free_layers.empty())
+    {
+        layer = page.free_layers.back();
+        page.free_layers.pop_back();
+    }
+    else
+    {
+        if (page.layer_count == page.layer_capacity && !grow(page, uploader))
+            return false;
+        layer = page.layer_count++;
+    }
+
+    slot.page = static_cast<uint32_t>(it - pages.begin());
+    slot.layer = layer;
+    return true;
+}
+
+bool TexturePool::add(const ResourceManager::Image& image, Slot& slot, StagingUploader* uploader)
+{
+    if (!image.is_valid() || !allocate(image.width, image.height, image.format, image.level_count, slot, uploader))
+        return false;
+
+    ResourceManager::write_image(device, image, pages[slot.page].texture, slot.layer, gpu_mip_generator, uploader);
+    return true;
+}
+
+bool TexturePool::add_color(glm::vec4 color, Slot& slot, StagingUploader* uploader)
+{
+    glm::vec4 clamped = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+    ResourceManager::Image image;
+    image.width = 1;
+    image.height = 1;
+    image.level_count = 1;
+    image.level_data = {uint8_t(clamped.r), uint8_t(clamped.g), uint8_t(clamped.b), uint8_t(clamped.a)};
+    return add(image, slot, uploader);
+}
+
+void TexturePool::remove(Slot slot)
+{
+    assert(slot.page < pages.size() && slot.layer < pages[slot.page].layer_count);
+    pages[slot.page].free_layers.push_back(slot.layer);
+}
+
+bool TexturePool::demote(Slot& slot, uint32_t levels, StagingUploader* uploader)
+{
+    assert(slot.page < pages.size() && slot.layer < pages[slot.page].layer_count);
+    const TextureFormat format = pages[slot.page].format;
+    const uint32_t level_count = pages[slot.page].level_count;
+    const uint32_t width = MipGenerator::level_size(pages[slot.page].width, levels);
+    const uint32_t height = MipGenerator::level_size(pages[slot.page].height, levels);
+    uint32_t block_size, block_bytes;
+    GpuMemory::block_layout(format, block_size, block_bytes);
+    if (levels == 0 || levels >= level_count || width % block_size != 0 || height % block_size != 0)
+        return false;
+
+    Slot demoted;
+    if (!allocate(width, height, format, level_count - levels, demoted, uploader))
+        return false;
+
+    // Writes recorded for the texture must land before its levels are copied
+    if (uploader)
+        uploader->submit();
+
+    CommandEncoderDescriptor encoder_desc;
+    encoder_desc.label = "Texture pool demotion";
+    CommandEncoder encoder = device.createCommandEncoder(encoder_desc);
+    for (uint32_t level = 0; level < level_count - levels; ++level)
+    {
+        ImageCopyTexture source;
+        source.texture = pages[slot.page].texture;
+        source.mipLevel = level + levels;
+        source.origin = {0, 0, slot.layer};
+        source.aspect = TextureAspect::All;
+        ImageCopyTexture destination;
+        destination.texture = pages[demoted.page].texture;
+        destination.mipLevel = level;
+        destination.origin = {0, 0, demoted.layer};
+        destination.aspect = TextureAspect::All;
+        encoder.copyTextureToTexture(source, destination, level_copy_size(format, width, height, level, 1));
+    }
+    CommandBufferDescriptor cmd_buffer_desc;
+    cmd_buffer_desc.label = "Texture pool demotion";
+    CommandBuffer command = encoder.finish(cmd_buffer_desc);
+    encoder.release();
+    queue.submit(command);
+    command.release();
+
+    remove(slot);
+    slot = demoted;
+    return true;
+}
+
+void TexturePool::trim(std::vector<Move>& moves, StagingUploader* uploader)
+{
+    for (uint32_t index = 0; index < pages.size(); ++index)
+    {
+        Page& page = pages[index];
+        if (!page.texture)
+            continue;
+
+        const uint32_t used = page.layer_count - static_cast<uint32_t>(page.free_layers.size());
+        if (used == 0)
+        {
+            // Added to again, the page starts over with one layer
+            page.view.release();
+            page.view = nullptr;
+            GpuMemory::destroy(page.texture);
+            page.layer_capacity = 0;
+            page.layer_count = 0;
+            page.free_layers.clear();
+            ++view_generation;
+            ++shrink_count;
+            continue;
+        }
+
+        uint32_t layer_capacity = 1;
+        while (layer_capacity < used)
+        {
+            layer_capacity *= 2;
+        }
+        if (layer_capacity > page.layer_capacity / 2)
+            continue;
+
+        // There are as many free layers below used as textures from used on: move each of the latter to one of the former
+        std::vector<bool> free(page.layer_count, false);
+        for (uint32_t layer : page.free_layers)
+        {
+            free[layer] = true;
+        }
+        std::vector<Move> page_moves;
+        uint32_t hole = 0;
+        for (uint32_t layer = used; layer < page.layer_count; ++layer)
+        {
+            if (free[layer])
+                continue;
+            while (!free[hole])
+            {
+                ++hole;
+            }
+            page_moves.push_back({{index, layer}, {index, hole++}});
+        }
+
+        resize_page(page, layer_capacity, used, page_moves, uploader);
+        page.layer_count = used;
+        page.free_layers.clear();
+        moves.insert(moves.end(), page_moves.begin(), page_moves.end());
+        ++shrink_count;
+    }
+}
+
+TextureView TexturePool::page_view(uint32_t page) const
+{
+    if (page < pages.size() && pages[page].view)
+        return pages[page].view;
+    for (const Page& other : pages)
+    {
+        if (other.view)
+            return other.view;
+    }
+    return nullptr;
+}
+
+TexturePool::Shape TexturePool::shape(Slot slot) const
+{
+    const Page& page = pages[slot.page];
+    return {page.width, page.height, page.format, page.level_count};
+}
+
+int64_t TexturePool::demote_bytes(Slot slot, uint32_t levels) const
+{
+    // Nothing changes when demote() refuses
+    const Page& page = pages[slot.page];
+    Shape demoted = {MipGenerator::level_size(page.width, levels), MipGenerator::level_size(page.height, levels), page.format,
+                     page.level_count - std::min(levels, page.level_count)};
+    uint32_t block_size, block_bytes;
+    GpuMemory::block_layout(page.format, block_size, block_bytes);
+    if (levels == 0 || levels >= page.level_count || demoted.width % block_size != 0 || demoted.height % block_size != 0)
+        return 0;
+    return static_cast<int64_t>(allocation_bytes(demoted)) - static_cast<int64_t>(release_bytes(slot));
+}
+
+int64_t TexturePool::replace_bytes(const Shape& shape, Slot replaced) const
+{
+    return static_cast<int64_t>(allocation_bytes(shape)) - static_cast<int64_t>(release_bytes(replaced));
+}
+
+uint64_t TexturePool::allocation_bytes(const Shape& shape) const
+{
+    auto it = std::find_if(pages.begin(), pages.end(), [&](const Page& page) {
+        return page.width == shape.width && page.height == shape.height && page.format == shape.format && page.level_count == shape.level_count;
+    });
+    if (it == pages.end() || !it->texture)
+    {
+        // A new page starts with one layer
+        Page page;
+        page.width = shape.width;
+        page.height = shape.height;
+        page.format = shape.format;
+        page.level_count = shape.level_count;
+        return layer_size(page);
+    }
+    const Page& page = *it;
+    if (!page.free_layers.empty() || page.layer_count < page.layer_capacity || page.layer_capacity >= max_layers)
+        return 0;
+    return uint64_t(std::min(page.layer_capacity * 2, max_layers) - page.layer_capacity) * layer_size(page);
+}
+
+uint64_t TexturePool::release_bytes(Slot slot) const
+{
+    // The capacity trim() leaves the page with, as many layers as it has textures rounded up to a power of two
+    const Page& page = pages[slot.page];
+    const uint32_t used = page.layer_count - static_cast<uint32_t>(page.free_layers.size()) - 1;
+    uint32_t layer_capacity = 0;
+    if (used > 0)
+    {
+        layer_capacity = 1;
+        while (layer_capacity < used)
+        {
+            layer_capacity *= 2;
+        }
+        if (layer_capacity > page.layer_capacity / 2)
+            layer_capacity = page.layer_capacity;
+    }
+    return uint64_t(page.layer_capacity - layer_capacity) * layer_size(page);
+}
+
+uint64_t TexturePool::layer_size(const Page& page) const
+{
+    uint32_t block_size, block_bytes;
+    GpuMemory::block_layout(page.format, block_size, block_bytes);
+    uint64_t size = 0;
+    for (uint32_t level = 0; level < page.level_count; ++level)
+    {
+        uint64_t block_columns = (MipGenerator::level_size(page.width, level) + block_size - 1) / block_size;
+        uint64_t block_rows = (MipGenerator::level_size(page.height, level) + block_size - 1) / block_size;
+        size += block_bytes * block_columns * block_rows;
+    }
+    return size;
+}
+
+TexturePool::Stats TexturePool::stats() const
+{
+    Stats stats;
+    stats.grow_count = grow_count;
+    stats.shrink_count = shrink_count;
+    for (const Page& page : pages)
+    {
+        stats.page_count += page.texture ? 1 : 0;
+        stats.layer_count += page.layer_count - static_cast<uint32_t>(page.free_layers.size());
+        stats.layer_capacity += page.layer_capacity;
+        stats.texture_bytes += layer_size(page) * page.layer_capacity;
+    }
+    return stats;
+}
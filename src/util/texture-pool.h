@@ -0,0 +1,153 @@
+#pragma once
+
+#include "resource-manager.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <vector>
+
+class GpuMipGenerator;
+class StagingUploader;
+
+// Textures of the same size, format and level count share the layers of one texture_2d_array (a page), so that a
+// single bind group holds every texture of the scene and a material picks its own with a (page, layer) pair rather
+// than with a bind group of its own. A page starts with one layer and doubles its layer count when full, copying the
+// layers it holds on the GPU, up to max_layers. Layers freed by remove() are reused first, and trim() gives the memory
+// of pages left mostly empty back.
+class TexturePool
+{
+  public:
+    // Texture bindings of the material bind group (see shader.wgsl)
+    static constexpr uint32_t MaxPages = 8;
+
+    // Where a texture lives in the pool
+    struct Slot
+    {
+        uint32_t page = 0;
+        uint32_t layer = 0;
+
+        bool operator==(const Slot& other) const { return page == other.page && layer == other.layer; }
+    };
+
+    // Size, format and level count shared by the textures of a page
+    struct Shape
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        wgpu::TextureFormat format = wgpu::TextureFormat::Undefined;
+        uint32_t level_count = 0;
+    };
+
+    // A texture moved by trim()
+    struct Move
+    {
+        Slot from;
+        Slot to;
+    };
+
+    struct Stats
+    {
+        uint32_t page_count = 0;
+        // Layers holding a texture, and layers allocated
+        uint32_t layer_count = 0;
+        uint32_t layer_capacity = 0;
+        // GPU memory of all pages
+        uint64_t texture_bytes = 0;
+        // Since creation
+        uint32_t grow_count = 0;
+        uint32_t shrink_count = 0;
+    };
+
+    TexturePool(wgpu::Device device, uint32_t max_layers, GpuMipGenerator* gpu_mip_generator = nullptr);
+    ~TexturePool();
+
+    TexturePool(const TexturePool&) = delete;
+    TexturePool& operator=(const TexturePool&) = delete;
+
+    // Upload a loaded image into a free layer of the page of its size, format and level count (see
+    // ResourceManager::write_image), creating or growing the page as needed. Returns false if the image is invalid,
+    // needs a new page while MaxPages are in use, or a full page already max_layers deep.
+    bool add(const ResourceManager::Image& image, Slot& slot, StagingUploader* uploader = nullptr);
+
+    // Add a 1x1 layer of a single color, to sample while the actual texture loads
+    bool add_color(glm::vec4 color, Slot& slot, StagingUploader* uploader = nullptr);
+
+    // Free a layer for the next add to its page. Writes are queued after the frames already submitted,
+    // which may still sample the layer.
+    void remove(Slot slot);
+
+    // Move a texture to the page of its level count - levels smallest levels, copying them on the GPU, and free its
+    // layer. Returns false if it has no more than levels levels, its smaller size is not a whole number of blocks,
+    // or the smaller page cannot be created or grown.
+    bool demote(Slot& slot, uint32_t levels, StagingUploader* uploader = nullptr);
+
+    // Shrink each page holding at most half its layer capacity to the smallest power of two that fits its textures,
+    // and release empty pages. Textures in the layers past the new capacity move to free layers below, reported in
+    // moves for their holders to update their slot.
+    void trim(std::vector<Move>& moves, StagingUploader* uploader = nullptr);
+
+    // Size of the texture in a slot, and the GPU memory of its layer
+    uint32_t width(Slot slot) const { return pages[slot.page].width; }
+    uint32_t height(Slot slot) const { return pages[slot.page].height; }
+    uint64_t bytes(Slot slot) const { return layer_size(pages[slot.page]); }
+    Shape shape(Slot slot) const;
+
+    // GPU memory the pool takes on (negative when it gives memory back) from demote(slot, levels), or from adding a
+    // texture of the given shape in place of the one in replaced, either followed by trim(). Memory changes a whole
+    // page at a time: the page taking the new layer may double, and the one freeing a layer only shrinks once at most
+    // half full, so that these differ from the size of the layers themselves.
+    int64_t demote_bytes(Slot slot, uint32_t levels) const;
+    int64_t replace_bytes(const Shape& shape, Slot replaced) const;
+
+    // View of all the layers of a page, the first page holding textures standing in for released pages and pages
+    // past page_count() so that every binding of the material bind group can be filled. Null while the pool is empty.
+    wgpu::TextureView page_view(uint32_t page) const;
+    uint32_t page_count() const { return static_cast<uint32_t>(pages.size()); }
+
+    // Incremented each time a page is created, grows, shrinks or is released, which replaces its view:
+    // bind groups holding page views are stale once it changes
+    uint64_t generation() const { return view_generation; }
+
+    Stats stats() const;
+
+  private:
+    struct Page
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        wgpu::TextureFormat format = wgpu::TextureFormat::Undefined;
+        uint32_t level_count = 0;
+
+        // Null once released by trim(), until a texture is added to it again
+        wgpu::Texture texture = nullptr;
+        wgpu::TextureView view = nullptr;
+        uint32_t layer_capacity = 0;
+        // Layers handed out so far, some of which may be free again
+        uint32_t layer_count = 0;
+        std::vector<uint32_t> free_layers;
+    };
+
+    // Create the texture and view of a page with room for layer_capacity layers
+    void create_page_texture(Page& page, uint32_t layer_capacity);
+    // Replace the texture of a page with one of layer_capacity layers, copying layers [0, copied_layers) and the
+    // moved ones over, and release the old one
+    void resize_page(Page& page, uint32_t layer_capacity, uint32_t copied_layers, const std::vector<Move>& moves, StagingUploader* uploader);
+    // Double the layer capacity of a full page
+    bool grow(Page& page, StagingUploader* uploader);
+    // A free layer of the page of the given size, format and level count, creating or growing the page as needed
+    bool allocate(uint32_t width, uint32_t height, wgpu::TextureFormat format, uint32_t level_count, Slot& slot, StagingUploader* uploader);
+    uint64_t layer_size(const Page& page) const;
+    // Bytes a page grows by, or is created with, for a texture of the given shape
+    uint64_t allocation_bytes(const Shape& shape) const;
+    // Bytes trim() gives back from the page of a slot once its layer is freed
+    uint64_t release_bytes(Slot slot) const;
+
+    wgpu::Device device = nullptr;
+    wgpu::Queue queue = nullptr;
+    uint32_t max_layers = 0;
+    GpuMipGenerator* gpu_mip_generator = nullptr;
+    std::vector<Page> pages;
+    uint64_t view_generation = 0;
+    uint32_t grow_count = 0;
+    uint32_t shrink_count = 0;
+};
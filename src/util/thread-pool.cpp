@@ -0,0 +1,104 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned thread_count)
+{
+    workers.reserve(thread_count);
+    for (unsigned i = 0; i < thread_count; ++i)
+    {
+        workers.emplace_back([this] { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::default_thread_count()
+{
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    return 0;
+#else
+    unsigned hardware_threads = std::thread::hardware_concurrency();
+    return hardware_threads > 1 ? hardware_threads - 1 : 0;
+#endif
+}
+
+void ThreadPool::worker_loop()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& fn)
+{
+    if (count == 0)
+        return;
+
+    // Helpers grab indices from a shared counter. A helper that only starts once every index has
+    // been claimed returns without touching fn, so we never wait on helpers that did not get to run
+    // (which would deadlock when called from a task while all workers are busy).
+    struct State
+    {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> completed{0};
+        size_t count = 0;
+        const std::function<void(size_t)>* fn = nullptr;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<State>();
+    state->count = count;
+    state->fn = &fn;
+
+    auto run = [](State& s) {
+        for (size_t i = s.next++; i < s.count; i = s.next++)
+        {
+            (*s.fn)(i);
+            if (++s.completed == s.count)
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.done.notify_all();
+            }
+        }
+    };
+
+    size_t helper_count = std::min<size_t>(workers.size(), count - 1);
+    if (helper_count > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < helper_count; ++i)
+            {
+                tasks.emplace_back([state, run] { run(*state); });
+            }
+        }
+        wake.notify_all();
+    }
+
+    run(*state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->completed == state->count; });
+}
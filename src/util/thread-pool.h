@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads consuming a FIFO of tasks.
+// With zero workers (e.g. Emscripten builds without pthreads), everything runs inline on the calling thread.
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(unsigned thread_count = default_thread_count());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // One worker per hardware thread, minus the calling (main) thread
+    static unsigned default_thread_count();
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    // Queue a task and return a future to its result
+    template <typename Fn>
+    auto submit(Fn&& fn) -> std::future<std::invoke_result_t<Fn>>
+    {
+        using Result = std::invoke_result_t<Fn>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Fn>(fn));
+        std::future<Result> future = task->get_future();
+        if (workers.empty())
+        {
+            (*task)();
+            return future;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([task] { (*task)(); });
+        }
+        wake.notify_one();
+        return future;
+    }
+
+    // Call fn(i) for every i in [0, count), spread over the workers and the calling thread.
+    // Returns once every call has completed. Safe to call from within a task.
+    void parallel_for(size_t count, const std::function<void(size_t)>& fn);
+
+  private:
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
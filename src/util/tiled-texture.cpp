@@ -0,0 +1,173 @@
+#include "tiled-texture.h"
+#include "texture-container.h"
+#include "mip-generator.h"
+#include "resource-manager.h"
+#include "thread-pool.h"
+
+#include <fstream>
+#include <cstring>
+
+static uint32_t level_count_for(uint32_t width, uint32_t height)
+{
+    uint32_t level_count = 1;
+    while (level_count < TiledTexture::MaxLevels && std::max(MipGenerator::level_size(width, level_count - 1),
+                                                             MipGenerator::level_size(height, level_count - 1)) > TiledTexture::TileSize)
+    {
+        ++level_count;
+    }
+    return level_count;
+}
+
+// Copy the tile at column x and row y of a level, with its border, wrapping around the edges of the level
+static void cut_tile(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t x, uint32_t y, uint8_t* tile)
+{
+    for (uint32_t row = 0; row < TiledTexture::PaddedTileSize; ++row)
+    {
+        int64_t source_y = int64_t(y) * TiledTexture::TileSize + row - TiledTexture::Border;
+        source_y = ((source_y % height) + height) % height;
+        for (uint32_t column = 0; column < TiledTexture::PaddedTileSize; ++column)
+        {
+            int64_t source_x = int64_t(x) * TiledTexture::TileSize + column - TiledTexture::Border;
+            source_x = ((source_x % width) + width) % width;
+            memcpy(tile + 4 * (size_t(row) * TiledTexture::PaddedTileSize + column), pixels + 4 * (size_t(source_y) * width + source_x), 4);
+        }
+    }
+}
+
+TiledTexture::path TiledTexture::tiled_path_for(const path& source)
+{
+    return TextureContainer::baked_path_for(source, ".wgvt");
+}
+
+bool TiledTexture::encode(const path& source, bool srgb, ThreadPool* pool)
+{
+    ResourceManager::Image image = ResourceManager::load_image(source, srgb, true);
+    if (!image.pixels)
+    {
+        std::cerr << "Could not load image " << source << std::endl;
+        return false;
+    }
+
+    Header header = {};
+    header.magic = Magic;
+    header.version = Version;
+    TextureContainer::source_key(source, header.source_path_hash, header.source_size, header.source_mtime);
+    header.width = image.width;
+    header.height = image.height;
+    header.level_count = level_count_for(image.width, image.height);
+    header.srgb = srgb;
+    uint64_t tile_count = 0;
+    for (uint32_t level = 0; level < header.level_count; ++level)
+    {
+        header.level_first_tile[level] = tile_count;
+        uint64_t columns = (MipGenerator::level_size(image.width, level) + TileSize - 1) / TileSize;
+        uint64_t rows = (MipGenerator::level_size(image.height, level) + TileSize - 1) / TileSize;
+        tile_count += columns * rows;
+    }
+
+    // Write to a temporary file first so that a concurrent reader never sees a partial texture
+    path tiled_path = tiled_path_for(source);
+    path tmp_path = tiled_path;
+    tmp_path += ".tmp";
+    std::error_code ec;
+    std::filesystem::create_directories(tiled_path.parent_path(), ec);
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            std::cerr << "Could not write tiled texture " << tiled_path << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+        // One row of tiles at a time, so that only the decoded image is held whole
+        std::vector<uint8_t> tile_row;
+        const uint8_t* level_pixels = image.pixels.get();
+        for (uint32_t level = 0; level < header.level_count; ++level)
+        {
+            uint32_t width = MipGenerator::level_size(image.width, level);
+            uint32_t height = MipGenerator::level_size(image.height, level);
+            uint32_t columns = (width + TileSize - 1) / TileSize;
+            uint32_t rows = (height + TileSize - 1) / TileSize;
+            tile_row.resize(size_t(columns) * TileBytes);
+            for (uint32_t y = 0; y < rows; ++y)
+            {
+                auto cut = [&](size_t x) { cut_tile(level_pixels, width, height, static_cast<uint32_t>(x), y, tile_row.data() + x * TileBytes); };
+                if (pool)
+                {
+                    pool->parallel_for(columns, cut);
+                }
+                else
+                {
+                    for (uint32_t x = 0; x < columns; ++x)
+                        cut(x);
+                }
+                file.write(reinterpret_cast<const char*>(tile_row.data()), tile_row.size());
+            }
+            level_pixels = level == 0 ? image.mip_levels.data() : level_pixels + 4 * size_t(width) * height;
+        }
+        if (!file)
+        {
+            std::cerr << "Could not write tiled texture " << tiled_path << std::endl;
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, tiled_path, ec);
+    if (ec)
+    {
+        std::cerr << "Could not write tiled texture " << tiled_path << ": " << ec.message() << std::endl;
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool TiledTexture::open(const path& source)
+{
+    if (!mapping.open(tiled_path_for(source)))
+        return false;
+
+    Header expected = {};
+    if (!TextureContainer::source_key(source, expected.source_path_hash, expected.source_size, expected.source_mtime) ||
+        mapping.size() < sizeof(Header))
+    {
+        mapping.close();
+        return false;
+    }
+
+    const Header& h = header();
+    bool valid = h.magic == Magic && h.version == Version;
+    valid = valid && h.source_path_hash == expected.source_path_hash && h.source_size == expected.source_size;
+    valid = valid && h.source_mtime == expected.source_mtime;
+    valid = valid && h.width > 0 && h.height > 0 && h.level_count == level_count_for(h.width, h.height);
+    uint64_t tile_count = 0;
+    for (uint32_t level = 0; valid && level < h.level_count; ++level)
+    {
+        valid = h.level_first_tile[level] == tile_count;
+        tile_count += uint64_t(tile_columns(level)) * tile_rows(level);
+    }
+    valid = valid && sizeof(Header) + tile_count * TileBytes <= mapping.size();
+    if (!valid)
+    {
+        mapping.close();
+        return false;
+    }
+    return true;
+}
+
+uint32_t TiledTexture::level_width(uint32_t level) const
+{
+    return MipGenerator::level_size(header().width, level);
+}
+
+uint32_t TiledTexture::level_height(uint32_t level) const
+{
+    return MipGenerator::level_size(header().height, level);
+}
+
+const uint8_t* TiledTexture::tile_data(uint32_t level, uint32_t x, uint32_t y) const
+{
+    uint64_t tile = header().level_first_tile[level] + uint64_t(y) * tile_columns(level) + x;
+    return mapping.data() + sizeof(Header) + tile * TileBytes;
+}
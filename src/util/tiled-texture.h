@@ -0,0 +1,71 @@
+#pragma once
+
+#include "mapped-file.h"
+
+#include <filesystem>
+
+class ThreadPool;
+
+// Binary file holding an RGBA8 texture cut into tiles, mip level by mip level, baked offline by the texture encoder
+// tool (e.g. "terrain16K.jpg.wgvt", see TextureContainer::baked_path_for). Each tile carries a border of texels from its
+// neighbours (wrapping around the edges, as the sampler repeats), so that a tile filters correctly on its own once
+// streamed into the atlas of VirtualTextureCache. Levels stop at the first one that fits in a single tile: textures
+// of any size map to a tile pyramid, with no whole level to upload but the coarsest tile.
+//
+// File layout (native endianness):
+//   Header
+//   tiles: for each level from level 0, its tile rows from the top, each tile PaddedTileSize^2 RGBA8 texels
+class TiledTexture
+{
+  public:
+    using path = std::filesystem::path;
+
+    static constexpr uint32_t Magic = 0x54564757; // "WGVT"
+    static constexpr uint32_t Version = 1;
+    static constexpr uint32_t MaxLevels = 16;
+    // Texels of a level covered by a tile, and texels stored per tile with the border
+    static constexpr uint32_t TileSize = 128;
+    static constexpr uint32_t Border = 4;
+    static constexpr uint32_t PaddedTileSize = TileSize + 2 * Border;
+    static constexpr uint32_t TileBytes = 4 * PaddedTileSize * PaddedTileSize;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+
+        // Key identifying the source the tiles were cut from (see TextureContainer::source_key)
+        uint64_t source_path_hash;
+        uint64_t source_size;
+        int64_t source_mtime;
+
+        uint32_t width;
+        uint32_t height;
+        uint32_t level_count;
+        // Whether the mip levels were averaged in linear space
+        uint32_t srgb;
+        // Index of the first tile of each level
+        uint64_t level_first_tile[MaxLevels];
+    };
+
+    // Where the tiled texture of a given source image lives
+    static path tiled_path_for(const path& source);
+
+    // Decode a source image, build its mip chain and write the tiles of every level into its tiled texture
+    static bool encode(const path& source, bool srgb, ThreadPool* pool = nullptr);
+
+    // Map the tiled texture of the given source image, return false if it is missing, stale or corrupt
+    bool open(const path& source);
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(mapping.data()); }
+
+    uint32_t level_width(uint32_t level) const;
+    uint32_t level_height(uint32_t level) const;
+    uint32_t tile_columns(uint32_t level) const { return (level_width(level) + TileSize - 1) / TileSize; }
+    uint32_t tile_rows(uint32_t level) const { return (level_height(level) + TileSize - 1) / TileSize; }
+    // TileBytes of the tile at column x and row y of a level
+    const uint8_t* tile_data(uint32_t level, uint32_t x, uint32_t y) const;
+
+  private:
+    MappedFile mapping;
+};
@@ -0,0 +1,67 @@
+#include "uniform-arena.h"
+#include "gpu-memory.h"
+#include "staging-uploader.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace wgpu;
+
+static Buffer create_uniform_buffer(Device device, uint64_t size)
+{
+    BufferDescriptor buffer_desc;
+    buffer_desc.label = "Uniform arena";
+    buffer_desc.size = size;
+    buffer_desc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+    buffer_desc.mappedAtCreation = false;
+    return GpuMemory::create_buffer(device, buffer_desc);
+}
+
+UniformArena::UniformArena(Device device, uint32_t block_size, uint32_t capacity) : device(device), size(block_size)
+{
+    SupportedLimits device_limits;
+    device.getLimits(&device_limits);
+    const uint32_t alignment = device_limits.limits.minUniformBufferOffsetAlignment;
+    block_stride = (block_size + alignment - 1) / alignment * alignment;
+
+    counters.capacity = uint64_t(block_stride) * std::max(capacity, 1u);
+    uniform_buffer = create_uniform_buffer(device, counters.capacity);
+}
+
+UniformArena::~UniformArena()
+{
+    GpuMemory::destroy(uniform_buffer);
+}
+
+void UniformArena::reset()
+{
+    blocks.clear();
+}
+
+uint32_t UniformArena::push(const void* data)
+{
+    const uint32_t offset = static_cast<uint32_t>(blocks.size());
+    // The padding up to the next block is left as is
+    blocks.resize(blocks.size() + block_stride);
+    memcpy(blocks.data() + offset, data, size);
+    return offset;
+}
+
+void UniformArena::upload(StagingUploader& uploader)
+{
+    counters.block_count = static_cast<uint32_t>(blocks.size() / block_stride);
+    counters.bytes_used = blocks.size();
+    if (blocks.empty())
+        return;
+
+    if (blocks.size() > counters.capacity)
+    {
+        // Destroyed once the draws already submitted with it complete
+        counters.capacity = std::max<uint64_t>(blocks.size(), counters.capacity * 2);
+        GpuMemory::destroy(uniform_buffer);
+        uniform_buffer = create_uniform_buffer(device, counters.capacity);
+        ++buffer_generation;
+        ++counters.grow_count;
+    }
+    uploader.upload_buffer(uniform_buffer, 0, blocks.data(), blocks.size());
+}
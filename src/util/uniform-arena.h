@@ -0,0 +1,66 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <vector>
+
+class StagingUploader;
+
+// Per-draw uniforms of a frame in one buffer, bound once with hasDynamicOffset: each push() appends a block at the
+// next multiple of minUniformBufferOffsetAlignment and returns its offset, to pass to setBindGroup for the draw.
+// upload() sends the blocks pushed since reset() with a single copy. Copies and draws run in submission order, so the
+// buffer is rewritten by the next frame without waiting for the GPU to be done with the previous one.
+class UniformArena
+{
+  public:
+    struct Stats
+    {
+        // Of the last frame
+        uint32_t block_count = 0;
+        uint64_t bytes_used = 0;
+        uint64_t capacity = 0;
+        // Times the buffer had to be recreated bigger
+        uint32_t grow_count = 0;
+    };
+
+    // Blocks of block_size bytes (a multiple of 16, as uniform structs are), room for capacity of them at first
+    UniformArena(wgpu::Device device, uint32_t block_size, uint32_t capacity = 1024);
+    ~UniformArena();
+
+    UniformArena(const UniformArena&) = delete;
+    UniformArena& operator=(const UniformArena&) = delete;
+
+    // Distance between blocks, the binding size being block_size
+    uint32_t stride() const { return block_stride; }
+    uint32_t block_size() const { return size; }
+
+    // Start a frame over
+    void reset();
+    // Dynamic offset of a new block holding block_size bytes of data
+    uint32_t push(const void* data);
+    template <typename T>
+    uint32_t push(const T& value)
+    {
+        static_assert(sizeof(T) % 16 == 0);
+        return push(static_cast<const void*>(&value));
+    }
+
+    // Copy the blocks pushed since reset() into the buffer, recreating it bigger first if they do not fit
+    void upload(StagingUploader& uploader);
+
+    wgpu::Buffer buffer() const { return uniform_buffer; }
+    // Increments whenever buffer() changes, for bind groups on it to be created again
+    uint32_t generation() const { return buffer_generation; }
+
+    const Stats& stats() const { return counters; }
+
+  private:
+    wgpu::Device device = nullptr;
+    uint32_t size = 0;
+    uint32_t block_stride = 0;
+    wgpu::Buffer uniform_buffer = nullptr;
+    uint32_t buffer_generation = 0;
+    // Blocks of the frame, laid out as in the buffer
+    std::vector<uint8_t> blocks;
+    Stats counters;
+};
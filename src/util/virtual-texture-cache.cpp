@@ -0,0 +1,348 @@
+#include "virtual-texture-cache.h"
+#include "gpu-memory.h"
+#include "staging-uploader.h"
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace wgpu;
+
+static uint32_t pack_tile(uint32_t texture, uint32_t level, uint32_t x, uint32_t y)
+{
+    return texture << 26 | level << 22 | y << 11 | x;
+}
+
+static uint32_t tile_texture(uint32_t tile)
+{
+    return tile >> 26;
+}
+
+static uint32_t tile_level(uint32_t tile)
+{
+    return (tile >> 22) & 0xf;
+}
+
+static uint32_t tile_y(uint32_t tile)
+{
+    return (tile >> 11) & 0x7ff;
+}
+
+static uint32_t tile_x(uint32_t tile)
+{
+    return tile & 0x7ff;
+}
+
+VirtualTextureCache::VirtualTextureCache(Device device, ThreadPool& pool, uint32_t slots_per_side, uint32_t max_uploads_per_frame)
+    : device(device), pool(pool), slots_per_side(std::clamp(slots_per_side, 1u, 256u)), max_uploads_per_frame(max_uploads_per_frame)
+{
+    queue = device.getQueue();
+    // Stand-ins until the first texture is added, so that the cache can be bound without any
+    create_atlas(1);
+    resize_indirection();
+}
+
+VirtualTextureCache::~VirtualTextureCache()
+{
+    // Tasks read from the mapped files
+    for (auto& [tile, load] : loading)
+    {
+        load.wait();
+    }
+    atlas_texture_view.release();
+    GpuMemory::destroy(atlas);
+    GpuMemory::destroy(indirection);
+    queue.release();
+}
+
+void VirtualTextureCache::create_atlas(uint32_t size)
+{
+    if (atlas)
+    {
+        atlas_texture_view.release();
+        GpuMemory::destroy(atlas);
+    }
+
+    TextureDescriptor texture_desc;
+    texture_desc.label = "Virtual texture atlas";
+    texture_desc.dimension = TextureDimension::_2D;
+    texture_desc.format = TextureFormat::RGBA8Unorm;
+    texture_desc.size = {size, size, 1};
+    texture_desc.mipLevelCount = 1;
+    texture_desc.sampleCount = 1;
+    texture_desc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+    texture_desc.viewFormatCount = 0;
+    texture_desc.viewFormats = nullptr;
+    atlas = GpuMemory::create_texture(device, texture_desc);
+
+    TextureViewDescriptor view_desc;
+    view_desc.aspect = TextureAspect::All;
+    view_desc.baseArrayLayer = 0;
+    view_desc.arrayLayerCount = 1;
+    view_desc.baseMipLevel = 0;
+    view_desc.mipLevelCount = 1;
+    view_desc.dimension = TextureViewDimension::_2D;
+    view_desc.format = texture_desc.format;
+    atlas_texture_view = atlas.createView(view_desc);
+    ++resource_generation;
+}
+
+void VirtualTextureCache::resize_indirection()
+{
+    uint64_t entry_count = HeaderSize;
+    for (const VirtualTexture& texture : textures)
+    {
+        entry_count = std::max<uint64_t>(entry_count, texture.offset + texture.indirection.size());
+    }
+    if (indirection)
+    {
+        // Frames already submitted may still read from it, which destroy() waits for
+        GpuMemory::destroy(indirection);
+    }
+
+    BufferDescriptor buffer_desc;
+    buffer_desc.label = "Virtual texture indirection";
+    buffer_desc.size = entry_count * sizeof(uint32_t);
+    buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+    buffer_desc.mappedAtCreation = false;
+    indirection = GpuMemory::create_buffer(device, buffer_desc);
+    for (VirtualTexture& texture : textures)
+    {
+        texture.dirty = true;
+    }
+    ++resource_generation;
+}
+
+uint32_t VirtualTextureCache::add(const path& source, StagingUploader* uploader)
+{
+    if (textures.size() >= MaxTextures)
+    {
+        std::cerr << "Could not add virtual texture " << source << ": the cache holds " << MaxTextures << " textures at most" << std::endl;
+        return None;
+    }
+    auto file = std::make_unique<TiledTexture>();
+    if (!file->open(source))
+        return None;
+    const TiledTexture::Header& header = file->header();
+    if (header.width > 0xffff || header.height > 0xffff)
+    {
+        std::cerr << "Could not add virtual texture " << source << ": " << header.width << "x" << header.height << " is too big" << std::endl;
+        return None;
+    }
+
+    if (slots.empty())
+    {
+        create_atlas(slots_per_side * TiledTexture::PaddedTileSize);
+        slots.resize(size_t(slots_per_side) * slots_per_side);
+    }
+
+    // Header, then the entries of each level
+    const uint32_t id = static_cast<uint32_t>(textures.size());
+    VirtualTexture& texture = textures.emplace_back();
+    texture.indirection.assign(HeaderSize, 0);
+    texture.indirection[0] = header.level_count;
+    texture.indirection[1] = id;
+    for (uint32_t level = 0; level < header.level_count; ++level)
+    {
+        texture.indirection[4 + 2 * level] = static_cast<uint32_t>(texture.indirection.size());
+        texture.indirection[5 + 2 * level] = file->level_width(level) | file->level_height(level) << 16;
+        texture.indirection.resize(texture.indirection.size() + size_t(file->tile_columns(level)) * file->tile_rows(level));
+    }
+    texture.offset = textures.size() > 1 ? textures[id - 1].offset + static_cast<uint32_t>(textures[id - 1].indirection.size()) : 0;
+
+    // The coarsest level is a single tile, always there to fall back to
+    const uint32_t coarsest = header.level_count - 1;
+    if (!make_resident(pack_tile(id, coarsest, 0, 0), file->tile_data(coarsest, 0, 0), true, uploader))
+    {
+        std::cerr << "Could not add virtual texture " << source << ": every atlas slot is pinned" << std::endl;
+        textures.pop_back();
+        return None;
+    }
+    texture.file = std::move(file);
+
+    resize_indirection();
+    for (VirtualTexture& dirty_texture : textures)
+    {
+        update_indirection(dirty_texture, uploader);
+    }
+    return texture.offset;
+}
+
+void VirtualTextureCache::request(const uint32_t* feedback, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (feedback[i] != None)
+            requested.insert(feedback[i]);
+    }
+}
+
+bool VirtualTextureCache::make_resident(uint32_t tile, const uint8_t* data, bool pinned, StagingUploader* uploader)
+{
+    // A free slot, or else the one requested least recently, as long as the last round did not request it
+    uint32_t chosen = None;
+    uint64_t oldest = feedback_round;
+    for (uint32_t i = 0; i < slots.size(); ++i)
+    {
+        const Slot& slot = slots[i];
+        if (slot.tile == None)
+        {
+            chosen = i;
+            break;
+        }
+        if (!slot.pinned && slot.last_requested < oldest)
+        {
+            chosen = i;
+            oldest = slot.last_requested;
+        }
+    }
+    if (chosen == None)
+        return false;
+
+    Slot& slot = slots[chosen];
+    if (slot.tile != None)
+    {
+        resident.erase(slot.tile);
+        textures[tile_texture(slot.tile)].dirty = true;
+        ++counters.evicted_tiles;
+    }
+    slot.tile = tile;
+    slot.last_requested = feedback_round;
+    slot.pinned = pinned;
+    resident[tile] = chosen;
+    textures[tile_texture(tile)].dirty = true;
+
+    ImageCopyTexture destination;
+    destination.texture = atlas;
+    destination.mipLevel = 0;
+    destination.origin = {chosen % slots_per_side * TiledTexture::PaddedTileSize, chosen / slots_per_side * TiledTexture::PaddedTileSize, 0};
+    destination.aspect = TextureAspect::All;
+    const Extent3D size = {TiledTexture::PaddedTileSize, TiledTexture::PaddedTileSize, 1};
+    if (uploader)
+    {
+        uploader->upload_texture(destination, data, 4 * TiledTexture::PaddedTileSize, TiledTexture::PaddedTileSize, size);
+    }
+    else
+    {
+        TextureDataLayout source;
+        source.offset = 0;
+        source.bytesPerRow = 4 * TiledTexture::PaddedTileSize;
+        source.rowsPerImage = TiledTexture::PaddedTileSize;
+        queue.writeTexture(destination, data, TiledTexture::TileBytes, source, size);
+    }
+    return true;
+}
+
+void VirtualTextureCache::update_indirection(VirtualTexture& texture, StagingUploader* uploader)
+{
+    if (!texture.dirty)
+        return;
+
+    const uint32_t id = static_cast<uint32_t>(&texture - textures.data());
+    const TiledTexture& file = *texture.file;
+    const uint32_t level_count = file.header().level_count;
+    for (uint32_t level = level_count; level-- > 0;)
+    {
+        const uint32_t columns = file.tile_columns(level);
+        uint32_t* entries = texture.indirection.data() + texture.indirection[4 + 2 * level];
+        // The coarsest tile is always resident, so only finer levels look up
+        const bool has_parent = level + 1 < level_count;
+        const uint32_t* parent_entries = has_parent ? texture.indirection.data() + texture.indirection[4 + 2 * (level + 1)] : nullptr;
+        const uint32_t parent_columns = has_parent ? file.tile_columns(level + 1) : 0;
+        for (uint32_t y = 0; y < file.tile_rows(level); ++y)
+        {
+            for (uint32_t x = 0; x < columns; ++x)
+            {
+                // Tiles that are not resident show the entry of the tile covering them one level up
+                auto it = resident.find(pack_tile(id, level, x, y));
+                if (it != resident.end())
+                    entries[y * columns + x] = it->second % slots_per_side | (it->second / slots_per_side) << 8 | level << 16;
+                else if (parent_entries)
+                    entries[y * columns + x] = parent_entries[y / 2 * parent_columns + x / 2];
+            }
+        }
+    }
+
+    const uint64_t offset = uint64_t(texture.offset) * sizeof(uint32_t);
+    const uint64_t size = texture.indirection.size() * sizeof(uint32_t);
+    if (uploader)
+        uploader->upload_buffer(indirection, offset, texture.indirection.data(), size);
+    else
+        queue.writeBuffer(indirection, offset, texture.indirection.data(), size);
+    texture.dirty = false;
+}
+
+void VirtualTextureCache::update(StagingUploader* uploader)
+{
+    // Coarse levels first: they cover more pixels, and finer tiles fall back to them while loading
+    std::vector<uint32_t> tiles(requested.begin(), requested.end());
+    requested.clear();
+    std::sort(tiles.begin(), tiles.end(), [](uint32_t a, uint32_t b) { return tile_level(a) > tile_level(b); });
+    if (!tiles.empty())
+        ++feedback_round;
+
+    const size_t max_loading = 4 * size_t(max_uploads_per_frame);
+    for (uint32_t tile : tiles)
+    {
+        auto it = resident.find(tile);
+        if (it != resident.end())
+        {
+            slots[it->second].last_requested = feedback_round;
+            continue;
+        }
+        if (loading.size() >= max_loading || loading.count(tile))
+            continue;
+
+        // Feedback comes from the GPU, check it before reading the file
+        const uint32_t texture = tile_texture(tile), level = tile_level(tile), x = tile_x(tile), y = tile_y(tile);
+        if (texture >= textures.size())
+            continue;
+        const TiledTexture* file = textures[texture].file.get();
+        if (level >= file->header().level_count || x >= file->tile_columns(level) || y >= file->tile_rows(level))
+            continue;
+        loading.emplace(tile, pool.submit([file, level, x, y]() {
+            // Page the tile in off the main thread
+            const uint8_t* data = file->tile_data(level, x, y);
+            return std::vector<uint8_t>(data, data + TiledTexture::TileBytes);
+        }));
+    }
+
+    uint32_t uploads = 0;
+    for (auto it = loading.begin(); it != loading.end() && uploads < max_uploads_per_frame;)
+    {
+        if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++it;
+            continue;
+        }
+        std::vector<uint8_t> data = it->second.get();
+        if (make_resident(it->first, data.data(), false, uploader))
+        {
+            ++uploads;
+            ++counters.loaded_tiles;
+        }
+        else
+        {
+            ++counters.dropped_tiles;
+        }
+        it = loading.erase(it);
+    }
+
+    for (VirtualTexture& texture : textures)
+    {
+        update_indirection(texture, uploader);
+    }
+}
+
+VirtualTextureCache::Stats VirtualTextureCache::stats() const
+{
+    Stats stats = counters;
+    stats.resident_tiles = static_cast<uint32_t>(resident.size());
+    stats.slot_count = static_cast<uint32_t>(slots.size());
+    stats.atlas_bytes = uint64_t(slots.size()) * TiledTexture::TileBytes;
+    for (const VirtualTexture& texture : textures)
+    {
+        stats.indirection_bytes += texture.indirection.size() * sizeof(uint32_t);
+    }
+    return stats;
+}
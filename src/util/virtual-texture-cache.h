@@ -0,0 +1,135 @@
+#pragma once
+
+#include "tiled-texture.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class ThreadPool;
+class StagingUploader;
+
+// Streams the tiles of tiled textures (see TiledTexture) into one fixed-size atlas, so that textures of any size
+// cost a bounded amount of GPU memory. Which tiles are needed comes from a feedback pass (fs_feedback in
+// shader.wgsl) writing, for each pixel, the tile it samples; tiles are then read from their mapped file on the
+// thread pool and uploaded a few per frame, evicting the tiles requested least recently. The coarsest tile of every
+// texture stays resident, so that there is always something to sample while finer tiles load.
+//
+// The shader finds tiles through the indirection buffer, which holds for each texture a header followed by one
+// entry per tile of each of its levels, pointing at the finest resident tile covering it:
+//   header:  level_count, texture id, 0, 0, then for each of MaxLevels levels: offset of its entries from the header,
+//            level width | level height << 16
+//   entries: slot column | slot row << 8 | level of the resident tile << 16, row-major
+class VirtualTextureCache
+{
+  public:
+    using path = std::filesystem::path;
+
+    // MaterialUniforms::virtual_texture of textures that are not virtual
+    static constexpr uint32_t None = ~0u;
+    // Feedback values: texture id << 26 | level << 22 | tile row << 11 | tile column, None where nothing virtual is seen
+    static constexpr uint32_t MaxTextures = 63;
+    // Feedback values of pixels sampling a pooled texture: PooledTexture | page << 16 | layer, which request() ignores
+    static constexpr uint32_t PooledTexture = MaxTextures << 26;
+    static constexpr uint32_t HeaderSize = 4 + 2 * TiledTexture::MaxLevels;
+
+    struct Stats
+    {
+        // Tiles resident in the atlas, out of slot_count
+        uint32_t resident_tiles = 0;
+        uint32_t slot_count = 0;
+        uint64_t atlas_bytes = 0;
+        uint64_t indirection_bytes = 0;
+        // Since creation
+        uint64_t loaded_tiles = 0;
+        uint64_t evicted_tiles = 0;
+        // Tiles loaded while every slot was in use, hence not uploaded
+        uint64_t dropped_tiles = 0;
+    };
+
+    // The atlas holds slots_per_side^2 tiles (15^2 fit in a 2048 texture), of which at most
+    // max_uploads_per_frame are streamed in each frame
+    VirtualTextureCache(wgpu::Device device, ThreadPool& pool, uint32_t slots_per_side = 15, uint32_t max_uploads_per_frame = 16);
+    ~VirtualTextureCache();
+
+    VirtualTextureCache(const VirtualTextureCache&) = delete;
+    VirtualTextureCache& operator=(const VirtualTextureCache&) = delete;
+
+    // Map the tiled texture baked from an image file and make its coarsest tile resident. Returns the offset of its
+    // header in the indirection buffer, or None if the image has no up-to-date tiled texture or the cache is full.
+    uint32_t add(const path& source, StagingUploader* uploader = nullptr);
+
+    // Record feedback values read back from the feedback pass
+    void request(const uint32_t* feedback, size_t count);
+
+    // Stream in the tiles requested since the last call: keep the resident ones, load the missing ones (coarse
+    // levels first), upload the loads done in free or least recently requested slots, and update the indirection
+    void update(StagingUploader* uploader = nullptr);
+
+    uint32_t texture_count() const { return static_cast<uint32_t>(textures.size()); }
+
+    wgpu::TextureView atlas_view() const { return atlas_texture_view; }
+    wgpu::Buffer indirection_buffer() const { return indirection; }
+
+    // Incremented each time the atlas or the indirection buffer is replaced, i.e. when bind groups holding them are stale
+    uint64_t generation() const { return resource_generation; }
+
+    Stats stats() const;
+
+  private:
+    struct VirtualTexture
+    {
+        std::unique_ptr<TiledTexture> file;
+        // Of its header in the indirection buffer, in entries
+        uint32_t offset = 0;
+        // Header followed by the entries of every level
+        std::vector<uint32_t> indirection;
+        bool dirty = true;
+    };
+
+    struct Slot
+    {
+        // Feedback value of the tile it holds, None if free
+        uint32_t tile = None;
+        // Last feedback round requesting the tile
+        uint64_t last_requested = 0;
+        // Coarsest tiles are never evicted
+        bool pinned = false;
+    };
+
+    void create_atlas(uint32_t size);
+    // Upload a tile into a free slot, or the least recently requested one, return false if every slot was
+    // requested by the last feedback round
+    bool make_resident(uint32_t tile, const uint8_t* data, bool pinned, StagingUploader* uploader);
+    // Point the entries of every tile of a texture at the finest resident tile covering it, and upload them
+    void update_indirection(VirtualTexture& texture, StagingUploader* uploader);
+    // (Re)create the indirection buffer with room for the entries of every texture
+    void resize_indirection();
+
+    wgpu::Device device = nullptr;
+    wgpu::Queue queue = nullptr;
+    ThreadPool& pool;
+    uint32_t slots_per_side = 0;
+    uint32_t max_uploads_per_frame = 0;
+
+    wgpu::Texture atlas = nullptr;
+    wgpu::TextureView atlas_texture_view = nullptr;
+    wgpu::Buffer indirection = nullptr;
+    uint64_t resource_generation = 0;
+
+    std::vector<VirtualTexture> textures;
+    std::vector<Slot> slots;
+    // Slot of each resident tile, by feedback value
+    std::unordered_map<uint32_t, uint32_t> resident;
+    // Tiles being read on the thread pool
+    std::unordered_map<uint32_t, std::future<std::vector<uint8_t>>> loading;
+    std::unordered_set<uint32_t> requested;
+    // Incremented by each update with requests, tiles requested by the current round are in use
+    uint64_t feedback_round = 0;
+    Stats counters;
+};
@@ -0,0 +1,123 @@
+#include "util/texture-container.h"
+#include "util/tiled-texture.h"
+#include "util/resource-manager.h"
+#include "util/thread-pool.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Offline encoder of textures: writes the TextureContainer of each image ("image.jpg" -> "image.jpg.wgtex") into the
+// baked resources of the build (see TextureContainer::baked_path_for), with its whole mip chain, which the app then
+// maps instead of decoding the image (see the bake-textures target).
+// Usage: webgpu-basics-texture-encoder [--bc1 | --bc7 | --rgba8 | --tiled] [--linear] image...
+//   --bc1     opaque images, 8 bytes per 4x4 block
+//   --bc7     images with alpha or fine gradients, 16 bytes per 4x4 block (default)
+//   --rgba8   uncompressed, 4 bytes per texel: no quality loss, only the decoding and mip generation are saved
+//   --tiled   writes the TiledTexture of each image instead ("image.jpg.wgvt"), streamed as a virtual texture
+//             by the app: for images beyond the 2K texture limit
+//   --linear  images holding data rather than colors (e.g. normal maps): mip levels are averaged without sRGB decoding
+
+// Peak signal-to-noise ratio of the decompressed level 0 against the source, over the channels the format keeps
+static double level_psnr(const TextureContainer& container, const ResourceManager::Image& source)
+{
+    const TextureContainer::Header& header = container.header();
+    std::vector<uint8_t> decoded(4 * size_t(header.width) * header.height);
+    TextureCompressor::decompress(container.level_data(0), header.width, header.height, header.format, decoded.data());
+
+    const int channels = header.format == TextureCompressor::Format::BC1 ? 3 : 4;
+    double squared_error = 0.0;
+    for (size_t i = 0; i < decoded.size(); i += 4)
+    {
+        for (int c = 0; c < channels; ++c)
+        {
+            double d = double(decoded[i + c]) - double(source.pixels.get()[i + c]);
+            squared_error += d * d;
+        }
+    }
+    double mse = squared_error / (double(header.width) * header.height * channels);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+int main(int argc, char** argv)
+{
+    TextureCompressor::Format format = TextureCompressor::Format::BC7;
+    bool srgb = true;
+    bool tiled = false;
+    std::vector<std::filesystem::path> sources;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--bc1") == 0)
+            format = TextureCompressor::Format::BC1;
+        else if (strcmp(argv[i], "--bc7") == 0)
+            format = TextureCompressor::Format::BC7;
+        else if (strcmp(argv[i], "--rgba8") == 0)
+            format = TextureCompressor::Format::RGBA8;
+        else if (strcmp(argv[i], "--tiled") == 0)
+            tiled = true;
+        else if (strcmp(argv[i], "--linear") == 0)
+            srgb = false;
+        else
+            sources.push_back(argv[i]);
+    }
+    if (sources.empty())
+    {
+        fprintf(stderr, "Usage: %s [--bc1 | --bc7 | --rgba8 | --tiled] [--linear] image...\n", argv[0]);
+        return 1;
+    }
+
+    ThreadPool pool;
+    int failures = 0;
+    for (const std::filesystem::path& source : sources)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (tiled)
+        {
+            TiledTexture tiled_texture;
+            if (!TiledTexture::encode(source, srgb, &pool) || !tiled_texture.open(source))
+            {
+                fprintf(stderr, "Could not tile %s\n", source.string().c_str());
+                ++failures;
+                continue;
+            }
+            double encode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            const TiledTexture::Header& header = tiled_texture.header();
+            uint64_t tile_count = 0;
+            for (uint32_t level = 0; level < header.level_count; ++level)
+            {
+                tile_count += uint64_t(tiled_texture.tile_columns(level)) * tiled_texture.tile_rows(level);
+            }
+            printf("%s: %ux%u, %u levels, %llu tiles of %u texels, %.1f MB, %.0f ms\n", source.string().c_str(), header.width, header.height,
+                   header.level_count, (unsigned long long)tile_count, TiledTexture::TileSize, tile_count * TiledTexture::TileBytes / 1e6, encode_ms);
+            continue;
+        }
+        if (!TextureContainer::encode(source, format, srgb, &pool))
+        {
+            ++failures;
+            continue;
+        }
+        double encode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        TextureContainer container;
+        if (!container.open(source))
+        {
+            fprintf(stderr, "Could not read back the container of %s\n", source.string().c_str());
+            ++failures;
+            continue;
+        }
+        const TextureContainer::Header& header = container.header();
+        uint64_t compressed_size = 0, rgba8_size = 0;
+        for (uint32_t level = 0; level < header.level_count; ++level)
+        {
+            compressed_size += container.level_size(level);
+            rgba8_size += 4 * uint64_t(container.level_width(level)) * container.level_height(level);
+        }
+        ResourceManager::Image image = ResourceManager::load_image(source, srgb, false);
+
+        printf("%s: %ux%u, %u levels, %s, %.1f MB -> %.1f MB (%.1fx), PSNR %.2f dB, %.0f ms\n", source.string().c_str(), header.width, header.height,
+               header.level_count, TextureCompressor::format_name(header.format), rgba8_size / 1e6, compressed_size / 1e6,
+               double(rgba8_size) / compressed_size, level_psnr(container, image), encode_ms);
+    }
+    return failures == 0 ? 0 : 1;
+}